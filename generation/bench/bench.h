@@ -0,0 +1,66 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+
+#define BENCH_MAX_BITS 16
+#define CANDIDATE_POOL_SIZE 256
+
+struct bench_options
+{
+    // minimum duration of each benchmark (when iterations is 0)
+    double min_seconds;
+    // fixed number of iterations (0: run for min_seconds instead)
+    unsigned long iterations;
+    unsigned bits[BENCH_MAX_BITS];
+    size_t num_bits;
+    unsigned long seed;
+};
+
+extern struct bench_options bench_options;
+
+struct candidate_pool
+{
+    BIGNUM *candidates[CANDIDATE_POOL_SIZE];
+    size_t next;
+    unsigned bits;
+    BN_CTX *ctx;
+    BIGNUM *r;
+};
+
+/*
+ * One iteration of a benchmark. Returns 0 on failure.
+ */
+typedef int (*bench_fn)(void *arg);
+
+/*
+ * Run 'fn' (at least once) until the time budget or the number of
+ * iterations is reached, then record 'units_per_iteration * iterations /
+ * seconds' as the rate of the benchmark. Returns 0 on failure.
+ */
+int bench_run(const char *name, unsigned bits, const char *unit,
+              double units_per_iteration, bench_fn fn, void *arg);
+
+/*
+ * In DETERMINISTIC_RNG builds, restart the random generators from the
+ * configured seed, so that a benchmark always sees the same candidates.
+ * Does nothing otherwise.
+ */
+int bench_reseed(void);
+
+/*
+ * Fill 'pool' with random odd numbers of 'bits' bits, with the top bit set
+ * (same shape as the prime candidates). Returns 0 on failure.
+ */
+int bench_setup_pool(struct candidate_pool *pool, unsigned bits);
+
+void bench_cleanup_pool(struct candidate_pool *pool);
+
+void bench_components(void);
+
+void bench_end_to_end(void);
+
+void bench_openssl(void);
+
+#endif /* !BENCH_H */
@@ -0,0 +1,105 @@
+#include <openssl/bn.h>
+
+#include "bench.h"
+#include "primes/preliminary.h"
+#include "random/random.h"
+#include "utils/logging.h"
+
+#define RNG_INTS_PER_ITERATION 1024
+
+static int bench_rng_fortuna(void *arg)
+{
+    (void)arg;
+    int sink = 0;
+    for (unsigned i = 0; i < RNG_INTS_PER_ITERATION; ++i)
+        sink ^= random_int();
+    return sink | 1;
+}
+
+static int bench_rng_system(void *arg)
+{
+    (void)arg;
+    int sink = 0;
+    for (unsigned i = 0; i < RNG_INTS_PER_ITERATION; ++i)
+        sink ^= no_init_random_int();
+    return sink | 1;
+}
+
+static int bench_candidate(void *arg)
+{
+    struct candidate_pool *pool = arg;
+    BIGNUM *p = pool->candidates[0];
+    return generate_prime_candidate(p, pool->bits);
+}
+
+static int bench_trial_division(void *arg)
+{
+    struct candidate_pool *pool = arg;
+    BIGNUM *n = pool->candidates[pool->next++ % CANDIDATE_POOL_SIZE];
+    return preliminary_checks(n, pool->ctx) != -1;
+}
+
+static int bench_modexp(void *arg)
+{
+    struct candidate_pool *pool = arg;
+    BIGNUM *n = pool->candidates[pool->next++ % CANDIDATE_POOL_SIZE];
+    BIGNUM *a = pool->candidates[pool->next % CANDIDATE_POOL_SIZE];
+    // a^(n - 1) % n, with a < n in most cases (as in a miller-rabin round)
+    return BN_mod_exp(pool->r, a, n, n, pool->ctx);
+}
+
+void bench_cleanup_pool(struct candidate_pool *pool)
+{
+    for (size_t i = 0; i < CANDIDATE_POOL_SIZE; ++i)
+        BN_free(pool->candidates[i]);
+    BN_free(pool->r);
+    BN_CTX_free(pool->ctx);
+}
+
+int bench_setup_pool(struct candidate_pool *pool, unsigned bits)
+{
+    *pool = (struct candidate_pool){ .next = 0, .bits = bits };
+    pool->ctx = BN_CTX_new();
+    pool->r = BN_new();
+    if (pool->ctx == NULL || pool->r == NULL)
+        goto SetupPoolFailed;
+
+    for (size_t i = 0; i < CANDIDATE_POOL_SIZE; ++i)
+    {
+        BIGNUM *n = BN_new();
+        pool->candidates[i] = n;
+        if (n == NULL || !BN_set_bit(n, 0) || !BN_set_bit(n, bits - 1)
+            || !generate_prime_candidate(n, bits))
+            goto SetupPoolFailed;
+    }
+    return 1;
+
+SetupPoolFailed:
+    LOG_ERROR("failed to setup candidate pool: %s", OPENSSL_ERR_STRING)
+    bench_cleanup_pool(pool);
+    return 0;
+}
+
+void bench_components(void)
+{
+    bench_run("rng_fortuna", 0, "bytes/s", RNG_INTS_PER_ITERATION * sizeof(int),
+              &bench_rng_fortuna, NULL);
+    bench_run("rng_system", 0, "bytes/s", RNG_INTS_PER_ITERATION * sizeof(int),
+              &bench_rng_system, NULL);
+
+    for (size_t i = 0; i < bench_options.num_bits; ++i)
+    {
+        unsigned bits = bench_options.bits[i];
+        struct candidate_pool pool;
+        if (!bench_reseed() || !bench_setup_pool(&pool, bits))
+            return;
+
+        bench_run("candidate_fill", bits, "candidates/s", 1, &bench_candidate,
+                  &pool);
+        bench_run("trial_division", bits, "candidates/s", 1,
+                  &bench_trial_division, &pool);
+        bench_run("modexp", bits, "modexp/s", 1, &bench_modexp, &pool);
+
+        bench_cleanup_pool(&pool);
+    }
+}
@@ -0,0 +1,72 @@
+#include <openssl/bn.h>
+
+#include "bench.h"
+#include "primes/generate_prime.h"
+#include "primes/primality_test.h"
+#include "utils/logging.h"
+
+struct prime_bench
+{
+    unsigned bits;
+    BIGNUM *prime;
+    struct candidate_pool pool;
+};
+
+static int bench_generate_prime(void *arg)
+{
+    struct prime_bench *bench = arg;
+    BIGNUM *p = generate_prime(bench->bits);
+    BN_clear_free(p);
+    return p != NULL;
+}
+
+static int bench_test_prime(void *arg)
+{
+    struct prime_bench *bench = arg;
+    return primality_test_once(bench->prime) == 1;
+}
+
+static int bench_test_random(void *arg)
+{
+    struct prime_bench *bench = arg;
+    struct candidate_pool *pool = &bench->pool;
+    BIGNUM *n = pool->candidates[pool->next++ % CANDIDATE_POOL_SIZE];
+    return primality_test_once(n) != -1;
+}
+
+void bench_end_to_end(void)
+{
+    for (size_t i = 0; i < bench_options.num_bits; ++i)
+    {
+        struct prime_bench bench = { .bits = bench_options.bits[i] };
+
+        // Same prime as bench_openssl() : only the test itself is measured
+        bench.prime = BN_new();
+        if (bench.prime == NULL
+            || !BN_generate_prime_ex(bench.prime, bench.bits, 0, NULL, NULL,
+                                     NULL))
+        {
+            LOG_ERROR("failed to generate reference prime: %s",
+                      OPENSSL_ERR_STRING)
+            BN_free(bench.prime);
+            return;
+        }
+
+        if (!bench_reseed() || !bench_setup_pool(&bench.pool, bench.bits))
+        {
+            BN_free(bench.prime);
+            return;
+        }
+
+        bench_run("primality_test_prime", bench.bits, "tests/s", 1,
+                  &bench_test_prime, &bench);
+        bench_run("primality_test_random", bench.bits, "tests/s", 1,
+                  &bench_test_random, &bench);
+        if (bench_reseed())
+            bench_run("generate_prime", bench.bits, "primes/s", 1,
+                      &bench_generate_prime, &bench);
+
+        bench_cleanup_pool(&bench.pool);
+        BN_free(bench.prime);
+    }
+}
@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "primes/preliminary.h"
+#include "random/random.h"
+#include "utils/logging.h"
+
+#define BENCH_MAX_RESULTS 256
+
+struct bench_result
+{
+    const char *name;
+    unsigned bits;
+    const char *unit;
+    unsigned long iterations;
+    double seconds;
+    double rate;
+};
+
+struct bench_options bench_options = {
+    .min_seconds = 2.0,
+    .iterations = 0,
+    .bits = { 512, 1024, 2048, 3072, 4096 },
+    .num_bits = 5,
+    .seed = 0,
+};
+
+static struct bench_result results[BENCH_MAX_RESULTS];
+static size_t num_results = 0;
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int bench_run(const char *name, unsigned bits, const char *unit,
+              double units_per_iteration, bench_fn fn, void *arg)
+{
+    unsigned long iterations = 0;
+    double start = monotonic_seconds();
+    double elapsed = 0;
+    do
+    {
+        if (!(*fn)(arg))
+        {
+            LOG_ERROR("benchmark %s (%u bits) failed", name, bits)
+            return 0;
+        }
+        ++iterations;
+        elapsed = monotonic_seconds() - start;
+    } while (bench_options.iterations
+                 ? iterations < bench_options.iterations
+                 : elapsed < bench_options.min_seconds);
+
+    double rate = units_per_iteration * iterations / elapsed;
+    printf("%-28s %6u bits %12.2f %-14s (%lu iterations, %.3f s)\n", name,
+           bits, rate, unit, iterations, elapsed);
+    fflush(stdout);
+
+    if (num_results == BENCH_MAX_RESULTS)
+    {
+        LOG_WARN("too many results, %s (%u bits) is not recorded", name, bits)
+        return 1;
+    }
+    results[num_results++] = (struct bench_result){
+        .name = name,
+        .bits = bits,
+        .unit = unit,
+        .iterations = iterations,
+        .seconds = elapsed,
+        .rate = rate,
+    };
+
+    return 1;
+}
+
+int bench_reseed(void)
+{
+#ifdef DETERMINISTIC_RNG
+    random_set_seed(bench_options.seed);
+    if (prng_initialized)
+    {
+        cleanup_prng();
+        return initialize_prng();
+    }
+#endif /* DETERMINISTIC_RNG */
+    return 1;
+}
+
+static int write_results(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+
+    struct utsname host;
+    if (uname(&host) == -1)
+        memset(&host, 0, sizeof(host));
+
+    fprintf(f,
+            "{\n  \"version\": 1,\n  \"timestamp\": %ld,\n"
+            "  \"host\": {\"sysname\": \"%s\", \"release\": \"%s\", "
+            "\"machine\": \"%s\", \"cpus\": %ld},\n",
+            (long)time(NULL), host.sysname, host.release, host.machine,
+            sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef DETERMINISTIC_RNG
+    fprintf(f, "  \"deterministic_rng\": true,\n  \"seed\": %lu,\n",
+            bench_options.seed);
+#else /* DETERMINISTIC_RNG */
+    fprintf(f, "  \"deterministic_rng\": false,\n");
+#endif /* DETERMINISTIC_RNG */
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < num_results; ++i)
+        fprintf(f,
+                "    {\"name\": \"%s\", \"bits\": %u, \"unit\": \"%s\", "
+                "\"iterations\": %lu, \"seconds\": %.6f, \"rate\": %.6g}%s\n",
+                results[i].name, results[i].bits, results[i].unit,
+                results[i].iterations, results[i].seconds, results[i].rate,
+                i + 1 < num_results ? "," : "");
+    fprintf(f, "  ]\n}\n");
+
+    fclose(f);
+    return 1;
+}
+
+static int parse_bits(char *arg)
+{
+    bench_options.num_bits = 0;
+    for (char *token = strtok(arg, ","); token != NULL;
+         token = strtok(NULL, ","))
+    {
+        if (bench_options.num_bits == BENCH_MAX_BITS)
+            return 0;
+        long bits = strtol(token, NULL, 10);
+        if (bits < 16)
+            return 0;
+        bench_options.bits[bench_options.num_bits++] = bits;
+    }
+    return bench_options.num_bits != 0;
+}
+
+static void usage_msg(void)
+{
+    fprintf(stderr,
+            "usage: ./my_prime-bench [--time seconds] [--iterations N] "
+            "[--bits b1,b2,...] [--seed N] [--output file] "
+            "[--only components|e2e|openssl]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *output = NULL;
+    const char *only = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i == argc - 1)
+        {
+            usage_msg();
+            return 2;
+        }
+        if (strcmp(argv[i], "--time") == 0)
+            bench_options.min_seconds = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--iterations") == 0)
+            bench_options.iterations = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0)
+            bench_options.seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--output") == 0)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--only") == 0)
+            only = argv[++i];
+        else if (strcmp(argv[i], "--bits") != 0 || !parse_bits(argv[++i]))
+        {
+            usage_msg();
+            return 2;
+        }
+    }
+
+#ifndef DETERMINISTIC_RNG
+    LOG_WARN("not built with DETERMINISTIC_RNG: end-to-end results depend on "
+             "the luck of the draw")
+#endif /* !DETERMINISTIC_RNG */
+
+    if (!setup_preliminary() || !bench_reseed() || !initialize_prng())
+    {
+        LOG_ERROR("failed to initialize. Exiting")
+        return 2;
+    }
+
+    if (only == NULL || strcmp(only, "components") == 0)
+        bench_components();
+    if (only == NULL || strcmp(only, "e2e") == 0)
+        bench_end_to_end();
+    if (only == NULL || strcmp(only, "openssl") == 0)
+        bench_openssl();
+
+    int success = output == NULL || write_results(output);
+
+    cleanup_prng();
+    cleanup_preliminary();
+
+    return success ? 0 : 2;
+}
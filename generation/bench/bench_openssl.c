@@ -0,0 +1,75 @@
+#include <openssl/bn.h>
+
+#include "bench.h"
+#include "utils/logging.h"
+
+/*
+ * Reference numbers : OpenSSL's own generation and primality test, on the
+ * same sizes (and the same kind of inputs) as bench_end_to_end()
+ */
+
+struct openssl_bench
+{
+    unsigned bits;
+    BIGNUM *prime;
+    struct candidate_pool pool;
+};
+
+static int bench_generate_prime(void *arg)
+{
+    struct openssl_bench *bench = arg;
+    BIGNUM *p = BN_new();
+    int success = p != NULL
+        && BN_generate_prime_ex(p, bench->bits, 0, NULL, NULL, NULL);
+    BN_free(p);
+    return success;
+}
+
+static int bench_test_prime(void *arg)
+{
+    struct openssl_bench *bench = arg;
+    return BN_check_prime(bench->prime, bench->pool.ctx, NULL) == 1;
+}
+
+static int bench_test_random(void *arg)
+{
+    struct openssl_bench *bench = arg;
+    struct candidate_pool *pool = &bench->pool;
+    BIGNUM *n = pool->candidates[pool->next++ % CANDIDATE_POOL_SIZE];
+    return BN_check_prime(n, pool->ctx, NULL) != -1;
+}
+
+void bench_openssl(void)
+{
+    for (size_t i = 0; i < bench_options.num_bits; ++i)
+    {
+        struct openssl_bench bench = { .bits = bench_options.bits[i] };
+
+        bench.prime = BN_new();
+        if (bench.prime == NULL
+            || !BN_generate_prime_ex(bench.prime, bench.bits, 0, NULL, NULL,
+                                     NULL))
+        {
+            LOG_ERROR("failed to generate reference prime: %s",
+                      OPENSSL_ERR_STRING)
+            BN_free(bench.prime);
+            return;
+        }
+
+        if (!bench_reseed() || !bench_setup_pool(&bench.pool, bench.bits))
+        {
+            BN_free(bench.prime);
+            return;
+        }
+
+        bench_run("openssl_check_prime", bench.bits, "tests/s", 1,
+                  &bench_test_prime, &bench);
+        bench_run("openssl_check_random", bench.bits, "tests/s", 1,
+                  &bench_test_random, &bench);
+        bench_run("openssl_generate_prime", bench.bits, "primes/s", 1,
+                  &bench_generate_prime, &bench);
+
+        bench_cleanup_pool(&bench.pool);
+        BN_free(bench.prime);
+    }
+}
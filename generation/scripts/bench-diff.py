@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+import sys
+import json
+
+
+def load_results(path: str) -> dict:
+    """Load the results of a `make bench` run
+
+    Args:
+        path (str) : json file written by my_prime-bench
+
+    Returns a dict mapping (name, bits) to the result
+    """
+    with open(path) as f:
+        data = json.load(f)
+    return {(r["name"], r["bits"]): r for r in data["results"]}
+
+
+def diff(old_path: str, new_path: str, threshold: float) -> int:
+    """Print the rate changes between two benchmark runs
+
+    Args:
+        old_path (str) : reference results
+        new_path (str) : new results
+        threshold (float) : relative slowdown (e.g. 0.05) reported as a regression
+
+    Returns the number of regressions
+    """
+    old = load_results(old_path)
+    new = load_results(new_path)
+    regressions = 0
+
+    for key in sorted(old.keys() & new.keys()):
+        old_rate, new_rate = old[key]["rate"], new[key]["rate"]
+        change = (new_rate - old_rate) / old_rate if old_rate else 0.0
+        mark = ""
+        if change < -threshold:
+            mark = "  <-- REGRESSION"
+            regressions += 1
+        print(f"{key[0]:<28} {key[1]:>6} {old_rate:>14.2f} {new_rate:>14.2f} "
+              f"{change:>+8.1%} {new[key]['unit']}{mark}")
+
+    for key in sorted(old.keys() - new.keys()):
+        print(f"{key[0]:<28} {key[1]:>6} (missing from {new_path})")
+    for key in sorted(new.keys() - old.keys()):
+        print(f"{key[0]:<28} {key[1]:>6} (new)")
+
+    return regressions
+
+
+if __name__ == "__main__":
+    if len(sys.argv) not in [3, 4]:
+        sys.stderr.write("usage: ./bench-diff.py <old.json> <new.json> [threshold]\n")
+        sys.exit(2)
+
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 0.05
+    sys.exit(1 if diff(sys.argv[1], sys.argv[2], threshold) else 0)
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+import sys
+import struct
+import datetime
+
+MAGIC = b"MPLOG\0\1\0"
+HEADER = struct.Struct("=QIBxHHH")
+LEVELS = ["ERROR", "WARN", "INFO", "DEBUG"]
+
+
+def decode(stream) -> None:
+    """Print the records of a binary log (see `--log-async=binary`)
+
+    Args:
+        stream : binary stream, positioned at the start of the log
+    """
+    if stream.read(len(MAGIC)) != MAGIC:
+        raise ValueError("not a my_prime binary log")
+
+    while len(header := stream.read(HEADER.size)) == HEADER.size:
+        ts, line, level, file_len, func_len, msg_len = HEADER.unpack(header)
+        file = stream.read(file_len).decode()
+        func = stream.read(func_len).decode()
+        msg = stream.read(msg_len).decode(errors="replace")
+        date = datetime.datetime.fromtimestamp(ts / 1e9).isoformat()
+        level_name = LEVELS[level] if level < len(LEVELS) else str(level)
+        print(f"{date} {{{level_name}}} ({file}:{line}) [{func}]: {msg}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 2:
+        sys.stderr.write("usage: ./decode-log.py [log-file]\n")
+        sys.exit(1)
+
+    if len(sys.argv) == 2:
+        with open(sys.argv[1], "rb") as f:
+            decode(f)
+    else:
+        decode(sys.stdin.buffer)
+
+    sys.exit(0)
@@ -1,12 +1,28 @@
+#include <errno.h>
+#include <limits.h>
 #include <openssl/bn.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "primes/autotune.h"
+#include "primes/constellation.h"
 #include "primes/generate_prime.h"
+#include "primes/mersenne.h"
+#include "primes/next_prime.h"
 #include "primes/preliminary.h"
 #include "primes/primality_test.h"
+#include "primes/prime_count.h"
+#include "primes/proth.h"
+#include "primes/provable.h"
+#include "primes/range_sieve.h"
+#include "primes/safe_prime.h"
 #include "random/random.h"
 #include "utils/logging.h"
+#include "utils/rsa/batch_gcd.h"
+#include "utils/rsa/keypair.h"
+#include "utils/stats.h"
+#include "utils/threads.h"
+#include "utils/tuning.h"
 
 #define EXIT_CODE_SUCCESS 0
 #define EXIT_CODE_FAILURE 2
@@ -14,12 +30,62 @@
 #define EXIT_CODE_NOT_PRIME 0
 #define EXIT_CODE_IS_PRIME 1
 
-#define CMD_FLAGS_GEN 0b000001
-#define CMD_FLAGS_HEX 0b000010
-#define CMD_FLAGS_TST 0b000100
-#define CMD_FLAGS_HLP 0b001000
-#define CMD_FLAGS_DEC 0b010000
-#define CMD_FLAGS_ERR 0b100000
+#define CMD_FLAGS_GEN (1u << 0)
+#define CMD_FLAGS_HEX (1u << 1)
+#define CMD_FLAGS_TST (1u << 2)
+#define CMD_FLAGS_HLP (1u << 3)
+#define CMD_FLAGS_DEC (1u << 4)
+#define CMD_FLAGS_ERR (1u << 5)
+#define CMD_FLAGS_BPSW (1u << 6)
+#define CMD_FLAGS_MR (1u << 7)
+#define CMD_FLAGS_PROV (1u << 8)
+#define CMD_FLAGS_CERT (1u << 9)
+#define CMD_FLAGS_SAFE (1u << 10)
+#define CMD_FLAGS_RSA (1u << 11)
+#define CMD_FLAGS_DER (1u << 12)
+#define CMD_FLAGS_MERSENNE (1u << 13)
+#define CMD_FLAGS_PROTH (1u << 14)
+#define CMD_FLAGS_RIESEL (1u << 15)
+#define CMD_FLAGS_LIST (1u << 16)
+#define CMD_FLAGS_COUNT (1u << 17)
+#define CMD_FLAGS_PI (1u << 18)
+#define CMD_FLAGS_NEXT (1u << 19)
+#define CMD_FLAGS_PREV (1u << 20)
+#define CMD_FLAGS_TUPLE (1u << 21)
+#define CMD_FLAGS_BGCD (1u << 22)
+#define CMD_FLAGS_TUNE (1u << 23)
+
+#define CMD_FLAGS_COMMANDS                                                     \
+    (CMD_FLAGS_GEN | CMD_FLAGS_TST | CMD_FLAGS_RSA | CMD_FLAGS_PROTH           \
+     | CMD_FLAGS_LIST | CMD_FLAGS_PI | CMD_FLAGS_NEXT | CMD_FLAGS_BGCD         \
+     | CMD_FLAGS_TUNE)
+
+// Checkpoint file of the long runs (--checkpoint)
+static const char *checkpoint_path = NULL;
+
+// Verdict cache of -t (--cache)
+static const char *cache_path = NULL;
+
+// Range of k of the special-form searches (--k-range)
+static uint64_t k_range_min = 1;
+static uint64_t k_range_max = 0;
+
+// Bounds of the listed range (-l)
+static uint64_t list_lo = 0;
+static uint64_t list_hi = 0;
+
+// Pattern (--constellation) and length of the base (--bits)
+static struct constellation constellation;
+static unsigned constellation_bits = 0;
+
+// Bound of the prime count (--count-primes)
+static uint64_t count_primes_x = 0;
+
+// File of the moduli (--batch-gcd)
+static const char *batch_gcd_path = NULL;
+
+// Tuning profile (--profile), instead of tuning_default_path()
+static const char *profile_path = NULL;
 
 static unsigned parse_args(int argc, char **argv, char *buffer);
 
@@ -29,6 +95,28 @@ static int exec_generate_prime(unsigned flags, char *buffer);
 
 static int exec_primality_test(unsigned flags, char *buffer);
 
+static int exec_mersenne_test(char *buffer);
+
+static int exec_proth_search(unsigned flags, char *buffer);
+
+static int exec_rsa_keypair(unsigned flags, char *buffer);
+
+static int exec_list_primes(unsigned flags);
+
+static int exec_count_primes(void);
+
+static int exec_next_prime(unsigned flags, char *buffer);
+
+static int exec_constellation(unsigned flags);
+
+static int exec_batch_gcd(unsigned flags);
+
+static int exec_autotune(void);
+
+static void load_tuning(void);
+
+static void apply_tuning(unsigned bits, int search);
+
 int main(int argc, char **argv)
 {
     char buffer[4096];
@@ -42,12 +130,45 @@ int main(int argc, char **argv)
         exit(flags & CMD_FLAGS_ERR ? EXIT_CODE_FAILURE : EXIT_CODE_SUCCESS);
     }
 
+    start_logging();
+
+    // --autotune measures the defaults
+    if (!(flags & CMD_FLAGS_TUNE))
+        load_tuning();
+
     /* Prime Number Generation */
     if (flags & CMD_FLAGS_GEN)
         exit_code = exec_generate_prime(flags, buffer);
+    /* Mersenne Numbers Primality Testing */
+    else if (flags & CMD_FLAGS_MERSENNE)
+        exit_code = exec_mersenne_test(buffer);
     /* Primality Testing */
     else if (flags & CMD_FLAGS_TST)
         exit_code = exec_primality_test(flags, buffer);
+    /* Special-Form Primes Search */
+    else if (flags & CMD_FLAGS_PROTH)
+        exit_code = exec_proth_search(flags, buffer);
+    /* RSA Keypair Generation */
+    else if (flags & CMD_FLAGS_RSA)
+        exit_code = exec_rsa_keypair(flags, buffer);
+    /* Prime Constellations */
+    else if (flags & CMD_FLAGS_TUPLE)
+        exit_code = exec_constellation(flags);
+    /* Range Enumeration */
+    else if (flags & CMD_FLAGS_LIST)
+        exit_code = exec_list_primes(flags);
+    /* Prime Counting */
+    else if (flags & CMD_FLAGS_PI)
+        exit_code = exec_count_primes();
+    /* Next / Previous Prime */
+    else if (flags & CMD_FLAGS_NEXT)
+        exit_code = exec_next_prime(flags, buffer);
+    /* Shared RSA Factors */
+    else if (flags & CMD_FLAGS_BGCD)
+        exit_code = exec_batch_gcd(flags);
+    /* Tuning Profile */
+    else if (flags & CMD_FLAGS_TUNE)
+        exit_code = exec_autotune();
     /* No command input */
     else
     {
@@ -55,7 +176,12 @@ int main(int argc, char **argv)
         exit_code = EXIT_CODE_SUCCESS;
     }
 
+    // the pending messages come before the report, which is never binary
+    stop_logging();
+    stats_report();
+
     // clean up
+    cleanup_stats();
     cleanup_preliminary();
     CRYPTO_cleanup_all_ex_data();
 
@@ -85,6 +211,7 @@ int exec_generate_prime(unsigned flags, char *buffer)
         LOG_ERROR("failed to initialize preliminary tests. Exiting")
         return EXIT_CODE_FAILURE;
     }
+    apply_tuning(length, 0);
 
     // Only init CSPRNG if we are generating primes
     if (!initialize_prng())
@@ -93,7 +220,19 @@ int exec_generate_prime(unsigned flags, char *buffer)
         return EXIT_CODE_FAILURE;
     }
 
-    BIGNUM *p = generate_prime(length);
+    if (flags & CMD_FLAGS_BPSW)
+        primality_test_type = PRIMALITY_TEST_BPSW;
+
+    struct prime_certificate certificate;
+    BIGNUM *p = NULL;
+    if (flags & CMD_FLAGS_PROV)
+        p = generate_provable_prime(length,
+                                    flags & CMD_FLAGS_CERT ? &certificate
+                                                           : NULL);
+    else if (flags & CMD_FLAGS_SAFE)
+        p = generate_safe_prime(length);
+    else
+        p = generate_prime(length);
     if (p == NULL)
     {
         LOG_ERROR("Failed to generate prime with length %s", buffer);
@@ -102,10 +241,18 @@ int exec_generate_prime(unsigned flags, char *buffer)
     }
     else
     {
+        STATS_TIMER_START(output_timer)
         char *p_str = flags & CMD_FLAGS_HEX ? BN_bn2hex(p) : BN_bn2dec(p);
         printf("%s\n", p_str);
+        fflush(stdout);
+        STATS_TIMER_STOP(STATS_STAGE_OUTPUT, output_timer)
         OPENSSL_free(p_str);
         BN_free(p);
+        if (flags & CMD_FLAGS_CERT)
+        {
+            print_certificate(stdout, &certificate, flags & CMD_FLAGS_HEX);
+            cleanup_certificate(&certificate);
+        }
     }
 
     cleanup_prng();
@@ -140,8 +287,28 @@ int exec_primality_test(unsigned flags, char *buffer)
             BN_free(n);
             return EXIT_CODE_FAILURE;
         }
+        apply_tuning(BN_num_bits(n), 0);
+
+        // BPSW is deterministic, and cheaper than the 40 random rounds
+        primality_test_type = flags & CMD_FLAGS_MR
+            ? PRIMALITY_TEST_MILLER_RABIN
+            : PRIMALITY_TEST_BPSW;
 
-        int success = primality_test_once(n);
+        int success = -1;
+        struct result_cache cache;
+        if (cache_path != NULL && result_cache_open(&cache, cache_path))
+        {
+            success = primality_test_cached(n, &cache);
+            result_cache_close(&cache);
+        }
+        else
+        {
+            // the cache only saves time : the test runs without it
+            if (cache_path != NULL)
+                LOG_WARN("verdict cache %s unavailable, testing without it",
+                         cache_path)
+            success = primality_test_once(n);
+        }
         BN_free(n);
 
         switch (success)
@@ -167,6 +334,341 @@ int exec_primality_test(unsigned flags, char *buffer)
     return EXIT_CODE_FAILURE;
 }
 
+int exec_mersenne_test(char *buffer)
+{
+    char *endptr = NULL;
+    unsigned long p = strtoul(buffer, &endptr, 10);
+    if (*buffer == 0 || *endptr != 0)
+    {
+        LOG_ERROR("Invalid exponent: %s", buffer)
+        return EXIT_CODE_FAILURE;
+    }
+
+    switch (lucas_lehmer_check(p, checkpoint_path))
+    {
+    case 1: {
+        LOG_INFO("2^%lu - 1 is a prime number", p)
+        return EXIT_CODE_IS_PRIME;
+    }
+    case 0: {
+        LOG_INFO("2^%lu - 1 is NOT a prime number", p)
+        return EXIT_CODE_NOT_PRIME;
+    }
+    default: {
+        LOG_WARN("lucas-lehmer test exited with a failure status for 2^%lu - 1",
+                 p)
+        return EXIT_CODE_FAILURE;
+    }
+    }
+}
+
+int exec_proth_search(unsigned flags, char *buffer)
+{
+    char *endptr = NULL;
+    unsigned long n = strtoul(buffer, &endptr, 10);
+    if (*buffer == 0 || *endptr != 0 || n == 0 || n > UINT_MAX)
+    {
+        LOG_ERROR("Invalid exponent: %s", buffer)
+        return EXIT_CODE_FAILURE;
+    }
+    if (k_range_max == 0)
+    {
+        LOG_ERROR("--k-range is required")
+        usage_msg();
+        return EXIT_CODE_FAILURE;
+    }
+
+    // Small or unusual candidates go through the generic test
+    if (!setup_preliminary())
+    {
+        LOG_ERROR("failed to initialize preliminary tests. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+    primality_test_type = flags & CMD_FLAGS_MR ? PRIMALITY_TEST_MILLER_RABIN
+                                               : PRIMALITY_TEST_BPSW;
+
+    long found = proth_search(n, k_range_min, k_range_max,
+                              flags & CMD_FLAGS_RIESEL ? -1 : 1, stdout);
+    if (found == -1)
+        return EXIT_CODE_FAILURE;
+
+    LOG_INFO("%ld prime(s) found", found)
+    return EXIT_CODE_SUCCESS;
+}
+
+static int parse_k_range(const char *arg)
+{
+    char *endptr = NULL;
+    k_range_min = strtoull(arg, &endptr, 10);
+    if (endptr == arg || *endptr != ':')
+        return 0;
+    const char *max = endptr + 1;
+    k_range_max = strtoull(max, &endptr, 10);
+    if (endptr == max || *endptr != 0 || k_range_min == 0
+        || k_range_min > k_range_max)
+    {
+        LOG_ERROR("Invalid k range: %s", arg)
+        return 0;
+    }
+    return 1;
+}
+
+int exec_rsa_keypair(unsigned flags, char *buffer)
+{
+    char *endptr = NULL;
+    long bits = strtol(buffer, &endptr, 10);
+    if (*endptr != 0 || bits <= 0 || bits > INT_MAX)
+    {
+        LOG_ERROR("Invalid modulus length: %s", buffer)
+        return EXIT_CODE_FAILURE;
+    }
+
+    if (!setup_preliminary())
+    {
+        LOG_ERROR("failed to initialize preliminary tests. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+    // the primes are half the modulus
+    apply_tuning(bits / 2, 0);
+    if (!initialize_prng())
+    {
+        LOG_ERROR("failed to initilalize PRNG. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+
+    if (flags & CMD_FLAGS_BPSW)
+        primality_test_type = PRIMALITY_TEST_BPSW;
+
+    struct rsa_keypair key;
+    int success = rsa_generate_keypair(&key, bits);
+    if (success)
+    {
+        success = rsa_write_keypair(stdout, &key, flags & CMD_FLAGS_DER);
+        rsa_cleanup_keypair(&key);
+    }
+
+    cleanup_prng();
+    return success ? EXIT_CODE_SUCCESS : EXIT_CODE_FAILURE;
+}
+
+int exec_list_primes(unsigned flags)
+{
+    long count = sieve_range(list_lo, list_hi,
+                             flags & CMD_FLAGS_COUNT ? NULL : stdout);
+    if (count == -1)
+        return EXIT_CODE_FAILURE;
+
+    if (flags & CMD_FLAGS_COUNT)
+        printf("%ld\n", count);
+    else
+        LOG_INFO("%ld prime(s) in [%lu, %lu]", count, (unsigned long)list_lo,
+                 (unsigned long)list_hi)
+    return EXIT_CODE_SUCCESS;
+}
+
+int exec_count_primes(void)
+{
+    long count = prime_count(count_primes_x);
+    if (count == -1)
+        return EXIT_CODE_FAILURE;
+
+    printf("%ld\n", count);
+    return EXIT_CODE_SUCCESS;
+}
+
+int exec_next_prime(unsigned flags, char *buffer)
+{
+    BIGNUM *n = NULL;
+    int (*bn_read_fn)(BIGNUM **a, const char *str) =
+        flags & CMD_FLAGS_DEC ? BN_dec2bn : BN_hex2bn;
+    size_t num_read = (*bn_read_fn)(&n, buffer);
+    if (num_read == 0 || num_read < strlen(buffer))
+    {
+        LOG_ERROR("Could not read given number \"%s\"", buffer)
+        BN_free(n);
+        return EXIT_CODE_FAILURE;
+    }
+    if (!setup_preliminary())
+    {
+        LOG_ERROR("failed to initialize preliminary tests. Exiting")
+        BN_free(n);
+        return EXIT_CODE_FAILURE;
+    }
+    apply_tuning(BN_num_bits(n), 1);
+
+    // deterministic : no random bases, so no PRNG either
+    primality_test_type = PRIMALITY_TEST_BPSW;
+    BIGNUM *p = find_next_prime(n, flags & CMD_FLAGS_PREV);
+    BN_free(n);
+    if (p == NULL)
+        return EXIT_CODE_FAILURE;
+
+    char *p_str = flags & CMD_FLAGS_DEC ? BN_bn2dec(p) : BN_bn2hex(p);
+    printf("%s\n", p_str);
+    OPENSSL_free(p_str);
+    BN_free(p);
+    return EXIT_CODE_SUCCESS;
+}
+
+int exec_constellation(unsigned flags)
+{
+    if (!setup_preliminary())
+    {
+        LOG_ERROR("failed to initialize preliminary tests. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+
+    // a range is small enough for the deterministic test
+    if (flags & CMD_FLAGS_LIST)
+    {
+        primality_test_type = PRIMALITY_TEST_BPSW;
+        long count = constellation_range(
+            &constellation, list_lo, list_hi,
+            flags & CMD_FLAGS_COUNT ? NULL : stdout);
+        if (count == -1)
+            return EXIT_CODE_FAILURE;
+        if (flags & CMD_FLAGS_COUNT)
+            printf("%ld\n", count);
+        return EXIT_CODE_SUCCESS;
+    }
+
+    if (!initialize_prng())
+    {
+        LOG_ERROR("failed to initilalize PRNG. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+    if (flags & CMD_FLAGS_BPSW)
+        primality_test_type = PRIMALITY_TEST_BPSW;
+
+    BIGNUM *p = find_constellation(&constellation, constellation_bits);
+    if (p == NULL)
+    {
+        cleanup_prng();
+        return EXIT_CODE_FAILURE;
+    }
+    char *p_str = flags & CMD_FLAGS_HEX ? BN_bn2hex(p) : BN_bn2dec(p);
+    printf("%s\n", p_str);
+    OPENSSL_free(p_str);
+    BN_free(p);
+    cleanup_prng();
+    return EXIT_CODE_SUCCESS;
+}
+
+int exec_batch_gcd(unsigned flags)
+{
+    size_t count = 0;
+    BIGNUM **moduli =
+        batch_gcd_load(batch_gcd_path, flags & CMD_FLAGS_DEC, &count);
+    if (moduli == NULL)
+        return EXIT_CODE_FAILURE;
+    LOG_INFO("Read %zu moduli from %s", count, batch_gcd_path)
+
+    BIGNUM **gcds = calloc(count, sizeof(BIGNUM *));
+    if (gcds == NULL)
+    {
+        LOG_ERROR("failed to allocate the gcds: %s", strerror(errno))
+        batch_gcd_free(moduli, count);
+        return EXIT_CODE_FAILURE;
+    }
+    long found = batch_gcd(moduli, count, gcds);
+
+    char *(*bn_write_fn)(const BIGNUM *a) =
+        flags & CMD_FLAGS_DEC ? BN_bn2dec : BN_bn2hex;
+    for (size_t i = 0; found > 0 && i < count; ++i)
+    {
+        if (BN_is_one(gcds[i]))
+            continue;
+        if (BN_cmp(gcds[i], moduli[i]) == 0)
+            LOG_WARN("modulus %zu shares all its factors (duplicate)", i)
+        char *n_str = bn_write_fn(moduli[i]);
+        char *g_str = bn_write_fn(gcds[i]);
+        if (n_str != NULL && g_str != NULL)
+            printf("%zu %s %s\n", i, n_str, g_str);
+        OPENSSL_free(n_str);
+        OPENSSL_free(g_str);
+    }
+    if (found >= 0)
+        LOG_INFO("%ld of the %zu moduli share a factor", found, count)
+
+    batch_gcd_free(gcds, count);
+    batch_gcd_free(moduli, count);
+    return found == -1 ? EXIT_CODE_FAILURE : EXIT_CODE_SUCCESS;
+}
+
+int exec_autotune(void)
+{
+    const char *path =
+        profile_path != NULL ? profile_path : tuning_default_path();
+    if (path == NULL)
+    {
+        LOG_ERROR("no profile path: set HOME or MY_PRIME_PROFILE, or use "
+                  "--profile")
+        return EXIT_CODE_FAILURE;
+    }
+    if (!setup_preliminary())
+    {
+        LOG_ERROR("failed to initialize preliminary tests. Exiting")
+        return EXIT_CODE_FAILURE;
+    }
+
+    struct tuning_entry entries[TUNING_MAX_ENTRIES];
+    long count = autotune(entries, TUNING_MAX_ENTRIES);
+    if (count == -1 || !tuning_save(path, entries, count))
+        return EXIT_CODE_FAILURE;
+
+    printf("# bits trial_primes sieve_window threads\n");
+    for (long i = 0; i < count; ++i)
+        printf("%u %u %u %u\n", entries[i].bits, entries[i].trial_primes,
+               entries[i].sieve_window, entries[i].threads);
+    LOG_INFO("Tuning profile written to %s", path)
+    return EXIT_CODE_SUCCESS;
+}
+
+void load_tuning(void)
+{
+    const char *path =
+        profile_path != NULL ? profile_path : tuning_default_path();
+    if (path != NULL && tuning_load(path) == 0 && profile_path != NULL)
+        LOG_WARN("no tuning profile at %s, using the defaults", path)
+}
+
+/*
+ * Parameters of the tuning profile for numbers of `bits` bits, if any. The
+ * thread count was timed on --next / --prev (search set), and is left alone
+ * for the other modes.
+ */
+void apply_tuning(unsigned bits, int search)
+{
+    const struct tuning_entry *entry = tuning_lookup(bits);
+    if (entry == NULL)
+        return;
+
+    if (entry->trial_primes != 0)
+        set_preliminary_num_primes(entry->trial_primes);
+    if (entry->sieve_window != 0)
+        next_prime_window = entry->sieve_window;
+    // --threads wins over the profile
+    if (search && entry->threads != 0 && NUM_THREADS == 0)
+        NUM_THREADS = entry->threads;
+    LOG_DEBUG("Tuning for %u bits: %zu trial primes, window of %u, %u "
+              "thread(s)",
+              bits, preliminary_num_primes(), next_prime_window,
+              num_threads())
+}
+
+static int parse_u64(const char *arg, uint64_t *value)
+{
+    char *endptr = NULL;
+    errno = 0;
+    *value = strtoull(arg, &endptr, 10);
+    if (*arg < '0' || *arg > '9' || *endptr != 0 || errno != 0)
+    {
+        LOG_ERROR("Invalid 64-bit number: %s", arg)
+        return 0;
+    }
+    return 1;
+}
+
 static void set_verbosity(char *arg);
 
 static unsigned parse_args(int argc, char **argv, char *buffer)
@@ -184,18 +686,171 @@ static unsigned parse_args(int argc, char **argv, char *buffer)
             flags |= CMD_FLAGS_DEC;
             continue;
         }
+        if (strcmp(argv[i], "--bpsw") == 0)
+        {
+            flags |= CMD_FLAGS_BPSW;
+            continue;
+        }
+        if (strcmp(argv[i], "--mr") == 0)
+        {
+            flags |= CMD_FLAGS_MR;
+            continue;
+        }
+        if (strcmp(argv[i], "--provable") == 0)
+        {
+            flags |= CMD_FLAGS_PROV;
+            continue;
+        }
+        if (strcmp(argv[i], "--certificate") == 0)
+        {
+            flags |= CMD_FLAGS_PROV | CMD_FLAGS_CERT;
+            continue;
+        }
+        if (strcmp(argv[i], "--safe") == 0)
+        {
+            flags |= CMD_FLAGS_SAFE;
+            continue;
+        }
+        if (strcmp(argv[i], "--der") == 0)
+        {
+            flags |= CMD_FLAGS_DER;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0)
+        {
+            if (i == argc - 1 || !set_num_threads(argv[++i]))
+                return CMD_FLAGS_ERR;
+            continue;
+        }
         if (strcmp(argv[i], "-g") == 0)
         {
-            if (flags & (CMD_FLAGS_GEN | CMD_FLAGS_TST))
+            if (flags & CMD_FLAGS_COMMANDS)
                 return CMD_FLAGS_ERR;
             flags |= CMD_FLAGS_GEN;
             goto NextArgIsAValue;
         }
         if (strcmp(argv[i], "-t") == 0)
         {
-            if (flags & (CMD_FLAGS_GEN | CMD_FLAGS_TST))
+            if (flags & CMD_FLAGS_COMMANDS)
                 return CMD_FLAGS_ERR;
             flags |= CMD_FLAGS_TST;
+            // -t --mersenne P : the number is given by --mersenne
+            if (i < argc - 1 && strcmp(argv[i + 1], "--mersenne") == 0)
+                continue;
+            goto NextArgIsAValue;
+        }
+        if (strcmp(argv[i], "--mersenne") == 0)
+        {
+            if (flags & (CMD_FLAGS_COMMANDS & ~CMD_FLAGS_TST))
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_TST | CMD_FLAGS_MERSENNE;
+            goto NextArgIsAValue;
+        }
+        if (strcmp(argv[i], "--proth") == 0 || strcmp(argv[i], "--riesel") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_PROTH;
+            if (argv[i][2] == 'r')
+                flags |= CMD_FLAGS_RIESEL;
+            goto NextArgIsAValue;
+        }
+        if (strcmp(argv[i], "--k-range") == 0)
+        {
+            if (i == argc - 1 || !parse_k_range(argv[++i]))
+                return CMD_FLAGS_ERR;
+            continue;
+        }
+        if (strcmp(argv[i], "--checkpoint") == 0)
+        {
+            if (i == argc - 1)
+                return CMD_FLAGS_ERR;
+            checkpoint_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0)
+        {
+            if (i == argc - 1)
+                return CMD_FLAGS_ERR;
+            cache_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-l") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS || i >= argc - 2
+                || !parse_u64(argv[i + 1], &list_lo)
+                || !parse_u64(argv[i + 2], &list_hi) || list_lo > list_hi)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_LIST;
+            i += 2;
+            continue;
+        }
+        if (strcmp(argv[i], "--next") == 0 || strcmp(argv[i], "--prev") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_NEXT;
+            if (argv[i][2] == 'p')
+                flags |= CMD_FLAGS_PREV;
+            goto NextArgIsAValue;
+        }
+        if (strcmp(argv[i], "--constellation") == 0)
+        {
+            if (i == argc - 1
+                || !parse_constellation(argv[++i], &constellation))
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_TUPLE;
+            continue;
+        }
+        if (strcmp(argv[i], "--bits") == 0)
+        {
+            uint64_t bits;
+            if (i == argc - 1 || !parse_u64(argv[++i], &bits) || bits == 0
+                || bits > INT_MAX)
+                return CMD_FLAGS_ERR;
+            constellation_bits = bits;
+            continue;
+        }
+        if (strcmp(argv[i], "--count-primes") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS || i == argc - 1
+                || !parse_u64(argv[++i], &count_primes_x))
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_PI;
+            continue;
+        }
+        if (strcmp(argv[i], "--count") == 0)
+        {
+            flags |= CMD_FLAGS_COUNT;
+            continue;
+        }
+        if (strcmp(argv[i], "--batch-gcd") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS || i == argc - 1)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_BGCD;
+            batch_gcd_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--autotune") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_TUNE;
+            continue;
+        }
+        if (strcmp(argv[i], "--profile") == 0)
+        {
+            if (i == argc - 1)
+                return CMD_FLAGS_ERR;
+            profile_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--rsa") == 0)
+        {
+            if (flags & CMD_FLAGS_COMMANDS)
+                return CMD_FLAGS_ERR;
+            flags |= CMD_FLAGS_RSA;
             goto NextArgIsAValue;
         }
         // help
@@ -217,6 +872,43 @@ static unsigned parse_args(int argc, char **argv, char *buffer)
             set_verbosity("-vv");
             continue;
         }
+        if (strcmp(argv[i], "--seed") == 0)
+        {
+#ifdef DETERMINISTIC_RNG
+            if (i == argc - 1)
+                return CMD_FLAGS_ERR;
+            random_set_seed(strtoul(argv[++i], NULL, 10));
+            continue;
+#else /* DETERMINISTIC_RNG */
+            LOG_ERROR("--seed requires a DETERMINISTIC_RNG build")
+            return CMD_FLAGS_ERR;
+#endif /* DETERMINISTIC_RNG */
+        }
+        if (strncmp(argv[i], "--log-async", 11) == 0)
+        {
+            if (!set_log_sink(argv[i]))
+                return CMD_FLAGS_ERR;
+            continue;
+        }
+        if (strcmp(argv[i], "--log-file") == 0)
+        {
+            if (i == argc - 1)
+                return CMD_FLAGS_ERR;
+            set_log_file(argv[++i]);
+            continue;
+        }
+        // instrumentation
+        if (strcmp(argv[i], "--perf-counters") == 0)
+        {
+            enable_perf_counters();
+            continue;
+        }
+        if (strncmp(argv[i], "--stats", 7) == 0)
+        {
+            if (!set_stats_format(argv[i]))
+                return CMD_FLAGS_ERR;
+            continue;
+        }
         flags |= CMD_FLAGS_ERR;
         return flags;
 
@@ -231,6 +923,28 @@ static unsigned parse_args(int argc, char **argv, char *buffer)
     }
     if (flags & CMD_FLAGS_GEN && flags & CMD_FLAGS_TST)
         flags |= CMD_FLAGS_ERR;
+    if (flags & CMD_FLAGS_BPSW && flags & CMD_FLAGS_MR)
+        flags |= CMD_FLAGS_ERR;
+    if (flags & (CMD_FLAGS_PROV | CMD_FLAGS_SAFE) && !(flags & CMD_FLAGS_GEN))
+        flags |= CMD_FLAGS_ERR;
+    if (flags & CMD_FLAGS_PROV && flags & CMD_FLAGS_SAFE)
+        flags |= CMD_FLAGS_ERR;
+    if (flags & CMD_FLAGS_DER && !(flags & CMD_FLAGS_RSA))
+        flags |= CMD_FLAGS_ERR;
+    if (flags & CMD_FLAGS_COUNT && !(flags & CMD_FLAGS_LIST))
+        flags |= CMD_FLAGS_ERR;
+    if (flags & CMD_FLAGS_NEXT && flags & CMD_FLAGS_MR)
+        flags |= CMD_FLAGS_ERR;
+    // --constellation takes either --bits or -l
+    if (flags & CMD_FLAGS_TUPLE
+        && (flags & (CMD_FLAGS_COMMANDS & ~CMD_FLAGS_LIST)
+            || !(flags & CMD_FLAGS_LIST) == !constellation_bits))
+        flags |= CMD_FLAGS_ERR;
+    if (constellation_bits && !(flags & CMD_FLAGS_TUPLE))
+        flags |= CMD_FLAGS_ERR;
+    if (cache_path != NULL
+        && (!(flags & CMD_FLAGS_TST) || flags & CMD_FLAGS_MERSENNE))
+        flags |= CMD_FLAGS_ERR;
 
     return flags;
 }
@@ -241,6 +955,12 @@ static void set_verbosity(char *arg)
     for (int i = 1; arg[i] == 'v'; ++i)
         ++log_level;
 
+    if (log_level > LOG_LEVEL_MAX)
+    {
+        LOG_WARN("log level %d was compiled out (LOG_LEVEL_MAX=%d)", log_level,
+                 LOG_LEVEL_MAX)
+        log_level = LOG_LEVEL_MAX;
+    }
     if (LOG_LEVEL < log_level)
         LOG_LEVEL = log_level;
 }
@@ -249,8 +969,17 @@ static void usage_msg(void)
 {
     fprintf(
         stderr,
-        "usage: ./my_prime [-h] [--help] [-g length] [-t number] [--hex] "
-        "[--dec] [-v] [--verbose] [-vv] [--debug]\n"
+        "usage: ./my_prime [-h] [--help] [-g length] [-t number] [--rsa bits] "
+        "[--cache file] [--der] [--batch-gcd file] [--autotune] "
+        "[--profile file] [--mersenne p] [--checkpoint file] [--proth n] "
+        "[--riesel n] "
+        "[--k-range A:B] [-l lo hi] [--count] [--count-primes x] [--next n] "
+        "[--prev n] "
+        "[--constellation 0,2,...] [--bits N] [--hex] "
+        "[--dec] [--bpsw] [--mr] [--provable] [--certificate] [--safe] "
+        "[--threads N] [-v] [--verbose] [-vv] [--debug] [--log-async[=binary]] "
+        "[--log-file file] "
+        "[--seed N] [--stats[=json]] [--perf-counters]\n"
         "  -h | --help: show this help message\n"
         "\n"
         " -g length: generate a prime number of `length` bits (generated >= "
@@ -258,11 +987,102 @@ static void usage_msg(void)
         "\n"
         " -t hex-number: run primality test in the given number\n"
         "     (which should be in hex format)\n"
+        " --cache file: for -t only. reuse the verdict stored in `file` for "
+        "this number\n"
+        "     (created if needed), and store the new one\n"
+        "\n"
+        " -t --mersenne p: run the Lucas-Lehmer test on 2^p - 1\n"
+        " --checkpoint file: for --mersenne only. save the progress in `file` "
+        "every few\n"
+        "     minutes, and resume from it if it exists\n"
+        "\n"
+        " --proth n --k-range A:B: print the primes k*2^n+1 for k in [A, B] "
+        "(sieve over\n"
+        "     the whole range, then Proth's theorem)\n"
+        " --riesel n --k-range A:B: same for k*2^n-1 (Lucas-Lehmer-Riesel "
+        "test)\n"
+        "\n"
+        " -l lo hi: print the primes of [lo, hi] (64-bit decimal bounds), "
+        "one per line\n"
+        "     (segmented sieve of Eratosthenes, on --threads threads)\n"
+        " --count: for -l only. print the number of primes instead\n"
+        " --count-primes x: print the number of primes <= x (x <= 2^62), "
+        "without\n"
+        "     sieving up to x (Lagarias-Miller-Odlyzko, on --threads "
+        "threads)\n"
+        "\n"
+        " --next n: print the smallest prime > n, in the base of n (hex, or "
+        "--dec)\n"
+        " --prev n: print the largest prime < n\n"
+        "     (windows next to n are sieved, then the BPSW test runs on "
+        "--threads threads)\n"
+        "\n"
+        " --constellation 0,2,... --bits N: generate a random N-bit prime p "
+        "such that\n"
+        "     p + every offset is prime (e.g. 0,2 for twin primes, 0,4,6 for "
+        "a triplet)\n"
+        " --constellation 0,2,... -l lo hi: print every such p of [lo, hi] "
+        "(--count\n"
+        "     to count them)\n"
+        "\n"
+        " --rsa bits: generate an RSA private key (e = 65537) with a modulus "
+        "of `bits`\n"
+        "     bits, and print it in PEM format (PKCS#8)\n"
+        " --der: for --rsa only. print the key in DER format instead\n"
+        " --batch-gcd file: read one modulus per line (hex, or --dec) and "
+        "print\n"
+        "     `index modulus factor` for every modulus sharing a factor with "
+        "another one\n"
+        "     (product and remainder trees, on --threads threads)\n"
+        "\n"
+        " --autotune: time the trial division, the primality test and the "
+        "--next search\n"
+        "     for lengths from 128 to 4096 bits on this host, and write the "
+        "tuning profile\n"
+        " --profile file: tuning profile to write (--autotune) or to load "
+        "(default:\n"
+        "     $MY_PRIME_PROFILE, or ~/.my_prime_profile). Without a profile, "
+        "the built-in\n"
+        "     defaults are used\n"
         "\n"
         "  -v | --verbose: log info messages\n"
         " -vv | --debug: log info and debug messages\n"
+        " --log-async[=text|binary]: write the log messages from a background "
+        "thread\n"
+        "     (messages are dropped rather than slowing down the computation)\n"
+        " --log-file file: file of the --log-async=binary records (default: "
+        "my_prime.log)\n"
+        "\n"
+        " --seed N: seed of the random generator (DETERMINISTIC_RNG builds "
+        "only)\n"
+        " --stats[=text|json]: print per-stage counters, timers and latency "
+        "histograms\n"
+        "     on stderr when exiting\n"
+        " --perf-counters: implies --stats. also count cycles, instructions, "
+        "branch and\n"
+        "     cache misses per stage (perf_event_open), if the system allows "
+        "it\n"
         "\n"
-        " --hex: for -g only. print the generated number in hex format\n"
-        " --dec: for -t only. accept input string as decimal, instead of "
-        "hex\n");
+        " --hex: for -g and --constellation only. print the generated number "
+        "in hex\n"
+        "     format\n"
+        " --dec: for -t, --next, --prev and --batch-gcd only. accept input "
+        "string as\n"
+        "     decimal, instead of hex\n"
+        " --bpsw: use the Baillie-PSW test (base-2 strong test + strong Lucas "
+        "test).\n"
+        "     This is the default for -t\n"
+        " --mr: use up to 40 Miller-Rabin rounds with random bases. This is "
+        "the default\n"
+        "     for -g\n"
+        " --provable: for -g only. build the prime recursively (Shawe-Taylor) "
+        "and prove\n"
+        "     its primality with Pocklington's criterion\n"
+        " --certificate: implies --provable. print the primality certificate "
+        "after the\n"
+        "     prime\n"
+        " --safe: for -g only. generate a safe prime p = 2q + 1 (q prime)\n"
+        " --threads N: number of threads searching for a prime (default: the "
+        "tuning\n"
+        "     profile, or one per cpu)\n");
 }
@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "autotune.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include "primes/miller_rabin.h"
+#include "primes/next_prime.h"
+#include "primes/preliminary.h"
+#include "primes/primality_test.h"
+#include "utils/logging.h"
+#include "utils/threads.h"
+
+// Bit lengths of the profile
+static const unsigned AUTOTUNE_BITS[] = {128, 256, 512, 1024, 2048, 3072, 4096};
+
+// Window sizes tried for --next / --prev
+static const unsigned AUTOTUNE_WINDOWS[] = {1024, 2048, 4096, 8192, 16384,
+                                            32768};
+
+// Above this length, the searches are too slow to time : the window and the
+// thread count of the longest measured length are kept
+#define AUTOTUNE_MAX_SEARCH_BITS 2048
+
+// Random numbers per bit length
+#define AUTOTUNE_SAMPLES 16
+
+// Searches per timing : 4096 / bits (at most AUTOTUNE_SAMPLES)
+#define AUTOTUNE_SEARCH_BITS 4096
+
+// Minimal duration of a stage timing, in ns
+#define AUTOTUNE_MIN_NS 50000000ull
+
+// A setting replaces the default only if it is this much faster (in %), so
+// that the noise of the timings does not end up in the profile
+#define AUTOTUNE_MARGIN 5
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof(*(array)))
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Cost of one BN_mod_word() by a small prime and of one strong test to base
+ * 2 (the round rejecting almost every composite), in ns
+ */
+static int time_stages(BIGNUM *const *samples, double *mod_ns,
+                       double *round_ns, BN_CTX *ctx)
+{
+    size_t max = preliminary_max_primes();
+    uint64_t ops = 0;
+    uint64_t start = monotonic_ns();
+    do
+    {
+        for (size_t s = 0; s < AUTOTUNE_SAMPLES; ++s)
+            for (size_t i = 0; i < max; ++i)
+                if (BN_mod_word(samples[s], preliminary_prime(i))
+                    == (BN_ULONG)-1)
+                {
+                    LOG_ERROR("failed to calculate mod: %s",
+                              OPENSSL_ERR_STRING)
+                    return 0;
+                }
+        ops += AUTOTUNE_SAMPLES * max;
+    } while (monotonic_ns() - start < AUTOTUNE_MIN_NS);
+    *mod_ns = (double)(monotonic_ns() - start) / ops;
+
+    ops = 0;
+    start = monotonic_ns();
+    do
+    {
+        for (size_t s = 0; s < AUTOTUNE_SAMPLES; ++s)
+            if (miller_rabin_base_check(samples[s], 2, ctx) == -1)
+                return 0;
+        ops += AUTOTUNE_SAMPLES;
+    } while (monotonic_ns() - start < AUTOTUNE_MIN_NS);
+    *round_ns = (double)(monotonic_ns() - start) / ops;
+    return 1;
+}
+
+/*
+ * Number of odd primes k minimizing the expected cost of a random odd
+ * candidate : the i-th division is done if the i - 1 first primes do not
+ * divide it, and the test round if none of the k primes does.
+ */
+static unsigned best_trial_primes(double mod_ns, double round_ns)
+{
+    size_t max = preliminary_max_primes();
+    // fraction of the candidates left after the k first primes
+    double survivors = 1;
+    double divisions_ns = 0;
+    size_t best = 1;
+    double best_ns = round_ns;
+    for (size_t k = 1; k <= max; ++k)
+    {
+        divisions_ns += survivors * mod_ns;
+        survivors *= 1 - 1.0 / preliminary_prime(k - 1);
+        double total_ns = divisions_ns + survivors * round_ns;
+        if (k == 1 || total_ns < best_ns)
+        {
+            best = k;
+            best_ns = total_ns;
+        }
+    }
+    return best;
+}
+
+/*
+ * Time of find_next_prime() from each of the count samples, in ns.
+ * Returns 0 on failure.
+ */
+static uint64_t time_search(BIGNUM *const *samples, size_t count)
+{
+    uint64_t start = monotonic_ns();
+    for (size_t s = 0; s < count; ++s)
+    {
+        BIGNUM *p = find_next_prime(samples[s], 0);
+        if (p == NULL)
+            return 0;
+        BN_free(p);
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    return elapsed == 0 ? 1 : elapsed;
+}
+
+/*
+ * Index of the fastest setting : the first one (the default) unless another
+ * one is AUTOTUNE_MARGIN % faster
+ */
+static size_t fastest(const uint64_t *ns, size_t count)
+{
+    size_t best = 0;
+    for (size_t i = 1; i < count; ++i)
+        if (ns[i] < ns[best])
+            best = i;
+    if (ns[best] * 100 > ns[0] * (100 - AUTOTUNE_MARGIN))
+        return 0;
+    return best;
+}
+
+// Window size of the fastest searches (the current one by default)
+static unsigned tune_window(BIGNUM *const *samples, size_t count)
+{
+    unsigned windows[1 + ARRAY_SIZE(AUTOTUNE_WINDOWS)] = {next_prime_window};
+    uint64_t ns[1 + ARRAY_SIZE(AUTOTUNE_WINDOWS)] = {0};
+    size_t num = 1;
+    for (size_t i = 0; i < ARRAY_SIZE(AUTOTUNE_WINDOWS); ++i)
+        if (AUTOTUNE_WINDOWS[i] != windows[0])
+            windows[num++] = AUTOTUNE_WINDOWS[i];
+
+    unsigned window = next_prime_window;
+    for (size_t i = 0; i < num; ++i)
+    {
+        next_prime_window = windows[i];
+        if ((ns[i] = time_search(samples, count)) == 0)
+            break;
+        LOG_DEBUG("  window %u: %.3f ms per search", windows[i],
+                  ns[i] / 1e6 / count)
+    }
+    next_prime_window = window;
+    for (size_t i = 0; i < num; ++i)
+        if (ns[i] == 0)
+            return 0;
+    return windows[fastest(ns, num)];
+}
+
+// Thread count of the fastest searches (num_threads() by default)
+static unsigned tune_threads(BIGNUM *const *samples, size_t count)
+{
+    // 1, 2, 4, ... below num_threads()
+    unsigned threads[32] = {num_threads()};
+    uint64_t ns[32] = {0};
+    size_t num = 1;
+    for (unsigned t = 1; t < threads[0] && num < ARRAY_SIZE(threads); t *= 2)
+        threads[num++] = t;
+
+    unsigned saved = NUM_THREADS;
+    for (size_t i = 0; i < num; ++i)
+    {
+        NUM_THREADS = threads[i];
+        if ((ns[i] = time_search(samples, count)) == 0)
+            break;
+        LOG_DEBUG("  %u thread(s): %.3f ms per search", threads[i],
+                  ns[i] / 1e6 / count)
+    }
+    NUM_THREADS = saved;
+    for (size_t i = 0; i < num; ++i)
+        if (ns[i] == 0)
+            return 0;
+    return threads[fastest(ns, num)];
+}
+
+static int tune_length(struct tuning_entry *entry, BIGNUM *const *samples,
+                       BN_CTX *ctx)
+{
+    double mod_ns = 0;
+    double round_ns = 0;
+    if (!time_stages(samples, &mod_ns, &round_ns, ctx))
+        return 0;
+    entry->trial_primes = best_trial_primes(mod_ns, round_ns);
+    LOG_INFO("%u bits: %.1f ns per trial division, %.1f us per test round, "
+             "%u trial primes",
+             entry->bits, mod_ns, round_ns / 1e3, entry->trial_primes)
+
+    if (entry->bits > AUTOTUNE_MAX_SEARCH_BITS)
+        return 1;
+
+    size_t count = AUTOTUNE_SEARCH_BITS / entry->bits;
+    if (count < 1)
+        count = 1;
+    if (count > AUTOTUNE_SAMPLES)
+        count = AUTOTUNE_SAMPLES;
+
+    size_t saved = preliminary_num_primes();
+    set_preliminary_num_primes(entry->trial_primes);
+    // the first search also warms up the caches
+    int success = time_search(samples, 1) != 0
+        && (entry->sieve_window = tune_window(samples, count)) != 0;
+    if (success)
+    {
+        unsigned window = next_prime_window;
+        next_prime_window = entry->sieve_window;
+        success = (entry->threads = tune_threads(samples, count)) != 0;
+        next_prime_window = window;
+    }
+    set_preliminary_num_primes(saved);
+    if (!success)
+        return 0;
+
+    LOG_INFO("%u bits: window of %u, %u thread(s)", entry->bits,
+             entry->sieve_window, entry->threads)
+    // one per cpu stays the default, rather than this host's count
+    if (NUM_THREADS == 0 && entry->threads == num_threads())
+        entry->threads = 0;
+    return 1;
+}
+
+long autotune(struct tuning_entry *entries, size_t max)
+{
+    BIGNUM *samples[AUTOTUNE_SAMPLES] = {NULL};
+    BN_CTX *ctx = BN_CTX_new();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("failed to allocate the context: %s", OPENSSL_ERR_STRING)
+        return -1;
+    }
+
+    // the searches are deterministic
+    enum primality_test_type test_type = primality_test_type;
+    primality_test_type = PRIMALITY_TEST_BPSW;
+
+    long count = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(AUTOTUNE_BITS) && (size_t)count < max;
+         ++i)
+    {
+        struct tuning_entry *entry = &entries[count];
+        entry->bits = AUTOTUNE_BITS[i];
+        // the lengths that are not searched keep the longest searched one
+        entry->sieve_window = count > 0 ? entries[count - 1].sieve_window : 0;
+        entry->threads = count > 0 ? entries[count - 1].threads : 0;
+
+        // random odd numbers of the length (only timed : the system
+        // generator is enough)
+        for (size_t s = 0; s < AUTOTUNE_SAMPLES; ++s)
+        {
+            if (samples[s] == NULL && (samples[s] = BN_new()) == NULL)
+                goto AutotuneFailed;
+            if (!BN_rand(samples[s], entry->bits, BN_RAND_TOP_ONE,
+                         BN_RAND_BOTTOM_ODD))
+                goto AutotuneFailed;
+        }
+
+        if (!tune_length(entry, samples, ctx))
+        {
+            count = -1;
+            break;
+        }
+        ++count;
+    }
+
+    primality_test_type = test_type;
+    for (size_t s = 0; s < AUTOTUNE_SAMPLES; ++s)
+        BN_free(samples[s]);
+    BN_CTX_free(ctx);
+    return count;
+
+AutotuneFailed:
+    LOG_ERROR("failed to draw the samples: %s", OPENSSL_ERR_STRING)
+    primality_test_type = test_type;
+    for (size_t s = 0; s < AUTOTUNE_SAMPLES; ++s)
+        BN_free(samples[s]);
+    BN_CTX_free(ctx);
+    return -1;
+}
@@ -0,0 +1,20 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+
+#include "utils/tuning.h"
+
+/*
+ * Measure on this host, for bit lengths from 128 to 4096 :
+ *  - the cost of a trial division by a small prime and of a strong test
+ *    round, and the number of odd primes minimizing the expected cost of a
+ *    random candidate (trial divisions, plus the test of the survivors)
+ *  - the time find_next_prime() takes with each window size, then with each
+ *    thread count (up to num_threads())
+ * and fill up to max entries of the tuning profile. setup_preliminary()
+ * must be done. Returns the number of entries, or -1 on failure.
+ */
+long autotune(struct tuning_entry *entries, size_t max);
+
+#endif /* !AUTOTUNE_H */
@@ -0,0 +1,511 @@
+#include "constellation.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/miller_rabin.h"
+#include "primes/primality_test.h"
+#include "primes/small_primes.h"
+#include "random/random.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+#include "utils/threads.h"
+
+// Number of consecutive odd bases sieved at once
+#ifndef CONSTELLATION_SIEVE_WINDOW
+#    define CONSTELLATION_SIEVE_WINDOW (1u << 15)
+#endif /* !CONSTELLATION_SIEVE_WINDOW */
+
+struct constellation_search
+{
+    const struct constellation *pattern;
+    unsigned num_tests;
+    // odd primes used by the sieve
+    const uint32_t *primes;
+    size_t num_primes;
+
+    // random search : bases of 'length' bits, set once a thread found one
+    // (or failed)
+    unsigned length;
+    int done;
+    BIGNUM *p;
+
+    // range : windows of the odd bases first + 2k, written in order
+    uint64_t first;
+    uint64_t hi;
+    uint64_t num_windows;
+    uint64_t next_window;
+    uint64_t printed_window;
+    long count;
+    int failed;
+    FILE *out;
+    pthread_cond_t printed;
+
+    pthread_mutex_t lock;
+};
+
+int parse_constellation(const char *arg, struct constellation *pattern)
+{
+    pattern->size = 0;
+    const char *s = arg;
+    for (;;)
+    {
+        char *endptr = NULL;
+        errno = 0;
+        unsigned long offset = strtoul(s, &endptr, 10);
+        if (endptr == s || *s < '0' || *s > '9' || errno != 0
+            || pattern->size == CONSTELLATION_MAX_SIZE
+            || offset > CONSTELLATION_MAX_OFFSET || offset % 2 != 0
+            || (pattern->size == 0 && offset != 0)
+            || (pattern->size > 0
+                && offset <= pattern->offsets[pattern->size - 1]))
+            goto InvalidConstellation;
+        pattern->offsets[pattern->size++] = offset;
+        if (*endptr == 0)
+            break;
+        if (*endptr != ',')
+            goto InvalidConstellation;
+        s = endptr + 1;
+    }
+    if (pattern->size < 2)
+        goto InvalidConstellation;
+
+    // some member of p + offsets is a multiple of q, for every p, if the
+    // offsets cover all the residues modulo q (only possible if q <= size)
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    for (size_t i = 0; primes[i] <= pattern->size; ++i)
+    {
+        unsigned char covered[CONSTELLATION_MAX_SIZE] = { 0 };
+        unsigned num_covered = 0;
+        for (unsigned j = 0; j < pattern->size; ++j)
+        {
+            uint32_t r = pattern->offsets[j] % primes[i];
+            num_covered += !covered[r];
+            covered[r] = 1;
+        }
+        if (num_covered == primes[i])
+        {
+            LOG_ERROR("%s is not admissible (it covers every residue modulo "
+                      "%u)",
+                      arg, primes[i])
+            return 0;
+        }
+    }
+    return 1;
+
+InvalidConstellation:
+    LOG_ERROR("Invalid constellation: %s (increasing even offsets from 0, "
+              "at least 2 and at most %u)",
+              arg, CONSTELLATION_MAX_SIZE)
+    return 0;
+}
+
+/*
+ * Mark in 'composite' every k < count such that first + 2k + offsets[i] has
+ * a small factor, for any i. residues[j] is first modulo primes[j]. If
+ * small is set, first is small enough for the members to be sieving primes
+ * themselves : these are not crossed off.
+ */
+static void sieve_window(const struct constellation_search *search,
+                         const uint32_t *residues, int small, uint64_t first,
+                         unsigned char *composite, uint64_t count)
+{
+    STATS_TIMER_START(sieve_timer)
+    memset(composite, 0, count);
+    const struct constellation *pattern = search->pattern;
+    for (size_t i = 0; i < search->num_primes; ++i)
+    {
+        uint64_t p = search->primes[i];
+        uint64_t half = (p + 1) / 2;
+        for (unsigned j = 0; j < pattern->size; ++j)
+        {
+            // first + offset + 2k = 0 (mod p)
+            uint64_t r = (residues[i] + pattern->offsets[j]) % p;
+            uint64_t k = (p - r) % p * half % p;
+            uint64_t self = UINT64_MAX;
+            if (small && p >= first + pattern->offsets[j])
+                self = (p - first - pattern->offsets[j]) / 2;
+            for (; k < count; k += p)
+                if (k != self)
+                    composite[k] = 1;
+        }
+    }
+    STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, sieve_timer)
+    STATS_ADD(STATS_CANDIDATES, count)
+}
+
+/*
+ * Cheapest tests first : a base-2 strong test on every member, and the
+ * full primality test only if they all pass.
+ */
+static int test_members(const struct constellation_search *search,
+                        const BIGNUM *base, BIGNUM *member, BN_CTX *ctx)
+{
+    const struct constellation *pattern = search->pattern;
+    for (int full = 0; full < 2; ++full)
+    {
+        for (unsigned i = 0; i < pattern->size; ++i)
+        {
+            if (!BN_copy(member, base)
+                || !BN_add_word(member, pattern->offsets[i]))
+                return -1;
+            int success;
+            if (full)
+                success = primality_test(member, search->num_tests, ctx);
+            else
+                success = BN_num_bits(member) <= 2
+                    ? 1
+                    : miller_rabin_base_check(member, 2, ctx);
+            if (success != 1)
+                return success;
+        }
+    }
+    return 1;
+}
+
+static int search_done(struct constellation_search *search)
+{
+    return __atomic_load_n(&search->done, __ATOMIC_ACQUIRE);
+}
+
+static void search_finish(struct constellation_search *search, BIGNUM *p)
+{
+    pthread_mutex_lock(&search->lock);
+    if (!search->done && p != NULL)
+    {
+        search->p = p;
+        p = NULL;
+    }
+    __atomic_store_n(&search->done, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&search->lock);
+
+    BN_clear_free(p);
+}
+
+/*
+ * Draw the first base of a window : 'length' bits, odd
+ */
+static int draw_window_start(BIGNUM *first, unsigned length)
+{
+    BN_zero(first);
+    if (!BN_set_bit(first, length - 1))
+        return 0;
+    STATS_TIMER_START(rng_timer)
+    int success = generate_prime_candidate(first, length);
+    STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
+    return success && BN_set_bit(first, 0);
+}
+
+static void *random_worker(void *arg)
+{
+    struct constellation_search *search = arg;
+
+    unsigned char *composite = malloc(CONSTELLATION_SIEVE_WINDOW);
+    uint32_t *residues = malloc((search->num_primes + 1) * sizeof(uint32_t));
+    BN_CTX *ctx = BN_CTX_secure_new();
+    BIGNUM *first = BN_secure_new();
+    BIGNUM *base = BN_secure_new();
+    BIGNUM *member = BN_secure_new();
+    if (composite == NULL || residues == NULL || ctx == NULL || first == NULL
+        || base == NULL || member == NULL)
+    {
+        LOG_ERROR("failed to allocate constellation worker: %s",
+                  OPENSSL_ERR_STRING)
+        goto RandomWorkerFailed;
+    }
+
+    while (!search_done(search))
+    {
+        if (!draw_window_start(first, search->length))
+            goto RandomWorkerFailed;
+        for (size_t i = 0; i < search->num_primes; ++i)
+        {
+            BN_ULONG r = BN_mod_word(first, search->primes[i]);
+            if (r == (BN_ULONG)-1)
+                goto RandomWorkerFailed;
+            residues[i] = r;
+        }
+        sieve_window(search, residues, 0, 0, composite,
+                     CONSTELLATION_SIEVE_WINDOW);
+
+        for (unsigned k = 0;
+             k < CONSTELLATION_SIEVE_WINDOW && !search_done(search); ++k)
+        {
+            if (composite[k])
+                continue;
+
+            // the base must still have length bits
+            if (!BN_copy(base, first) || !BN_add_word(base, 2 * (BN_ULONG)k))
+                goto RandomWorkerFailed;
+            if (BN_num_bits(base) != (int)search->length)
+                break;
+
+            int success = test_members(search, base, member, ctx);
+            if (success == -1)
+                goto RandomWorkerFailed;
+            if (success == 1)
+            {
+                LOG_INFO("Found a constellation")
+                search_finish(search, base);
+                base = NULL;
+                break;
+            }
+        }
+    }
+
+    free(composite);
+    free(residues);
+    BN_CTX_free(ctx);
+    BN_clear_free(first);
+    BN_clear_free(base);
+    BN_clear_free(member);
+    return NULL;
+
+RandomWorkerFailed:
+    LOG_ERROR("constellation worker failed: %s", OPENSSL_ERR_STRING)
+    search_finish(search, NULL);
+    free(composite);
+    free(residues);
+    BN_CTX_free(ctx);
+    BN_clear_free(first);
+    BN_clear_free(base);
+    BN_clear_free(member);
+    return NULL;
+}
+
+/*
+ * Only primes q with q^2 < 2^(length - 1) can be used by the sieve :
+ * otherwise, a member could be q itself.
+ */
+static size_t sieve_num_primes(const uint32_t *primes, size_t count,
+                               unsigned length)
+{
+    size_t n = 0;
+    while (n < count
+           && (length - 1 >= 64
+               || (uint64_t)primes[n] * primes[n] < (1ull << (length - 1))))
+        ++n;
+    return n;
+}
+
+static int run_workers(struct constellation_search *search,
+                       void *(*worker)(void *), unsigned num)
+{
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 0;
+    }
+
+    unsigned started = 0;
+    for (; started < num; ++started)
+    {
+        int error =
+            pthread_create(&threads[started], NULL, worker, search);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    return started == num;
+}
+
+BIGNUM *find_constellation(const struct constellation *pattern,
+                           unsigned length)
+{
+    if (length < 3)
+    {
+        LOG_ERROR("Invalid length: %u (constellations need at least 3 bits)",
+                  length)
+        return NULL;
+    }
+
+    struct constellation_search search = {
+        .pattern = pattern,
+        .num_tests = estimate_num_tests(length),
+        .length = length,
+        .done = 0,
+        .p = NULL,
+    };
+    // skip 2, the bases are odd
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    search.primes = primes + 1;
+    search.num_primes = sieve_num_primes(primes + 1, count - 1, length);
+    pthread_mutex_init(&search.lock, NULL);
+
+    unsigned n = num_threads();
+    LOG_INFO("Searching a %u-bits constellation of %u primes with %u "
+             "thread(s), sieving with %zu primes",
+             length, pattern->size, n, search.num_primes)
+    if (!run_workers(&search, &random_worker, n))
+        search_finish(&search, NULL);
+
+    pthread_mutex_destroy(&search.lock);
+    return search.p;
+}
+
+static void mark_failed(struct constellation_search *search)
+{
+    pthread_mutex_lock(&search->lock);
+    search->failed = 1;
+    pthread_cond_broadcast(&search->printed);
+    pthread_mutex_unlock(&search->lock);
+}
+
+/*
+ * Write the bases found in a window once the previous windows are written
+ */
+static int print_window(struct constellation_search *search, uint64_t window,
+                        const uint64_t *found, size_t num_found)
+{
+    pthread_mutex_lock(&search->lock);
+    while (search->printed_window != window && !search->failed)
+        pthread_cond_wait(&search->printed, &search->lock);
+    int success = !search->failed;
+    for (size_t i = 0; success && search->out != NULL && i < num_found; ++i)
+        success = fprintf(search->out, "%lu\n", (unsigned long)found[i]) > 0;
+    search->count += num_found;
+    ++search->printed_window;
+    pthread_cond_broadcast(&search->printed);
+    pthread_mutex_unlock(&search->lock);
+    return success;
+}
+
+static void *range_worker(void *arg)
+{
+    struct constellation_search *search = arg;
+
+    unsigned char *composite = malloc(CONSTELLATION_SIEVE_WINDOW);
+    uint32_t *residues = malloc((search->num_primes + 1) * sizeof(uint32_t));
+    uint64_t *found = malloc(CONSTELLATION_SIEVE_WINDOW * sizeof(uint64_t));
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *base = BN_new();
+    BIGNUM *member = BN_new();
+    if (composite == NULL || residues == NULL || found == NULL || ctx == NULL
+        || base == NULL || member == NULL)
+    {
+        LOG_ERROR("failed to allocate constellation worker: %s",
+                  OPENSSL_ERR_STRING)
+        goto RangeWorkerFailed;
+    }
+
+    for (;;)
+    {
+        uint64_t window =
+            __atomic_fetch_add(&search->next_window, 1, __ATOMIC_RELAXED);
+        if (window >= search->num_windows
+            || __atomic_load_n(&search->failed, __ATOMIC_RELAXED))
+            break;
+
+        uint64_t first =
+            search->first + 2 * window * (uint64_t)CONSTELLATION_SIEVE_WINDOW;
+        uint64_t count = (search->hi - first) / 2 + 1;
+        if (count > CONSTELLATION_SIEVE_WINDOW)
+            count = CONSTELLATION_SIEVE_WINDOW;
+        for (size_t i = 0; i < search->num_primes; ++i)
+            residues[i] = first % search->primes[i];
+        sieve_window(search, residues, 1, first, composite, count);
+
+        size_t num_found = 0;
+        for (uint64_t k = 0; k < count; ++k)
+        {
+            if (composite[k])
+                continue;
+            if (!BN_set_word(base, first + 2 * k))
+                goto RangeWorkerFailed;
+            int success = test_members(search, base, member, ctx);
+            if (success == -1)
+                goto RangeWorkerFailed;
+            if (success == 1)
+                found[num_found++] = first + 2 * k;
+        }
+        if (!print_window(search, window, found, num_found))
+            goto RangeWorkerFailed;
+    }
+
+    free(composite);
+    free(residues);
+    free(found);
+    BN_CTX_free(ctx);
+    BN_free(base);
+    BN_free(member);
+    return NULL;
+
+RangeWorkerFailed:
+    LOG_ERROR("constellation worker failed: %s", OPENSSL_ERR_STRING)
+    mark_failed(search);
+    free(composite);
+    free(residues);
+    free(found);
+    BN_CTX_free(ctx);
+    BN_free(base);
+    BN_free(member);
+    return NULL;
+}
+
+long constellation_range(const struct constellation *pattern, uint64_t lo,
+                         uint64_t hi, FILE *out)
+{
+    if (lo > hi)
+    {
+        LOG_ERROR("Invalid range: [%lu, %lu]", (unsigned long)lo,
+                  (unsigned long)hi)
+        return -1;
+    }
+    // the members of the bases above do not fit in 64 bits
+    uint32_t last = pattern->offsets[pattern->size - 1];
+    if (hi > UINT64_MAX - last)
+    {
+        LOG_DEBUG("Bases above %lu are not searched",
+                  (unsigned long)(UINT64_MAX - last))
+        hi = UINT64_MAX - last;
+    }
+
+    // 2 is the base of no constellation : its other members are even
+    struct constellation_search search = {
+        .pattern = pattern,
+        .first = lo <= 3 ? 3 : lo | 1,
+        .hi = hi,
+        .next_window = 0,
+        .printed_window = 0,
+        .count = 0,
+        .failed = 0,
+        .out = out,
+    };
+    if (search.first > hi)
+        return 0;
+    uint64_t num_bases = (hi - search.first) / 2 + 1;
+    search.num_windows = (num_bases - 1) / CONSTELLATION_SIEVE_WINDOW + 1;
+
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    search.primes = primes + 1;
+    search.num_primes = count - 1;
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.printed, NULL);
+
+    unsigned n = num_threads();
+    if (n > search.num_windows)
+        n = search.num_windows;
+    LOG_INFO("Searching [%lu, %lu] for constellations of %u primes with %u "
+             "thread(s)",
+             (unsigned long)lo, (unsigned long)hi, pattern->size, n)
+    if (!run_workers(&search, &range_worker, n))
+        mark_failed(&search);
+
+    pthread_cond_destroy(&search.printed);
+    pthread_mutex_destroy(&search.lock);
+    if (search.failed || (out != NULL && fflush(out) != 0))
+        return -1;
+    return search.count;
+}
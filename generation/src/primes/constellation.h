@@ -0,0 +1,48 @@
+#ifndef CONSTELLATION_H
+#define CONSTELLATION_H
+
+#include <openssl/bn.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CONSTELLATION_MAX_SIZE 16
+#define CONSTELLATION_MAX_OFFSET (1u << 20)
+
+/*
+ * Pattern of a prime constellation : p + offsets[i] are all primes
+ * (offsets[0] = 0, e.g. 0,2 for the twin primes or 0,2,6 for a prime triplet)
+ */
+struct constellation
+{
+    unsigned size;
+    uint32_t offsets[CONSTELLATION_MAX_SIZE];
+};
+
+/*
+ * Parse "0,2,6". The offsets must be even and increasing, and the pattern
+ * admissible (it does not cover every residue modulo a prime). Returns 0 if
+ * it is not valid.
+ */
+int parse_constellation(const char *arg, struct constellation *pattern);
+
+/*
+ * Random p of 'length' bits such that every p + offsets[i] is prime. Windows
+ * of consecutive odd bases are sieved with every offset at once (a base is
+ * removed as soon as one of its members has a small factor), on
+ * num_threads() threads, and the members of the survivors go through a
+ * base-2 strong test before the full primality_test().
+ */
+BIGNUM *find_constellation(const struct constellation *pattern,
+                           unsigned length);
+
+/*
+ * Bases p of [lo, hi] of the constellation, written to 'out' (one per line,
+ * in increasing order), or only counted if out is NULL. hi is lowered so
+ * that the members fit in 64 bits. The windows are shared between
+ * num_threads() threads.
+ * Returns the number of bases, or -1 on failure.
+ */
+long constellation_range(const struct constellation *pattern, uint64_t lo,
+                         uint64_t hi, FILE *out);
+
+#endif /* !CONSTELLATION_H */
@@ -0,0 +1,229 @@
+#include "lucas.h"
+
+#include <openssl/err.h>
+
+#include "utils/logging.h"
+#include "utils/stats.h"
+
+// Number of values of D tried before checking that n is not a square
+#define LUCAS_SQUARE_CHECK_AFTER 8
+
+int bn_is_perfect_square(const BIGNUM *n, BN_CTX *ctx)
+{
+    if (BN_is_negative(n))
+        return 0;
+    if (BN_is_zero(n) || BN_is_one(n))
+        return 1;
+
+    // Squares are 0, 1, 4 or 9 mod 16 : most non-squares stop here
+    BN_ULONG low = BN_mod_word(n, 16);
+    if (low != 0 && low != 1 && low != 4 && low != 9)
+        return 0;
+
+    int result = -1;
+    BN_CTX_start(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    BIGNUM *y = BN_CTX_get(ctx);
+    if (y == NULL)
+        goto PerfectSquareEnd;
+
+    // Newton iteration, starting above the root : x = 2^ceil(bits / 2)
+    BN_zero(x);
+    if (!BN_set_bit(x, (BN_num_bits(n) + 1) / 2))
+        goto PerfectSquareEnd;
+    for (;;)
+    {
+        // y = (x + n / x) / 2
+        if (!BN_div(y, NULL, n, x, ctx) || !BN_add(y, y, x)
+            || !BN_rshift1(y, y))
+            goto PerfectSquareEnd;
+        if (BN_cmp(y, x) >= 0)
+            break;
+        if (!BN_copy(x, y))
+            goto PerfectSquareEnd;
+    }
+    // x = floor(sqrt(n))
+    if (!BN_sqr(y, x, ctx))
+        goto PerfectSquareEnd;
+    result = BN_cmp(y, n) == 0;
+
+PerfectSquareEnd:
+    if (result == -1)
+        LOG_ERROR("integer square root: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+
+    return result;
+}
+
+/*
+ * Selfridge's method A : first D in 5, -7, 9, -11, 13, ... such that the
+ * Jacobi symbol (D/n) is -1. Returns 1 if found, 0 if n is shown composite
+ * on the way (or is a perfect square), 2 if n is shown prime (n = |D|) and
+ * -1 on failure.
+ */
+static int selfridge_parameter(BIGNUM *n, long *d_out, BN_CTX *ctx)
+{
+    int result = -1;
+
+    BN_CTX_start(ctx);
+    BIGNUM *d = BN_CTX_get(ctx);
+    if (d == NULL)
+        goto SelfridgeEnd;
+
+    long abs_d = 5;
+    for (unsigned tries = 0;; ++tries, abs_d += 2)
+    {
+        long signed_d = tries % 2 ? -abs_d : abs_d;
+        if (!BN_set_word(d, abs_d))
+            goto SelfridgeEnd;
+        BN_set_negative(d, signed_d < 0);
+
+        int jacobi = BN_kronecker(d, n, ctx);
+        if (jacobi == -2)
+            goto SelfridgeEnd;
+        if (jacobi == -1)
+        {
+            *d_out = signed_d;
+            result = 1;
+            break;
+        }
+        // |D| shares a factor with n : n is composite, unless n = |D|
+        if (jacobi == 0)
+        {
+            result = BN_is_word(n, abs_d) ? 2 : 0;
+            break;
+        }
+
+        // For a square, (D/n) is never -1
+        if (tries == LUCAS_SQUARE_CHECK_AFTER)
+        {
+            int square = bn_is_perfect_square(n, ctx);
+            if (square != 0)
+            {
+                result = square == 1 ? 0 : -1;
+                break;
+            }
+        }
+    }
+
+SelfridgeEnd:
+    if (result == -1)
+        LOG_ERROR("choosing the Selfridge parameter: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+
+    return result;
+}
+
+/*
+ * r = a / 2 % n (n odd, 0 <= a < n). Halving commutes with the montgomery
+ * representation, so this works on montgomery values too.
+ */
+static int bn_mod_half(BIGNUM *r, const BIGNUM *a, const BIGNUM *n)
+{
+    if (BN_is_odd(a))
+        return BN_add(r, a, n) && BN_rshift1(r, r);
+    return BN_rshift1(r, a);
+}
+
+/*
+ * Set r to the montgomery representation of the (small, signed) integer v
+ */
+static int bn_small_to_montgomery(BIGNUM *r, long v, BIGNUM *n,
+                                  BN_MONT_CTX *mont, BN_CTX *ctx)
+{
+    if (!BN_set_word(r, v < 0 ? -v : v))
+        return 0;
+    if (v < 0 && !BN_sub(r, n, r))
+        return 0;
+    return BN_to_montgomery(r, r, mont, ctx);
+}
+
+int strong_lucas_check(BIGNUM *n, BN_CTX *ctx)
+{
+    long d_param;
+    int result = selfridge_parameter(n, &d_param, ctx);
+    if (result != 1)
+        return result == 2 ? 1 : result;
+
+    STATS_ADD(STATS_LUCAS_TESTS, 1)
+    result = -1;
+
+    BN_MONT_CTX *mont = BN_MONT_CTX_new();
+    BN_CTX_start(ctx);
+    BIGNUM *k = BN_CTX_get(ctx);
+    BIGNUM *u = BN_CTX_get(ctx);
+    BIGNUM *v = BN_CTX_get(ctx);
+    BIGNUM *qk = BN_CTX_get(ctx);
+    BIGNUM *q = BN_CTX_get(ctx);
+    BIGNUM *d = BN_CTX_get(ctx);
+    BIGNUM *t = BN_CTX_get(ctx);
+    if (mont == NULL || t == NULL || !BN_MONT_CTX_set(mont, n, ctx))
+        goto StrongLucasEnd;
+
+    // n + 1 = k * 2^s, with k odd
+    if (!BN_copy(k, n) || !BN_add_word(k, 1))
+        goto StrongLucasEnd;
+    unsigned s = 0;
+    while (!BN_is_odd(k))
+    {
+        ++s;
+        BN_rshift1(k, k);
+    }
+
+    /*
+     * Everything below is in montgomery form : U_1 = 1, V_1 = P = 1 and
+     * Q^1 = Q. The multiplications are montgomery ones, the additions and
+     * halvings are unchanged.
+     */
+    if (!bn_small_to_montgomery(u, 1, n, mont, ctx) || !BN_copy(v, u)
+        || !bn_small_to_montgomery(q, (1 - d_param) / 4, n, mont, ctx)
+        || !BN_copy(qk, q)
+        || !bn_small_to_montgomery(d, d_param, n, mont, ctx))
+        goto StrongLucasEnd;
+
+    STATS_TIMER_START(lucas_timer)
+    for (int bit = BN_num_bits(k) - 2; bit >= 0; --bit)
+    {
+        // U_2j = U_j * V_j ; V_2j = V_j^2 - 2 * Q^j ; Q^2j = (Q^j)^2
+        if (!BN_mod_mul_montgomery(u, u, v, mont, ctx)
+            || !BN_mod_mul_montgomery(v, v, v, mont, ctx)
+            || !BN_mod_lshift1_quick(t, qk, n) || !BN_mod_sub_quick(v, v, t, n)
+            || !BN_mod_mul_montgomery(qk, qk, qk, mont, ctx))
+            goto StrongLucasStopTimer;
+
+        if (!BN_is_bit_set(k, bit))
+            continue;
+
+        // U_j+1 = (P * U_j + V_j) / 2 ; V_j+1 = (D * U_j + P * V_j) / 2
+        if (!BN_mod_mul_montgomery(t, d, u, mont, ctx)
+            || !BN_mod_add_quick(u, u, v, n) || !bn_mod_half(u, u, n)
+            || !BN_mod_add_quick(v, t, v, n) || !bn_mod_half(v, v, n)
+            || !BN_mod_mul_montgomery(qk, qk, q, mont, ctx))
+            goto StrongLucasStopTimer;
+    }
+
+    // U_k == 0 or V_k * 2^r == 0 for some 0 <= r < s
+    result = BN_is_zero(u) || BN_is_zero(v);
+    for (unsigned r = 1; r < s && !result; ++r)
+    {
+        if (!BN_mod_mul_montgomery(v, v, v, mont, ctx)
+            || !BN_mod_lshift1_quick(t, qk, n) || !BN_mod_sub_quick(v, v, t, n)
+            || !BN_mod_mul_montgomery(qk, qk, qk, mont, ctx))
+        {
+            result = -1;
+            break;
+        }
+        result = BN_is_zero(v);
+    }
+
+StrongLucasStopTimer:
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, lucas_timer)
+
+StrongLucasEnd:
+    if (result == -1)
+        LOG_ERROR("strong lucas test: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+    BN_MONT_CTX_free(mont);
+
+    return result;
+}
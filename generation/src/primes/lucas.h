@@ -0,0 +1,19 @@
+#ifndef LUCAS_H
+#define LUCAS_H
+
+#include <openssl/bn.h>
+
+/*
+ * Strong Lucas probable-prime test of the odd number n > 3, with the
+ * parameters chosen by Selfridge's method A (P = 1, Q = (1 - D) / 4).
+ * Returns 1 if n is a strong Lucas probable prime, 0 if it is composite
+ * and -1 on failure.
+ */
+int strong_lucas_check(BIGNUM *n, BN_CTX *ctx);
+
+/*
+ * Returns 1 if n is a perfect square, 0 if it is not and -1 on failure.
+ */
+int bn_is_perfect_square(const BIGNUM *n, BN_CTX *ctx);
+
+#endif /* !LUCAS_H */
@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mersenne.h"
+
+#include <errno.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/logging.h"
+#include "utils/stats.h"
+
+// Seconds between two checkpoints
+#ifndef MERSENNE_CHECKPOINT_PERIOD
+#    define MERSENNE_CHECKPOINT_PERIOD 300
+#endif /* !MERSENNE_CHECKPOINT_PERIOD */
+
+#define MERSENNE_CHECKPOINT_MAGIC "LL1"
+
+/*
+ * Factors of 2^p - 1 (p odd prime) are q = 2kp + 1 with q = +-1 (mod 8).
+ * They are tried up to 2^MERSENNE_TRIAL_FACTOR_BITS if it is defined, and
+ * otherwise up to a bound growing with p (see trial_factor_bits). pow2_mod
+ * needs q < 2^32.
+ */
+#define MERSENNE_TRIAL_FACTOR_MAX_BITS 32
+
+#ifdef MERSENNE_TRIAL_FACTOR_BITS
+#    if MERSENNE_TRIAL_FACTOR_BITS > MERSENNE_TRIAL_FACTOR_MAX_BITS
+#        error "MERSENNE_TRIAL_FACTOR_BITS must be at most 32"
+#    endif
+#endif /* MERSENNE_TRIAL_FACTOR_BITS */
+
+static int is_prime_word(unsigned long n)
+{
+    if (n < 2)
+        return 0;
+    if (n % 2 == 0)
+        return n == 2;
+    for (unsigned long d = 3; d * d <= n; d += 2)
+        if (n % d == 0)
+            return 0;
+    return 1;
+}
+
+// 2^p mod q, with q < 2^32
+static uint64_t pow2_mod(unsigned long p, uint64_t q)
+{
+    uint64_t result = 1;
+    uint64_t base = 2 % q;
+    for (; p != 0; p >>= 1)
+    {
+        if (p & 1)
+            result = result * base % q;
+        base = base * base % q;
+    }
+    return result;
+}
+
+// Single-word squarings in a squaring of `words` words (Karatsuba)
+static double karatsuba_cost(unsigned long words)
+{
+    double cost = 1;
+    for (; words > 1; words = (words + 1) / 2)
+        cost *= 3;
+    return cost;
+}
+
+/*
+ * Bit depth of the trial factoring, GIMPS style : the candidates between
+ * 2^(b-1) and 2^b (about 2^b / 4p of them) are worth trying if they cost
+ * less than the Lucas-Lehmer test times the chance (about 1/b) that one of
+ * them divides 2^p - 1. A candidate (pow2_mod) is counted as a single-word
+ * squaring, so the test costs p * karatsuba_cost(p / 64 words) of them.
+ */
+static unsigned trial_factor_bits(unsigned long p)
+{
+#ifdef MERSENNE_TRIAL_FACTOR_BITS
+    (void)p;
+    return MERSENNE_TRIAL_FACTOR_BITS;
+#else /* MERSENNE_TRIAL_FACTOR_BITS */
+    double test_cost = p * karatsuba_cost((p + 63) / 64);
+    unsigned bits = 1;
+    while (bits < MERSENNE_TRIAL_FACTOR_MAX_BITS
+           && (double)(1ull << (bits + 1)) / (4.0 * p)
+               <= test_cost / (bits + 1))
+        ++bits;
+    return bits;
+#endif /* MERSENNE_TRIAL_FACTOR_BITS */
+}
+
+static uint64_t trial_factor(unsigned long p)
+{
+    uint64_t limit = 1ull << trial_factor_bits(p);
+    LOG_DEBUG("trial factoring 2^%lu - 1 up to %lu", p, (unsigned long)limit)
+    for (uint64_t q = 2 * (uint64_t)p + 1; q < limit; q += 2 * (uint64_t)p)
+    {
+        // q must be a proper factor (not 2^p - 1 itself)
+        if (p < 64 && q >= (1ull << p) - 1)
+            break;
+        if ((q % 8 == 1 || q % 8 == 7) && pow2_mod(p, q) == 1)
+            return q;
+    }
+    return 0;
+}
+
+/*
+ * s = s mod (2^p - 1), using 2^p = 1 : s = (s & (2^p - 1)) + (s >> p),
+ * no division involved. s < 2^(2p) on entry.
+ */
+static int mersenne_fold(BIGNUM *s, BIGNUM *high, const BIGNUM *m,
+                         unsigned long p)
+{
+    while ((unsigned long)BN_num_bits(s) > p)
+    {
+        if (!BN_rshift(high, s, p) || !BN_mask_bits(s, p)
+            || !BN_add(s, s, high))
+            return 0;
+    }
+    if (BN_cmp(s, m) == 0)
+        BN_zero(s);
+    return 1;
+}
+
+static int load_checkpoint(const char *path, unsigned long p,
+                           unsigned long *iteration, BIGNUM **s)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+            return 0;
+        LOG_ERROR("failed to open checkpoint %s: %s", path, strerror(errno))
+        return -1;
+    }
+
+    int result = -1;
+    char magic[4];
+    unsigned long checkpoint_p;
+    char *hex = NULL;
+    // the residue is written on its own line, of p / 4 + 1 hex digits max
+    size_t hex_size = p / 4 + 3;
+    if ((hex = malloc(hex_size)) == NULL)
+        goto LoadCheckpointEnd;
+    if (fscanf(f, "%3s %lu %lu\n", magic, &checkpoint_p, iteration) != 3
+        || strcmp(magic, MERSENNE_CHECKPOINT_MAGIC) != 0
+        || fgets(hex, hex_size, f) == NULL)
+    {
+        LOG_ERROR("invalid checkpoint %s", path)
+        goto LoadCheckpointEnd;
+    }
+    if (checkpoint_p != p)
+    {
+        LOG_ERROR("checkpoint %s is for 2^%lu - 1, not 2^%lu - 1", path,
+                  checkpoint_p, p)
+        goto LoadCheckpointEnd;
+    }
+    hex[strcspn(hex, "\n")] = 0;
+    if (!BN_hex2bn(s, hex))
+    {
+        LOG_ERROR("invalid residue in checkpoint %s", path)
+        goto LoadCheckpointEnd;
+    }
+    result = 1;
+
+LoadCheckpointEnd:
+    free(hex);
+    fclose(f);
+    return result;
+}
+
+/*
+ * Written to a temporary file first, then renamed : a crash while writing
+ * never loses the previous checkpoint.
+ */
+static int save_checkpoint(const char *path, unsigned long p,
+                           unsigned long iteration, const BIGNUM *s)
+{
+    size_t tmp_size = strlen(path) + 5;
+    char *tmp = malloc(tmp_size);
+    char *hex = BN_bn2hex(s);
+    FILE *f = NULL;
+    int success = 0;
+    if (tmp == NULL || hex == NULL)
+        goto SaveCheckpointEnd;
+    snprintf(tmp, tmp_size, "%s.tmp", path);
+
+    if ((f = fopen(tmp, "w")) == NULL)
+        goto SaveCheckpointEnd;
+    success = fprintf(f, "%s %lu %lu\n%s\n", MERSENNE_CHECKPOINT_MAGIC, p,
+                      iteration, hex)
+            > 0
+        && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    success = fclose(f) == 0 && success;
+    success = success && rename(tmp, path) == 0;
+
+SaveCheckpointEnd:
+    if (!success)
+        LOG_ERROR("failed to save checkpoint %s: %s", path, strerror(errno))
+    else
+        LOG_INFO("checkpoint: iteration %lu / %lu", iteration, p - 2)
+    free(tmp);
+    OPENSSL_free(hex);
+    return success;
+}
+
+int lucas_lehmer_check(unsigned long p, const char *checkpoint)
+{
+    if (p < 2 || p > (unsigned long)INT32_MAX)
+    {
+        LOG_ERROR("Invalid exponent: %lu", p)
+        return -1;
+    }
+    // 2^p - 1 is composite if p is
+    if (!is_prime_word(p))
+        return 0;
+    if (p == 2)
+        return 1;
+
+    uint64_t factor = trial_factor(p);
+    if (factor != 0)
+    {
+        LOG_INFO("2^%lu - 1 has the factor %lu", p, (unsigned long)factor)
+        return 0;
+    }
+
+    int result = -1;
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *s = BN_new();
+    BIGNUM *m = BN_new();
+    BIGNUM *high = BN_new();
+    if (ctx == NULL || s == NULL || m == NULL || high == NULL
+        || !BN_set_bit(m, p) || !BN_sub_word(m, 1))
+        goto LucasLehmerEnd;
+
+    // s_0 = 4, s_(i+1) = s_i^2 - 2 : 2^p - 1 is prime iff s_(p-2) = 0
+    unsigned long iteration = 0;
+    int loaded = checkpoint == NULL
+        ? 0
+        : load_checkpoint(checkpoint, p, &iteration, &s);
+    if (loaded == -1)
+        goto LucasLehmerEnd;
+    if (loaded)
+        LOG_INFO("resuming from iteration %lu", iteration)
+    else if (!BN_set_word(s, 4))
+        goto LucasLehmerEnd;
+
+    time_t last_checkpoint = time(NULL);
+    // a single timed region for the whole loop : one per squaring would
+    // cost as much as a small squaring with --perf-counters
+    STATS_TIMER_START(square_timer)
+    int success = 1;
+    for (; iteration < p - 2 && success; ++iteration)
+    {
+        // s - 2 mod 2^p - 1, with s < 2 wrapping around
+        success = BN_sqr(s, s, ctx) && mersenne_fold(s, high, m, p)
+            && (BN_num_bits(s) >= 2 || BN_add(s, s, m)) && BN_sub_word(s, 2);
+
+        if (success && checkpoint != NULL
+            && time(NULL) - last_checkpoint >= MERSENNE_CHECKPOINT_PERIOD)
+        {
+            success = save_checkpoint(checkpoint, p, iteration + 1, s);
+            last_checkpoint = time(NULL);
+        }
+    }
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, square_timer)
+    if (!success)
+        goto LucasLehmerEnd;
+    result = BN_is_zero(s);
+
+    // the run is over : its checkpoint is of no use anymore
+    if (checkpoint != NULL && unlink(checkpoint) == -1 && errno != ENOENT)
+        LOG_WARN("failed to remove checkpoint %s: %s", checkpoint,
+                 strerror(errno))
+
+LucasLehmerEnd:
+    if (result == -1)
+        LOG_ERROR("lucas-lehmer test of 2^%lu - 1: %s", p, OPENSSL_ERR_STRING)
+    BN_free(high);
+    BN_free(m);
+    BN_free(s);
+    BN_CTX_free(ctx);
+    return result;
+}
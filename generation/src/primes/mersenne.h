@@ -0,0 +1,12 @@
+#ifndef MERSENNE_H
+#define MERSENNE_H
+
+/*
+ * Lucas-Lehmer test of the Mersenne number 2^p - 1. If checkpoint is not
+ * NULL, the state is saved in that file periodically, and a run is resumed
+ * from it if it exists. Returns 1 if 2^p - 1 is prime, 0 if it is
+ * composite and -1 on failure.
+ */
+int lucas_lehmer_check(unsigned long p, const char *checkpoint);
+
+#endif /* !MERSENNE_H */
@@ -6,6 +6,7 @@
 #include "primes/primality_test.h"
 #include "random/random.h"
 #include "utils/logging.h"
+#include "utils/stats.h"
 
 #ifndef MILLER_RABBIN_MAX_NUM_TESTS
 #    define MILLER_RABBIN_MAX_NUM_TESTS 40
@@ -72,7 +73,11 @@ BIGNUM *miller_rabin_prime_generation(unsigned length, unsigned num_tests)
             LOG_DEBUG("%d candidates tested", count)
 #endif /* CANDIDATES_COUNT */
 
-        if (!generate_prime_candidate(p, length))
+        STATS_ADD(STATS_CANDIDATES, 1)
+        STATS_TIMER_START(rng_timer)
+        int generated = generate_prime_candidate(p, length);
+        STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
+        if (!generated)
             goto MillerRabinFailed;
 
         if ((success = primality_test(p, num_tests, ctx)) == -1)
@@ -145,10 +150,15 @@ int miller_rabin_primality_check(BIGNUM *n, unsigned num_tests, BN_CTX *ctx)
 
     for (unsigned round = 0; round < num_tests; ++round)
     {
+        STATS_ADD(STATS_MR_ROUNDS, 1)
         // Endpoint is excluded
+        STATS_TIMER_START(rng_timer)
         random_bn_from_range(a, two, n_minus_one);
+        STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
         // Modular exponentiation (x = a ^ d % n)
+        STATS_TIMER_START(modexp_timer)
         BN_mod_exp(x, a, d, n, ctx);
+        STATS_TIMER_STOP(STATS_STAGE_MODEXP, modexp_timer)
 
         for (unsigned sub_round = 0; sub_round < s; ++sub_round)
         {
@@ -159,6 +169,7 @@ int miller_rabin_primality_check(BIGNUM *n, unsigned num_tests, BN_CTX *ctx)
             if (BN_is_one(y) && !BN_is_one(x) && BN_cmp(x, n_minus_one) != 0)
             {
                 // nontrivial square root of 1 modulo n
+                STATS_ADD(STATS_MR_EARLY_EXITS, 1)
                 result = 0;
                 goto MillerRabinTestsEnd;
             }
@@ -169,6 +180,7 @@ int miller_rabin_primality_check(BIGNUM *n, unsigned num_tests, BN_CTX *ctx)
         //    y != 1
         if (!BN_is_one(y))
         {
+            STATS_ADD(STATS_MR_EARLY_EXITS, 1)
             result = 0;
             goto MillerRabinTestsEnd;
         }
@@ -182,3 +194,68 @@ MillerRabinTestsEnd:
 
     return result;
 }
+
+int miller_rabin_base_check(BIGNUM *n, BN_ULONG base, BN_CTX *ctx)
+{
+    int result = -1;
+
+    BN_CTX_start(ctx);
+    BIGNUM *d = BN_CTX_get(ctx);
+    BIGNUM *a = BN_CTX_get(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    BIGNUM *n_minus_one = BN_CTX_get(ctx);
+    if (n_minus_one == NULL)
+    {
+        LOG_ERROR("initializing constants from ctx: %s", OPENSSL_ERR_STRING)
+        goto MillerRabinBaseEnd;
+    }
+
+    if (!BN_sub(n_minus_one, n, BN_value_one()) || !BN_set_word(a, base)
+        || !BN_copy(d, n_minus_one))
+    {
+        LOG_ERROR("pre-setting constants: %s", OPENSSL_ERR_STRING)
+        goto MillerRabinBaseEnd;
+    }
+
+    // d * 2^s = n - 1
+    unsigned s = 0;
+    while (!BN_is_odd(d))
+    {
+        ++s;
+        BN_rshift1(d, d);
+    }
+
+    STATS_ADD(STATS_MR_ROUNDS, 1)
+    // x = base ^ d % n
+    STATS_TIMER_START(modexp_timer)
+    int success = BN_mod_exp(x, a, d, n, ctx);
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, modexp_timer)
+    if (!success)
+    {
+        LOG_ERROR("modular exponentiation: %s", OPENSSL_ERR_STRING)
+        goto MillerRabinBaseEnd;
+    }
+
+    result = BN_is_one(x) || BN_cmp(x, n_minus_one) == 0;
+    for (unsigned round = 1; round < s && !result; ++round)
+    {
+        // x = x^2 % n
+        if (!BN_mod_sqr(x, x, n, ctx))
+        {
+            LOG_ERROR("modular square: %s", OPENSSL_ERR_STRING)
+            result = -1;
+            goto MillerRabinBaseEnd;
+        }
+        // 1 without going through n - 1 : nontrivial square root of 1
+        if (BN_is_one(x))
+            break;
+        result = BN_cmp(x, n_minus_one) == 0;
+    }
+    if (!result)
+        STATS_ADD(STATS_MR_EARLY_EXITS, 1)
+
+MillerRabinBaseEnd:
+    BN_CTX_end(ctx);
+
+    return result;
+}
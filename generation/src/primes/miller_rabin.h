@@ -11,6 +11,13 @@ BIGNUM *miller_rabin_prime_generation(unsigned length, unsigned num_tests);
 
 int miller_rabin_primality_check(BIGNUM *n, unsigned num_tests, BN_CTX *ctx);
 
+/*
+ * Strong probable-prime test of the odd number n > 3 to a fixed base.
+ * Returns 1 if n is a strong probable prime, 0 if it is composite and
+ * -1 on failure.
+ */
+int miller_rabin_base_check(BIGNUM *n, BN_ULONG base, BN_CTX *ctx);
+
 unsigned estimate_num_tests(unsigned length);
 
 #endif /* !MILLER_RABIN_H */
@@ -0,0 +1,314 @@
+#include "next_prime.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/miller_rabin.h"
+#include "primes/primality_test.h"
+#include "primes/small_primes.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+#include "utils/threads.h"
+
+// Odd numbers sieved at once (a few times the average prime gap)
+#ifndef NEXT_PRIME_WINDOW
+#    define NEXT_PRIME_WINDOW (1u << 13)
+#endif /* !NEXT_PRIME_WINDOW */
+
+unsigned next_prime_window = NEXT_PRIME_WINDOW;
+
+struct next_prime_search
+{
+    int previous;
+    unsigned num_tests;
+    // odd primes used by the sieve, and the residues of base modulo them
+    const uint32_t *primes;
+    uint32_t *residues;
+    size_t num_primes;
+    // the window holds base + 2k (base - 2k if previous), k < num_candidates
+    BIGNUM *base;
+    uint64_t num_candidates;
+    unsigned char *composite;
+    // next k to test, and smallest k found prime (UINT64_MAX if none)
+    uint64_t next_k;
+    uint64_t found_k;
+    int failed;
+    pthread_mutex_t lock;
+};
+
+/*
+ * base as a 64-bit number, if it fits (the sieve must not cross off the
+ * small primes themselves, and the previous primes stop at 3)
+ */
+static int small_base(const BIGNUM *base, uint64_t *value)
+{
+    if (BN_num_bits(base) > 63)
+        return 0;
+    *value = BN_get_word(base);
+    return 1;
+}
+
+static void sieve_window(struct next_prime_search *search)
+{
+    STATS_TIMER_START(sieve_timer)
+    memset(search->composite, 0, search->num_candidates);
+    uint64_t base = 0;
+    int small = small_base(search->base, &base);
+
+    for (size_t i = 0; i < search->num_primes; ++i)
+    {
+        uint64_t p = search->primes[i];
+        uint64_t r = search->residues[i];
+        // base + 2k = 0 (mod p), i.e. k = -r / 2 (k = r / 2 if previous)
+        uint64_t half = (p + 1) / 2;
+        uint64_t k = (search->previous ? r : (p - r) % p) * half % p;
+
+        // p itself is a candidate when base is small
+        uint64_t self = UINT64_MAX;
+        if (small && !search->previous && p >= base)
+            self = (p - base) / 2;
+        if (small && search->previous && p <= base)
+            self = (base - p) / 2;
+
+        for (; k < search->num_candidates; k += p)
+            if (k != self)
+                search->composite[k] = 1;
+    }
+    STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, sieve_timer)
+    STATS_ADD(STATS_CANDIDATES, search->num_candidates)
+}
+
+static void search_fail(struct next_prime_search *search)
+{
+    __atomic_store_n(&search->failed, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Test the survivors of the window in increasing k, until one is prime :
+ * the threads skip the k above the smallest one found so far.
+ */
+static void *next_prime_worker(void *arg)
+{
+    struct next_prime_search *search = arg;
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *candidate = BN_new();
+    if (ctx == NULL || candidate == NULL)
+    {
+        LOG_ERROR("failed to allocate next prime worker: %s",
+                  OPENSSL_ERR_STRING)
+        goto NextPrimeWorkerFailed;
+    }
+
+    for (;;)
+    {
+        uint64_t k =
+            __atomic_fetch_add(&search->next_k, 1, __ATOMIC_RELAXED);
+        if (k >= search->num_candidates
+            || k > __atomic_load_n(&search->found_k, __ATOMIC_RELAXED)
+            || __atomic_load_n(&search->failed, __ATOMIC_RELAXED))
+            break;
+        if (search->composite[k])
+            continue;
+
+        if (!BN_copy(candidate, search->base)
+            || !(search->previous ? BN_sub_word(candidate, 2 * k)
+                                  : BN_add_word(candidate, 2 * k)))
+            goto NextPrimeWorkerFailed;
+        int success = primality_test(candidate, search->num_tests, ctx);
+        if (success == -1)
+            goto NextPrimeWorkerFailed;
+        if (success == 0)
+            continue;
+
+        pthread_mutex_lock(&search->lock);
+        if (k < search->found_k)
+            __atomic_store_n(&search->found_k, k, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&search->lock);
+    }
+
+    BN_CTX_free(ctx);
+    BN_free(candidate);
+    return NULL;
+
+NextPrimeWorkerFailed:
+    LOG_ERROR("next prime worker failed: %s", OPENSSL_ERR_STRING)
+    search_fail(search);
+    BN_CTX_free(ctx);
+    BN_free(candidate);
+    return NULL;
+}
+
+static int test_window(struct next_prime_search *search)
+{
+    search->next_k = 0;
+    unsigned num = num_threads();
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 0;
+    }
+
+    unsigned started = 0;
+    for (; started < num; ++started)
+    {
+        int error = pthread_create(&threads[started], NULL,
+                                   &next_prime_worker, search);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            search_fail(search);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    return !search->failed;
+}
+
+/*
+ * Move to the next window : base +- 2 * next_prime_window, and the residues
+ * follow without any BIGNUM reduction
+ */
+static int slide_window(struct next_prime_search *search)
+{
+    uint64_t shift = 2 * (uint64_t)next_prime_window;
+    for (size_t i = 0; i < search->num_primes; ++i)
+    {
+        uint64_t p = search->primes[i];
+        uint64_t r = search->residues[i];
+        search->residues[i] = search->previous ? (r + p - shift % p) % p
+                                               : (r + shift) % p;
+    }
+    return search->previous ? BN_sub_word(search->base, shift)
+                            : BN_add_word(search->base, shift);
+}
+
+/*
+ * First odd candidate : n + 1 or n + 2 (n - 1 or n - 2 if previous). Sets
+ * result to 2 (or returns 0 if there is no prime below n) when n is too
+ * small.
+ */
+static int setup_base(struct next_prime_search *search, const BIGNUM *n,
+                      BIGNUM **result)
+{
+    uint64_t small = 0;
+    int negative = BN_is_negative(n);
+    if (!search->previous
+        && (negative || (small_base(n, &small) && small < 2)))
+        goto SetupBaseTwo;
+    if (search->previous
+        && (negative || (small_base(n, &small) && small <= 3)))
+    {
+        if (!negative && small == 3)
+            goto SetupBaseTwo;
+        LOG_ERROR("There is no prime below 2")
+        return 0;
+    }
+
+    if (!BN_copy(search->base, n))
+        return -1;
+    int success = search->previous ? BN_sub_word(search->base, 1)
+                                   : BN_add_word(search->base, 1);
+    if (success && !BN_is_odd(search->base))
+        success = search->previous ? BN_sub_word(search->base, 1)
+                                   : BN_add_word(search->base, 1);
+    return success ? 1 : -1;
+
+SetupBaseTwo:
+    *result = BN_new();
+    if (*result == NULL || !BN_set_word(*result, 2))
+        return -1;
+    return 0;
+}
+
+BIGNUM *find_next_prime(const BIGNUM *n, int previous)
+{
+    struct next_prime_search search = {
+        .previous = previous,
+        .num_tests = estimate_num_tests(BN_num_bits(n)),
+        .found_k = UINT64_MAX,
+        .failed = 0,
+    };
+    BIGNUM *result = NULL;
+    search.base = BN_new();
+    search.composite = malloc(next_prime_window);
+    // skip 2, no candidate is even
+    search.primes = small_primes(&search.num_primes) + 1;
+    --search.num_primes;
+    search.residues = malloc(search.num_primes * sizeof(uint32_t));
+    pthread_mutex_init(&search.lock, NULL);
+    if (search.base == NULL || search.composite == NULL
+        || search.residues == NULL)
+    {
+        LOG_ERROR("failed to allocate next prime search: %s", strerror(errno))
+        goto NextPrimeEnd;
+    }
+
+    int setup = setup_base(&search, n, &result);
+    if (setup == -1)
+        LOG_ERROR("failed to set up next prime search: %s", OPENSSL_ERR_STRING)
+    if (setup != 1)
+        goto NextPrimeEnd;
+
+    for (size_t i = 0; i < search.num_primes; ++i)
+    {
+        BN_ULONG r = BN_mod_word(search.base, search.primes[i]);
+        if (r == (BN_ULONG)-1)
+        {
+            LOG_ERROR("failed to reduce the window start: %s",
+                      OPENSSL_ERR_STRING)
+            goto NextPrimeEnd;
+        }
+        search.residues[i] = r;
+    }
+
+    for (uint64_t window = 0;; ++window)
+    {
+        // the previous primes stop at 3
+        uint64_t base = 0;
+        int last = previous && small_base(search.base, &base)
+                   && (base - 3) / 2 < next_prime_window;
+        search.num_candidates = last ? (base - 3) / 2 + 1 : next_prime_window;
+
+        LOG_DEBUG("Sieving window %lu (%lu candidates)", (unsigned long)window,
+                  (unsigned long)search.num_candidates)
+        sieve_window(&search);
+        if (!test_window(&search))
+            goto NextPrimeEnd;
+        if (search.found_k != UINT64_MAX)
+            break;
+        if (last)
+        {
+            // only 2 is left below
+            result = BN_new();
+            if (result == NULL || !BN_set_word(result, 2))
+                LOG_ERROR("failed to build the prime: %s", OPENSSL_ERR_STRING)
+            goto NextPrimeEnd;
+        }
+        if (!slide_window(&search))
+            goto NextPrimeEnd;
+    }
+
+    result = BN_dup(search.base);
+    if (result == NULL
+        || !(previous ? BN_sub_word(result, 2 * search.found_k)
+                      : BN_add_word(result, 2 * search.found_k)))
+    {
+        LOG_ERROR("failed to build the prime: %s", OPENSSL_ERR_STRING)
+        BN_free(result);
+        result = NULL;
+    }
+
+NextPrimeEnd:
+    pthread_mutex_destroy(&search.lock);
+    BN_free(search.base);
+    free(search.composite);
+    free(search.residues);
+    return result;
+}
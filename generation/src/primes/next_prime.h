@@ -0,0 +1,20 @@
+#ifndef NEXT_PRIME_H
+#define NEXT_PRIME_H
+
+#include <openssl/bn.h>
+
+// Odd numbers sieved at once (NEXT_PRIME_WINDOW, or the tuning profile)
+extern unsigned next_prime_window;
+
+/*
+ * Smallest prime > n (previous = 0), or largest prime < n (previous = 1),
+ * for n of any size. Windows of odd numbers next to n are sieved with the
+ * primes of small_primes() (a single BIGNUM reduction per prime, the next
+ * windows reuse the residues), and their survivors go through
+ * primality_test() on num_threads() threads, in order. Uses no randomness
+ * if primality_test_type is PRIMALITY_TEST_BPSW.
+ * Returns NULL on failure, or if there is no prime < n.
+ */
+BIGNUM *find_next_prime(const BIGNUM *n, int previous);
+
+#endif /* !NEXT_PRIME_H */
@@ -1,75 +1,47 @@
 #include "preliminary.h"
 
-#include <errno.h>
-#include <string.h>
-
+#include "primes/small_primes.h"
 #include "utils/logging.h"
+#include "utils/stats.h"
 
-// 24 first prime numbers
-static BN_ULONG PRELIMINARY_PRIMES[] = { 3,  5,  7,  11, 13, 17, 19, 23,
-                                         29, 31, 37, 41, 43, 47, 53, 59,
-                                         61, 67, 71, 73, 79, 83, 89, 97 };
+// Odd primes tried by default : the 24 first ones, 3 to 97
+#ifndef PRELIMINARY_NUM_PRIMES
+#    define PRELIMINARY_NUM_PRIMES 24
+#endif /* !PRELIMINARY_NUM_PRIMES */
 
-static size_t NUM_PRELIMINARY_PRIMES =
-    sizeof(PRELIMINARY_PRIMES) / sizeof(PRELIMINARY_PRIMES[0]);
+// Odd primes below SMALL_PRIMES_LIMIT
+static const uint32_t *PRELIMINARY_PRIMES = NULL;
+static size_t MAX_PRELIMINARY_PRIMES = 0;
 
-static BIGNUM **PRELIMINARY_PRIMES_BIGNUMS = NULL;
+static size_t NUM_PRELIMINARY_PRIMES = PRELIMINARY_NUM_PRIMES;
 
 int setup_preliminary(void)
 {
-    if (PRELIMINARY_PRIMES_BIGNUMS != NULL)
+    if (PRELIMINARY_PRIMES != NULL)
     {
         LOG_WARN("Preliminary already initialized")
         return -1;
     }
 
-    PRELIMINARY_PRIMES_BIGNUMS = calloc(NUM_PRELIMINARY_PRIMES, sizeof(void *));
-    if (PRELIMINARY_PRIMES_BIGNUMS == NULL)
-    {
-        LOG_ERROR("failed to allocate PPB: %s", strerror(errno))
-        return 0;
-    }
-
-    for (size_t i = 0; i < NUM_PRELIMINARY_PRIMES; ++i)
-    {
-        BN_ULONG small_prime_word = PRELIMINARY_PRIMES[i];
-        BIGNUM *small_prime = BN_new();
-        if (small_prime == NULL)
-        {
-            LOG_ERROR("failed to allocate PPB[%zu] %lu: %s", i,
-                      small_prime_word, OPENSSL_ERR_STRING)
-            goto SetupPreliminaryFailed;
-        }
-        if (!BN_set_word(small_prime, small_prime_word))
-        {
-            LOG_ERROR("failed to set word of PPB[%zu] to %lu: %s", i,
-                      small_prime_word, OPENSSL_ERR_STRING)
-            goto SetupPreliminaryFailed;
-        }
-        PRELIMINARY_PRIMES_BIGNUMS[i] = small_prime;
-    }
-
+    // skip 2, the candidates are odd
+    PRELIMINARY_PRIMES = small_primes(&MAX_PRELIMINARY_PRIMES) + 1;
+    --MAX_PRELIMINARY_PRIMES;
+    if (NUM_PRELIMINARY_PRIMES > MAX_PRELIMINARY_PRIMES)
+        NUM_PRELIMINARY_PRIMES = MAX_PRELIMINARY_PRIMES;
     return 1;
-
-SetupPreliminaryFailed:
-
-    cleanup_preliminary();
-    return 0;
 }
 
 void cleanup_preliminary()
 {
-    if (PRELIMINARY_PRIMES_BIGNUMS == NULL)
+    if (PRELIMINARY_PRIMES == NULL)
     {
-        LOG_DEBUG("preliminary primes bignums is NULL")
+        LOG_DEBUG("preliminary primes are not initialized")
         return;
     }
 
-    for (size_t i = 0; i < NUM_PRELIMINARY_PRIMES; ++i)
-        BN_free(PRELIMINARY_PRIMES_BIGNUMS[i]);
-
-    free(PRELIMINARY_PRIMES_BIGNUMS);
-    PRELIMINARY_PRIMES_BIGNUMS = NULL;
+    // the table of small_primes() is never freed
+    PRELIMINARY_PRIMES = NULL;
+    MAX_PRELIMINARY_PRIMES = 0;
 }
 
 /*
@@ -88,15 +60,16 @@ int preliminary_checks(BIGNUM *n, BN_CTX *ctx)
         return -1;
     }
 
-    if (PRELIMINARY_PRIMES_BIGNUMS == NULL)
+    if (PRELIMINARY_PRIMES == NULL)
     {
-        LOG_ERROR("PPB is NULL")
+        LOG_ERROR("preliminary primes are not initialized")
         return -1;
     }
 
     /* Trivial- and Edge-cases */
+    // certainly prime : the tests below only handle odd numbers
     if (BN_is_word(n, 2))
-        return 1;
+        return 2;
     if (BN_is_negative(n))
     {
         LOG_WARN("Negative prime candidate")
@@ -105,38 +78,51 @@ int preliminary_checks(BIGNUM *n, BN_CTX *ctx)
     if (!BN_is_odd(n) || BN_is_zero(n) || BN_is_one(n))
         return 0;
 
-    const size_t num_preliminary_primes =
-        sizeof(PRELIMINARY_PRIMES) / sizeof(PRELIMINARY_PRIMES[0]);
-
-    BN_CTX_start(ctx);
-
-    BIGNUM *rem = BN_CTX_get(ctx);
-    if (rem == NULL)
-    {
-        LOG_ERROR("BN_CTX_get failed: %s", OPENSSL_ERR_STRING)
-        BN_CTX_end(ctx);
-        return -1;
-    }
-
-    for (size_t i = 0; i < num_preliminary_primes; ++i)
+    for (size_t i = 0; i < NUM_PRELIMINARY_PRIMES; ++i)
     {
-        BIGNUM *div = PRELIMINARY_PRIMES_BIGNUMS[i];
-        if (BN_cmp(n, div) == 0)
+        BN_ULONG div = PRELIMINARY_PRIMES[i];
+        if (BN_is_word(n, div))
             return 2;
 
-        if (!BN_mod(rem, n, div, ctx))
+        BN_ULONG rem = BN_mod_word(n, div);
+        if (rem == (BN_ULONG)-1)
         {
-            LOG_ERROR("failed to calculate mod %lu", PRELIMINARY_PRIMES[i])
-            BN_CTX_end(ctx);
+            LOG_ERROR("failed to calculate mod %lu: %s", div,
+                      OPENSSL_ERR_STRING)
             return -1;
         }
-        if (BN_is_zero(rem))
+        if (rem == 0)
         {
-            BN_CTX_end(ctx);
+            STATS_REJECTION(i)
             return 0;
         }
     }
 
-    BN_CTX_end(ctx);
     return 1;
 }
+
+size_t preliminary_num_primes(void)
+{
+    return NUM_PRELIMINARY_PRIMES;
+}
+
+size_t preliminary_max_primes(void)
+{
+    return MAX_PRELIMINARY_PRIMES;
+}
+
+void set_preliminary_num_primes(size_t count)
+{
+    if (count == 0)
+        count = 1;
+    if (PRELIMINARY_PRIMES != NULL && count > MAX_PRELIMINARY_PRIMES)
+        count = MAX_PRELIMINARY_PRIMES;
+    NUM_PRELIMINARY_PRIMES = count;
+}
+
+BN_ULONG preliminary_prime(size_t index)
+{
+    if (PRELIMINARY_PRIMES == NULL || index >= MAX_PRELIMINARY_PRIMES)
+        return 0;
+    return PRELIMINARY_PRIMES[index];
+}
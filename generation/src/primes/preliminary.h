@@ -7,6 +7,27 @@ int setup_preliminary(void);
 
 void cleanup_preliminary(void);
 
+/*
+ * Trial division of n by the first preliminary_num_primes() odd primes.
+ * Returns 0 if n is composite, 2 if it is 2 or one of these primes, 1 if it
+ * has none of them as a factor, and -1 on failure.
+ */
 int preliminary_checks(BIGNUM *n, BN_CTX *ctx);
 
+size_t preliminary_num_primes(void);
+
+/*
+ * Odd primes available for the trial division (the ones below
+ * SMALL_PRIMES_LIMIT), once setup_preliminary() is done
+ */
+size_t preliminary_max_primes(void);
+
+/*
+ * Number of odd primes tried by preliminary_checks() (24 by default, see
+ * the tuning profile), at least 1 and at most preliminary_max_primes()
+ */
+void set_preliminary_num_primes(size_t count);
+
+BN_ULONG preliminary_prime(size_t index);
+
 #endif /* !PRELIMINARY_H */
@@ -1,14 +1,30 @@
 #include "primality_test.h"
 
+#include <string.h>
+
+#include "primes/lucas.h"
 #include "primes/miller_rabin.h"
 #include "primes/preliminary.h"
 #include "utils/logging.h"
+#include "utils/stats.h"
+
+enum primality_test_type primality_test_type = PRIMALITY_TEST_MILLER_RABIN;
 
 int primality_test(BIGNUM *p, unsigned num_tests, BN_CTX *ctx)
 {
+    STATS_ADD(STATS_PRIMALITY_TESTS, 1)
+
+    STATS_TIMER_START(trial_division_timer)
     int success = preliminary_checks(p, ctx);
+    STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, trial_division_timer)
+
     if (success == 1)
-        success = miller_rabin_primality_check(p, num_tests, ctx);
+    {
+        if (primality_test_type == PRIMALITY_TEST_BPSW)
+            success = bpsw_primality_check(p, ctx);
+        else
+            success = miller_rabin_primality_check(p, num_tests, ctx);
+    }
     if (success == 2)
         success = 1;
 
@@ -26,3 +42,73 @@ int primality_test_once(BIGNUM *p)
 
     return success;
 }
+
+// The verdict of entry is enough for the current primality_test_type
+static int cached_verdict_applies(const struct result_cache_entry *entry,
+                                  unsigned num_tests)
+{
+    if (!entry->prime || entry->tests & RESULT_CACHE_PROVEN)
+        return 1;
+    if (primality_test_type == PRIMALITY_TEST_BPSW)
+        return (entry->tests & RESULT_CACHE_BPSW) != 0;
+    return entry->rounds >= num_tests;
+}
+
+int primality_test_cached(BIGNUM *p, struct result_cache *cache)
+{
+    unsigned num_tests = estimate_num_tests(BN_num_bits(p));
+    struct result_cache_entry entry = {0};
+    int found = result_cache_lookup(cache, p, &entry);
+    if (found == -1)
+        LOG_WARN("cache lookup failed, testing without it")
+    if (found != 1)
+        memset(&entry, 0, sizeof(entry));
+
+    if (found == 1 && cached_verdict_applies(&entry, num_tests))
+    {
+        LOG_DEBUG("Cached verdict: %s (tests %#x, %u rounds)",
+                  entry.prime ? "prime" : "composite", entry.tests,
+                  entry.rounds)
+        return entry.prime;
+    }
+
+    // the rounds already passed use independent random bases
+    unsigned missing = num_tests;
+    if (found == 1 && primality_test_type == PRIMALITY_TEST_MILLER_RABIN)
+    {
+        missing -= entry.rounds;
+        LOG_DEBUG("Topping up %u cached rounds with %u more", entry.rounds,
+                  missing)
+    }
+
+    BN_CTX *ctx = BN_CTX_secure_new();
+    int success = ctx == NULL ? -1 : primality_test(p, missing, ctx);
+    BN_CTX_free(ctx);
+    if (success == -1)
+        return -1;
+
+    entry.prime = success;
+    if (success && primality_test_type == PRIMALITY_TEST_BPSW)
+    {
+        // no BPSW pseudoprime is below 2^64
+        entry.tests |= BN_num_bits(p) <= 64 ? RESULT_CACHE_PROVEN
+                                            : RESULT_CACHE_BPSW;
+    }
+    else if (success)
+    {
+        entry.tests |= RESULT_CACHE_MILLER_RABIN;
+        entry.rounds += missing;
+    }
+    if (!result_cache_store(cache, p, &entry))
+        LOG_WARN("failed to store the verdict in the cache")
+    return success;
+}
+
+int bpsw_primality_check(BIGNUM *p, BN_CTX *ctx)
+{
+    int success = miller_rabin_base_check(p, 2, ctx);
+    if (success == 1)
+        success = strong_lucas_check(p, ctx);
+
+    return success;
+}
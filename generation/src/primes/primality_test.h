@@ -3,8 +3,37 @@
 
 #include <openssl/bn.h>
 
+#include "utils/result_cache.h"
+
+enum primality_test_type
+{
+    // up to 40 rounds with random bases
+    PRIMALITY_TEST_MILLER_RABIN = 0,
+    // base-2 strong test + strong lucas test (deterministic)
+    PRIMALITY_TEST_BPSW,
+};
+
+extern enum primality_test_type primality_test_type;
+
+/*
+ * Returns 1 if p is (probably) prime, 0 if it is composite and -1 on
+ * failure. num_tests is the number of miller-rabin rounds, and is ignored
+ * by the BPSW test.
+ */
 int primality_test(BIGNUM *p, unsigned num_tests, BN_CTX *ctx);
 
 int primality_test_once(BIGNUM *p);
 
+/*
+ * primality_test_once() through the verdict cached for p, if any : a
+ * composite verdict is returned as is, and a prime one is topped up with the
+ * missing miller-rabin rounds (or the BPSW test) before it is stored back.
+ */
+int primality_test_cached(BIGNUM *p, struct result_cache *cache);
+
+/*
+ * Baillie-PSW test of the odd number p > 3 (no trial division)
+ */
+int bpsw_primality_check(BIGNUM *p, BN_CTX *ctx);
+
 #endif /* !PRIMALITY_TEST_H */
@@ -0,0 +1,769 @@
+#include "prime_count.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/range_sieve.h"
+#include "utils/logging.h"
+#include "utils/threads.h"
+
+// Below this bound, π(x) is simply sieved
+#define PRIME_COUNT_SIEVE_LIMIT (1u << 24)
+
+/*
+ * y = alpha * x^(1/3) : a larger y moves work from the sieve of [1, x / y]
+ * (and P2) to the leaves, and uses more memory. The default grows with x.
+ */
+#ifdef PRIME_COUNT_ALPHA
+#    define ALPHA(x) PRIME_COUNT_ALPHA
+#else /* PRIME_COUNT_ALPHA */
+#    define ALPHA(x) default_alpha(x)
+#endif /* PRIME_COUNT_ALPHA */
+
+/*
+ * φ(v, 4) = (v / 210) * 48 + PHI_TINY[v % 210] : the numbers coprime to
+ * 2, 3, 5 and 7 repeat every 210. The sieve of the special leaves starts
+ * with these PHI_TINY_C primes crossed off.
+ */
+#define PHI_TINY_C 4
+#define PHI_TINY_PRODUCT 210
+#define PHI_TINY_TOTIENT 48
+
+/*
+ * Odd numbers (one bit each) per segment of the special leaves sieve, and
+ * per counter of the bits left in the segment : a leaf counts the whole
+ * counters below it, then the bits of a single counter.
+ */
+#define LEAVES_SEGMENT_BITS (1u << 18)
+#define COUNTER_BITS (1u << 9)
+
+// Numbers per block of P2
+#define P2_BLOCK_SIZE (1u << 18)
+
+// Blocks of b per work item of the easy leaves
+#define EASY_LEAVES_B 256
+
+static uint16_t PHI_TINY[PHI_TINY_PRODUCT];
+static pthread_once_t phi_tiny_once = PTHREAD_ONCE_INIT;
+
+struct prime_count
+{
+    uint64_t x;
+    uint64_t y;
+    uint64_t z;
+    // primes[1..a] are the primes <= y (primes[0] = 1)
+    uint32_t *primes;
+    uint64_t a;
+    // π(n), least prime factor (UINT32_MAX for 1) and Möbius function, n <= y
+    uint32_t *pi;
+    uint32_t *lpf;
+    int8_t *mu;
+    uint64_t pi_sqrt_y;
+    // the special leaves of b < num_hard are (partly) hard
+    uint64_t num_hard;
+    uint64_t block_size;
+
+    // work items of the running phase, committed in order when needed
+    uint64_t next_item;
+    uint64_t num_items;
+    uint64_t committed;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t advanced;
+
+    int64_t s2;
+    // count of the leaves sieve below the next block, for every b
+    int64_t *phi;
+    // P2 : sum of π(x / p), and π(n) below the next block
+    uint64_t v_lo;
+    uint64_t v_hi;
+    int64_t p2_sum;
+    int64_t p2_primes;
+};
+
+struct leaves_worker
+{
+    struct prime_count *pc;
+    uint64_t *bits;
+    uint32_t *counters;
+    uint64_t total;
+    // next odd multiple of primes[b] to cross off
+    uint64_t *next;
+    // count of the block sieve below the segment, for every b
+    int64_t *phi;
+    // sum of μ(m) over the leaves of the block, for every b
+    int64_t *mu_sum;
+};
+
+struct p2_worker
+{
+    struct prime_count *pc;
+    uint8_t *composite;
+    uint8_t *composite_p;
+};
+
+static void setup_phi_tiny(void)
+{
+    uint16_t count = 0;
+    for (unsigned n = 0; n < PHI_TINY_PRODUCT; ++n)
+    {
+        if (n % 2 != 0 && n % 3 != 0 && n % 5 != 0 && n % 7 != 0)
+            ++count;
+        PHI_TINY[n] = count;
+    }
+}
+
+static uint64_t phi_tiny(uint64_t v)
+{
+    return v / PHI_TINY_PRODUCT * PHI_TINY_TOTIENT
+           + PHI_TINY[v % PHI_TINY_PRODUCT];
+}
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = 0;
+    for (int bit = 31; bit >= 0; --bit)
+    {
+        uint64_t candidate = r | (1ull << bit);
+        if (candidate * candidate <= n)
+            r = candidate;
+    }
+    return r;
+}
+
+static uint64_t icbrt(uint64_t n)
+{
+    uint64_t r = 0;
+    for (int bit = 20; bit >= 0; --bit)
+    {
+        uint64_t candidate = r | (1ull << bit);
+        if (candidate * candidate * candidate <= n)
+            r = candidate;
+    }
+    return r;
+}
+
+static uint64_t min_u64(uint64_t a, uint64_t b)
+{
+    return a < b ? a : b;
+}
+
+static uint64_t max_u64(uint64_t a, uint64_t b)
+{
+    return a > b ? a : b;
+}
+
+#ifndef PRIME_COUNT_ALPHA
+static uint64_t default_alpha(uint64_t x)
+{
+    unsigned digits = 0;
+    for (; x >= 10; x /= 10)
+        ++digits;
+    return digits <= 10 ? 1 : digits - 9;
+}
+#endif /* !PRIME_COUNT_ALPHA */
+
+/*
+ * Run worker on num_items work items with num_threads() threads.
+ * Returns 1 on success, 0 on failure.
+ */
+static int run_workers(struct prime_count *pc, void *(*worker)(void *),
+                       uint64_t num_items)
+{
+    if (num_items == 0)
+        return 1;
+    pc->next_item = 0;
+    pc->num_items = num_items;
+    pc->committed = 0;
+    unsigned num = num_threads();
+    if (num > num_items)
+        num = num_items;
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 0;
+    }
+
+    unsigned started = 0;
+    for (; started < num; ++started)
+    {
+        int error = pthread_create(&threads[started], NULL, worker, pc);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            pthread_mutex_lock(&pc->lock);
+            pc->failed = 1;
+            pthread_cond_broadcast(&pc->advanced);
+            pthread_mutex_unlock(&pc->lock);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    return !pc->failed;
+}
+
+static void mark_failed(struct prime_count *pc)
+{
+    pthread_mutex_lock(&pc->lock);
+    pc->failed = 1;
+    pthread_cond_broadcast(&pc->advanced);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+/*
+ * Wait for the items before item to be committed, and lock. Returns 0 (and
+ * unlocks) if a thread failed.
+ */
+static int wait_turn(struct prime_count *pc, uint64_t item)
+{
+    pthread_mutex_lock(&pc->lock);
+    while (pc->committed != item && !pc->failed)
+        pthread_cond_wait(&pc->advanced, &pc->lock);
+    if (pc->failed)
+    {
+        pthread_mutex_unlock(&pc->lock);
+        return 0;
+    }
+    return 1;
+}
+
+static void end_turn(struct prime_count *pc)
+{
+    ++pc->committed;
+    pthread_cond_broadcast(&pc->advanced);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+static int next_item(struct prime_count *pc, uint64_t *item)
+{
+    *item = __atomic_fetch_add(&pc->next_item, 1, __ATOMIC_RELAXED);
+    return *item < pc->num_items
+           && !__atomic_load_n(&pc->failed, __ATOMIC_RELAXED);
+}
+
+/*
+ * Primes, π, least prime factors and Möbius function up to y
+ */
+static int setup_tables(struct prime_count *pc)
+{
+    size_t count = 0;
+    uint32_t *sieved = sieving_primes(pc->y, &count);
+    uint64_t size = pc->y + 1;
+    pc->primes = malloc((count + 4) * sizeof(uint32_t));
+    pc->pi = malloc(size * sizeof(uint32_t));
+    pc->lpf = calloc(size, sizeof(uint32_t));
+    pc->mu = malloc(size);
+    if (sieved == NULL || pc->primes == NULL || pc->pi == NULL
+        || pc->lpf == NULL || pc->mu == NULL)
+    {
+        LOG_ERROR("failed to allocate the prime count tables: %s",
+                  strerror(errno))
+        free(sieved);
+        return 0;
+    }
+
+    static const uint32_t FIRST_PRIMES[4] = { 1, 2, 3, 5 };
+    memcpy(pc->primes, FIRST_PRIMES, sizeof(FIRST_PRIMES));
+    memcpy(pc->primes + 4, sieved, count * sizeof(uint32_t));
+    free(sieved);
+    pc->a = count + 3;
+
+    memset(pc->mu, 1, size);
+    for (uint64_t i = 1; i <= pc->a; ++i)
+    {
+        uint64_t p = pc->primes[i];
+        for (uint64_t n = p; n <= pc->y; n += p)
+        {
+            if (pc->lpf[n] == 0)
+                pc->lpf[n] = p;
+            pc->mu[n] = -pc->mu[n];
+        }
+        for (uint64_t n = p * p; n <= pc->y; n += p * p)
+            pc->mu[n] = 0;
+    }
+    pc->lpf[1] = UINT32_MAX;
+
+    uint64_t i = 0;
+    for (uint64_t n = 0; n <= pc->y; ++n)
+    {
+        if (i < pc->a && pc->primes[i + 1] == n)
+            ++i;
+        pc->pi[n] = i;
+    }
+    pc->pi_sqrt_y = pc->pi[isqrt(pc->y)];
+    return 1;
+}
+
+/*
+ * Ordinary leaves : μ(n) φ(x / n, c) for the n <= y whose prime factors are
+ * all above the first c primes.
+ */
+static int64_t ordinary_leaves(const struct prime_count *pc)
+{
+    int64_t s1 = 0;
+    uint32_t last_tiny = pc->primes[PHI_TINY_C];
+    for (uint64_t n = 1; n <= pc->y; ++n)
+        if (pc->mu[n] != 0 && pc->lpf[n] > last_tiny)
+            s1 += pc->mu[n] * (int64_t)phi_tiny(pc->x / n);
+    return s1;
+}
+
+/*
+ * Special leaves -μ(m) φ(x / (p_b m), b - 1) of b > π(y^(1/2)) that do not
+ * need the sieve : m is a prime, and when x / (p_b m) < y, φ is 1 if
+ * x / (p_b m) < p_b, else π(x / (p_b m)) - b + 2. The consecutive m with the
+ * same π(x / (p_b m)) are counted at once.
+ */
+static int64_t easy_leaves(const struct prime_count *pc, uint64_t b)
+{
+    uint64_t x = pc->x;
+    uint64_t y = pc->y;
+    uint64_t p = pc->primes[b];
+    // the leaves of m <= x / (p y) are hard
+    uint64_t m_lo = max_u64(p, x / (p * y));
+    if (m_lo >= y)
+        return 0;
+
+    int64_t s2 = 0;
+    uint64_t m_hi = y;
+    uint64_t m_trivial = x / (p * p);
+    if (m_trivial < y)
+    {
+        m_hi = max_u64(m_lo, m_trivial);
+        s2 += pc->pi[y] - pc->pi[m_hi];
+    }
+    for (uint64_t l = pc->pi[m_lo] + 1; l <= pc->pi[m_hi];)
+    {
+        uint64_t k = pc->pi[x / (p * pc->primes[l])];
+        uint64_t last = min_u64(x / (p * pc->primes[k]), m_hi);
+        uint64_t end = pc->pi[last];
+        s2 += (int64_t)(k - b + 2) * (int64_t)(end - l + 1);
+        l = end + 1;
+    }
+    return s2;
+}
+
+static void *easy_leaves_worker(void *arg)
+{
+    struct prime_count *pc = arg;
+    uint64_t first = max_u64(pc->pi_sqrt_y, PHI_TINY_C) + 1;
+    uint64_t item;
+    while (next_item(pc, &item))
+    {
+        uint64_t b = first + item * EASY_LEAVES_B;
+        uint64_t end = min_u64(b + EASY_LEAVES_B, pc->a);
+        int64_t s2 = 0;
+        for (; b < end; ++b)
+            s2 += easy_leaves(pc, b);
+        __atomic_fetch_add(&pc->s2, s2, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/*
+ * Segment of the odd numbers low + 2i + 1 < high, without the multiples of
+ * the first PHI_TINY_C primes
+ */
+static void init_segment(struct leaves_worker *worker, uint64_t low,
+                         uint64_t high)
+{
+    uint64_t num_bits = (high - low) / 2;
+    size_t num_words = (LEAVES_SEGMENT_BITS + 63) / 64;
+    memset(worker->bits, 0xff, num_bits / 64 * sizeof(uint64_t));
+    memset(worker->bits + num_bits / 64, 0,
+           (num_words - num_bits / 64) * sizeof(uint64_t));
+    if (num_bits % 64 != 0)
+        worker->bits[num_bits / 64] = (1ull << (num_bits % 64)) - 1;
+
+    for (uint64_t p = 3; p <= 7; p += 2)
+    {
+        uint64_t n = max_u64(p, (low + p - 1) / p * p);
+        if (n % 2 == 0)
+            n += p;
+        for (; n < high; n += 2 * p)
+        {
+            uint64_t i = (n - low) / 2;
+            worker->bits[i / 64] &= ~(1ull << (i % 64));
+        }
+    }
+
+    worker->total = 0;
+    for (size_t c = 0; c < LEAVES_SEGMENT_BITS / COUNTER_BITS; ++c)
+    {
+        uint32_t count = 0;
+        const uint64_t *bits = worker->bits + c * (COUNTER_BITS / 64);
+        for (size_t w = 0; w < COUNTER_BITS / 64; ++w)
+            count += __builtin_popcountll(bits[w]);
+        worker->counters[c] = count;
+        worker->total += count;
+    }
+}
+
+static void cross_off(struct leaves_worker *worker, uint64_t p, uint64_t *next,
+                      uint64_t low, uint64_t high)
+{
+    uint64_t *bits = worker->bits;
+    uint32_t *counters = worker->counters;
+    uint64_t crossed = 0;
+    uint64_t n = *next;
+    for (; n < high; n += 2 * p)
+    {
+        uint64_t i = (n - low) / 2;
+        uint64_t bit = (bits[i / 64] >> (i % 64)) & 1;
+        bits[i / 64] &= ~(1ull << (i % 64));
+        counters[i / COUNTER_BITS] -= bit;
+        crossed += bit;
+    }
+    worker->total -= crossed;
+    *next = n;
+}
+
+/*
+ * Bits of the segment below t. The calls for one b have increasing t :
+ * *counter and *counted are the whole counters already summed.
+ */
+static uint64_t count_below(const struct leaves_worker *worker, uint64_t t,
+                            uint64_t *counter, uint64_t *counted)
+{
+    while ((*counter + 1) * COUNTER_BITS <= t)
+        *counted += worker->counters[(*counter)++];
+    uint64_t count = *counted;
+    uint64_t w = *counter * (COUNTER_BITS / 64);
+    for (; w < t / 64; ++w)
+        count += __builtin_popcountll(worker->bits[w]);
+    if (t % 64 != 0)
+        count +=
+            __builtin_popcountll(worker->bits[w] & ((1ull << (t % 64)) - 1));
+    return count;
+}
+
+/*
+ * Hard special leaves of a block of [1, z] : φ(x / (p_b m), b - 1) is the
+ * count of the sieve (crossed off with the primes before p_b) up to
+ * x / (p_b m). The counts start at the block, the caller adds the blocks
+ * before it.
+ */
+static int64_t hard_leaves(struct leaves_worker *worker, uint64_t block_lo,
+                           uint64_t block_hi)
+{
+    const struct prime_count *pc = worker->pc;
+    uint64_t x = pc->x;
+    uint64_t y = pc->y;
+    int64_t s2 = 0;
+    for (uint64_t b = PHI_TINY_C + 1; b < pc->num_hard; ++b)
+    {
+        uint64_t p = pc->primes[b];
+        uint64_t n = max_u64(p, (block_lo + p - 1) / p * p);
+        worker->next[b] = n % 2 == 0 ? n + p : n;
+        worker->phi[b] = 0;
+        worker->mu_sum[b] = 0;
+    }
+
+    uint64_t segment = 2 * LEAVES_SEGMENT_BITS;
+    for (uint64_t low = block_lo; low < block_hi; low += segment)
+    {
+        uint64_t high = min_u64(low + segment, block_hi);
+        init_segment(worker, low, high);
+
+        for (uint64_t b = PHI_TINY_C + 1; b < pc->num_hard; ++b)
+        {
+            uint64_t p = pc->primes[b];
+            uint64_t min_m = x / (p * high);
+            uint64_t max_m = low == 0 ? y : min_u64(x / (p * low), y);
+            if (b > pc->pi_sqrt_y)
+            {
+                min_m = max_u64(min_m, p);
+                max_m = min_u64(max_m, x / (p * y));
+            }
+            else
+                min_m = max_u64(min_m, y / p);
+            if (p >= max_m)
+                break;
+
+            uint64_t counter = 0;
+            uint64_t counted = 0;
+            if (b <= pc->pi_sqrt_y)
+            {
+                for (uint64_t m = max_m; m > min_m; --m)
+                {
+                    if (pc->mu[m] == 0 || pc->lpf[m] <= p)
+                        continue;
+                    uint64_t t = (x / (p * m) - low + 1) / 2;
+                    int64_t count = count_below(worker, t, &counter, &counted);
+                    s2 -= pc->mu[m] * (worker->phi[b] + count);
+                    worker->mu_sum[b] += pc->mu[m];
+                }
+            }
+            else if (min_m < max_m)
+            {
+                for (uint64_t l = pc->pi[max_m]; l > pc->pi[min_m]; --l)
+                {
+                    uint64_t m = pc->primes[l];
+                    uint64_t t = (x / (p * m) - low + 1) / 2;
+                    s2 += worker->phi[b]
+                          + count_below(worker, t, &counter, &counted);
+                    --worker->mu_sum[b];
+                }
+            }
+
+            worker->phi[b] += worker->total;
+            cross_off(worker, p, &worker->next[b], low, high);
+        }
+    }
+    return s2;
+}
+
+static void *hard_leaves_worker(void *arg)
+{
+    struct prime_count *pc = arg;
+    struct leaves_worker worker = { .pc = pc };
+    worker.bits = malloc((LEAVES_SEGMENT_BITS + 63) / 64 * sizeof(uint64_t));
+    worker.counters =
+        malloc(LEAVES_SEGMENT_BITS / COUNTER_BITS * sizeof(uint32_t));
+    worker.next = malloc(pc->num_hard * sizeof(uint64_t));
+    worker.phi = malloc(pc->num_hard * sizeof(int64_t));
+    worker.mu_sum = malloc(pc->num_hard * sizeof(int64_t));
+    if (worker.bits == NULL || worker.counters == NULL || worker.next == NULL
+        || worker.phi == NULL || worker.mu_sum == NULL)
+    {
+        LOG_ERROR("failed to allocate leaves worker: %s", strerror(errno))
+        mark_failed(pc);
+        goto HardLeavesEnd;
+    }
+
+    uint64_t item;
+    while (next_item(pc, &item))
+    {
+        uint64_t block_lo = item * pc->block_size;
+        uint64_t block_hi = min_u64(block_lo + pc->block_size, pc->z + 1);
+        int64_t s2 = hard_leaves(&worker, block_lo, block_hi);
+
+        if (!wait_turn(pc, item))
+            break;
+        pc->s2 += s2;
+        for (uint64_t b = PHI_TINY_C + 1; b < pc->num_hard; ++b)
+        {
+            pc->s2 -= worker.mu_sum[b] * pc->phi[b];
+            pc->phi[b] += worker.phi[b];
+        }
+        end_turn(pc);
+    }
+
+HardLeavesEnd:
+    free(worker.bits);
+    free(worker.counters);
+    free(worker.next);
+    free(worker.phi);
+    free(worker.mu_sum);
+    return NULL;
+}
+
+/*
+ * Odd numbers of [lo, hi) that are composite : composite[j] is the number
+ * (lo | 1) + 2j. Needs the primes up to hi^(1/2). Returns the count of odd
+ * numbers.
+ */
+static uint64_t sieve_odd(const struct prime_count *pc, uint64_t lo,
+                          uint64_t hi, uint8_t *composite)
+{
+    uint64_t first = lo | 1;
+    if (hi <= first)
+        return 0;
+    uint64_t count = (hi - first + 1) / 2;
+    memset(composite, 0, count);
+    for (uint64_t i = 2; i <= pc->a; ++i)
+    {
+        uint64_t p = pc->primes[i];
+        if (p * p >= hi)
+            break;
+        uint64_t n = max_u64(p * p, (first + p - 1) / p * p);
+        if (n % 2 == 0)
+            n += p;
+        for (; n < hi; n += 2 * p)
+            composite[(n - first) / 2] = 1;
+    }
+    return count;
+}
+
+/*
+ * P2 over a block [lo, hi) of the values x / p : the sum of the primes
+ * in [lo, x / p] for the primes y < p <= x^(1/2) with x / p in the block.
+ */
+static void p2_block(struct p2_worker *worker, uint64_t lo, uint64_t hi,
+                     int64_t *sum, int64_t *num_p, int64_t *block_primes)
+{
+    const struct prime_count *pc = worker->pc;
+    uint64_t x = pc->x;
+    uint64_t num_v = sieve_odd(pc, lo, hi, worker->composite);
+    uint64_t first_v = lo | 1;
+
+    uint64_t p_lo = max_u64(x / hi + 1, pc->y + 1);
+    uint64_t p_hi = min_u64(x / lo, isqrt(x));
+    uint64_t num_candidates = 0;
+    if (p_lo <= p_hi)
+        num_candidates = sieve_odd(pc, p_lo, p_hi + 1, worker->composite_p);
+    uint64_t first_p = p_lo | 1;
+
+    *sum = 0;
+    *num_p = 0;
+    uint64_t j = 0;
+    int64_t count = 0;
+    for (uint64_t k = num_candidates; k-- > 0;)
+    {
+        if (worker->composite_p[k])
+            continue;
+        uint64_t v = x / (first_p + 2 * k);
+        for (; j < num_v && first_v + 2 * j <= v; ++j)
+            count += !worker->composite[j];
+        *sum += count;
+        ++*num_p;
+    }
+    for (; j < num_v; ++j)
+        count += !worker->composite[j];
+    *block_primes = count;
+}
+
+static void *p2_worker(void *arg)
+{
+    struct prime_count *pc = arg;
+    struct p2_worker worker = { .pc = pc };
+    worker.composite = malloc(P2_BLOCK_SIZE / 2 + 64);
+    worker.composite_p = malloc(P2_BLOCK_SIZE / 2 + 64);
+    if (worker.composite == NULL || worker.composite_p == NULL)
+    {
+        LOG_ERROR("failed to allocate P2 worker: %s", strerror(errno))
+        mark_failed(pc);
+        goto P2WorkerEnd;
+    }
+
+    uint64_t item;
+    while (next_item(pc, &item))
+    {
+        uint64_t lo = pc->v_lo + item * P2_BLOCK_SIZE;
+        uint64_t hi = min_u64(lo + P2_BLOCK_SIZE, pc->v_hi + 1);
+        int64_t sum;
+        int64_t num_p;
+        int64_t block_primes;
+        p2_block(&worker, lo, hi, &sum, &num_p, &block_primes);
+
+        if (!wait_turn(pc, item))
+            break;
+        pc->p2_sum += sum + num_p * pc->p2_primes;
+        pc->p2_primes += block_primes;
+        end_turn(pc);
+    }
+
+P2WorkerEnd:
+    free(worker.composite);
+    free(worker.composite_p);
+    return NULL;
+}
+
+/*
+ * P2(x, a) = sum of π(x / p_b) - (b - 1) over a < b <= π(x^(1/2))
+ */
+static int p2(struct prime_count *pc, int64_t *result)
+{
+    uint64_t root = isqrt(pc->x);
+    pc->v_lo = root;
+    pc->v_hi = pc->x / (pc->y + 1);
+    long below = sieve_range(0, root - 1, NULL);
+    if (below == -1)
+        return 0;
+    pc->p2_primes = below;
+    pc->p2_sum = 0;
+    if (!run_workers(pc, &p2_worker, (pc->v_hi - pc->v_lo) / P2_BLOCK_SIZE + 1))
+        return 0;
+
+    int64_t b = below;
+    int root_is_prime = 1;
+    for (uint64_t i = 1; i <= pc->a; ++i)
+    {
+        uint64_t p = pc->primes[i];
+        if (p * p > root)
+            break;
+        if (root % p == 0)
+            root_is_prime = 0;
+    }
+    b += root_is_prime;
+    int64_t a = pc->a;
+    *result = pc->p2_sum - (b * (b - 1) - a * (a - 1)) / 2;
+    return 1;
+}
+
+long prime_count(uint64_t x)
+{
+    if (x > PRIME_COUNT_MAX)
+    {
+        LOG_ERROR("π(x) is limited to x <= 2^62")
+        return -1;
+    }
+    if (x < PRIME_COUNT_SIEVE_LIMIT)
+        return sieve_range(0, x, NULL);
+    pthread_once(&phi_tiny_once, &setup_phi_tiny);
+
+    struct prime_count pc = { .x = x };
+    uint64_t root = isqrt(x);
+    pc.y = icbrt(x) * ALPHA(x);
+    if (pc.y >= root)
+        pc.y = root - 1;
+    pc.z = x / pc.y;
+    long result = -1;
+    pthread_mutex_init(&pc.lock, NULL);
+    pthread_cond_init(&pc.advanced, NULL);
+    if (!setup_tables(&pc))
+        goto PrimeCountEnd;
+
+    // the hard leaves of b > π(y^(1/2)) need p_b^2 < x / y
+    pc.num_hard = pc.pi_sqrt_y + 1;
+    while (pc.num_hard < pc.a
+           && (uint64_t)pc.primes[pc.num_hard] * pc.primes[pc.num_hard] < pc.z)
+        ++pc.num_hard;
+    pc.phi = calloc(pc.num_hard, sizeof(int64_t));
+    if (pc.phi == NULL)
+    {
+        LOG_ERROR("failed to allocate the prime count tables: %s",
+                  strerror(errno))
+        goto PrimeCountEnd;
+    }
+
+    // a few blocks per thread, as the leaves are denser in the first ones
+    uint64_t segment = 2 * LEAVES_SEGMENT_BITS;
+    uint64_t num_segments = pc.z / segment + 1;
+    uint64_t num_blocks = num_threads() == 1 ? 1 : 8 * num_threads();
+    if (num_blocks > num_segments)
+        num_blocks = num_segments;
+    pc.block_size = (num_segments + num_blocks - 1) / num_blocks * segment;
+
+    LOG_INFO("π(%lu): y = %lu, a = %lu, %lu hard b, %lu block(s)",
+             (unsigned long)x, (unsigned long)pc.y, (unsigned long)pc.a,
+             (unsigned long)pc.num_hard, (unsigned long)num_blocks)
+    int64_t s1 = ordinary_leaves(&pc);
+    uint64_t first_easy = max_u64(pc.pi_sqrt_y, PHI_TINY_C) + 1;
+    uint64_t num_easy = pc.a > first_easy ? pc.a - first_easy : 0;
+    int64_t p2_value;
+    if (!run_workers(&pc, &easy_leaves_worker,
+                     (num_easy + EASY_LEAVES_B - 1) / EASY_LEAVES_B)
+        || !run_workers(&pc, &hard_leaves_worker,
+                        (pc.z + 1 + pc.block_size - 1) / pc.block_size)
+        || !p2(&pc, &p2_value))
+        goto PrimeCountEnd;
+    LOG_DEBUG("S1 = %ld, S2 = %ld, P2 = %ld", (long)s1, (long)pc.s2,
+              (long)p2_value)
+    result = s1 + pc.s2 + (long)pc.a - 1 - p2_value;
+
+PrimeCountEnd:
+    pthread_cond_destroy(&pc.advanced);
+    pthread_mutex_destroy(&pc.lock);
+    free(pc.primes);
+    free(pc.pi);
+    free(pc.lpf);
+    free(pc.mu);
+    free(pc.phi);
+    return result;
+}
@@ -0,0 +1,20 @@
+#ifndef PRIME_COUNT_H
+#define PRIME_COUNT_H
+
+#include <stdint.h>
+
+// Largest x accepted by prime_count()
+#define PRIME_COUNT_MAX (1ull << 62)
+
+/*
+ * π(x), the number of primes <= x, with the Lagarias-Miller-Odlyzko
+ * algorithm : π(x) = φ(x, a) + a - 1 - P2(x, a), a = π(y), y ~ x^(1/3).
+ * The special leaves of φ are computed with a segmented sieve of [1, x / y]
+ * (or with a table of π(n), n <= y, when they are easy), and both the
+ * special leaves and P2 are shared between num_threads() threads.
+ * Uses O(y) memory. Small x are sieved instead.
+ * Returns -1 on failure.
+ */
+long prime_count(uint64_t x);
+
+#endif /* !PRIME_COUNT_H */
@@ -0,0 +1,587 @@
+#include "proth.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/lucas.h"
+#include "primes/miller_rabin.h"
+#include "primes/primality_test.h"
+#include "primes/small_primes.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+#include "utils/threads.h"
+
+// Number of k sieved at once (one segment per thread at a time)
+#ifndef PROTH_SIEVE_WINDOW
+#    define PROTH_SIEVE_WINDOW (1u << 18)
+#endif /* !PROTH_SIEVE_WINDOW */
+
+// Below this size, the generic primality test is used
+#define PROTH_MIN_BITS 32
+
+// From this size on, the squarings are reduced with the form of N rather
+// than in Montgomery form (below, OpenSSL's Montgomery code is faster)
+#ifndef PROTH_REDUCE_MIN_BITS
+#    define PROTH_REDUCE_MIN_BITS 3072
+#endif /* !PROTH_REDUCE_MIN_BITS */
+
+// Largest parameter tried when looking for a Jacobi symbol of -1
+#define PROTH_MAX_PARAMETER 1000
+
+struct proth_sieve
+{
+    unsigned n;
+    int sign;
+    uint64_t k_min;
+    uint64_t k_max;
+    // k = target (mod prime) iff prime divides k * 2^n + sign
+    const uint32_t *primes;
+    uint32_t *targets;
+    // k such that k * 2^n + sign is the prime itself (0 if none)
+    uint64_t *self;
+    size_t num_primes;
+    uint64_t num_segments;
+    // next segment to sieve, and next segment to print
+    uint64_t next_segment;
+    uint64_t printed_segment;
+    long found;
+    int failed;
+    FILE *out;
+    pthread_mutex_t lock;
+    pthread_cond_t printed;
+};
+
+// 2^n mod p
+static uint64_t pow2_mod(unsigned n, uint64_t p)
+{
+    uint64_t result = 1;
+    uint64_t base = 2 % p;
+    for (; n != 0; n >>= 1)
+    {
+        if (n & 1)
+            result = result * base % p;
+        base = base * base % p;
+    }
+    return result;
+}
+
+/*
+ * k * 2^n + sign = 0 (mod p) iff k = -sign * (2^n)^-1 (mod p) : one
+ * exponentiation per prime, then every p-th k is composite.
+ */
+static int setup_sieve(struct proth_sieve *sieve)
+{
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    // 2 never divides k * 2^n +- 1 (n >= 1)
+    sieve->primes = primes + 1;
+    sieve->num_primes = count - 1;
+    sieve->targets = calloc(sieve->num_primes, sizeof(uint32_t));
+    sieve->self = calloc(sieve->num_primes, sizeof(uint64_t));
+    if (sieve->targets == NULL || sieve->self == NULL)
+    {
+        LOG_ERROR("failed to allocate sieve: %s", strerror(errno))
+        return 0;
+    }
+
+    for (size_t i = 0; i < sieve->num_primes; ++i)
+    {
+        uint64_t p = sieve->primes[i];
+        uint32_t inverse = small_prime_inverse(pow2_mod(sieve->n, p), p);
+        sieve->targets[i] = sieve->sign > 0 ? (p - inverse) % p : inverse;
+
+        uint64_t base = p - sieve->sign;
+        if (sieve->n < 32 && base % (1ull << sieve->n) == 0)
+            sieve->self[i] = base >> sieve->n;
+    }
+
+    return 1;
+}
+
+static void sieve_segment(struct proth_sieve *sieve, uint64_t lo, uint64_t hi,
+                          unsigned char *composite)
+{
+    STATS_TIMER_START(sieve_timer)
+    memset(composite, 0, hi - lo + 1);
+    for (size_t i = 0; i < sieve->num_primes; ++i)
+    {
+        uint64_t p = sieve->primes[i];
+        // offsets from lo, so that nothing wraps when hi is close to 2^64
+        uint64_t offset = (sieve->targets[i] + p - lo % p) % p;
+        for (; offset <= hi - lo; offset += p)
+            if (lo + offset != sieve->self[i])
+                composite[offset] = 1;
+    }
+    STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, sieve_timer)
+}
+
+/*
+ * Move the powers of 2 of k to n. Returns 1 if k < 2^n afterwards (the
+ * special-form tests apply).
+ */
+static int normalize(uint64_t *k, unsigned *n)
+{
+    while (*k != 0 && *k % 2 == 0)
+    {
+        *k /= 2;
+        ++*n;
+    }
+    return *n >= 64 || (*k >> *n) == 0;
+}
+
+/*
+ * x mod N for N = k * 2^n + sign and 0 <= x : with x = h * 2^n + l and
+ * h = q * k + r, x = r * 2^n + l - sign * q (mod N). Each step is a shift,
+ * a division by the word k and two additions, instead of a multiplication
+ * by N as in Montgomery form. tmp is overwritten.
+ */
+static int reduce_special(BIGNUM *x, BN_ULONG k, unsigned n, int sign,
+                          const BIGNUM *N, BIGNUM *tmp)
+{
+    // below 2^(n + bits(k) + 1) < 4 * N, a few subtractions of N finish
+    int max_bits = n + BN_num_bits_word(k) + 1;
+    while (!BN_is_negative(x) && BN_num_bits(x) > max_bits)
+    {
+        if (!BN_rshift(tmp, x, n) || !BN_mask_bits(x, n))
+            return 0;
+        BN_ULONG r = BN_div_word(tmp, k);
+        if (r == (BN_ULONG)-1)
+            return 0;
+        if (!(sign > 0 ? BN_sub(x, x, tmp) : BN_add(x, x, tmp))
+            || !BN_set_word(tmp, r) || !BN_lshift(tmp, tmp, n)
+            || !BN_add(x, x, tmp))
+            return 0;
+    }
+    while (BN_is_negative(x))
+        if (!BN_add(x, x, N))
+            return 0;
+    while (BN_ucmp(x, N) >= 0)
+        if (!BN_sub(x, x, N))
+            return 0;
+    return 1;
+}
+
+// Whether the squarings mod N = k * 2^n +- 1 go through reduce_special()
+static int use_special(const BIGNUM *N, uint64_t k)
+{
+    return BN_num_bits(N) >= PROTH_REDUCE_MIN_BITS && (BN_ULONG)k == k;
+}
+
+static int generic_check(const BIGNUM *N, BN_CTX *ctx)
+{
+    unsigned num_tests = estimate_num_tests(BN_num_bits(N));
+    return primality_test((BIGNUM *)N, num_tests, ctx);
+}
+
+/*
+ * Smallest a (a prime) such that the Jacobi symbol (a / N) is -1. Returns
+ * 1 if found, 0 if N is shown composite, and 2 if N is a perfect square
+ * candidate (no such a below PROTH_MAX_PARAMETER).
+ */
+static int proth_witness(const BIGNUM *N, BN_ULONG *witness, BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *a = BN_CTX_get(ctx);
+    int result = -1;
+    if (a == NULL)
+        goto ProthWitnessEnd;
+
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    result = 2;
+    for (size_t i = 1; i < count && primes[i] < PROTH_MAX_PARAMETER; ++i)
+    {
+        if (!BN_set_word(a, primes[i]))
+        {
+            result = -1;
+            break;
+        }
+        int symbol = BN_kronecker(a, N, ctx);
+        if (symbol == -2)
+        {
+            result = -1;
+            break;
+        }
+        if (symbol != 1)
+        {
+            // (a / N) = 0 : a divides N (and N > a)
+            result = symbol == -1;
+            *witness = primes[i];
+            break;
+        }
+    }
+
+ProthWitnessEnd:
+    BN_CTX_end(ctx);
+    return result;
+}
+
+/*
+ * Proth's theorem : N = k * 2^n + 1 with k < 2^n is prime iff
+ * a^((N - 1) / 2) = -1 (mod N) for some a. When (a / N) = -1, every prime N
+ * passes with that a, so one exponentiation decides. a^k is computed first
+ * (a is a single word), then squared n - 1 times, in Montgomery form or
+ * reduced with reduce_special() for large N.
+ */
+int proth_check(const BIGNUM *N, uint64_t k, unsigned n, BN_CTX *ctx)
+{
+    STATS_ADD(STATS_PRIMALITY_TESTS, 1)
+    if (!normalize(&k, &n) || BN_num_bits(N) <= PROTH_MIN_BITS)
+        return generic_check(N, ctx);
+
+    BN_ULONG a = 0;
+    int result = proth_witness(N, &a, ctx);
+    if (result == 2)
+        result = bn_is_perfect_square(N, ctx) == 1 ? 0 : generic_check(N, ctx);
+    if (result != 1)
+        return result;
+
+    result = -1;
+    BN_MONT_CTX *mont = BN_MONT_CTX_new();
+    BN_CTX_start(ctx);
+    BIGNUM *y = BN_CTX_get(ctx);
+    BIGNUM *exponent = BN_CTX_get(ctx);
+    BIGNUM *minus_one = BN_CTX_get(ctx);
+    BIGNUM *tmp = BN_CTX_get(ctx);
+    if (mont == NULL || tmp == NULL || !BN_MONT_CTX_set(mont, N, ctx)
+        || !BN_set_word(exponent, k) || !BN_sub(minus_one, N, BN_value_one()))
+        goto ProthCheckEnd;
+
+    STATS_TIMER_START(modexp_timer)
+    int success = BN_mod_exp_mont_word(y, a, exponent, N, ctx, mont);
+    if (use_special(N, k))
+        for (unsigned i = 1; i < n && success; ++i)
+            success = BN_sqr(y, y, ctx) && reduce_special(y, k, n, 1, N, tmp);
+    else
+    {
+        success = success && BN_to_montgomery(y, y, mont, ctx);
+        for (unsigned i = 1; i < n && success; ++i)
+            success = BN_mod_mul_montgomery(y, y, y, mont, ctx);
+        success = success && BN_from_montgomery(y, y, mont, ctx);
+    }
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, modexp_timer)
+    if (success)
+        result = BN_cmp(y, minus_one) == 0;
+
+ProthCheckEnd:
+    if (result == -1)
+        LOG_ERROR("proth test: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+    BN_MONT_CTX_free(mont);
+    return result;
+}
+
+/*
+ * Rodseth's method : smallest P such that ((P - 2) / N) = 1 and
+ * ((P + 2) / N) = -1. Same return values as proth_witness.
+ */
+static int riesel_parameter(const BIGNUM *N, BN_ULONG *parameter, BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *a = BN_CTX_get(ctx);
+    int result = -1;
+    if (a == NULL)
+        goto RieselParameterEnd;
+
+    result = 2;
+    for (BN_ULONG P = 3; P < PROTH_MAX_PARAMETER; ++P)
+    {
+        int minus = BN_set_word(a, P - 2) ? BN_kronecker(a, N, ctx) : -2;
+        int plus = BN_set_word(a, P + 2) ? BN_kronecker(a, N, ctx) : -2;
+        if (minus == -2 || plus == -2)
+        {
+            result = -1;
+            break;
+        }
+        if (minus == 0 || plus == 0)
+        {
+            result = 0;
+            break;
+        }
+        if (minus == 1 && plus == -1)
+        {
+            result = 1;
+            *parameter = P;
+            break;
+        }
+    }
+
+RieselParameterEnd:
+    BN_CTX_end(ctx);
+    return result;
+}
+
+/*
+ * v = V_k(P, 1) mod N, with the doubling formulas
+ * V_2m = V_m^2 - 2 and V_2m+1 = V_m * V_m+1 - P
+ */
+static int lucas_v(BIGNUM *v, uint64_t k, BN_ULONG P, const BIGNUM *N,
+                   BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *next = BN_CTX_get(ctx);
+    BIGNUM *bn_p = BN_CTX_get(ctx);
+    BIGNUM *two = BN_CTX_get(ctx);
+    int success = two != NULL && BN_set_word(bn_p, P) && BN_set_word(two, 2)
+        && BN_set_word(v, 2) && BN_set_word(next, P);
+
+    // (v, next) = (V_m, V_m+1)
+    for (int bit = 63; bit >= 0 && success; --bit)
+    {
+        if ((k >> bit) & 1)
+            success = BN_mod_mul(v, v, next, N, ctx)
+                && BN_mod_sub(v, v, bn_p, N, ctx)
+                && BN_mod_sqr(next, next, N, ctx)
+                && BN_mod_sub(next, next, two, N, ctx);
+        else
+            success = BN_mod_mul(next, v, next, N, ctx)
+                && BN_mod_sub(next, next, bn_p, N, ctx)
+                && BN_mod_sqr(v, v, N, ctx) && BN_mod_sub(v, v, two, N, ctx);
+    }
+
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * Lucas-Lehmer-Riesel : N = k * 2^n - 1 with k < 2^n is prime iff
+ * u_(n-2) = 0 (mod N), where u_0 = V_k(P, 1) and u_(i+1) = u_i^2 - 2.
+ */
+int riesel_check(const BIGNUM *N, uint64_t k, unsigned n, BN_CTX *ctx)
+{
+    STATS_ADD(STATS_PRIMALITY_TESTS, 1)
+    if (!normalize(&k, &n) || BN_num_bits(N) <= PROTH_MIN_BITS)
+        return generic_check(N, ctx);
+
+    BN_ULONG P = 0;
+    int result = riesel_parameter(N, &P, ctx);
+    if (result == 2)
+        result = bn_is_perfect_square(N, ctx) == 1 ? 0 : generic_check(N, ctx);
+    if (result != 1)
+        return result;
+
+    result = -1;
+    BN_MONT_CTX *mont = BN_MONT_CTX_new();
+    BN_CTX_start(ctx);
+    BIGNUM *u = BN_CTX_get(ctx);
+    BIGNUM *two = BN_CTX_get(ctx);
+    BIGNUM *tmp = BN_CTX_get(ctx);
+    int special = use_special(N, k);
+    if (mont == NULL || tmp == NULL || !BN_set_word(two, 2))
+        goto RieselCheckEnd;
+    if (!special
+        && (!BN_MONT_CTX_set(mont, N, ctx)
+            || !BN_to_montgomery(two, two, mont, ctx)))
+        goto RieselCheckEnd;
+
+    STATS_TIMER_START(modexp_timer)
+    int success = lucas_v(u, k, P, N, ctx);
+    if (special)
+        for (unsigned i = 2; i < n && success; ++i)
+            success = BN_sqr(u, u, ctx) && reduce_special(u, k, n, -1, N, tmp)
+                && BN_mod_sub_quick(u, u, two, N);
+    else
+    {
+        success = success && BN_to_montgomery(u, u, mont, ctx);
+        for (unsigned i = 2; i < n && success; ++i)
+            success = BN_mod_mul_montgomery(u, u, u, mont, ctx)
+                && BN_mod_sub_quick(u, u, two, N);
+    }
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, modexp_timer)
+    if (success)
+        result = BN_is_zero(u);
+
+RieselCheckEnd:
+    if (result == -1)
+        LOG_ERROR("lucas-lehmer-riesel test: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+    BN_MONT_CTX_free(mont);
+    return result;
+}
+
+static void mark_failed(struct proth_sieve *sieve)
+{
+    pthread_mutex_lock(&sieve->lock);
+    sieve->failed = 1;
+    pthread_cond_broadcast(&sieve->printed);
+    pthread_mutex_unlock(&sieve->lock);
+}
+
+/*
+ * Segments are tested in any order, but printed in order : a thread waits
+ * for the previous segments to be printed before printing its own.
+ */
+static int print_segment(struct proth_sieve *sieve, uint64_t segment,
+                         const uint64_t *found, size_t num_found)
+{
+    pthread_mutex_lock(&sieve->lock);
+    while (sieve->printed_segment != segment && !sieve->failed)
+        pthread_cond_wait(&sieve->printed, &sieve->lock);
+
+    int success = !sieve->failed;
+    for (size_t i = 0; i < num_found && success; ++i)
+        success = fprintf(sieve->out, "%lu*2^%u%c1\n", (unsigned long)found[i],
+                          sieve->n, sieve->sign > 0 ? '+' : '-')
+            > 0;
+    if (success)
+        fflush(sieve->out);
+    sieve->found += num_found;
+    ++sieve->printed_segment;
+    pthread_cond_broadcast(&sieve->printed);
+    pthread_mutex_unlock(&sieve->lock);
+
+    return success;
+}
+
+static void *proth_worker(void *arg)
+{
+    struct proth_sieve *sieve = arg;
+
+    unsigned char *composite = malloc(PROTH_SIEVE_WINDOW);
+    size_t found_size = 64;
+    uint64_t *found = malloc(found_size * sizeof(uint64_t));
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *N = BN_new();
+    if (composite == NULL || found == NULL || ctx == NULL || N == NULL)
+    {
+        LOG_ERROR("failed to allocate proth worker")
+        goto ProthWorkerFailed;
+    }
+
+    for (;;)
+    {
+        uint64_t segment =
+            __atomic_fetch_add(&sieve->next_segment, 1, __ATOMIC_RELAXED);
+        if (segment >= sieve->num_segments
+            || __atomic_load_n(&sieve->failed, __ATOMIC_RELAXED))
+            break;
+
+        uint64_t lo = sieve->k_min + segment * PROTH_SIEVE_WINDOW;
+        uint64_t hi = sieve->k_max - lo < PROTH_SIEVE_WINDOW - 1
+            ? sieve->k_max
+            : lo + PROTH_SIEVE_WINDOW - 1;
+        sieve_segment(sieve, lo, hi, composite);
+        STATS_ADD(STATS_CANDIDATES, hi - lo + 1)
+
+        size_t num_found = 0;
+        for (uint64_t offset = 0; offset <= hi - lo; ++offset)
+        {
+            if (composite[offset])
+                continue;
+            uint64_t k = lo + offset;
+
+            // N = k * 2^n + sign
+            int success = BN_set_word(N, k) && BN_lshift(N, N, sieve->n)
+                && (sieve->sign > 0 ? BN_add_word(N, 1) : BN_sub_word(N, 1));
+            if (!success)
+                goto ProthWorkerFailed;
+            success = sieve->sign > 0 ? proth_check(N, k, sieve->n, ctx)
+                                      : riesel_check(N, k, sieve->n, ctx);
+            if (success == -1)
+                goto ProthWorkerFailed;
+            if (!success)
+                continue;
+
+            if (num_found == found_size)
+            {
+                uint64_t *bigger =
+                    realloc(found, 2 * found_size * sizeof(uint64_t));
+                if (bigger == NULL)
+                    goto ProthWorkerFailed;
+                found = bigger;
+                found_size *= 2;
+            }
+            found[num_found++] = k;
+        }
+
+        if (!print_segment(sieve, segment, found, num_found))
+            goto ProthWorkerFailed;
+    }
+
+    free(composite);
+    free(found);
+    BN_CTX_free(ctx);
+    BN_free(N);
+    return NULL;
+
+ProthWorkerFailed:
+    LOG_ERROR("proth worker failed: %s", OPENSSL_ERR_STRING)
+    mark_failed(sieve);
+    free(composite);
+    free(found);
+    BN_CTX_free(ctx);
+    BN_free(N);
+    return NULL;
+}
+
+long proth_search(unsigned n, uint64_t k_min, uint64_t k_max, int sign,
+                  FILE *out)
+{
+    if (n == 0 || k_min == 0 || k_min > k_max || (sign != 1 && sign != -1))
+    {
+        LOG_ERROR("Invalid search: k in [%lu, %lu], n = %u",
+                  (unsigned long)k_min, (unsigned long)k_max, n)
+        return -1;
+    }
+
+    struct proth_sieve sieve = {
+        .n = n,
+        .sign = sign,
+        .k_min = k_min,
+        .k_max = k_max,
+        .num_segments = (k_max - k_min) / PROTH_SIEVE_WINDOW + 1,
+        .next_segment = 0,
+        .printed_segment = 0,
+        .found = 0,
+        .failed = 0,
+        .out = out,
+    };
+    long result = -1;
+    pthread_t *threads = NULL;
+    if (!setup_sieve(&sieve))
+        goto ProthSearchEnd;
+
+    unsigned num = num_threads();
+    if (num > sieve.num_segments)
+        num = sieve.num_segments;
+    threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        goto ProthSearchEnd;
+    }
+    pthread_mutex_init(&sieve.lock, NULL);
+    pthread_cond_init(&sieve.printed, NULL);
+
+    LOG_INFO("Searching k*2^%u%c1 for k in [%lu, %lu] with %u thread(s)", n,
+             sign > 0 ? '+' : '-', (unsigned long)k_min, (unsigned long)k_max,
+             num);
+    unsigned started = 0;
+    for (; started < num; ++started)
+    {
+        int error =
+            pthread_create(&threads[started], NULL, &proth_worker, &sieve);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            mark_failed(&sieve);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&sieve.printed);
+    pthread_mutex_destroy(&sieve.lock);
+    if (!sieve.failed)
+        result = sieve.found;
+
+ProthSearchEnd:
+    free(threads);
+    free(sieve.targets);
+    free(sieve.self);
+    return result;
+}
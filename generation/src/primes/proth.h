@@ -0,0 +1,31 @@
+#ifndef PROTH_H
+#define PROTH_H
+
+#include <openssl/bn.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Search the primes k * 2^n + sign (sign is 1 or -1) for k in
+ * [k_min, k_max]. The whole k range is sieved at once, and the survivors
+ * are tested on num_threads() threads : with Proth's theorem for
+ * k * 2^n + 1, and with the Lucas-Lehmer-Riesel test for k * 2^n - 1. The
+ * primes found are written to 'out' ("k*2^n+1", in increasing k order).
+ * Returns the number of primes found, or -1 on failure.
+ */
+long proth_search(unsigned n, uint64_t k_min, uint64_t k_max, int sign,
+                  FILE *out);
+
+/*
+ * Primality test of N = k * 2^n + 1. The answer is proven when k < 2^n
+ * (once the powers of 2 of k are moved to n), and probable otherwise.
+ * Returns 1 if N is prime, 0 if it is composite and -1 on failure.
+ */
+int proth_check(const BIGNUM *N, uint64_t k, unsigned n, BN_CTX *ctx);
+
+/*
+ * Same for N = k * 2^n - 1 (Lucas-Lehmer-Riesel test)
+ */
+int riesel_check(const BIGNUM *N, uint64_t k, unsigned n, BN_CTX *ctx);
+
+#endif /* !PROTH_H */
@@ -0,0 +1,276 @@
+#include "provable.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/preliminary.h"
+#include "random/random.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+
+// Below this length, primes are proven by trial division
+#define PROVABLE_BASE_LENGTH 32
+// Witnesses tried before giving up on a candidate that looks prime
+#define POCKLINGTON_MAX_WITNESS 32
+
+static int is_prime_word(unsigned long n)
+{
+    if (n < 2)
+        return 0;
+    if (n < 4)
+        return 1;
+    if (n % 2 == 0)
+        return 0;
+    for (unsigned long d = 3; d * d <= n; d += 2)
+        if (n % d == 0)
+            return 0;
+    return 1;
+}
+
+/*
+ * Random prime of 'length' bits (length <= PROVABLE_BASE_LENGTH)
+ */
+static BIGNUM *generate_small_prime(unsigned length)
+{
+    unsigned long top = 1ul << (length - 1);
+    unsigned long candidate;
+    do
+    {
+        candidate = ((unsigned long)random_int() & (top - 1)) | top;
+        // 2 is the only even prime (and a 2-bits one)
+        if (length > 2)
+            candidate |= 1;
+    } while (!is_prime_word(candidate));
+
+    BIGNUM *p = BN_secure_new();
+    if (p == NULL || !BN_set_word(p, candidate))
+    {
+        LOG_ERROR("failed to set small prime: %s", OPENSSL_ERR_STRING)
+        BN_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static int add_step(struct prime_certificate *certificate, BIGNUM *p,
+                    BIGNUM *q, BIGNUM *r, BN_ULONG a)
+{
+    if (certificate == NULL)
+        return 1;
+
+    struct pocklington_step *steps =
+        realloc(certificate->steps, (certificate->num_steps + 1)
+                                        * sizeof(struct pocklington_step));
+    if (steps == NULL)
+    {
+        LOG_ERROR("failed to grow certificate: %s", strerror(errno))
+        return 0;
+    }
+    certificate->steps = steps;
+
+    struct pocklington_step *step = &steps[certificate->num_steps];
+    step->p = BN_dup(p);
+    step->q = BN_dup(q);
+    step->r = BN_dup(r);
+    step->a = a;
+    ++certificate->num_steps;
+    if (step->p == NULL || step->q == NULL || step->r == NULL)
+    {
+        LOG_ERROR("failed to copy certificate step: %s", OPENSSL_ERR_STRING)
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Pocklington's criterion with the witness a (q prime, q > sqrt(p)).
+ * Returns 1 if p is proven prime, 0 if p is composite, 2 if a is not a
+ * witness (try another one) and -1 on failure.
+ */
+static int pocklington_check(BIGNUM *p, BIGNUM *r, BN_ULONG a, BN_CTX *ctx)
+{
+    int result = -1;
+
+    BN_CTX_start(ctx);
+    BIGNUM *bn_a = BN_CTX_get(ctx);
+    BIGNUM *e = BN_CTX_get(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    if (x == NULL || !BN_set_word(bn_a, a))
+        goto PocklingtonEnd;
+
+    // a^(p - 1) % p == 1, otherwise p is composite (Fermat)
+    STATS_TIMER_START(fermat_timer)
+    int success =
+        BN_sub(e, p, BN_value_one()) && BN_mod_exp(x, bn_a, e, p, ctx);
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, fermat_timer)
+    if (!success)
+        goto PocklingtonEnd;
+    if (!BN_is_one(x))
+    {
+        result = 0;
+        goto PocklingtonEnd;
+    }
+
+    // gcd(a^(2r) - 1, p) == 1
+    STATS_TIMER_START(gcd_timer)
+    success = BN_lshift1(e, r) && BN_mod_exp(x, bn_a, e, p, ctx)
+        && BN_sub_word(x, 1) && BN_gcd(x, x, p, ctx);
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, gcd_timer)
+    if (!success)
+        goto PocklingtonEnd;
+    result = BN_is_one(x) ? 1 : 2;
+
+PocklingtonEnd:
+    if (result == -1)
+        LOG_ERROR("pocklington check: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+
+    return result;
+}
+
+static BIGNUM *provable_prime_rec(unsigned length,
+                                  struct prime_certificate *certificate,
+                                  BN_CTX *ctx)
+{
+    if (length <= PROVABLE_BASE_LENGTH)
+    {
+        BIGNUM *p = generate_small_prime(length);
+        if (p != NULL && certificate != NULL)
+            certificate->base_prime = BN_get_word(p);
+        return p;
+    }
+
+    // q >= 2^ceil(length / 2) > sqrt(p)
+    BIGNUM *q = provable_prime_rec((length + 1) / 2 + 1, certificate, ctx);
+    if (q == NULL)
+        return NULL;
+
+    BIGNUM *p = BN_secure_new();
+    BN_CTX_start(ctx);
+    BIGNUM *r = BN_CTX_get(ctx);
+    BIGNUM *r_min = BN_CTX_get(ctx);
+    BIGNUM *r_max = BN_CTX_get(ctx);
+    BIGNUM *two_q = BN_CTX_get(ctx);
+    if (p == NULL || two_q == NULL || !BN_lshift1(two_q, q))
+        goto ProvablePrimeFailed;
+
+    // 2^(length - 1) < 2rq + 1 < 2^length, i.e. r in [r_min, r_max)
+    BN_zero(r_min);
+    BN_zero(r_max);
+    if (!BN_set_bit(r_min, length - 1) || !BN_set_bit(r_max, length)
+        || !BN_div(r_min, NULL, r_min, two_q, ctx)
+        || !BN_sub_word(r_max, 1) || !BN_div(r_max, NULL, r_max, two_q, ctx)
+        || !BN_add_word(r_min, 1))
+        goto ProvablePrimeFailed;
+
+    for (;;)
+    {
+        STATS_ADD(STATS_CANDIDATES, 1)
+        STATS_TIMER_START(rng_timer)
+        random_bn_from_range(r, r_min, r_max);
+        STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
+        // p = 2rq + 1
+        if (!BN_mul(p, r, two_q, ctx) || !BN_add_word(p, 1))
+            goto ProvablePrimeFailed;
+
+        STATS_TIMER_START(trial_division_timer)
+        int success = preliminary_checks(p, ctx);
+        STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, trial_division_timer)
+        if (success == -1)
+            goto ProvablePrimeFailed;
+        if (success == 0)
+            continue;
+
+        BN_ULONG a = 2;
+        do
+            success = pocklington_check(p, r, a, ctx);
+        while (success == 2 && ++a < POCKLINGTON_MAX_WITNESS);
+        if (success == -1)
+            goto ProvablePrimeFailed;
+        if (success != 1)
+            continue;
+
+        if (!add_step(certificate, p, q, r, a))
+            goto ProvablePrimeFailed;
+        break;
+    }
+
+    BN_CTX_end(ctx);
+    BN_clear_free(q);
+    return p;
+
+ProvablePrimeFailed:
+    LOG_ERROR("failed to generate provable prime of length %u: %s", length,
+              OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+    BN_clear_free(q);
+    BN_clear_free(p);
+    return NULL;
+}
+
+BIGNUM *generate_provable_prime(unsigned length,
+                                struct prime_certificate *certificate)
+{
+    if (length < 2)
+    {
+        LOG_ERROR("no prime has less than 2 bits")
+        return NULL;
+    }
+    if (certificate != NULL)
+        *certificate = (struct prime_certificate){ 0 };
+
+    BN_CTX *ctx = BN_CTX_secure_new();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("failed to allocate context: %s", OPENSSL_ERR_STRING)
+        return NULL;
+    }
+
+    BIGNUM *p = provable_prime_rec(length, certificate, ctx);
+    BN_CTX_free(ctx);
+
+    if (p == NULL && certificate != NULL)
+        cleanup_certificate(certificate);
+    return p;
+}
+
+static void print_bn(FILE *f, const BIGNUM *n, int hex)
+{
+    char *str = hex ? BN_bn2hex(n) : BN_bn2dec(n);
+    fprintf(f, "%s%s", hex ? "0x" : "", str == NULL ? "?" : str);
+    OPENSSL_free(str);
+}
+
+void print_certificate(FILE *f, const struct prime_certificate *certificate,
+                       int hex)
+{
+    fprintf(f, "# trial division\n");
+    fprintf(f, hex ? "0x%lX\n" : "%lu\n",
+            (unsigned long)certificate->base_prime);
+    fprintf(f, "# pocklington: p q r a (p = 2rq + 1)\n");
+    for (size_t i = 0; i < certificate->num_steps; ++i)
+    {
+        const struct pocklington_step *step = &certificate->steps[i];
+        print_bn(f, step->p, hex);
+        fputc(' ', f);
+        print_bn(f, step->q, hex);
+        fputc(' ', f);
+        print_bn(f, step->r, hex);
+        fprintf(f, " %lu\n", (unsigned long)step->a);
+    }
+}
+
+void cleanup_certificate(struct prime_certificate *certificate)
+{
+    for (size_t i = 0; i < certificate->num_steps; ++i)
+    {
+        BN_free(certificate->steps[i].p);
+        BN_free(certificate->steps[i].q);
+        BN_free(certificate->steps[i].r);
+    }
+    free(certificate->steps);
+    *certificate = (struct prime_certificate){ 0 };
+}
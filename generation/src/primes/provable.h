@@ -0,0 +1,45 @@
+#ifndef PROVABLE_H
+#define PROVABLE_H
+
+#include <openssl/bn.h>
+#include <stdio.h>
+
+/*
+ * One step of a Pocklington certificate : p = 2 * r * q + 1 with q a proven
+ * prime such that q > sqrt(p). Then p is prime iff
+ *   a^(p - 1) = 1 (mod p) and gcd(a^(2 * r) - 1, p) = 1
+ */
+struct pocklington_step
+{
+    BIGNUM *p;
+    BIGNUM *q;
+    BIGNUM *r;
+    BN_ULONG a;
+};
+
+/*
+ * Chain of steps, from the smallest prime (proven by trial division) to the
+ * generated one.
+ */
+struct prime_certificate
+{
+    BN_ULONG base_prime;
+    struct pocklington_step *steps;
+    size_t num_steps;
+};
+
+/*
+ * Generate a prime number of 'length' bits, built recursively with the
+ * Shawe-Taylor method (FIPS 186-5, appendix A.1.2) : its primality is
+ * proven, not just probable. If 'certificate' is not NULL, it receives the
+ * proof (to be freed with cleanup_certificate()).
+ */
+BIGNUM *generate_provable_prime(unsigned length,
+                                struct prime_certificate *certificate);
+
+void print_certificate(FILE *f, const struct prime_certificate *certificate,
+                       int hex);
+
+void cleanup_certificate(struct prime_certificate *certificate);
+
+#endif /* !PROVABLE_H */
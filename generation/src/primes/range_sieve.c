@@ -0,0 +1,792 @@
+#include "range_sieve.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/small_primes.h"
+#include "utils/logging.h"
+#include "utils/threads.h"
+
+// Bytes (of 30 numbers) per segment : the segment is sieved in the L1 cache
+#ifndef SIEVE_SEGMENT_SIZE
+#    define SIEVE_SEGMENT_SIZE (1u << 15)
+#endif /* !SIEVE_SEGMENT_SIZE */
+
+/*
+ * Segments per chunk (the unit of work of a thread). Counting uses longer
+ * chunks as the range goes up, so that finding the first multiple of every
+ * sieving prime in the chunk stays cheap, but a printed chunk is buffered
+ * until the previous ones are written : its length is bounded.
+ */
+#define SIEVE_CHUNK_SEGMENTS 64
+
+/*
+ * The multiples of 7, 11, 13 and 17 (the first PRESIEVE_PRIMES sieving
+ * primes) repeat every 7 * 11 * 13 * 17 bytes : segments start as a copy of
+ * that pattern instead of being sieved with them.
+ */
+#define PRESIEVE_PRIMES 4
+#define PRESIEVE_SIZE (7 * 11 * 13 * 17)
+
+// Odd numbers per window of the sieving primes generation
+#define SIEVING_PRIMES_WINDOW (1u << 18)
+
+/*
+ * Ranges shorter than sqrt(hi) / RANGE_TEST_RATIO are tested number by
+ * number : generating the sieving primes up to sqrt(hi) would cost more
+ * than the tests
+ */
+#ifndef RANGE_TEST_RATIO
+#    define RANGE_TEST_RATIO 64
+#endif /* !RANGE_TEST_RATIO */
+
+// Odd primes tried before the Miller-Rabin test of a number
+#define RANGE_TEST_TRIAL_PRIMES 64
+
+// Longest line written for a prime (20 digits and a new line)
+#define MAX_LINE_SIZE 21
+
+// Numbers coprime to 30, and distance to the next one
+static const uint8_t WHEEL[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+static const uint8_t WHEEL_STEP[8] = { 6, 4, 2, 4, 2, 4, 6, 2 };
+
+// Position of r in WHEEL (-1 if r is not coprime to 30)
+static const int8_t WHEEL_INDEX[30] = {
+    -1, 0,  -1, -1, -1, -1, -1, 1,  -1, -1, -1, 2,  -1, 3,  -1,
+    -1, -1, 4,  -1, 5,  -1, -1, -1, 6,  -1, -1, -1, -1, -1, 7,
+};
+
+// Distance from r to the first number >= r that is coprime to 30
+static const uint8_t NEXT_COPRIME[30] = {
+    1, 0, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0, 1, 0, 3,
+    2, 1, 0, 1, 0, 3, 2, 1, 0, 5, 4, 3, 2, 1, 0,
+};
+
+/*
+ * p = 30a + WHEEL[c] crosses off p * q, q running over the numbers coprime
+ * to 30. From q = WHEEL[i] (mod 30) to the next one, p * q moves forward by
+ * a * WHEEL_STEP[i] + STEP_EXTRA[c][i] bytes, and p * q lands on the bit
+ * CROSS_MASK[c][i] of its byte.
+ */
+static uint8_t STEP_EXTRA[8][8];
+static uint8_t CROSS_MASK[8][8];
+static uint8_t PRESIEVE[PRESIEVE_SIZE];
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+struct range_sieve
+{
+    uint64_t lo;
+    uint64_t hi;
+    // byte b holds the numbers base + 30b + WHEEL[i]
+    uint64_t base;
+    uint64_t num_bytes;
+    // bits of the first and last bytes that are in [max(lo, 7), hi]
+    uint8_t first_mask;
+    uint8_t last_mask;
+    uint64_t chunk_segments;
+    uint64_t num_chunks;
+    /*
+     * medium sieving primes (< 30 * SIEVE_SEGMENT_SIZE) : the larger ones
+     * are generated window by window by each chunk, never all held at once
+     */
+    uint32_t *primes;
+    size_t num_primes;
+    // next chunk to sieve, and next chunk to print
+    uint64_t next_chunk;
+    uint64_t printed_chunk;
+    long count;
+    int failed;
+    FILE *out;
+    pthread_mutex_t lock;
+    pthread_cond_t printed;
+};
+
+/*
+ * Sieving primes > 30 * SIEVE_SEGMENT_SIZE have at most one multiple in a
+ * segment : they wait in the bucket of the segment of their next multiple.
+ */
+struct bucket
+{
+    // prime << 32 | byte in the segment << 3 | wheel position
+    uint64_t *entries;
+    size_t size;
+    size_t capacity;
+};
+
+struct sieve_worker
+{
+    struct range_sieve *sieve;
+    uint8_t *segment;
+    // medium primes : next multiple (bytes from the current segment)
+    uint64_t *next_byte;
+    uint8_t *position;
+    struct bucket *buckets;
+    size_t num_buckets;
+    // window of the large sieving primes generation
+    unsigned char *window;
+    char *text;
+    size_t text_size;
+    size_t text_capacity;
+};
+
+static void setup_wheel(void)
+{
+    for (int c = 0; c < 8; ++c)
+        for (int i = 0; i < 8; ++i)
+        {
+            unsigned product = WHEEL[c] * WHEEL[i];
+            STEP_EXTRA[c][i] =
+                WHEEL[c] * (WHEEL[i] + WHEEL_STEP[i]) / 30 - product / 30;
+            CROSS_MASK[c][i] = 1u << WHEEL_INDEX[product % 30];
+        }
+
+    memset(PRESIEVE, 0xff, sizeof(PRESIEVE));
+    for (unsigned p = 7; p <= 17; p += p == 7 ? 4 : 2)
+        for (unsigned n = p; n < 30 * PRESIEVE_SIZE; n += 2 * p)
+            if (WHEEL_INDEX[n % 30] != -1)
+                PRESIEVE[n / 30] &= ~(1u << WHEEL_INDEX[n % 30]);
+}
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = 0;
+    for (int bit = 31; bit >= 0; --bit)
+    {
+        uint64_t candidate = r | (1ull << bit);
+        if (candidate * candidate <= n)
+            r = candidate;
+    }
+    return r;
+}
+
+/*
+ * Flag the odd composites of the window of the odd numbers lo + 2j <= hi
+ * (lo odd, j < SIEVING_PRIMES_WINDOW, hi < 2^32) : composite[j] is set
+ */
+static void sieve_window(uint64_t lo, uint64_t hi, unsigned char *composite)
+{
+    size_t num_small;
+    const uint32_t *small = small_primes(&num_small);
+    memset(composite, 0, SIEVING_PRIMES_WINDOW);
+    for (size_t i = 1; i < num_small; ++i)
+    {
+        uint64_t p = small[i];
+        if (p * p > hi)
+            break;
+        uint64_t first = p * p >= lo ? p * p : (lo + p - 1) / p * p;
+        if (first % 2 == 0)
+            first += p;
+        for (uint64_t n = first; n <= hi; n += 2 * p)
+            composite[(n - lo) / 2] = 1;
+    }
+}
+
+uint32_t *sieving_primes(uint32_t limit, size_t *count)
+{
+    unsigned char *composite = malloc(SIEVING_PRIMES_WINDOW);
+    size_t capacity = 1024;
+    uint32_t *primes = malloc(capacity * sizeof(uint32_t));
+    *count = 0;
+    if (composite == NULL || primes == NULL)
+        goto SievingPrimesFailed;
+
+    // window of the odd numbers lo + 2j, j < SIEVING_PRIMES_WINDOW
+    for (uint64_t lo = 7; lo <= limit; lo += 2 * SIEVING_PRIMES_WINDOW)
+    {
+        uint64_t hi = lo + 2 * (uint64_t)SIEVING_PRIMES_WINDOW - 2;
+        if (hi > limit)
+            hi = limit;
+        sieve_window(lo, hi, composite);
+
+        for (uint64_t n = lo; n <= hi; n += 2)
+        {
+            if (composite[(n - lo) / 2])
+                continue;
+            if (*count == capacity)
+            {
+                uint32_t *bigger =
+                    realloc(primes, 2 * capacity * sizeof(uint32_t));
+                if (bigger == NULL)
+                    goto SievingPrimesFailed;
+                primes = bigger;
+                capacity *= 2;
+            }
+            primes[(*count)++] = n;
+        }
+    }
+
+    free(composite);
+    if (*count != 0)
+        return primes;
+    free(primes);
+    return NULL;
+
+SievingPrimesFailed:
+    LOG_ERROR("failed to allocate sieving primes: %s", strerror(errno))
+    free(composite);
+    free(primes);
+    *count = 0;
+    return NULL;
+}
+
+static int bucket_push(struct bucket *bucket, uint64_t entry)
+{
+    if (bucket->size == bucket->capacity)
+    {
+        size_t capacity = bucket->capacity ? 2 * bucket->capacity : 256;
+        uint64_t *entries =
+            realloc(bucket->entries, capacity * sizeof(uint64_t));
+        if (entries == NULL)
+        {
+            LOG_ERROR("failed to grow bucket: %s", strerror(errno))
+            return 0;
+        }
+        bucket->entries = entries;
+        bucket->capacity = capacity;
+    }
+    bucket->entries[bucket->size++] = entry;
+    return 1;
+}
+
+/*
+ * First multiple p * q >= max(start, p^2) with q coprime to 30 : its byte
+ * (from the byte of start) and the wheel position of q. Returns 0 if it is
+ * past last.
+ */
+static int first_multiple(uint64_t p, uint64_t start, uint64_t last,
+                          uint64_t *byte, uint8_t *position)
+{
+    uint64_t from = p * p > start ? p * p : start;
+    uint64_t q = from / p + (from % p != 0);
+    q += NEXT_COPRIME[q % 30];
+    uint64_t n;
+    if (__builtin_mul_overflow(p, q, &n) || n > last)
+        return 0;
+    *byte = (n - start) / 30;
+    *position = WHEEL_INDEX[q % 30];
+    return 1;
+}
+
+/*
+ * Find the first multiple of every sieving prime in the chunk : the medium
+ * primes keep it in next_byte, and the large ones, generated window by
+ * window up to sqrt(last), go to the bucket of their segment if it is in
+ * the chunk (and are dropped otherwise).
+ */
+static int setup_chunk(struct sieve_worker *worker, uint64_t start,
+                       uint64_t last, uint64_t chunk_bytes)
+{
+    struct range_sieve *sieve = worker->sieve;
+    uint64_t root = isqrt(last);
+    for (size_t i = 0; i < worker->num_buckets; ++i)
+        worker->buckets[i].size = 0;
+
+    for (size_t j = PRESIEVE_PRIMES;
+         j < sieve->num_primes && sieve->primes[j] <= root; ++j)
+    {
+        uint64_t byte;
+        uint8_t position = 0;
+        int found =
+            first_multiple(sieve->primes[j], start, last, &byte, &position);
+        worker->next_byte[j] = found ? byte : chunk_bytes;
+        worker->position[j] = position;
+    }
+
+    // 30 * SIEVE_SEGMENT_SIZE is even
+    for (uint64_t lo = 30 * SIEVE_SEGMENT_SIZE + 1; lo <= root;
+         lo += 2 * SIEVING_PRIMES_WINDOW)
+    {
+        uint64_t hi = lo + 2 * (uint64_t)SIEVING_PRIMES_WINDOW - 2;
+        if (hi > root)
+            hi = root;
+        sieve_window(lo, hi, worker->window);
+        for (uint64_t p = lo; p <= hi; p += 2)
+        {
+            uint64_t byte;
+            uint8_t position = 0;
+            if (worker->window[(p - lo) / 2]
+                || !first_multiple(p, start, last, &byte, &position)
+                || byte >= chunk_bytes)
+                continue;
+            uint64_t segment = byte / SIEVE_SEGMENT_SIZE;
+            uint64_t entry =
+                p << 32 | (byte % SIEVE_SEGMENT_SIZE) << 3 | position;
+            if (!bucket_push(&worker->buckets[segment], entry))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Sieve the size bytes of the segment-th segment of the chunk, whose first
+ * byte holds the numbers 30 * first + WHEEL[i]
+ */
+static int sieve_segment(struct sieve_worker *worker, uint64_t segment,
+                         uint64_t first, size_t size, uint64_t num_segments,
+                         size_t num_medium)
+{
+    struct range_sieve *sieve = worker->sieve;
+    uint8_t *bytes = worker->segment;
+    for (size_t copied = 0; copied < size;)
+    {
+        size_t from = (first + copied) % PRESIEVE_SIZE;
+        size_t length = PRESIEVE_SIZE - from < size - copied
+            ? PRESIEVE_SIZE - from
+            : size - copied;
+        memcpy(bytes + copied, PRESIEVE + from, length);
+        copied += length;
+    }
+    // the pattern crossed 7, 11, 13 and 17 off too
+    if (first == 0)
+        bytes[0] |= 0x1e;
+
+    for (size_t j = PRESIEVE_PRIMES; j < num_medium; ++j)
+    {
+        uint32_t p = sieve->primes[j];
+        uint64_t a = p / 30;
+        int c = WHEEL_INDEX[p % 30];
+        uint64_t byte = worker->next_byte[j];
+        unsigned i = worker->position[j];
+        if (byte >= size)
+        {
+            worker->next_byte[j] = byte - size;
+            continue;
+        }
+
+        /*
+         * 8 multiples of the wheel span exactly p bytes : their offsets from
+         * the first one are the same in every turn, so the crossings of a
+         * turn do not depend on each other.
+         */
+        uint64_t offsets[9];
+        uint8_t masks[8];
+        offsets[0] = 0;
+        for (unsigned k = 0; k < 8; ++k)
+        {
+            unsigned position = (i + k) & 7;
+            masks[k] = ~CROSS_MASK[c][position];
+            offsets[k + 1] = offsets[k] + a * WHEEL_STEP[position]
+                + STEP_EXTRA[c][position];
+        }
+        for (; byte + p <= size; byte += p)
+            for (unsigned k = 0; k < 8; ++k)
+                bytes[byte + offsets[k]] &= masks[k];
+        unsigned k = 0;
+        for (; byte + offsets[k] < size; ++k)
+            bytes[byte + offsets[k]] &= masks[k];
+
+        worker->next_byte[j] = byte + offsets[k] - size;
+        worker->position[j] = (i + k) & 7;
+    }
+
+    // large primes : one multiple here, then off to a later segment
+    struct bucket *bucket = &worker->buckets[segment];
+    for (size_t k = 0; k < bucket->size; ++k)
+    {
+        uint64_t entry = bucket->entries[k];
+        uint32_t p = entry >> 32;
+        uint64_t byte = (entry >> 3) & 0x1fffffff;
+        unsigned i = entry & 7;
+        int c = WHEEL_INDEX[p % 30];
+        bytes[byte] &= ~CROSS_MASK[c][i];
+
+        byte += segment * SIEVE_SEGMENT_SIZE
+            + (uint64_t)(p / 30) * WHEEL_STEP[i] + STEP_EXTRA[c][i];
+        uint64_t target = byte / SIEVE_SEGMENT_SIZE;
+        if (target < num_segments
+            && !bucket_push(&worker->buckets[target],
+                            (uint64_t)p << 32
+                                | (byte % SIEVE_SEGMENT_SIZE) << 3
+                                | ((i + 1) & 7)))
+            return 0;
+    }
+    bucket->size = 0;
+    return 1;
+}
+
+static long count_bits(const uint8_t *bytes, size_t size)
+{
+    long count = 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; i < size; ++i)
+        count += __builtin_popcount(bytes[i]);
+    return count;
+}
+
+static char *write_decimal(char *text, uint64_t n)
+{
+    char digits[20];
+    int length = 0;
+    do
+    {
+        digits[length++] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    while (length != 0)
+        *text++ = digits[--length];
+    *text++ = '\n';
+    return text;
+}
+
+static int append_primes(struct sieve_worker *worker, const uint8_t *bytes,
+                         size_t size, uint64_t first_byte)
+{
+    size_t needed = worker->text_size + 8 * size * MAX_LINE_SIZE;
+    if (needed > worker->text_capacity)
+    {
+        char *text = realloc(worker->text, needed);
+        if (text == NULL)
+        {
+            LOG_ERROR("failed to grow output buffer: %s", strerror(errno))
+            return 0;
+        }
+        worker->text = text;
+        worker->text_capacity = needed;
+    }
+
+    char *text = worker->text + worker->text_size;
+    uint64_t base = worker->sieve->base + 30 * first_byte;
+    for (size_t k = 0; k < size; ++k, base += 30)
+        for (unsigned bits = bytes[k]; bits != 0; bits &= bits - 1)
+            text = write_decimal(text, base + WHEEL[__builtin_ctz(bits)]);
+    worker->text_size = text - worker->text;
+    return 1;
+}
+
+static int write_text(struct sieve_worker *worker)
+{
+    int success = fwrite(worker->text, 1, worker->text_size, worker->sieve->out)
+        == worker->text_size;
+    worker->text_size = 0;
+    if (!success)
+        LOG_ERROR("failed to write primes: %s", strerror(errno))
+    return success;
+}
+
+static void mark_failed(struct range_sieve *sieve)
+{
+    pthread_mutex_lock(&sieve->lock);
+    sieve->failed = 1;
+    pthread_cond_broadcast(&sieve->printed);
+    pthread_mutex_unlock(&sieve->lock);
+}
+
+/*
+ * Chunks are sieved in any order, but printed in order. The thread holding
+ * the next chunk to print writes it as it goes, the others buffer theirs
+ * and wait for their turn.
+ */
+static int finish_chunk(struct sieve_worker *worker, uint64_t chunk)
+{
+    struct range_sieve *sieve = worker->sieve;
+    pthread_mutex_lock(&sieve->lock);
+    while (sieve->printed_chunk != chunk && !sieve->failed)
+        pthread_cond_wait(&sieve->printed, &sieve->lock);
+    int success = !sieve->failed && write_text(worker);
+    __atomic_store_n(&sieve->printed_chunk, chunk + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&sieve->printed);
+    pthread_mutex_unlock(&sieve->lock);
+    return success;
+}
+
+static int sieve_chunk(struct sieve_worker *worker, uint64_t chunk)
+{
+    struct range_sieve *sieve = worker->sieve;
+    uint64_t chunk_bytes = sieve->chunk_segments * SIEVE_SEGMENT_SIZE;
+    uint64_t first_byte = chunk * chunk_bytes;
+    if (sieve->num_bytes - first_byte < chunk_bytes)
+        chunk_bytes = sieve->num_bytes - first_byte;
+    uint64_t num_segments =
+        (chunk_bytes + SIEVE_SEGMENT_SIZE - 1) / SIEVE_SEGMENT_SIZE;
+
+    // last number of the chunk, without overflowing near 2^64
+    uint64_t start = sieve->base + 30 * first_byte;
+    uint64_t last = sieve->hi - start < 30 * chunk_bytes - 1
+        ? sieve->hi
+        : start + 30 * chunk_bytes - 1;
+    if (!setup_chunk(worker, start, last, chunk_bytes))
+        return 0;
+    size_t num_medium = 0;
+    uint64_t root = isqrt(last);
+    while (num_medium < sieve->num_primes && sieve->primes[num_medium] <= root)
+        ++num_medium;
+
+    long count = 0;
+    for (uint64_t segment = 0; segment < num_segments; ++segment)
+    {
+        uint64_t offset = segment * SIEVE_SEGMENT_SIZE;
+        size_t size = chunk_bytes - offset < SIEVE_SEGMENT_SIZE
+            ? chunk_bytes - offset
+            : SIEVE_SEGMENT_SIZE;
+        if (!sieve_segment(worker, segment,
+                           sieve->base / 30 + first_byte + offset, size,
+                           num_segments, num_medium))
+            return 0;
+
+        // only [max(lo, 7), hi] in the first and last bytes
+        if (first_byte + offset == 0)
+            worker->segment[0] &= sieve->first_mask;
+        if (first_byte + offset + size == sieve->num_bytes)
+            worker->segment[size - 1] &= sieve->last_mask;
+
+        if (sieve->out == NULL)
+            count += count_bits(worker->segment, size);
+        else
+        {
+            if (!append_primes(worker, worker->segment, size,
+                               first_byte + offset))
+                return 0;
+            count += count_bits(worker->segment, size);
+            if (__atomic_load_n(&sieve->printed_chunk, __ATOMIC_ACQUIRE)
+                    == chunk
+                && !write_text(worker))
+                return 0;
+        }
+    }
+
+    __atomic_add_fetch(&sieve->count, count, __ATOMIC_RELAXED);
+    return sieve->out == NULL || finish_chunk(worker, chunk);
+}
+
+static void cleanup_worker(struct sieve_worker *worker)
+{
+    for (size_t i = 0; worker->buckets != NULL && i < worker->num_buckets; ++i)
+        free(worker->buckets[i].entries);
+    free(worker->buckets);
+    free(worker->segment);
+    free(worker->next_byte);
+    free(worker->position);
+    free(worker->window);
+    free(worker->text);
+}
+
+static void *sieve_worker(void *arg)
+{
+    struct range_sieve *sieve = arg;
+    struct sieve_worker worker = { .sieve = sieve };
+
+    worker.num_buckets = sieve->chunk_segments;
+    worker.segment = malloc(SIEVE_SEGMENT_SIZE);
+    worker.next_byte = malloc((sieve->num_primes + 1) * sizeof(uint64_t));
+    worker.position = malloc(sieve->num_primes + 1);
+    worker.buckets = calloc(worker.num_buckets, sizeof(struct bucket));
+    worker.window = malloc(SIEVING_PRIMES_WINDOW);
+    if (worker.segment == NULL || worker.next_byte == NULL
+        || worker.position == NULL || worker.buckets == NULL
+        || worker.window == NULL)
+    {
+        LOG_ERROR("failed to allocate sieve worker: %s", strerror(errno))
+        goto SieveWorkerFailed;
+    }
+
+    for (;;)
+    {
+        uint64_t chunk =
+            __atomic_fetch_add(&sieve->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= sieve->num_chunks
+            || __atomic_load_n(&sieve->failed, __ATOMIC_RELAXED))
+            break;
+        if (!sieve_chunk(&worker, chunk))
+            goto SieveWorkerFailed;
+    }
+
+    cleanup_worker(&worker);
+    return NULL;
+
+SieveWorkerFailed:
+    mark_failed(sieve);
+    cleanup_worker(&worker);
+    return NULL;
+}
+
+static uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t n)
+{
+    return (uint64_t)((unsigned __int128)a * b % n);
+}
+
+/*
+ * Deterministic Miller-Rabin below 2^64 (Sinclair's bases), after a trial
+ * division by the first odd primes, for an odd n >= 7
+ */
+static int is_prime_u64(uint64_t n)
+{
+    static const uint64_t BASES[] = { 2,      325,     9375,      28178,
+                                      450775, 9780504, 1795265022 };
+    size_t num_small;
+    const uint32_t *small = small_primes(&num_small);
+    for (size_t i = 1; i <= RANGE_TEST_TRIAL_PRIMES && i < num_small; ++i)
+        if (n % small[i] == 0)
+            return n == small[i];
+
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+    for (size_t i = 0; i < sizeof(BASES) / sizeof(BASES[0]); ++i)
+    {
+        uint64_t a = BASES[i] % n;
+        if (a == 0)
+            continue;
+        uint64_t x = 1;
+        for (uint64_t e = d; e != 0; e >>= 1, a = mul_mod(a, a, n))
+            if (e & 1)
+                x = mul_mod(x, a, n);
+        if (x == 1 || x == n - 1)
+            continue;
+        int witness = 1;
+        for (int j = 1; j < s && witness; ++j)
+        {
+            x = mul_mod(x, x, n);
+            witness = x != n - 1;
+        }
+        if (witness)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Primes of [lo, hi] (7 <= lo), tested one by one among the numbers coprime
+ * to 30, for ranges too narrow to be worth the sieving primes. count is
+ * the number of primes already found. Same return value as sieve_range.
+ */
+static long test_range(uint64_t lo, uint64_t hi, FILE *out, long count)
+{
+    LOG_INFO("Testing the numbers of [%lu, %lu] one by one", (unsigned long)lo,
+             (unsigned long)hi)
+    uint64_t n = lo + NEXT_COPRIME[lo % 30];
+    // past 2^64, n wraps around below lo
+    for (; n >= lo && n <= hi; n += WHEEL_STEP[WHEEL_INDEX[n % 30]])
+    {
+        if (!is_prime_u64(n))
+            continue;
+        ++count;
+        if (out != NULL && fprintf(out, "%lu\n", (unsigned long)n) < 0)
+            return -1;
+    }
+    if (out != NULL && fflush(out) != 0)
+        return -1;
+    return count;
+}
+
+static uint8_t range_mask(uint64_t base, uint64_t lo, uint64_t hi)
+{
+    uint8_t mask = 0;
+    for (int i = 0; i < 8; ++i)
+        if (base + WHEEL[i] >= lo && base + WHEEL[i] - lo <= hi - lo)
+            mask |= 1u << i;
+    return mask;
+}
+
+long sieve_range(uint64_t lo, uint64_t hi, FILE *out)
+{
+    if (lo > hi)
+    {
+        LOG_ERROR("Invalid range: [%lu, %lu]", (unsigned long)lo,
+                  (unsigned long)hi)
+        return -1;
+    }
+    pthread_once(&wheel_once, &setup_wheel);
+
+    // 2, 3 and 5 are not on the wheel
+    long count = 0;
+    for (uint64_t p = 2; p <= 5; p += p == 2 ? 1 : 2)
+    {
+        if (p < lo || p > hi)
+            continue;
+        ++count;
+        if (out != NULL && fprintf(out, "%lu\n", (unsigned long)p) < 0)
+            return -1;
+    }
+    if (hi < 7)
+        return count;
+    if (lo < 7)
+        lo = 7;
+
+    struct range_sieve sieve = {
+        .lo = lo,
+        .hi = hi,
+        .base = lo - lo % 30,
+        .next_chunk = 0,
+        .printed_chunk = 0,
+        .count = count,
+        .failed = 0,
+        .out = out,
+    };
+    sieve.num_bytes = (hi - sieve.base) / 30 + 1;
+    sieve.first_mask = range_mask(sieve.base, lo, hi);
+    sieve.last_mask = range_mask(sieve.base + 30 * (sieve.num_bytes - 1), lo,
+                                 hi);
+    if (sieve.num_bytes == 1)
+        sieve.first_mask &= sieve.last_mask;
+
+    uint64_t root = isqrt(hi);
+    if (hi - lo < root / RANGE_TEST_RATIO)
+        return test_range(lo, hi, out, count);
+    if (root >= 7)
+    {
+        uint64_t limit = root < 30 * SIEVE_SEGMENT_SIZE
+            ? root
+            : 30 * SIEVE_SEGMENT_SIZE - 1;
+        sieve.primes = sieving_primes(limit, &sieve.num_primes);
+        if (sieve.primes == NULL)
+            return -1;
+    }
+
+    sieve.chunk_segments = SIEVE_CHUNK_SEGMENTS;
+    if (out == NULL
+        && root / (30 * SIEVE_SEGMENT_SIZE) * 4 > SIEVE_CHUNK_SEGMENTS)
+        sieve.chunk_segments = root / (30 * SIEVE_SEGMENT_SIZE) * 4;
+    uint64_t chunk_bytes = sieve.chunk_segments * SIEVE_SEGMENT_SIZE;
+    sieve.num_chunks = (sieve.num_bytes - 1) / chunk_bytes + 1;
+
+    long result = -1;
+    unsigned num = num_threads();
+    if (num > sieve.num_chunks)
+        num = sieve.num_chunks;
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        goto SieveRangeEnd;
+    }
+    pthread_mutex_init(&sieve.lock, NULL);
+    pthread_cond_init(&sieve.printed, NULL);
+
+    LOG_INFO("Sieving [%lu, %lu] with the primes up to %lu, %lu chunk(s) and "
+             "%u thread(s)",
+             (unsigned long)lo, (unsigned long)hi, (unsigned long)root,
+             (unsigned long)sieve.num_chunks, num)
+    unsigned started = 0;
+    for (; started < num; ++started)
+    {
+        int error =
+            pthread_create(&threads[started], NULL, &sieve_worker, &sieve);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            mark_failed(&sieve);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&sieve.printed);
+    pthread_mutex_destroy(&sieve.lock);
+    if (!sieve.failed && (out == NULL || fflush(out) == 0))
+        result = sieve.count;
+
+SieveRangeEnd:
+    free(threads);
+    free(sieve.primes);
+    return result;
+}
@@ -0,0 +1,27 @@
+#ifndef RANGE_SIEVE_H
+#define RANGE_SIEVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Primes of [lo, hi] (any 64-bit bounds), with a segmented sieve of
+ * Eratosthenes over a mod-30 wheel : a byte holds the 8 numbers of 30
+ * consecutive ones that are coprime to 30. The segments fit in the L1 cache,
+ * the large sieving primes are generated for each chunk and kept in buckets
+ * (one per upcoming segment), and contiguous chunks of segments are shared
+ * between num_threads() threads. Ranges much narrower than sqrt(hi) are
+ * tested number by number instead. The primes are written to 'out' (one per
+ * line, in increasing order), or only counted if out is NULL.
+ * Returns the number of primes, or -1 on failure.
+ */
+long sieve_range(uint64_t lo, uint64_t hi, FILE *out);
+
+/*
+ * Primes 7 <= p <= limit (limit < 2^32), with a segmented sieve over the
+ * primes of small_primes(). Returns NULL on failure (or if there is none).
+ */
+uint32_t *sieving_primes(uint32_t limit, size_t *count);
+
+#endif /* !RANGE_SIEVE_H */
@@ -0,0 +1,309 @@
+#include "safe_prime.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "primes/miller_rabin.h"
+#include "primes/primality_test.h"
+#include "primes/small_primes.h"
+#include "random/random.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+#include "utils/threads.h"
+
+/*
+ * Candidates are q = 11 (mod 12) : q = 2 (mod 3) so that 3 does not divide
+ * p = 2q + 1, and q = 3 (mod 4) so that p = 7 (mod 8), which makes 2 a
+ * quadratic residue modulo p (see safe_prime_euler_check).
+ */
+#define SAFE_PRIME_STEP 12
+#define SAFE_PRIME_RESIDUE 11
+
+// Number of candidates q0 + 12k sieved at once
+#ifndef SAFE_PRIME_SIEVE_WINDOW
+#    define SAFE_PRIME_SIEVE_WINDOW (1u << 15)
+#endif /* !SAFE_PRIME_SIEVE_WINDOW */
+
+struct safe_prime_search
+{
+    unsigned length;
+    unsigned num_tests;
+    // odd primes used by the sieve (from 5), and the inverses of 12
+    const uint32_t *primes;
+    uint32_t *step_inverses;
+    size_t num_primes;
+    // set once a thread found a safe prime, or failed
+    int done;
+    BIGNUM *p;
+    pthread_mutex_t lock;
+};
+
+static int search_done(struct safe_prime_search *search)
+{
+    return __atomic_load_n(&search->done, __ATOMIC_ACQUIRE);
+}
+
+static void search_finish(struct safe_prime_search *search, BIGNUM *p)
+{
+    pthread_mutex_lock(&search->lock);
+    if (!search->done && p != NULL)
+    {
+        search->p = p;
+        p = NULL;
+    }
+    __atomic_store_n(&search->done, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&search->lock);
+
+    BN_clear_free(p);
+}
+
+/*
+ * Draw the start q0 of a window : length - 1 bits, q0 = 11 (mod 12)
+ */
+static int draw_window_start(BIGNUM *q0, unsigned length)
+{
+    // the previous window may have carried past the top bit
+    BN_zero(q0);
+    if (!BN_set_bit(q0, length - 2))
+        return 0;
+    STATS_TIMER_START(rng_timer)
+    int success = generate_prime_candidate(q0, length - 1);
+    STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
+    if (!success)
+        return 0;
+
+    BN_ULONG residue = BN_mod_word(q0, SAFE_PRIME_STEP);
+    if (residue == (BN_ULONG)-1)
+        return 0;
+    return BN_add_word(q0, (SAFE_PRIME_RESIDUE + SAFE_PRIME_STEP - residue)
+                               % SAFE_PRIME_STEP);
+}
+
+/*
+ * Mark in 'composite' every k such that either q0 + 12k or 2(q0 + 12k) + 1
+ * has a small factor.
+ */
+static int sieve_window(struct safe_prime_search *search, const BIGNUM *q0,
+                        unsigned char *composite)
+{
+    STATS_TIMER_START(sieve_timer)
+    memset(composite, 0, SAFE_PRIME_SIEVE_WINDOW);
+
+    for (size_t i = 0; i < search->num_primes; ++i)
+    {
+        uint64_t s = search->primes[i];
+        BN_ULONG r = BN_mod_word(q0, s);
+        if (r == (BN_ULONG)-1)
+        {
+            STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, sieve_timer)
+            return 0;
+        }
+
+        // q = 0 (mod s) and q = (s - 1) / 2 (mod s), i.e. p = 0 (mod s)
+        uint64_t targets[2] = { 0, (s - 1) / 2 };
+        for (size_t j = 0; j < 2; ++j)
+        {
+            uint64_t k =
+                (targets[j] + s - r) % s * search->step_inverses[i] % s;
+            for (; k < SAFE_PRIME_SIEVE_WINDOW; k += s)
+                composite[k] = 1;
+        }
+    }
+    STATS_TIMER_STOP(STATS_STAGE_TRIAL_DIVISION, sieve_timer)
+
+    return 1;
+}
+
+/*
+ * 2^q = 1 (mod p). With p = 7 (mod 8), this is Euler's criterion to base 2,
+ * which every prime p passes. If q is prime, it also proves p prime
+ * (Pocklington, since q > sqrt(p) and gcd(2^2 - 1, p) = 1).
+ */
+static int safe_prime_euler_check(const BIGNUM *p, const BIGNUM *q,
+                                  BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    int result = -1;
+
+    STATS_TIMER_START(modexp_timer)
+    if (x != NULL && BN_set_word(x, 2) && BN_mod_exp(x, x, q, p, ctx))
+        result = BN_is_one(x);
+    STATS_TIMER_STOP(STATS_STAGE_MODEXP, modexp_timer)
+
+    BN_CTX_end(ctx);
+    return result;
+}
+
+/*
+ * Cheapest tests first : base-2 strong test on q, then the base-2 Euler
+ * criterion on p (which proves p once q is proven), and the full primality
+ * test of q last.
+ */
+static int safe_prime_check(const BIGNUM *q, BIGNUM *p, unsigned num_tests,
+                            BN_CTX *ctx)
+{
+    if (!BN_lshift1(p, q) || !BN_add_word(p, 1))
+        return -1;
+
+    int success = miller_rabin_base_check((BIGNUM *)q, 2, ctx);
+    if (success == 1)
+        success = safe_prime_euler_check(p, q, ctx);
+    if (success == 1)
+        success = primality_test((BIGNUM *)q, num_tests, ctx);
+
+    return success;
+}
+
+static void *safe_prime_worker(void *arg)
+{
+    struct safe_prime_search *search = arg;
+
+    unsigned char *composite = malloc(SAFE_PRIME_SIEVE_WINDOW);
+    BN_CTX *ctx = BN_CTX_secure_new();
+    BIGNUM *q0 = BN_secure_new();
+    BIGNUM *q = BN_secure_new();
+    BIGNUM *p = BN_secure_new();
+    if (composite == NULL || ctx == NULL || q0 == NULL || q == NULL
+        || p == NULL)
+    {
+        LOG_ERROR("failed to allocate safe prime worker: %s",
+                  OPENSSL_ERR_STRING)
+        goto SafePrimeWorkerFailed;
+    }
+
+    while (!search_done(search))
+    {
+        if (!draw_window_start(q0, search->length)
+            || !sieve_window(search, q0, composite))
+            goto SafePrimeWorkerFailed;
+        STATS_ADD(STATS_CANDIDATES, SAFE_PRIME_SIEVE_WINDOW)
+
+        for (unsigned k = 0;
+             k < SAFE_PRIME_SIEVE_WINDOW && !search_done(search); ++k)
+        {
+            if (composite[k])
+                continue;
+
+            // q = q0 + 12k, which must still have length - 1 bits
+            if (!BN_copy(q, q0)
+                || !BN_add_word(q, (BN_ULONG)SAFE_PRIME_STEP * k))
+                goto SafePrimeWorkerFailed;
+            if (BN_num_bits(q) != (int)search->length - 1)
+                break;
+
+            int success = safe_prime_check(q, p, search->num_tests, ctx);
+            if (success == -1)
+                goto SafePrimeWorkerFailed;
+            if (success == 1)
+            {
+                LOG_INFO("Found a safe prime")
+                search_finish(search, p);
+                p = NULL;
+                break;
+            }
+        }
+    }
+
+    free(composite);
+    BN_CTX_free(ctx);
+    BN_clear_free(q0);
+    BN_clear_free(q);
+    BN_clear_free(p);
+    return NULL;
+
+SafePrimeWorkerFailed:
+    LOG_ERROR("safe prime worker failed: %s", OPENSSL_ERR_STRING)
+    search_finish(search, NULL);
+    free(composite);
+    BN_CTX_free(ctx);
+    BN_clear_free(q0);
+    BN_clear_free(q);
+    BN_clear_free(p);
+    return NULL;
+}
+
+/*
+ * Only primes s with s^2 < q can be used by the sieve : otherwise, q or p
+ * could be s itself.
+ */
+static size_t sieve_num_primes(const uint32_t *primes, size_t count,
+                               unsigned length)
+{
+    size_t n = 0;
+    while (n < count
+           && (length - 2 >= 64
+               || (uint64_t)primes[n] * primes[n] < (1ull << (length - 2))))
+        ++n;
+    return n;
+}
+
+BIGNUM *generate_safe_prime(unsigned length)
+{
+    // 23 = 2 * 11 + 1 is the smallest safe prime with q = 11 (mod 12)
+    if (length < 5)
+    {
+        LOG_ERROR("Invalid length: %u (safe primes need at least 5 bits)",
+                  length)
+        return NULL;
+    }
+
+    struct safe_prime_search search = {
+        .length = length,
+        .num_tests = estimate_num_tests(length - 1),
+        .done = 0,
+        .p = NULL,
+    };
+
+    // skip 2 and 3, already excluded by q = 11 (mod 12)
+    size_t count;
+    const uint32_t *primes = small_primes(&count);
+    search.primes = primes + 2;
+    search.num_primes = sieve_num_primes(primes + 2, count - 2, length);
+    search.step_inverses = calloc(search.num_primes + 1, sizeof(uint32_t));
+    if (search.step_inverses == NULL)
+    {
+        LOG_ERROR("failed to allocate sieve: %s", strerror(errno))
+        return NULL;
+    }
+    for (size_t i = 0; i < search.num_primes; ++i)
+        search.step_inverses[i] =
+            small_prime_inverse(SAFE_PRIME_STEP, search.primes[i]);
+
+    unsigned n = num_threads();
+    pthread_t *threads = calloc(n, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        free(search.step_inverses);
+        return NULL;
+    }
+    pthread_mutex_init(&search.lock, NULL);
+
+    LOG_INFO("Searching a %u-bits safe prime with %u thread(s), sieving with "
+             "%zu primes",
+             length, n, search.num_primes);
+    unsigned started = 0;
+    for (; started < n; ++started)
+    {
+        int error = pthread_create(&threads[started], NULL, &safe_prime_worker,
+                                   &search);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            search_finish(&search, NULL);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&search.lock);
+    free(threads);
+    free(search.step_inverses);
+
+    return search.p;
+}
@@ -0,0 +1,12 @@
+#ifndef SAFE_PRIME_H
+#define SAFE_PRIME_H
+
+#include <openssl/bn.h>
+
+/*
+ * Generate a safe prime p = 2q + 1 (q prime) of 'length' bits, with
+ * num_threads() threads searching concurrently.
+ */
+BIGNUM *generate_safe_prime(unsigned length);
+
+#endif /* !SAFE_PRIME_H */
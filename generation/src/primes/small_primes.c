@@ -0,0 +1,53 @@
+#include "small_primes.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// pi(2^16) = 6542
+#define SMALL_PRIMES_MAX_COUNT 6542
+
+static uint32_t SMALL_PRIMES[SMALL_PRIMES_MAX_COUNT];
+static size_t NUM_SMALL_PRIMES = 0;
+static pthread_once_t small_primes_once = PTHREAD_ONCE_INIT;
+
+static void setup_small_primes(void)
+{
+    static unsigned char composite[SMALL_PRIMES_LIMIT];
+    memset(composite, 0, sizeof(composite));
+
+    for (uint32_t i = 2; i < SMALL_PRIMES_LIMIT; ++i)
+    {
+        if (composite[i])
+            continue;
+        SMALL_PRIMES[NUM_SMALL_PRIMES++] = i;
+        for (uint32_t j = i * i; j < SMALL_PRIMES_LIMIT; j += i)
+            composite[j] = 1;
+    }
+}
+
+const uint32_t *small_primes(size_t *count)
+{
+    pthread_once(&small_primes_once, &setup_small_primes);
+    *count = NUM_SMALL_PRIMES;
+    return SMALL_PRIMES;
+}
+
+uint32_t small_prime_inverse(uint32_t a, uint32_t p)
+{
+    // extended euclid, with the coefficients kept modulo p
+    int64_t t = 0;
+    int64_t new_t = 1;
+    int64_t r = p;
+    int64_t new_r = a % p;
+    while (new_r != 0)
+    {
+        int64_t quotient = r / new_r;
+        int64_t tmp = t - quotient * new_t;
+        t = new_t;
+        new_t = tmp;
+        tmp = r - quotient * new_r;
+        r = new_r;
+        new_r = tmp;
+    }
+    return t < 0 ? t + p : t;
+}
@@ -0,0 +1,22 @@
+#ifndef SMALL_PRIMES_H
+#define SMALL_PRIMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The table holds every prime below this bound
+#define SMALL_PRIMES_LIMIT (1u << 16)
+
+/*
+ * Primes below SMALL_PRIMES_LIMIT, in increasing order (2 included). The
+ * table is built with the sieve of Eratosthenes on the first call, and is
+ * never freed. Safe to call from several threads.
+ */
+const uint32_t *small_primes(size_t *count);
+
+/*
+ * Inverse of a modulo the prime p (a not a multiple of p)
+ */
+uint32_t small_prime_inverse(uint32_t a, uint32_t p);
+
+#endif /* !SMALL_PRIMES_H */
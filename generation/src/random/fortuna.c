@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -10,6 +11,7 @@
 #include "random/random.h"
 #include "utils/logging.h"
 #include "utils/rsa/rsa.h"
+#include "utils/stats.h"
 
 #define FORTUNA_NUM_POOLS 3
 
@@ -17,19 +19,51 @@
 #    define FORTUNA_RESEED_PERIOD 1000
 #endif /* !FORTUNA_RESEED_PERIOD  */
 
-int f_seed = 0;
-int f_counter = 0;
+/*
+ * Generator state of a thread : the RSA permutation is shared, and every
+ * thread encrypts its own stream of inputs (stream << 32 | counter), so that
+ * no lock is taken on a draw and the threads never draw the same input.
+ */
+struct fortuna_state
+{
+    // fortuna_generation the state was seeded in
+    unsigned generation;
+    uint32_t stream;
+    uint32_t counter;
+    int seed;
+    unsigned num_calls;
+    unsigned pool_counter;
+};
+
+// Incremented by fortuna_seed() : the threads seed their state again
+static unsigned fortuna_generation = 0;
+static uint32_t fortuna_num_streams = 0;
+
+static __thread struct fortuna_state state = { 0 };
 
 static void fortuna_seed_from_pool(unsigned pool_index);
 
+// Seed the state of the calling thread from the pools, once per thread
+static void fortuna_seed_state(void)
+{
+    state.generation = __atomic_load_n(&fortuna_generation, __ATOMIC_ACQUIRE);
+    state.stream =
+        __atomic_fetch_add(&fortuna_num_streams, 1, __ATOMIC_RELAXED);
+    for (unsigned pool_index = 0; pool_index < FORTUNA_NUM_POOLS; ++pool_index)
+        fortuna_seed_from_pool(pool_index);
+    state.counter = state.seed;
+    state.num_calls = 0;
+    state.pool_counter = 0;
+}
+
 int fortuna_seed(void)
 {
     if (!initialize_rsa())
         return 0;
 
-    for (unsigned pool_index = 0; pool_index < FORTUNA_NUM_POOLS; ++pool_index)
-        fortuna_seed_from_pool(pool_index);
-    f_counter = f_seed;
+    __atomic_store_n(&fortuna_num_streams, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&fortuna_generation, 1, __ATOMIC_RELEASE);
+    fortuna_seed_state();
     return 1;
 }
 
@@ -41,19 +75,22 @@ void fortuna_cleanup(void)
 
 int fortuna_rand(void)
 {
+    if (state.generation
+        != __atomic_load_n(&fortuna_generation, __ATOMIC_ACQUIRE))
+        fortuna_seed_state();
+
 #ifndef FORTUNA_NO_AUTO_RESEED
-    static unsigned num_calls = 0;
-    static unsigned pool_counter = 0;
-    if (++num_calls == FORTUNA_RESEED_PERIOD)
+    if (++state.num_calls == FORTUNA_RESEED_PERIOD)
     {
-        num_calls = 0;
+        state.num_calls = 0;
+        STATS_ADD(STATS_RESEEDS, 1)
         LOG_DEBUG("reseeding with pool counter %u (pool index = %u)",
-                  pool_counter, pool_counter % FORTUNA_NUM_POOLS)
-        fortuna_seed_from_pool(pool_counter++);
+                  state.pool_counter, state.pool_counter % FORTUNA_NUM_POOLS)
+        fortuna_seed_from_pool(state.pool_counter++);
     }
 #endif /* !FORTUNA_NO_AUTO_RESEED */
 
-    return rsa_encrypt(f_counter++);
+    return rsa_encrypt((uint64_t)state.stream << 32 | state.counter++);
 }
 
 void fortuna_seed_from_pool(unsigned pool_index)
@@ -62,17 +99,26 @@ void fortuna_seed_from_pool(unsigned pool_index)
     switch (pool_index)
     {
     case 0: {
-        f_seed = no_init_random_int();
+        state.seed = no_init_random_int();
     }
     break;
+#ifndef DETERMINISTIC_RNG
     case 1: {
-        f_seed ^= time(NULL);
+        state.seed ^= time(NULL);
+    }
+    break;
+    case 2: {
+        state.seed ^= (getpid() << 16) | pthread_self();
     }
     break;
+#else /* !DETERMINISTIC_RNG */
+    case 1:
     case 2: {
-        f_seed ^= (getpid() << 16) | pthread_self();
+        // time and pid would make the runs irreproducible
+        state.seed ^= no_init_random_int();
     }
     break;
+#endif /* !DETERMINISTIC_RNG */
     default:
         LOG_WARN("invalid pool index %d / %d", pool_index, FORTUNA_NUM_POOLS)
         break;
@@ -5,6 +5,10 @@ int fortuna_seed(void);
 
 void fortuna_cleanup(void);
 
+/*
+ * Next random int of the calling thread. Every thread has its own state,
+ * seeded on its first call : safe to call from several threads.
+ */
 int fortuna_rand(void);
 
 #endif /* !FORTUNA_H */
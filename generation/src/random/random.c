@@ -7,11 +7,39 @@
 
 #include "random/fortuna.h"
 #include "utils/logging.h"
+#include "utils/stats.h"
 
 int prng_initialized = 0;
 
+#ifdef DETERMINISTIC_RNG
+/*
+ * Seeded (splitmix64) replacement of the system random bytes. Fortuna is
+ * seeded from it too, so that whole runs are reproducible. It is meant for
+ * benchmarks only : the output is NOT cryptographically secure.
+ */
+static unsigned long deterministic_state = DETERMINISTIC_RNG_DEFAULT_SEED;
+
+void random_set_seed(unsigned long seed)
+{
+    deterministic_state = seed;
+}
+
+static int deterministic_random_int(void)
+{
+    unsigned long z = __atomic_add_fetch(
+        &deterministic_state, 0x9e3779b97f4a7c15ul, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ul;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebul;
+    return (int)(z ^ (z >> 31));
+}
+#endif /* DETERMINISTIC_RNG */
+
 int initialize_prng(void)
 {
+#ifdef DETERMINISTIC_RNG
+    LOG_WARN("built with DETERMINISTIC_RNG: output is NOT cryptographically "
+             "secure")
+#endif /* DETERMINISTIC_RNG */
     if (!fortuna_seed())
     {
         LOG_INFO("PRNG initialization failed")
@@ -37,15 +65,25 @@ void cleanup_prng(void)
 
 int random_int(void)
 {
-    return prng_initialized ? fortuna_rand() : no_init_random_int();
+    if (!prng_initialized)
+        return no_init_random_int();
+
+    STATS_ADD(STATS_RNG_BYTES, sizeof(int))
+    // no lock : every thread draws from its own Fortuna stream
+    return fortuna_rand();
 }
 
 int no_init_random_int(void)
 {
+    STATS_ADD(STATS_RNG_BYTES, sizeof(int))
+#ifdef DETERMINISTIC_RNG
+    return deterministic_random_int();
+#else /* DETERMINISTIC_RNG */
     int value;
     if (getrandom(&value, sizeof(int), GRND_RANDOM) == -1)
         LOG_ERROR("%s", strerror(errno))
     return value;
+#endif /* DETERMINISTIC_RNG */
 }
 
 int random_decision()
@@ -67,6 +105,8 @@ static int random_bn_fill(BIGNUM *p, unsigned pos, unsigned until,
 void bn_rand_max(BIGNUM *n, BIGNUM *max)
 {
     unsigned length = BN_num_bits(max);
+    // bits above length would never be cleared by the loop below
+    BN_zero(n);
     BN_set_bit(n, length - 1);
     random_bn_fill(n, 0, length, &random_int);
 
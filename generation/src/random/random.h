@@ -21,4 +21,15 @@ void random_bn_from_range(BIGNUM *r, BIGNUM *a, BIGNUM *b);
 
 int generate_prime_candidate(BIGNUM *p, unsigned length);
 
+#ifdef DETERMINISTIC_RNG
+#    ifndef DETERMINISTIC_RNG_DEFAULT_SEED
+#        define DETERMINISTIC_RNG_DEFAULT_SEED 0
+#    endif /* !DETERMINISTIC_RNG_DEFAULT_SEED */
+
+/*
+ * Reset the seeded generator : the same seed gives the same candidates.
+ */
+void random_set_seed(unsigned long seed);
+#endif /* DETERMINISTIC_RNG */
+
 #endif /* !RANDOM_H */
@@ -0,0 +1,431 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "corpus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/logging.h"
+
+// A varint holds 7 bits per byte
+#define VARINT_MAX_SIZE 10
+// Bytes per index entry : first value, offset
+#define INDEX_ENTRY_SIZE 16
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+enum header_field
+{
+    HEADER_VERSION = 8, // uint32
+    HEADER_BLOCK_SIZE = 12, // uint32
+    HEADER_COUNT = 16,
+    HEADER_NUM_BLOCKS = 24,
+    HEADER_INDEX_OFFSET = 32,
+    HEADER_DATA_CHECKSUM = 40,
+    HEADER_INDEX_CHECKSUM = 48,
+};
+
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+static uint32_t load32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store64(unsigned char *p, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i, value >>= 8)
+        p[i] = value & 0xff;
+}
+
+static void store32(unsigned char *p, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i, value >>= 8)
+        p[i] = value & 0xff;
+}
+
+// FNV-1a, continued from hash
+static uint64_t checksum(uint64_t hash, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    return hash;
+}
+
+int is_corpus_file(const char *path)
+{
+    char magic[sizeof(CORPUS_MAGIC) - 1];
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return 0;
+    int success = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+        && memcmp(magic, CORPUS_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return success;
+}
+
+static int check_header(struct corpus *corpus)
+{
+    const unsigned char *header = corpus->map;
+    if (corpus->size < CORPUS_HEADER_SIZE
+        || memcmp(header, CORPUS_MAGIC, sizeof(CORPUS_MAGIC) - 1) != 0)
+    {
+        LOG_ERROR("not a corpus file")
+        return 0;
+    }
+    if (load32(header + HEADER_VERSION) != CORPUS_VERSION)
+    {
+        LOG_ERROR("unsupported corpus version %u",
+                  load32(header + HEADER_VERSION))
+        return 0;
+    }
+
+    corpus->block_size = load32(header + HEADER_BLOCK_SIZE);
+    corpus->count = load64(header + HEADER_COUNT);
+    corpus->num_blocks = load64(header + HEADER_NUM_BLOCKS);
+    uint64_t index_offset = load64(header + HEADER_INDEX_OFFSET);
+    // num_blocks is bounded by the file size before any multiplication
+    if (corpus->block_size == 0 || index_offset < CORPUS_HEADER_SIZE
+        || index_offset > corpus->size
+        || corpus->num_blocks
+            > (corpus->size - index_offset) / INDEX_ENTRY_SIZE
+        || corpus->size - index_offset
+            != corpus->num_blocks * INDEX_ENTRY_SIZE
+        || corpus->num_blocks
+            != corpus->count / corpus->block_size
+                + (corpus->count % corpus->block_size != 0))
+    {
+        LOG_ERROR("inconsistent corpus header")
+        return 0;
+    }
+
+    corpus->index = corpus->map + index_offset;
+    if (checksum(FNV_OFFSET_BASIS, corpus->index,
+                 corpus->num_blocks * INDEX_ENTRY_SIZE)
+        != load64(header + HEADER_INDEX_CHECKSUM))
+    {
+        LOG_ERROR("corpus index checksum mismatch")
+        return 0;
+    }
+    for (uint64_t i = 0; i < corpus->num_blocks; ++i)
+    {
+        const unsigned char *entry = corpus->index + i * INDEX_ENTRY_SIZE;
+        uint64_t offset = load64(entry + 8);
+        if (offset < CORPUS_HEADER_SIZE || offset > index_offset
+            || (i != 0 && load64(entry) <= load64(entry - INDEX_ENTRY_SIZE)))
+        {
+            LOG_ERROR("corrupt corpus index entry %lu", (unsigned long)i)
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int corpus_open(struct corpus *corpus, const char *path)
+{
+    memset(corpus, 0, sizeof(struct corpus));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        LOG_ERROR("failed to stat %s (or empty file)", path)
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("failed to map %s: %s", path, strerror(errno))
+        return 0;
+    }
+    corpus->map = map;
+    corpus->size = st.st_size;
+
+    if (!check_header(corpus))
+    {
+        LOG_ERROR("invalid corpus %s", path)
+        corpus_close(corpus);
+        return 0;
+    }
+    return 1;
+}
+
+void corpus_close(struct corpus *corpus)
+{
+    if (corpus->map != NULL)
+        munmap((void *)corpus->map, corpus->size);
+    memset(corpus, 0, sizeof(struct corpus));
+}
+
+static uint64_t block_first(const struct corpus *corpus, uint64_t block)
+{
+    return load64(corpus->index + block * INDEX_ENTRY_SIZE);
+}
+
+// bytes of the block : up to the next one (or the index)
+static const unsigned char *block_data(const struct corpus *corpus,
+                                       uint64_t block,
+                                       const unsigned char **end)
+{
+    const unsigned char *entry = corpus->index + block * INDEX_ENTRY_SIZE;
+    *end = block + 1 < corpus->num_blocks
+        ? corpus->map + load64(entry + INDEX_ENTRY_SIZE + 8)
+        : corpus->index;
+    return corpus->map + load64(entry + 8);
+}
+
+/*
+ * Read a varint and move p past it. Returns 0 if it is truncated or too long.
+ */
+static int read_varint(const unsigned char **p, const unsigned char *end,
+                       uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift = 0; *p < end && shift < 7 * VARINT_MAX_SIZE;
+         shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+static size_t block_count(const struct corpus *corpus, uint64_t block)
+{
+    if (block + 1 < corpus->num_blocks)
+        return corpus->block_size;
+    return corpus->count - block * corpus->block_size;
+}
+
+size_t corpus_decode_block(const struct corpus *corpus, uint64_t block,
+                           uint64_t *values)
+{
+    const unsigned char *end;
+    const unsigned char *p = block_data(corpus, block, &end);
+    size_t count = block_count(corpus, block);
+
+    values[0] = block_first(corpus, block);
+    for (size_t i = 1; i < count; ++i)
+    {
+        uint64_t delta;
+        if (!read_varint(&p, end, &delta) || delta == 0
+            || values[i - 1] + delta < values[i - 1])
+            return 0;
+        values[i] = values[i - 1] + delta;
+    }
+    return p == end ? count : 0;
+}
+
+int corpus_verify(const struct corpus *corpus)
+{
+    const unsigned char *data = corpus->map + CORPUS_HEADER_SIZE;
+    if (checksum(FNV_OFFSET_BASIS, data, corpus->index - data)
+        != load64(corpus->map + HEADER_DATA_CHECKSUM))
+    {
+        LOG_ERROR("corpus data checksum mismatch")
+        return 0;
+    }
+
+    uint64_t *values = malloc(corpus->block_size * sizeof(uint64_t));
+    if (values == NULL)
+    {
+        LOG_ERROR("failed to allocate block: %s", strerror(errno))
+        return 0;
+    }
+    int success = 1;
+    for (uint64_t block = 0; block < corpus->num_blocks && success; ++block)
+    {
+        size_t count = corpus_decode_block(corpus, block, values);
+        // blocks must chain up in increasing order
+        success = count != 0
+            && (block + 1 == corpus->num_blocks
+                || values[count - 1] < block_first(corpus, block + 1));
+        if (!success)
+            LOG_ERROR("corrupt corpus block %lu", (unsigned long)block)
+    }
+    free(values);
+    return success;
+}
+
+uint64_t corpus_get(const struct corpus *corpus, uint64_t i)
+{
+    uint64_t block = i / corpus->block_size;
+    const unsigned char *end;
+    const unsigned char *p = block_data(corpus, block, &end);
+    uint64_t value = block_first(corpus, block);
+    // decode the deltas up to the i-th entry only
+    uint64_t delta;
+    for (uint64_t j = i % corpus->block_size;
+         j != 0 && read_varint(&p, end, &delta); --j)
+        value += delta;
+    return value;
+}
+
+uint64_t corpus_lower_bound(const struct corpus *corpus, uint64_t value)
+{
+    if (corpus->count == 0 || value <= block_first(corpus, 0))
+        return 0;
+
+    // last block starting below value
+    uint64_t lo = 0;
+    uint64_t hi = corpus->num_blocks;
+    while (hi - lo > 1)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (block_first(corpus, mid) < value)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    const unsigned char *end;
+    const unsigned char *p = block_data(corpus, lo, &end);
+    uint64_t current = block_first(corpus, lo);
+    uint64_t i = lo * corpus->block_size;
+    uint64_t block_end = i + block_count(corpus, lo);
+    uint64_t delta;
+    while (current < value && ++i < block_end && read_varint(&p, end, &delta))
+        current += delta;
+    return i;
+}
+
+int corpus_writer_open(struct corpus_writer *writer, const char *path,
+                       uint32_t block_size)
+{
+    memset(writer, 0, sizeof(struct corpus_writer));
+    if (block_size == 0)
+        block_size = CORPUS_DEFAULT_BLOCK_SIZE;
+    writer->block_size = block_size;
+    writer->offset = CORPUS_HEADER_SIZE;
+    writer->checksum = FNV_OFFSET_BASIS;
+
+    writer->f = fopen(path, "wb");
+    if (writer->f == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+    // the header is written last, when everything is known
+    unsigned char header[CORPUS_HEADER_SIZE] = { 0 };
+    if (fwrite(header, 1, sizeof(header), writer->f) != sizeof(header))
+    {
+        LOG_ERROR("failed to write %s: %s", path, strerror(errno))
+        fclose(writer->f);
+        writer->f = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static int writer_new_block(struct corpus_writer *writer, uint64_t value)
+{
+    uint64_t block = writer->count / writer->block_size;
+    if (2 * block + 2 > writer->index_capacity)
+    {
+        uint64_t capacity =
+            writer->index_capacity ? 2 * writer->index_capacity : 1024;
+        uint64_t *index = realloc(writer->index, capacity * sizeof(uint64_t));
+        if (index == NULL)
+        {
+            LOG_ERROR("failed to allocate corpus index: %s", strerror(errno))
+            return 0;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+    writer->index[2 * block] = value;
+    writer->index[2 * block + 1] = writer->offset;
+    return 1;
+}
+
+int corpus_writer_add(struct corpus_writer *writer, uint64_t value)
+{
+    if (writer->count != 0 && value <= writer->last)
+    {
+        LOG_ERROR("corpus entries must be increasing (%lu after %lu)",
+                  (unsigned long)value, (unsigned long)writer->last)
+        return 0;
+    }
+
+    if (writer->count % writer->block_size == 0)
+    {
+        if (!writer_new_block(writer, value))
+            return 0;
+    }
+    else
+    {
+        unsigned char varint[VARINT_MAX_SIZE];
+        size_t size = 0;
+        uint64_t delta = value - writer->last;
+        for (; delta >= 0x80; delta >>= 7)
+            varint[size++] = (delta & 0x7f) | 0x80;
+        varint[size++] = delta;
+        if (fwrite(varint, 1, size, writer->f) != size)
+        {
+            LOG_ERROR("failed to write corpus: %s", strerror(errno))
+            return 0;
+        }
+        writer->checksum = checksum(writer->checksum, varint, size);
+        writer->offset += size;
+    }
+
+    writer->last = value;
+    ++writer->count;
+    return 1;
+}
+
+int corpus_writer_close(struct corpus_writer *writer)
+{
+    uint64_t num_blocks =
+        (writer->count + writer->block_size - 1) / writer->block_size;
+    uint64_t index_checksum = FNV_OFFSET_BASIS;
+    int success = 1;
+    for (uint64_t i = 0; i < num_blocks && success; ++i)
+    {
+        unsigned char entry[INDEX_ENTRY_SIZE];
+        store64(entry, writer->index[2 * i]);
+        store64(entry + 8, writer->index[2 * i + 1]);
+        index_checksum = checksum(index_checksum, entry, sizeof(entry));
+        success = fwrite(entry, 1, sizeof(entry), writer->f) == sizeof(entry);
+    }
+
+    unsigned char header[CORPUS_HEADER_SIZE] = { 0 };
+    memcpy(header, CORPUS_MAGIC, sizeof(CORPUS_MAGIC) - 1);
+    store32(header + HEADER_VERSION, CORPUS_VERSION);
+    store32(header + HEADER_BLOCK_SIZE, writer->block_size);
+    store64(header + HEADER_COUNT, writer->count);
+    store64(header + HEADER_NUM_BLOCKS, num_blocks);
+    store64(header + HEADER_INDEX_OFFSET, writer->offset);
+    store64(header + HEADER_DATA_CHECKSUM, writer->checksum);
+    store64(header + HEADER_INDEX_CHECKSUM, index_checksum);
+    success = success && fseek(writer->f, 0, SEEK_SET) == 0
+        && fwrite(header, 1, sizeof(header), writer->f) == sizeof(header);
+    success = fclose(writer->f) == 0 && success;
+    if (!success)
+        LOG_ERROR("failed to write corpus: %s", strerror(errno))
+
+    free(writer->index);
+    memset(writer, 0, sizeof(struct corpus_writer));
+    return success;
+}
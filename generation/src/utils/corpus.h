@@ -0,0 +1,98 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Binary corpus of increasing 64-bit numbers (e.g. the base-2 pseudoprimes).
+ * All the fields are little-endian :
+ *  - a header of CORPUS_HEADER_SIZE bytes (magic, version, block size,
+ *    number of entries and blocks, offset of the index, checksums)
+ *  - the blocks : every entry of a block but the first is the LEB128 varint
+ *    of its difference with the previous one
+ *  - the sparse index : first value and offset of every block
+ * The file is mapped as is : a lookup is a binary search of the index and
+ * the decoding of a single block.
+ */
+
+#define CORPUS_MAGIC "PSPCORP1"
+#define CORPUS_VERSION 1
+#define CORPUS_HEADER_SIZE 64
+#define CORPUS_DEFAULT_BLOCK_SIZE 4096
+
+struct corpus
+{
+    const unsigned char *map;
+    size_t size;
+    uint64_t count;
+    uint32_t block_size;
+    uint64_t num_blocks;
+    const unsigned char *index;
+};
+
+struct corpus_writer
+{
+    FILE *f;
+    uint32_t block_size;
+    uint64_t count;
+    uint64_t last;
+    uint64_t offset;
+    uint64_t checksum;
+    // first value and offset of every block
+    uint64_t *index;
+    uint64_t index_capacity;
+};
+
+/*
+ * Check the first bytes of a file for the corpus magic
+ */
+int is_corpus_file(const char *path);
+
+/*
+ * Map a corpus and check its header and index (see corpus_verify for the
+ * data). Returns 1 on success, 0 on failure.
+ */
+int corpus_open(struct corpus *corpus, const char *path);
+
+void corpus_close(struct corpus *corpus);
+
+/*
+ * Check the data checksum and that every block decodes to increasing
+ * entries. Returns 1 if the corpus is valid.
+ */
+int corpus_verify(const struct corpus *corpus);
+
+/*
+ * Decode the block-th block into values (block_size entries at most).
+ * Returns the number of entries, or 0 if the block is corrupt.
+ */
+size_t corpus_decode_block(const struct corpus *corpus, uint64_t block,
+                           uint64_t *values);
+
+/*
+ * i-th entry (i < count)
+ */
+uint64_t corpus_get(const struct corpus *corpus, uint64_t i);
+
+/*
+ * Position of the first entry >= value (count if there is none)
+ */
+uint64_t corpus_lower_bound(const struct corpus *corpus, uint64_t value);
+
+/*
+ * Write a corpus one entry at a time, in increasing order. Return 1 on
+ * success, 0 on failure.
+ */
+int corpus_writer_open(struct corpus_writer *writer, const char *path,
+                       uint32_t block_size);
+
+int corpus_writer_add(struct corpus_writer *writer, uint64_t value);
+
+/*
+ * Write the index and the header, and close the file
+ */
+int corpus_writer_close(struct corpus_writer *writer);
+
+#endif /* !CORPUS_H */
@@ -1,5 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "logging.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 /*
  * 0: quiet (not even error messages)
  * 1: no warnings
@@ -8,3 +18,322 @@
  * 4: default + info & debug messages
  */
 int LOG_LEVEL = DEFAULT_LOG_LEVEL;
+
+enum log_sink LOG_SINK = LOG_SINK_SYNC;
+
+// Must be a power of two
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 240
+// Sleep duration of the writer when all the rings are empty
+#define LOG_WRITER_IDLE_NS 200000
+
+#define LOG_BINARY_MAGIC "MPLOG\0\1\0"
+
+// Destination of the binary records (the text goes to stderr)
+#define LOG_DEFAULT_FILE "my_prime.log"
+
+struct log_record
+{
+    uint64_t timestamp_ns;
+    const char *prefix;
+    const char *file;
+    const char *func;
+    int line;
+    int level;
+    unsigned length;
+    char message[LOG_MESSAGE_SIZE];
+};
+
+/*
+ * Single-producer (the owning thread) single-consumer (the writer) ring.
+ * 'head' is only written by the producer and 'tail' only by the consumer,
+ * so neither side ever waits for the other : when the ring is full, the
+ * message is dropped and counted.
+ */
+struct log_ring
+{
+    struct log_record records[LOG_RING_SIZE];
+    unsigned head;
+    unsigned tail;
+    unsigned long dropped;
+    struct log_ring *next;
+};
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *rings = NULL;
+static __thread struct log_ring *local_ring = NULL;
+
+static const char *log_path = LOG_DEFAULT_FILE;
+// stderr, or the binary log file while the writer runs
+static FILE *log_out = NULL;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static int writer_stop = 0;
+
+int set_log_sink(const char *arg)
+{
+    if (strcmp(arg, "--log-async") == 0
+        || strcmp(arg, "--log-async=text") == 0)
+        LOG_SINK = LOG_SINK_ASYNC_TEXT;
+    else if (strcmp(arg, "--log-async=binary") == 0)
+        LOG_SINK = LOG_SINK_ASYNC_BINARY;
+    else
+        return 0;
+
+    return 1;
+}
+
+void set_log_file(const char *path)
+{
+    log_path = path;
+}
+
+static struct log_ring *get_local_ring(void)
+{
+    if (local_ring != NULL)
+        return local_ring;
+
+    struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+    if (ring == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_lock);
+
+    local_ring = ring;
+    return ring;
+}
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void log_message_sync(const char *prefix, const char *file, int line,
+                             const char *func, const char *format,
+                             va_list args)
+{
+    char message[LOG_MESSAGE_SIZE * 4];
+    vsnprintf(message, sizeof(message), format, args);
+    fprintf(stderr,
+            "%s (\033[35m%s\033[39m:\033[34m%d\033[39m) "
+            "[\033[93m%s\033[39m]: %s\n",
+            prefix, file, line, func, message);
+}
+
+void log_message(int level, const char *prefix, const char *file, int line,
+                 const char *func, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    struct log_ring *ring = NULL;
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)
+        || (ring = get_local_ring()) == NULL)
+    {
+        log_message_sync(prefix, file, line, func, format, args);
+        va_end(args);
+        return;
+    }
+
+    unsigned head = ring->head;
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == LOG_RING_SIZE)
+    {
+        ++ring->dropped;
+        va_end(args);
+        return;
+    }
+
+    // prefix, file and func are string literals : keeping pointers is safe
+    struct log_record *record = &ring->records[head % LOG_RING_SIZE];
+    record->timestamp_ns = realtime_ns();
+    record->prefix = prefix;
+    record->file = file;
+    record->func = func;
+    record->line = line;
+    record->level = level;
+    int length = vsnprintf(record->message, LOG_MESSAGE_SIZE, format, args);
+    if (length < 0)
+        length = 0;
+    if (length >= LOG_MESSAGE_SIZE)
+        length = LOG_MESSAGE_SIZE - 1;
+    record->length = length;
+    va_end(args);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The writer batches its output : stderr is unbuffered, and a write(2) per
+ * message is what made verbose runs so slow in the first place.
+ */
+static char out_buffer[1 << 16];
+static size_t out_length = 0;
+
+static void out_flush(void)
+{
+    fwrite(out_buffer, 1, out_length, log_out);
+    out_length = 0;
+}
+
+static void out_append(const void *data, size_t length)
+{
+    if (out_length + length > sizeof(out_buffer))
+        out_flush();
+    if (length > sizeof(out_buffer))
+    {
+        fwrite(data, 1, length, log_out);
+        return;
+    }
+    memcpy(out_buffer + out_length, data, length);
+    out_length += length;
+}
+
+static void write_record_text(const struct log_record *record)
+{
+    char line[LOG_MESSAGE_SIZE + 512];
+    int length = snprintf(line, sizeof(line),
+                          "%s (\033[35m%s\033[39m:\033[34m%d\033[39m) "
+                          "[\033[93m%s\033[39m]: %.*s\n",
+                          record->prefix, record->file, record->line,
+                          record->func, (int)record->length, record->message);
+    if (length < 0)
+        return;
+    if ((size_t)length >= sizeof(line))
+        length = sizeof(line) - 1;
+    out_append(line, length);
+}
+
+/*
+ * Binary record layout (native endianness) :
+ *   u64 timestamp (ns since epoch), u32 line, u8 level, u8 0,
+ *   u16 file length, u16 func length, u16 message length,
+ *   then the file, func and message bytes (not NUL-terminated)
+ */
+static void write_record_binary(const struct log_record *record)
+{
+    uint16_t file_length = strlen(record->file);
+    uint16_t func_length = strlen(record->func);
+    uint16_t message_length = record->length;
+    uint32_t line = record->line;
+    uint8_t level_pad[2] = { record->level, 0 };
+
+    out_append(&record->timestamp_ns, sizeof(uint64_t));
+    out_append(&line, sizeof(uint32_t));
+    out_append(level_pad, sizeof(level_pad));
+    out_append(&file_length, sizeof(uint16_t));
+    out_append(&func_length, sizeof(uint16_t));
+    out_append(&message_length, sizeof(uint16_t));
+    out_append(record->file, file_length);
+    out_append(record->func, func_length);
+    out_append(record->message, message_length);
+}
+
+static unsigned drain_rings(void)
+{
+    unsigned num_written = 0;
+    struct log_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->next)
+    {
+        unsigned tail = ring->tail;
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; ++tail, ++num_written)
+        {
+            struct log_record *record = &ring->records[tail % LOG_RING_SIZE];
+            if (LOG_SINK == LOG_SINK_ASYNC_BINARY)
+                write_record_binary(record);
+            else
+                write_record_text(record);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (out_length)
+        out_flush();
+
+    return num_written;
+}
+
+static void *writer_routine(void *arg)
+{
+    (void)arg;
+    const struct timespec idle = { .tv_sec = 0,
+                                   .tv_nsec = LOG_WRITER_IDLE_NS };
+
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+        if (drain_rings() == 0)
+            nanosleep(&idle, NULL);
+
+    return NULL;
+}
+
+int start_logging(void)
+{
+    if (LOG_SINK == LOG_SINK_SYNC || writer_running)
+        return 1;
+
+    log_out = stderr;
+    if (LOG_SINK == LOG_SINK_ASYNC_BINARY)
+    {
+        // the synchronous messages and the reports stay on stderr, in text
+        if ((log_out = fopen(log_path, "wb")) == NULL)
+        {
+            LOG_SINK = LOG_SINK_SYNC;
+            LOG_ERROR("failed to open the log file %s: %s", log_path,
+                      strerror(errno))
+            return 0;
+        }
+        fwrite(LOG_BINARY_MAGIC, 1, sizeof(LOG_BINARY_MAGIC) - 1, log_out);
+    }
+
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, &writer_routine, NULL) != 0)
+    {
+        if (log_out != stderr)
+            fclose(log_out);
+        log_out = NULL;
+        LOG_SINK = LOG_SINK_SYNC;
+        LOG_ERROR("failed to start the log writer thread")
+        return 0;
+    }
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+void stop_logging(void)
+{
+    if (!writer_running)
+        return;
+
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer_thread, NULL);
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    // Messages pushed between the last drain and the join
+    drain_rings();
+
+    unsigned long dropped = 0;
+    pthread_mutex_lock(&rings_lock);
+    while (rings != NULL)
+    {
+        struct log_ring *next = rings->next;
+        dropped += rings->dropped;
+        free(rings);
+        rings = next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+    local_ring = NULL;
+
+    if (log_out != stderr && fclose(log_out) != 0)
+        LOG_ERROR("failed to write the log file %s", log_path)
+    log_out = NULL;
+
+    LOG_SINK = LOG_SINK_SYNC;
+    if (dropped)
+        LOG_WARN("%lu log messages were dropped (ring buffers full)", dropped)
+}
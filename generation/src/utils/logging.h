@@ -6,16 +6,24 @@
 
 #define DEFAULT_LOG_LEVEL 2
 
+/*
+ * Compile-time ceiling of LOG_LEVEL : every call site whose level is not
+ * below it is removed by the compiler (e.g. -DLOG_LEVEL_MAX=2 keeps only
+ * the error and warning messages).
+ */
+#ifndef LOG_LEVEL_MAX
+#    define LOG_LEVEL_MAX 4
+#endif /* !LOG_LEVEL_MAX */
+
 #define OPENSSL_ERR_STRING ERR_error_string(ERR_get_error(), NULL)
 
 #define LOG_MESSAGE(LogLevelThreshold, Prefix, Format, ...)                    \
     {                                                                          \
-        if (LOG_LEVEL > (LogLevelThreshold))                                   \
+        if ((LogLevelThreshold) < LOG_LEVEL_MAX                                \
+            && LOG_LEVEL > (LogLevelThreshold))                                \
         {                                                                      \
-            fprintf(stderr,                                                    \
-                    Prefix " (\033[35m%s\033[39m:\033[34m%d\033[39m) "         \
-                           "[\033[93m%s\033[39m]: " Format "\n",               \
-                    __FILE__, __LINE__, __func__, ##__VA_ARGS__);              \
+            log_message((LogLevelThreshold), Prefix, __FILE__, __LINE__,       \
+                        __func__, Format, ##__VA_ARGS__);                      \
         }                                                                      \
     }
 
@@ -31,6 +39,42 @@
 #define LOG_DEBUG(Format, ...)                                                 \
     LOG_MESSAGE(3, "\033[94m{DEBUG}\033[39m", Format, ##__VA_ARGS__)
 
+enum log_sink
+{
+    LOG_SINK_SYNC = 0, // fprintf on stderr, from the calling thread
+    LOG_SINK_ASYNC_TEXT, // per-thread ring buffers, drained to stderr
+    LOG_SINK_ASYNC_BINARY, // same, with binary records in the log file
+};
+
 extern int LOG_LEVEL;
 
+extern enum log_sink LOG_SINK;
+
+/*
+ * Parse the argument of "--log-async[=text|binary]".
+ * Returns 0 if the format is unknown.
+ */
+int set_log_sink(const char *arg);
+
+/*
+ * File the binary records of "--log-async=binary" are written to
+ * (my_prime.log by default). path must outlive the logging.
+ */
+void set_log_file(const char *path);
+
+/*
+ * Start the background writer if an asynchronous sink was selected.
+ * Returns 0 on failure (the synchronous sink is then used).
+ */
+int start_logging(void);
+
+/*
+ * Stop the background writer, after writing every pending message.
+ */
+void stop_logging(void);
+
+void log_message(int level, const char *prefix, const char *file, int line,
+                 const char *func, const char *format, ...)
+    __attribute__((format(printf, 6, 7)));
+
 #endif /* !LOGGING_H */
@@ -0,0 +1,101 @@
+#ifndef MONT64_H
+#define MONT64_H
+
+#include <stdint.h>
+
+/*
+ * Montgomery arithmetic modulo an odd n < 2^63, with R = 2^64 and 128-bit
+ * products. Everything is inlined : these are the inner loops of the
+ * scanning tools, where BIGNUMs would cost more than the arithmetic.
+ */
+struct mont64
+{
+    uint64_t n;
+    // -n^-1 mod 2^64
+    uint64_t n_inv;
+    // R mod n (1 in Montgomery form) and R^2 mod n
+    uint64_t one;
+    uint64_t r2;
+};
+
+static inline void mont64_init(struct mont64 *m, uint64_t n)
+{
+    // Newton iteration : every step doubles the number of correct bits
+    uint64_t inv = n;
+    for (int i = 0; i < 5; ++i)
+        inv *= 2 - n * inv;
+
+    m->n = n;
+    m->n_inv = -inv;
+    m->one = (uint64_t)(((unsigned __int128)1 << 64) % n);
+    m->r2 = (uint64_t)((unsigned __int128)m->one * m->one % n);
+}
+
+// t * R^-1 mod n, for t < n * R
+static inline uint64_t mont64_redc(const struct mont64 *m, unsigned __int128 t)
+{
+    uint64_t q = (uint64_t)t * m->n_inv;
+    uint64_t r = (uint64_t)((t + (unsigned __int128)q * m->n) >> 64);
+    return r >= m->n ? r - m->n : r;
+}
+
+static inline uint64_t mont64_mul(const struct mont64 *m, uint64_t a,
+                                  uint64_t b)
+{
+    return mont64_redc(m, (unsigned __int128)a * b);
+}
+
+static inline uint64_t mont64_add(const struct mont64 *m, uint64_t a,
+                                  uint64_t b)
+{
+    uint64_t r = a + b;
+    return r >= m->n ? r - m->n : r;
+}
+
+static inline uint64_t mont64_sub(const struct mont64 *m, uint64_t a,
+                                  uint64_t b)
+{
+    return a >= b ? a - b : a + m->n - b;
+}
+
+static inline uint64_t mont64_to(const struct mont64 *m, uint64_t a)
+{
+    return mont64_mul(m, a % m->n, m->r2);
+}
+
+static inline uint64_t mont64_from(const struct mont64 *m, uint64_t a)
+{
+    return mont64_redc(m, a);
+}
+
+// a^e, with a and the result in Montgomery form
+static inline uint64_t mont64_pow(const struct mont64 *m, uint64_t a,
+                                  uint64_t e)
+{
+    uint64_t result = m->one;
+    for (; e != 0; e >>= 1)
+    {
+        if (e & 1)
+            result = mont64_mul(m, result, a);
+        a = mont64_mul(m, a, a);
+    }
+    return result;
+}
+
+/*
+ * 2^e in Montgomery form, left to right : multiplying by 2 is a modular
+ * addition, so every bit costs a single squaring.
+ */
+static inline uint64_t mont64_pow2(const struct mont64 *m, uint64_t e)
+{
+    uint64_t result = m->one;
+    for (int bit = 63 - __builtin_clzll(e | 1); bit >= 0; --bit)
+    {
+        result = mont64_mul(m, result, result);
+        if ((e >> bit) & 1)
+            result = mont64_add(m, result, result);
+    }
+    return result;
+}
+
+#endif /* !MONT64_H */
@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "result_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/logging.h"
+
+// Slots of a new cache (a power of two), 48 bytes each
+#ifndef RESULT_CACHE_SLOTS
+#    define RESULT_CACHE_SLOTS (1u << 16)
+#endif /* !RESULT_CACHE_SLOTS */
+
+// Slots a number can live in, from its home slot
+#ifndef RESULT_CACHE_PROBES
+#    define RESULT_CACHE_PROBES 16
+#endif /* !RESULT_CACHE_PROBES */
+
+#if (RESULT_CACHE_SLOTS & (RESULT_CACHE_SLOTS - 1)) != 0                      \
+    || RESULT_CACHE_SLOTS < RESULT_CACHE_PROBES
+#    error "RESULT_CACHE_SLOTS must be a power of two >= RESULT_CACHE_PROBES"
+#endif
+
+struct cache_header
+{
+    char magic[sizeof(RESULT_CACHE_MAGIC) - 1];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_slots;
+    // incremented on every access, 0 marks the empty slots
+    uint64_t clock;
+};
+
+struct cache_slot
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    uint64_t last_used;
+    struct result_cache_entry entry;
+};
+
+static int lock_cache(const struct result_cache *cache, short type)
+{
+    struct flock lock = {
+        .l_type = type,
+        .l_whence = SEEK_SET,
+        .l_start = 0,
+        .l_len = 0,
+    };
+    while (fcntl(cache->fd, F_SETLKW, &lock) == -1)
+    {
+        if (errno != EINTR)
+        {
+            LOG_ERROR("failed to lock the cache: %s", strerror(errno))
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void unlock_cache(const struct result_cache *cache)
+{
+    struct flock lock = {
+        .l_type = F_UNLCK,
+        .l_whence = SEEK_SET,
+        .l_start = 0,
+        .l_len = 0,
+    };
+    fcntl(cache->fd, F_SETLK, &lock);
+}
+
+static struct cache_header *cache_header(const struct result_cache *cache)
+{
+    return (struct cache_header *)cache->map;
+}
+
+static struct cache_slot *cache_slot(const struct result_cache *cache,
+                                     uint64_t i)
+{
+    return (struct cache_slot *)(cache->map + RESULT_CACHE_HEADER_SIZE)
+        + (i & (cache->num_slots - 1));
+}
+
+// Write the header and size the file, if it is new (under the write lock)
+static int initialize_file(struct result_cache *cache, const char *path)
+{
+    struct stat st;
+    if (fstat(cache->fd, &st) == -1)
+    {
+        LOG_ERROR("failed to stat %s: %s", path, strerror(errno))
+        return 0;
+    }
+    if (st.st_size != 0)
+        return 1;
+
+    LOG_INFO("Creating the cache %s (%u slots)", path, RESULT_CACHE_SLOTS)
+    unsigned char header[RESULT_CACHE_HEADER_SIZE] = {0};
+    struct cache_header fields = {
+        .version = RESULT_CACHE_VERSION,
+        .num_slots = RESULT_CACHE_SLOTS,
+        .clock = 1,
+    };
+    memcpy(fields.magic, RESULT_CACHE_MAGIC, sizeof(fields.magic));
+    memcpy(header, &fields, sizeof(fields));
+
+    off_t size = RESULT_CACHE_HEADER_SIZE
+        + (off_t)RESULT_CACHE_SLOTS * sizeof(struct cache_slot);
+    if (ftruncate(cache->fd, size) == -1
+        || pwrite(cache->fd, header, sizeof(header), 0) != sizeof(header))
+    {
+        LOG_ERROR("failed to create %s: %s", path, strerror(errno))
+        return 0;
+    }
+    return 1;
+}
+
+static int check_header(struct result_cache *cache)
+{
+    const struct cache_header *header = cache_header(cache);
+    if (cache->size < RESULT_CACHE_HEADER_SIZE
+        || memcmp(header->magic, RESULT_CACHE_MAGIC, sizeof(header->magic))
+            != 0)
+    {
+        LOG_ERROR("not a cache file")
+        return 0;
+    }
+    if (header->version != RESULT_CACHE_VERSION)
+    {
+        LOG_ERROR("unsupported cache version %u", header->version)
+        return 0;
+    }
+
+    cache->num_slots = header->num_slots;
+    if (cache->num_slots < RESULT_CACHE_PROBES
+        || (cache->num_slots & (cache->num_slots - 1)) != 0
+        || cache->size - RESULT_CACHE_HEADER_SIZE
+            != cache->num_slots * sizeof(struct cache_slot))
+    {
+        LOG_ERROR("inconsistent cache header")
+        return 0;
+    }
+    return 1;
+}
+
+int result_cache_open(struct result_cache *cache, const char *path)
+{
+    memset(cache, 0, sizeof(struct result_cache));
+    cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (cache->fd == -1)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+
+    if (!lock_cache(cache, F_WRLCK))
+        goto ResultCacheOpenFailed;
+    int success = initialize_file(cache, path);
+    unlock_cache(cache);
+    if (!success)
+        goto ResultCacheOpenFailed;
+
+    struct stat st;
+    if (fstat(cache->fd, &st) == -1)
+    {
+        LOG_ERROR("failed to stat %s: %s", path, strerror(errno))
+        goto ResultCacheOpenFailed;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     cache->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("failed to map %s: %s", path, strerror(errno))
+        goto ResultCacheOpenFailed;
+    }
+    cache->map = map;
+    cache->size = st.st_size;
+
+    if (!check_header(cache))
+    {
+        LOG_ERROR("invalid cache %s", path)
+        goto ResultCacheOpenFailed;
+    }
+    return 1;
+
+ResultCacheOpenFailed:
+    result_cache_close(cache);
+    return 0;
+}
+
+void result_cache_close(struct result_cache *cache)
+{
+    if (cache->map != NULL)
+        munmap(cache->map, cache->size);
+    if (cache->fd >= 0)
+        close(cache->fd);
+    memset(cache, 0, sizeof(struct result_cache));
+    cache->fd = -1;
+}
+
+// SHA-256 of the sign and the big-endian bytes of n
+static int digest_number(const BIGNUM *n, unsigned char *digest)
+{
+    size_t size = BN_num_bytes(n) + 1;
+    unsigned char *bytes = malloc(size);
+    if (bytes == NULL)
+    {
+        LOG_ERROR("failed to allocate the cache key: %s", strerror(errno))
+        return 0;
+    }
+    bytes[0] = BN_is_negative(n);
+    BN_bn2bin(n, bytes + 1);
+    SHA256(bytes, size, digest);
+    free(bytes);
+    return 1;
+}
+
+static uint64_t home_slot(const unsigned char *digest)
+{
+    uint64_t home = 0;
+    memcpy(&home, digest, sizeof(home));
+    return home;
+}
+
+static uint64_t tick(const struct result_cache *cache)
+{
+    return __atomic_fetch_add(&cache_header(cache)->clock, 1,
+                              __ATOMIC_RELAXED);
+}
+
+// Slot holding digest, or NULL (under a lock)
+static struct cache_slot *find_slot(const struct result_cache *cache,
+                                    const unsigned char *digest)
+{
+    uint64_t home = home_slot(digest);
+    for (unsigned i = 0; i < RESULT_CACHE_PROBES; ++i)
+    {
+        struct cache_slot *slot = cache_slot(cache, home + i);
+        if (__atomic_load_n(&slot->last_used, __ATOMIC_RELAXED) != 0
+            && memcmp(slot->digest, digest, sizeof(slot->digest)) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+int result_cache_lookup(struct result_cache *cache, const BIGNUM *n,
+                        struct result_cache_entry *entry)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    if (!digest_number(n, digest) || !lock_cache(cache, F_RDLCK))
+        return -1;
+
+    // the other readers may refresh last_used too, hence the atomics
+    struct cache_slot *slot = find_slot(cache, digest);
+    if (slot != NULL)
+    {
+        *entry = slot->entry;
+        __atomic_store_n(&slot->last_used, tick(cache), __ATOMIC_RELAXED);
+    }
+    unlock_cache(cache);
+    return slot != NULL;
+}
+
+// Empty slot, or else the least recently used one (under the write lock)
+static struct cache_slot *evict_slot(const struct result_cache *cache,
+                                     const unsigned char *digest)
+{
+    uint64_t home = home_slot(digest);
+    struct cache_slot *oldest = cache_slot(cache, home);
+    for (unsigned i = 0; i < RESULT_CACHE_PROBES; ++i)
+    {
+        struct cache_slot *slot = cache_slot(cache, home + i);
+        if (slot->last_used == 0)
+            return slot;
+        if (slot->last_used < oldest->last_used)
+            oldest = slot;
+    }
+    LOG_DEBUG("Evicting the cache slot %lu",
+              (unsigned long)(oldest - cache_slot(cache, 0)))
+    return oldest;
+}
+
+int result_cache_store(struct result_cache *cache, const BIGNUM *n,
+                       const struct result_cache_entry *entry)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    if (!digest_number(n, digest) || !lock_cache(cache, F_WRLCK))
+        return 0;
+
+    struct cache_slot *slot = find_slot(cache, digest);
+    if (slot == NULL)
+    {
+        slot = evict_slot(cache, digest);
+        memcpy(slot->digest, digest, sizeof(slot->digest));
+        slot->entry = *entry;
+    }
+    else if (!entry->prime || !slot->entry.prime)
+    {
+        slot->entry.prime = 0;
+        slot->entry.tests = 0;
+        slot->entry.rounds = 0;
+    }
+    else
+    {
+        slot->entry.tests |= entry->tests;
+        if (entry->rounds > slot->entry.rounds)
+            slot->entry.rounds = entry->rounds;
+    }
+    __atomic_store_n(&slot->last_used, tick(cache), __ATOMIC_RELAXED);
+    unlock_cache(cache);
+    return 1;
+}
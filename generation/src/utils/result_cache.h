@@ -0,0 +1,71 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk cache of primality verdicts, keyed by the SHA-256 of the number
+ * (sign and big-endian bytes). The file is mapped as is (host byte order) :
+ *  - a header of RESULT_CACHE_HEADER_SIZE bytes (magic, version, number of
+ *    slots, LRU clock)
+ *  - an open-addressing table of slots : a number lives in one of the
+ *    RESULT_CACHE_PROBES slots following its home slot, and a new one
+ *    evicts the least recently used of them when they are all taken
+ * Readers hold a shared fcntl() lock on the file and writers an exclusive
+ * one, so that several processes can use the same cache.
+ */
+
+#define RESULT_CACHE_MAGIC "MPCACHE1"
+#define RESULT_CACHE_VERSION 1
+#define RESULT_CACHE_HEADER_SIZE 64
+
+// Tests passed by a prime verdict
+#define RESULT_CACHE_MILLER_RABIN (1u << 0)
+#define RESULT_CACHE_BPSW (1u << 1)
+#define RESULT_CACHE_PROVEN (1u << 2)
+
+struct result_cache_entry
+{
+    // 1 if prime, 0 if composite (a composite verdict is always certain)
+    uint8_t prime;
+    // RESULT_CACHE_* flags, for a prime verdict
+    uint8_t tests;
+    uint16_t reserved;
+    // miller-rabin rounds passed (random bases)
+    uint32_t rounds;
+};
+
+struct result_cache
+{
+    int fd;
+    unsigned char *map;
+    size_t size;
+    uint64_t num_slots;
+};
+
+/*
+ * Open (or create, with RESULT_CACHE_SLOTS slots) the cache file.
+ * Returns 1 on success, 0 on failure.
+ */
+int result_cache_open(struct result_cache *cache, const char *path);
+
+void result_cache_close(struct result_cache *cache);
+
+/*
+ * Returns 1 and fills entry if n is in the cache, 0 if it is not, and -1 on
+ * failure.
+ */
+int result_cache_lookup(struct result_cache *cache, const BIGNUM *n,
+                        struct result_cache_entry *entry);
+
+/*
+ * Merge entry into the cached verdict of n (a composite verdict wins, the
+ * tests are combined and the most rounds are kept). Returns 1 on success, 0
+ * on failure.
+ */
+int result_cache_store(struct result_cache *cache, const BIGNUM *n,
+                       const struct result_cache_entry *entry);
+
+#endif /* !RESULT_CACHE_H */
@@ -0,0 +1,559 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch_gcd.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "utils/threads.h"
+
+/*
+ * Above this size (in bits), the remainders are computed with a Newton
+ * reciprocal and multiplications (Karatsuba) rather than BN_mod (schoolbook
+ * division, quadratic), and the products of unequal operands are balanced
+ */
+#ifndef BATCH_GCD_NEWTON_BITS
+#    define BATCH_GCD_NEWTON_BITS (1u << 14)
+#endif /* !BATCH_GCD_NEWTON_BITS */
+
+enum tree_pass
+{
+    PASS_PRODUCT,
+    PASS_REMAINDER,
+    PASS_LEAVES,
+};
+
+/*
+ * levels[0] are the moduli and levels[num_levels - 1] the root. The
+ * remainder pass overwrites every node with the remainder of its parent
+ * modulo its square, and frees the levels above it.
+ */
+struct batch_tree
+{
+    BIGNUM ***levels;
+    size_t *sizes;
+    size_t num_levels;
+    BIGNUM **gcds;
+    // level being computed by the workers
+    enum tree_pass pass;
+    size_t level;
+    size_t next_node;
+    int failed;
+    long found;
+};
+
+static int push_number(BIGNUM ***numbers, size_t *count, size_t *capacity,
+                       BIGNUM *n)
+{
+    if (*count == *capacity)
+    {
+        size_t capacity2 = *capacity == 0 ? 1024 : 2 * *capacity;
+        BIGNUM **numbers2 = realloc(*numbers, capacity2 * sizeof(BIGNUM *));
+        if (numbers2 == NULL)
+        {
+            LOG_ERROR("failed to allocate the moduli: %s", strerror(errno))
+            return 0;
+        }
+        *numbers = numbers2;
+        *capacity = capacity2;
+    }
+    (*numbers)[(*count)++] = n;
+    return 1;
+}
+
+BIGNUM **batch_gcd_load(const char *path, int decimal, size_t *count)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return NULL;
+    }
+
+    int (*bn_read_fn)(BIGNUM **, const char *) =
+        decimal ? BN_dec2bn : BN_hex2bn;
+    BIGNUM **numbers = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, f)) != -1)
+    {
+        ++line_number;
+        while (length > 0 && isspace((unsigned char)line[length - 1]))
+            line[--length] = '\0';
+        char *s = line;
+        while (isspace((unsigned char)*s))
+            ++s;
+        if (*s == '\0' || *s == '#')
+            continue;
+
+        BIGNUM *n = NULL;
+        if (bn_read_fn(&n, s) != (int)strlen(s) || BN_is_negative(n)
+            || BN_is_zero(n) || BN_is_one(n))
+        {
+            LOG_ERROR("%s:%zu: invalid modulus", path, line_number)
+            BN_free(n);
+            goto BatchGcdLoadFailed;
+        }
+        if (!push_number(&numbers, count, &capacity, n))
+        {
+            BN_free(n);
+            goto BatchGcdLoadFailed;
+        }
+    }
+    if (ferror(f))
+    {
+        LOG_ERROR("failed to read %s: %s", path, strerror(errno))
+        goto BatchGcdLoadFailed;
+    }
+    if (*count == 0)
+    {
+        LOG_ERROR("no modulus in %s", path)
+        goto BatchGcdLoadFailed;
+    }
+    free(line);
+    fclose(f);
+    return numbers;
+
+BatchGcdLoadFailed:
+    free(line);
+    fclose(f);
+    batch_gcd_free(numbers, *count);
+    *count = 0;
+    return NULL;
+}
+
+void batch_gcd_free(BIGNUM **numbers, size_t count)
+{
+    if (numbers == NULL)
+        return;
+    for (size_t i = 0; i < count; ++i)
+        BN_free(numbers[i]);
+    free(numbers);
+}
+
+static void free_level(struct batch_tree *tree, size_t level)
+{
+    // the moduli belong to the caller
+    if (level == 0 || tree->levels[level] == NULL)
+        return;
+    batch_gcd_free(tree->levels[level], tree->sizes[level]);
+    tree->levels[level] = NULL;
+}
+
+static int words(const BIGNUM *a)
+{
+    return (BN_num_bits(a) + BN_BITS2 - 1) / BN_BITS2;
+}
+
+/*
+ * r = a * b. BN_mul only uses Karatsuba on operands of (about) the same
+ * number of words, and BN_sqr on powers of two words : the larger operand
+ * is cut into pieces of the size of the smaller one. r may be a or b.
+ */
+static int tree_mul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
+{
+    if (words(a) < words(b))
+    {
+        const BIGNUM *t = a;
+        a = b;
+        b = t;
+    }
+    int piece_bits = words(b) * BN_BITS2;
+    if (words(a) <= words(b) + 1
+        || (unsigned)BN_num_bits(b) <= BATCH_GCD_NEWTON_BITS)
+        return BN_mul(r, a, b, ctx);
+
+    // the pieces are multiplied in absolute value
+    int negative = BN_is_negative(a) != BN_is_negative(b);
+    BN_CTX_start(ctx);
+    BIGNUM *sum = BN_CTX_get(ctx);
+    BIGNUM *piece = BN_CTX_get(ctx);
+    int success = piece != NULL && BN_set_word(sum, 0);
+    for (int shift = 0; success && shift < BN_num_bits(a);
+         shift += piece_bits)
+    {
+        success = BN_rshift(piece, a, shift)
+            && (BN_num_bits(piece) <= piece_bits
+                || BN_mask_bits(piece, piece_bits))
+            && tree_mul(piece, piece, b, ctx)
+            && BN_lshift(piece, piece, shift);
+        BN_set_negative(piece, 0);
+        success = success && BN_add(sum, sum, piece);
+    }
+    success = success && BN_copy(r, sum) != NULL;
+    BN_set_negative(r, negative);
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * mu ~ 2^(2 * bits) / d, for d of 'bits' bits, within a few units : the
+ * reciprocal of the top half of d, then one Newton step
+ * mu += mu * (2^(2 * bits) - d * mu) / 2^(2 * bits), where only the top
+ * bits of mu and of the error (GUARD_BITS more than the half that is
+ * missing) are multiplied.
+ */
+#define GUARD_BITS 64
+
+static int reciprocal(BIGNUM *mu, const BIGNUM *d, int bits, BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *e = BN_CTX_get(ctx);
+    BIGNUM *t = BN_CTX_get(ctx);
+    int success = t != NULL;
+    if (success && (unsigned)bits <= BATCH_GCD_NEWTON_BITS)
+    {
+        success = BN_set_word(t, 0) && BN_set_bit(t, 2 * bits)
+            && BN_div(mu, NULL, t, d, ctx);
+        BN_CTX_end(ctx);
+        return success;
+    }
+
+    int half = (bits + 1) / 2;
+    int mu_shift = half - GUARD_BITS;
+    int e_shift = bits - GUARD_BITS;
+    success = success && BN_rshift(t, d, bits - half)
+        && reciprocal(mu, t, half, ctx) && BN_lshift(mu, mu, bits - half)
+        && tree_mul(t, d, mu, ctx) && BN_set_word(e, 0)
+        && BN_set_bit(e, 2 * bits) && BN_sub(e, e, t)
+        && BN_rshift(t, mu, mu_shift) && BN_rshift(e, e, e_shift)
+        && tree_mul(t, t, e, ctx)
+        && BN_rshift(t, t, 2 * bits - mu_shift - e_shift)
+        && BN_add(mu, mu, t);
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * r = a mod d, for a < 2^(2 * bits) (Barrett reduction) : the quotient
+ * ((a >> (bits - 1)) * mu) >> (bits + 1) is off by a few units
+ */
+static int barrett_mod(BIGNUM *r, const BIGNUM *a, const BIGNUM *d,
+                       const BIGNUM *mu, int bits, BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *q = BN_CTX_get(ctx);
+    int success = q != NULL && BN_rshift(q, a, bits - 1)
+        && tree_mul(q, q, mu, ctx) && BN_rshift(q, q, bits + 1)
+        && tree_mul(q, q, d, ctx) && BN_sub(r, a, q);
+    while (success && BN_is_negative(r))
+        success = BN_add(r, r, d);
+    while (success && BN_cmp(r, d) >= 0)
+        success = BN_sub(r, r, d);
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * r = a mod d, for a >= 0 (r may be a). In the remainder tree, a is usually
+ * below d^2 : above it (unbalanced siblings), the top 2 * bits bits of a are
+ * reduced until it is.
+ */
+static int tree_mod(BIGNUM *r, const BIGNUM *a, const BIGNUM *d, BN_CTX *ctx)
+{
+    int bits = BN_num_bits(d);
+    if ((unsigned)bits <= BATCH_GCD_NEWTON_BITS || BN_ucmp(a, d) < 0)
+        return BN_mod(r, a, d, ctx);
+
+    BN_CTX_start(ctx);
+    BIGNUM *mu = BN_CTX_get(ctx);
+    BIGNUM *top = BN_CTX_get(ctx);
+    int success = top != NULL && reciprocal(mu, d, bits, ctx)
+        && BN_copy(r, a) != NULL;
+    while (success && BN_num_bits(r) > 2 * bits)
+    {
+        int shift = BN_num_bits(r) - 2 * bits;
+        success = BN_rshift(top, r, shift) && BN_mask_bits(r, shift)
+            && barrett_mod(top, top, d, mu, bits, ctx)
+            && BN_lshift(top, top, shift) && BN_add(r, r, top);
+    }
+    success = success && barrett_mod(r, r, d, mu, bits, ctx);
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * r = gcd(a, b), for a, b >= 0. BN_gcd runs in constant time, which the
+ * moduli do not need : Euclid's algorithm is about 3 times faster on them.
+ */
+static int tree_gcd(BIGNUM *r, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
+{
+    BN_CTX_start(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    BIGNUM *y = BN_CTX_get(ctx);
+    int success = y != NULL && BN_copy(x, a) != NULL && BN_copy(y, b) != NULL;
+    while (success && !BN_is_zero(y))
+    {
+        success = BN_mod(x, x, y, ctx);
+        BIGNUM *t = x;
+        x = y;
+        y = t;
+    }
+    success = success && BN_copy(r, x) != NULL;
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * Product : node i of the level is the product of its two children (or a
+ * copy of the last one).
+ */
+static int product_node(struct batch_tree *tree, size_t i, BN_CTX *ctx)
+{
+    BIGNUM *const *below = tree->levels[tree->level - 1];
+    size_t below_size = tree->sizes[tree->level - 1];
+    BIGNUM *node = BN_new();
+    if (node == NULL)
+        return 0;
+    tree->levels[tree->level][i] = node;
+    if (2 * i + 1 < below_size)
+        return tree_mul(node, below[2 * i], below[2 * i + 1], ctx);
+    return BN_copy(node, below[2 * i]) != NULL;
+}
+
+/*
+ * Remainder : node = parent mod node^2, in place
+ */
+static int remainder_node(struct batch_tree *tree, size_t i, BN_CTX *ctx)
+{
+    BIGNUM *node = tree->levels[tree->level][i];
+    const BIGNUM *parent = tree->levels[tree->level + 1][i / 2];
+    // node^2 >= 2^(2 * (bits - 1)) : no need to square it
+    if (BN_num_bits(parent) <= 2 * (BN_num_bits(node) - 1))
+        return BN_copy(node, parent) != NULL;
+    BN_CTX_start(ctx);
+    BIGNUM *square = BN_CTX_get(ctx);
+    int success = square != NULL && tree_mul(square, node, node, ctx)
+        && tree_mod(node, parent, square, ctx);
+    BN_CTX_end(ctx);
+    return success;
+}
+
+/*
+ * Leaf : gcd((P mod n^2) / n, n), where P mod n^2 is the remainder of the
+ * parent (or n itself for a single modulus)
+ */
+static int leaf_node(struct batch_tree *tree, size_t i, BN_CTX *ctx)
+{
+    const BIGNUM *n = tree->levels[0][i];
+    const BIGNUM *parent =
+        tree->num_levels > 1 ? tree->levels[1][i / 2] : tree->levels[0][i];
+    BIGNUM *g = BN_new();
+    if (g == NULL)
+        return 0;
+    tree->gcds[i] = g;
+    BN_CTX_start(ctx);
+    BIGNUM *square = BN_CTX_get(ctx);
+    int success = square != NULL && tree_mul(square, n, n, ctx)
+        && tree_mod(g, parent, square, ctx) && BN_div(g, NULL, g, n, ctx)
+        && tree_gcd(g, g, n, ctx);
+    BN_CTX_end(ctx);
+    if (success && !BN_is_one(g))
+        __atomic_fetch_add(&tree->found, 1, __ATOMIC_RELAXED);
+    return success;
+}
+
+static void *tree_worker(void *arg)
+{
+    struct batch_tree *tree = arg;
+    BN_CTX *ctx = BN_CTX_new();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("failed to allocate a context")
+        __atomic_store_n(&tree->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    size_t size = tree->sizes[tree->level];
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&tree->next_node, 1, __ATOMIC_RELAXED);
+        if (i >= size || __atomic_load_n(&tree->failed, __ATOMIC_RELAXED))
+            break;
+        int success = 0;
+        switch (tree->pass)
+        {
+        case PASS_PRODUCT:
+            success = product_node(tree, i, ctx);
+            break;
+        case PASS_REMAINDER:
+            success = remainder_node(tree, i, ctx);
+            break;
+        case PASS_LEAVES:
+            success = leaf_node(tree, i, ctx);
+            break;
+        }
+        if (!success)
+        {
+            LOG_ERROR("failed to compute the node %zu of the level %zu", i,
+                      tree->level)
+            __atomic_store_n(&tree->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    BN_CTX_free(ctx);
+    return NULL;
+}
+
+/*
+ * Compute every node of a level, with up to num_threads() threads (the
+ * calling one included). Returns 1 on success, 0 on failure.
+ */
+static int run_level(struct batch_tree *tree, enum tree_pass pass,
+                     size_t level)
+{
+    tree->pass = pass;
+    tree->level = level;
+    tree->next_node = 0;
+    size_t num = num_threads();
+    if (num > tree->sizes[level])
+        num = tree->sizes[level];
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 0;
+    }
+
+    size_t started = 0;
+    for (; started + 1 < num; ++started)
+    {
+        int error =
+            pthread_create(&threads[started], NULL, &tree_worker, tree);
+        if (error != 0)
+        {
+            LOG_ERROR("failed to start thread: %s", strerror(error))
+            __atomic_store_n(&tree->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    tree_worker(tree);
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    return !tree->failed;
+}
+
+static int build_product_tree(struct batch_tree *tree)
+{
+    for (size_t level = 1; level < tree->num_levels; ++level)
+    {
+        tree->sizes[level] = (tree->sizes[level - 1] + 1) / 2;
+        tree->levels[level] = calloc(tree->sizes[level], sizeof(BIGNUM *));
+        if (tree->levels[level] == NULL)
+        {
+            LOG_ERROR("failed to allocate the product tree: %s",
+                      strerror(errno))
+            return 0;
+        }
+        LOG_DEBUG("Product tree level %zu: %zu nodes", level,
+                  tree->sizes[level])
+        if (!run_level(tree, PASS_PRODUCT, level))
+            return 0;
+    }
+    LOG_INFO("Product of the %zu moduli: %d bits", tree->sizes[0],
+             BN_num_bits(tree->levels[tree->num_levels - 1][0]))
+    return 1;
+}
+
+static int descend_remainder_tree(struct batch_tree *tree)
+{
+    // the root is its own remainder
+    for (size_t level = tree->num_levels - 1; level-- > 1;)
+    {
+        LOG_DEBUG("Remainder tree level %zu: %zu nodes", level,
+                  tree->sizes[level])
+        if (!run_level(tree, PASS_REMAINDER, level))
+            return 0;
+        free_level(tree, level + 1);
+    }
+    if (!run_level(tree, PASS_LEAVES, 0))
+        return 0;
+    free_level(tree, 1);
+    return 1;
+}
+
+/*
+ * gcds[i] = n[i] when every prime factor of n[i] is shared (e.g. n[i] = pq,
+ * with p and q in two other moduli) : look for a proper factor in the gcds
+ * of n[i] with the other flagged moduli. Returns 1 on success, 0 on
+ * failure.
+ */
+static int split_full_gcds(BIGNUM *const *n, size_t count, BIGNUM **gcds)
+{
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *g = BN_new();
+    if (ctx == NULL || g == NULL)
+    {
+        LOG_ERROR("failed to allocate the gcd")
+        BN_CTX_free(ctx);
+        BN_free(g);
+        return 0;
+    }
+
+    int success = 1;
+    for (size_t i = 0; i < count && success; ++i)
+    {
+        if (BN_cmp(gcds[i], n[i]) != 0)
+            continue;
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (j == i || BN_is_one(gcds[j]))
+                continue;
+            if (!tree_gcd(g, n[i], n[j], ctx))
+            {
+                success = 0;
+                break;
+            }
+            if (!BN_is_one(g) && BN_cmp(g, n[i]) != 0)
+            {
+                success = BN_copy(gcds[i], g) != NULL;
+                break;
+            }
+        }
+    }
+    BN_free(g);
+    BN_CTX_free(ctx);
+    return success;
+}
+
+long batch_gcd(BIGNUM *const *n, size_t count, BIGNUM **gcds)
+{
+    struct batch_tree tree = {
+        .num_levels = 1,
+        .gcds = gcds,
+    };
+    for (size_t size = count; size > 1; size = (size + 1) / 2)
+        ++tree.num_levels;
+    tree.levels = calloc(tree.num_levels, sizeof(BIGNUM **));
+    tree.sizes = calloc(tree.num_levels, sizeof(size_t));
+    if (tree.levels == NULL || tree.sizes == NULL)
+    {
+        LOG_ERROR("failed to allocate the product tree: %s", strerror(errno))
+        free(tree.levels);
+        free(tree.sizes);
+        return -1;
+    }
+    tree.levels[0] = (BIGNUM **)n;
+    tree.sizes[0] = count;
+
+    long found = -1;
+    if (build_product_tree(&tree) && descend_remainder_tree(&tree)
+        && split_full_gcds(n, count, gcds))
+        found = tree.found;
+
+    for (size_t level = 1; level < tree.num_levels; ++level)
+        free_level(&tree, level);
+    free(tree.levels);
+    free(tree.sizes);
+    return found;
+}
@@ -0,0 +1,31 @@
+#ifndef BATCH_GCD_H
+#define BATCH_GCD_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+
+/*
+ * Read one number per line (hex, or decimal if 'decimal'), skipping the
+ * empty lines and the ones starting with '#'. The file is read line by
+ * line. Returns the array of the numbers and sets count, or returns NULL on
+ * failure.
+ */
+BIGNUM **batch_gcd_load(const char *path, int decimal, size_t *count);
+
+void batch_gcd_free(BIGNUM **numbers, size_t count);
+
+/*
+ * Bernstein's batch gcd : gcds[i] = gcd(n[i], product of the others), for
+ * all i at once. The product tree of the moduli is built bottom-up, then
+ * the remainder tree P mod n^2 top-down, and gcds[i] is
+ * gcd((P mod n[i]^2) / n[i], n[i]). Every level of both trees is spread
+ * across num_threads() threads.
+ * When all the factors of n[i] are shared, gcds[i] is replaced by a proper
+ * factor found among the other nontrivial gcds, if there is one : it stays
+ * n[i] for a duplicate.
+ * gcds must hold count NULL pointers, and is filled with new BIGNUMs.
+ * Returns the number of moduli with a nontrivial gcd, or -1 on failure.
+ */
+long batch_gcd(BIGNUM *const *n, size_t count, BIGNUM **gcds);
+
+#endif /* !BATCH_GCD_H */
@@ -0,0 +1,243 @@
+#include "keypair.h"
+
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "primes/miller_rabin.h"
+#include "primes/primality_test.h"
+#include "random/random.h"
+#include "utils/logging.h"
+#include "utils/stats.h"
+
+// p and q must differ in their top 100 bits (FIPS 186-5, A.1.3)
+#define RSA_KEYPAIR_MIN_DISTANCE_BITS 100
+
+struct rsa_factor_search
+{
+    unsigned length;
+    BN_ULONG e;
+    BIGNUM *p;
+    int success;
+};
+
+int rsa_generate_factor(BIGNUM *p, unsigned length, BN_ULONG e)
+{
+    if (length < 3)
+    {
+        LOG_ERROR("Invalid length: %u", length)
+        return 0;
+    }
+    unsigned num_tests = estimate_num_tests(length);
+
+    BN_CTX *ctx = BN_CTX_secure_new();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("Out of memory")
+        return 0;
+    }
+
+    int success = 0;
+    do
+    {
+        STATS_ADD(STATS_CANDIDATES, 1)
+        STATS_TIMER_START(rng_timer)
+        int generated = BN_set_bit(p, 0) && BN_set_bit(p, length - 1)
+            && generate_prime_candidate(p, length)
+            && BN_set_bit(p, length - 2);
+        STATS_TIMER_STOP(STATS_STAGE_RNG, rng_timer)
+        if (!generated)
+        {
+            LOG_ERROR("failed to generate candidate: %s", OPENSSL_ERR_STRING)
+            break;
+        }
+
+        // e prime : gcd(e, p - 1) != 1 iff p = 1 (mod e)
+        if (BN_mod_word(p, e) == 1)
+            continue;
+
+        if ((success = primality_test(p, num_tests, ctx)) == -1)
+            break;
+    } while (!success);
+
+    BN_CTX_free(ctx);
+    return success == 1;
+}
+
+static void *rsa_factor_worker(void *arg)
+{
+    struct rsa_factor_search *search = arg;
+    search->success =
+        rsa_generate_factor(search->p, search->length, search->e);
+    return NULL;
+}
+
+int rsa_generate_factors(BIGNUM *p, BIGNUM *q, unsigned length, BN_ULONG e)
+{
+    if (length < 3)
+    {
+        LOG_ERROR("Invalid length: %u", length)
+        return 0;
+    }
+
+    struct rsa_factor_search searches[2] = {
+        { .length = length, .e = e, .p = p, .success = 0 },
+        { .length = length, .e = e, .p = q, .success = 0 },
+    };
+
+    // q is searched on a second thread, p on the calling one
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, &rsa_factor_worker, &searches[1]);
+    if (error != 0)
+        LOG_WARN("failed to start thread (%s), searching p and q in sequence",
+                 strerror(error))
+    rsa_factor_worker(&searches[0]);
+    if (error == 0)
+        pthread_join(thread, NULL);
+    else
+        rsa_factor_worker(&searches[1]);
+
+    return searches[0].success && searches[1].success;
+}
+
+int rsa_generate_keypair(struct rsa_keypair *key, unsigned bits)
+{
+    *key = (struct rsa_keypair){ 0 };
+    if (bits < 128 || bits % 2 != 0)
+    {
+        LOG_ERROR("Invalid modulus length: %u (must be even, >= 128)", bits)
+        return 0;
+    }
+
+    BN_CTX *ctx = BN_CTX_secure_new();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("Out of memory")
+        return 0;
+    }
+    BN_CTX_start(ctx);
+    BIGNUM *p_m_1 = BN_CTX_get(ctx);
+    BIGNUM *q_m_1 = BN_CTX_get(ctx);
+    BIGNUM *lambda = BN_CTX_get(ctx);
+    BIGNUM *gcd = BN_CTX_get(ctx);
+    if (gcd == NULL)
+        goto RsaKeypairFailed;
+
+    key->n = BN_new();
+    key->e = BN_new();
+    key->d = BN_secure_new();
+    key->p = BN_secure_new();
+    key->q = BN_secure_new();
+    key->dp = BN_secure_new();
+    key->dq = BN_secure_new();
+    key->qinv = BN_secure_new();
+    if (key->qinv == NULL || key->dq == NULL || key->dp == NULL
+        || key->q == NULL || key->p == NULL || key->d == NULL
+        || key->e == NULL || key->n == NULL
+        || !BN_set_word(key->e, RSA_KEYPAIR_E))
+        goto RsaKeypairFailed;
+
+    for (;;)
+    {
+        if (!rsa_generate_factors(key->p, key->q, bits / 2, RSA_KEYPAIR_E))
+            goto RsaKeypairFailed;
+        // |p - q| > 2^(bits / 2 - 100), p > q
+        if (!BN_sub(gcd, key->p, key->q))
+            goto RsaKeypairFailed;
+        if (BN_num_bits(gcd) > (int)bits / 2 - RSA_KEYPAIR_MIN_DISTANCE_BITS)
+            break;
+        LOG_DEBUG("p and q are too close, trying again")
+    }
+    if (BN_is_negative(gcd))
+        BN_swap(key->p, key->q);
+
+    // n = p * q, lambda = lcm(p - 1, q - 1), d = e^-1 mod lambda
+    if (!BN_mul(key->n, key->p, key->q, ctx)
+        || !BN_sub(p_m_1, key->p, BN_value_one())
+        || !BN_sub(q_m_1, key->q, BN_value_one())
+        || !BN_gcd(gcd, p_m_1, q_m_1, ctx)
+        || !BN_mul(lambda, p_m_1, q_m_1, ctx)
+        || !BN_div(lambda, NULL, lambda, gcd, ctx)
+        || !BN_mod_inverse(key->d, key->e, lambda, ctx))
+        goto RsaKeypairFailed;
+
+    // CRT parameters
+    if (!BN_mod(key->dp, key->d, p_m_1, ctx)
+        || !BN_mod(key->dq, key->d, q_m_1, ctx)
+        || !BN_mod_inverse(key->qinv, key->q, key->p, ctx))
+        goto RsaKeypairFailed;
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return 1;
+
+RsaKeypairFailed:
+    LOG_ERROR("failed to generate RSA keypair: %s", OPENSSL_ERR_STRING)
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    rsa_cleanup_keypair(key);
+    return 0;
+}
+
+void rsa_cleanup_keypair(struct rsa_keypair *key)
+{
+    BN_free(key->n);
+    BN_free(key->e);
+    BN_clear_free(key->d);
+    BN_clear_free(key->p);
+    BN_clear_free(key->q);
+    BN_clear_free(key->dp);
+    BN_clear_free(key->dq);
+    BN_clear_free(key->qinv);
+    *key = (struct rsa_keypair){ 0 };
+}
+
+int rsa_write_keypair(FILE *f, const struct rsa_keypair *key, int der)
+{
+    int success = 0;
+    OSSL_PARAM_BLD *builder = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY_CTX *pkey_ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+
+    if (builder == NULL
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_N, key->n)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_E, key->e)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_D, key->d)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_FACTOR1,
+                                   key->p)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_FACTOR2,
+                                   key->q)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_EXPONENT1,
+                                   key->dp)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_EXPONENT2,
+                                   key->dq)
+        || !OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_COEFFICIENT1,
+                                   key->qinv)
+        || (params = OSSL_PARAM_BLD_to_param(builder)) == NULL)
+        goto WriteKeypairEnd;
+
+    pkey_ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+    if (pkey_ctx == NULL || EVP_PKEY_fromdata_init(pkey_ctx) <= 0
+        || EVP_PKEY_fromdata(pkey_ctx, &pkey, EVP_PKEY_KEYPAIR, params) <= 0)
+        goto WriteKeypairEnd;
+
+    if (der)
+        success = i2d_PKCS8PrivateKey_fp(f, pkey, NULL, NULL, 0, NULL, NULL);
+    else
+        success = PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL);
+
+WriteKeypairEnd:
+    if (!success)
+        LOG_ERROR("failed to write RSA keypair: %s", OPENSSL_ERR_STRING)
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_CTX_free(pkey_ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(builder);
+    return success;
+}
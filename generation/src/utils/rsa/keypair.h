@@ -0,0 +1,49 @@
+#ifndef KEYPAIR_H
+#define KEYPAIR_H
+
+#include <openssl/bn.h>
+#include <stdio.h>
+
+// Public exponent. It must be prime (see rsa_generate_factors)
+#define RSA_KEYPAIR_E 65537
+
+struct rsa_keypair
+{
+    BIGNUM *n;
+    BIGNUM *e;
+    BIGNUM *d;
+    BIGNUM *p;
+    BIGNUM *q;
+    // CRT parameters : d mod (p - 1), d mod (q - 1) and q^-1 mod p
+    BIGNUM *dp;
+    BIGNUM *dq;
+    BIGNUM *qinv;
+};
+
+/*
+ * Generate a prime p of 'length' bits (with the two top bits set, so that
+ * the product of two of them has exactly 2 * length bits), on the calling
+ * thread. Candidates c with c = 1 (mod e) are rejected before any test, so
+ * that gcd(e, p - 1) = 1. Returns 1 on success, 0 on failure.
+ */
+int rsa_generate_factor(BIGNUM *p, unsigned length, BN_ULONG e);
+
+/*
+ * rsa_generate_factor() for p and q, concurrently on two threads (each one
+ * draws from its own Fortuna stream). Returns 1 on success, 0 on failure.
+ */
+int rsa_generate_factors(BIGNUM *p, BIGNUM *q, unsigned length, BN_ULONG e);
+
+/*
+ * Generate a full RSA keypair with a modulus of 'bits' bits, and e = 65537.
+ */
+int rsa_generate_keypair(struct rsa_keypair *key, unsigned bits);
+
+void rsa_cleanup_keypair(struct rsa_keypair *key);
+
+/*
+ * Write the private key (PKCS#8), in PEM or DER format.
+ */
+int rsa_write_keypair(FILE *f, const struct rsa_keypair *key, int der);
+
+#endif /* !KEYPAIR_H */
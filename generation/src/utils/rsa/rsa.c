@@ -1,23 +1,59 @@
 #include "rsa.h"
 
 #include <openssl/bn.h>
+#include <pthread.h>
 #include <stddef.h>
 
-#include "primes/generate_prime.h"
 #include "utils/logging.h"
+#include "utils/rsa/keypair.h"
 
 #define RSA_PQ_LENGTH 1024
 
 typedef unsigned long long ull;
 
+// Read-only once initialized : shared by every thread
 struct rsa_ctx
 {
     BIGNUM *n;
     BIGNUM *e;
-    BN_CTX *ctx;
 };
 
-struct rsa_ctx rsa_ctx = { .n = NULL, .e = NULL, .ctx = NULL };
+struct rsa_ctx rsa_ctx = { .n = NULL, .e = NULL };
+
+// BN_CTX of each thread, freed when it exits
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+static int thread_ctx_key_created = 0;
+
+static void free_thread_ctx(void *ctx)
+{
+    BN_CTX_free(ctx);
+}
+
+static void create_thread_ctx_key(void)
+{
+    thread_ctx_key_created =
+        pthread_key_create(&thread_ctx_key, &free_thread_ctx) == 0;
+}
+
+static BN_CTX *thread_ctx(void)
+{
+    pthread_once(&thread_ctx_once, &create_thread_ctx_key);
+    if (!thread_ctx_key_created)
+        return NULL;
+
+    BN_CTX *ctx = pthread_getspecific(thread_ctx_key);
+    if (ctx != NULL)
+        return ctx;
+    if ((ctx = BN_CTX_secure_new()) == NULL)
+        return NULL;
+    if (pthread_setspecific(thread_ctx_key, ctx) != 0)
+    {
+        BN_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
 
 int initialize_rsa()
 {
@@ -51,11 +87,15 @@ int initialize_rsa()
     }
     BN_CTX_start(ctx);
 
-    p = generate_prime(RSA_PQ_LENGTH);
-    q = generate_prime(RSA_PQ_LENGTH);
-    if (q == NULL || p == NULL)
+    // gcd(e, p - 1) = gcd(e, q - 1) = 1, so that encryption is a permutation.
+    // No thread is started : this runs before the PRNG is ready.
+    p = BN_secure_new();
+    q = BN_secure_new();
+    if (q == NULL || p == NULL
+        || !rsa_generate_factor(p, RSA_PQ_LENGTH, RSA_KEYPAIR_E)
+        || !rsa_generate_factor(q, RSA_PQ_LENGTH, RSA_KEYPAIR_E))
     {
-        LOG_ERROR("generate_prime for p & q: %s", OPENSSL_ERR_STRING)
+        LOG_ERROR("failed to generate p & q: %s", OPENSSL_ERR_STRING)
         goto RsaInitializeFailed;
     }
 
@@ -90,7 +130,7 @@ int initialize_rsa()
         // phi = (p - 1) * (q - 1)
         err |= !BN_mul(phi, p_m_1, q_m_1, ctx);
         // e = 65537
-        err |= !BN_set_word(e, 65537);
+        err |= !BN_set_word(e, RSA_KEYPAIR_E);
         if (err)
         {
             LOG_ERROR("setting variables p - 1, q - 1, phi and e failed: %s",
@@ -123,12 +163,12 @@ int initialize_rsa()
 #endif /* BETTER_CHOOSE_RSA_E */
 
     BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
     BN_clear_free(p);
     BN_clear_free(q);
 
     rsa_ctx.n = n;
     rsa_ctx.e = e;
-    rsa_ctx.ctx = ctx;
 
     return 1;
 
@@ -149,32 +189,48 @@ void cleanup_rsa(void)
     LOG_DEBUG("Cleaning up RSA block cipher")
     BN_clear_free(rsa_ctx.n);
     BN_clear_free(rsa_ctx.e);
-    BN_CTX_free(rsa_ctx.ctx);
+    rsa_ctx = (struct rsa_ctx){ .n = NULL, .e = NULL };
+    // the workers freed theirs when exiting
+    if (thread_ctx_key_created)
+    {
+        BN_CTX_free(pthread_getspecific(thread_ctx_key));
+        pthread_setspecific(thread_ctx_key, NULL);
+    }
 }
 
-int rsa_encrypt(int x)
+int rsa_encrypt(uint64_t x)
 {
     if (rsa_ctx.n == NULL)
     {
         LOG_ERROR("RSA was not initialized")
         return 0;
     }
+    BN_CTX *ctx = thread_ctx();
+    if (ctx == NULL)
+    {
+        LOG_ERROR("failed to allocate the thread context: %s",
+                  OPENSSL_ERR_STRING)
+        return 0;
+    }
 
     const int int_num_bytes = sizeof(int);
 
-    BN_CTX_start(rsa_ctx.ctx);
+    BN_CTX_start(ctx);
 
-    BIGNUM *bn_x = BN_CTX_get(rsa_ctx.ctx);
-    BN_set_word(bn_x, x);
-    BIGNUM *bn_y = BN_CTX_get(rsa_ctx.ctx);
+    BIGNUM *bn_x = BN_CTX_get(ctx);
+    // BN_ULONG may only hold 32 bits
+    BN_set_word(bn_x, (BN_ULONG)(x >> 32));
+    BN_lshift(bn_x, bn_x, 32);
+    BN_add_word(bn_x, (BN_ULONG)(x & 0xffffffffu));
+    BIGNUM *bn_y = BN_CTX_get(ctx);
     // y = (x ^ e) % n
-    BN_mod_exp(bn_y, bn_x, rsa_ctx.e, rsa_ctx.n, rsa_ctx.ctx);
+    BN_mod_exp(bn_y, bn_x, rsa_ctx.e, rsa_ctx.n, ctx);
     // truncate bn_y if needed
     if (BN_num_bytes(bn_y) > int_num_bytes)
         BN_mask_bits(bn_y, sizeof(int) * 8);
     int y = BN_get_word(bn_y);
 
-    BN_CTX_end(rsa_ctx.ctx);
+    BN_CTX_end(ctx);
 
     return y;
 }
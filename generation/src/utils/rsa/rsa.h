@@ -1,10 +1,16 @@
 #ifndef RSA_H
 #define RSA_H
 
+#include <stdint.h>
+
 int initialize_rsa(void);
 
 void cleanup_rsa(void);
 
-int rsa_encrypt(int x);
+/*
+ * Low bits of x^e mod n. The key is shared : safe to call from several
+ * threads (each one has its own BN_CTX).
+ */
+int rsa_encrypt(uint64_t x);
 
 #endif /* !RSA_H */
@@ -0,0 +1,498 @@
+// syscall()
+#define _DEFAULT_SOURCE
+
+#include "stats.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "primes/preliminary.h"
+#include "utils/logging.h"
+
+// log2 buckets of nanoseconds (last bucket is >= 2^(N-1) ns, i.e. ~9 min)
+#define STATS_HISTOGRAM_BUCKETS 40
+
+struct stats_timer
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t histogram[STATS_HISTOGRAM_BUCKETS];
+    uint64_t perf[STATS_NUM_PERF_EVENTS];
+};
+
+/*
+ * perf_event group of a thread : the leader is the first event that could
+ * be opened, and a read() of the leader returns every member at once
+ */
+struct stats_perf_group
+{
+    int fds[STATS_NUM_PERF_EVENTS];
+    int leader;
+    // position of the event in the group read, -1 if it is not counted
+    int index[STATS_NUM_PERF_EVENTS];
+    unsigned size;
+};
+
+/*
+ * Every thread only ever writes to its own block, so the hot paths never
+ * take a lock. The blocks are chained together (under a mutex, once per
+ * thread) so that they can be merged when reporting.
+ */
+struct stats_block
+{
+    uint64_t counters[STATS_NUM_COUNTERS];
+    uint64_t rejections[STATS_MAX_REJECTION_PRIMES];
+    struct stats_timer timers[STATS_NUM_STAGES];
+    struct stats_perf_group perf;
+    // timed regions open on the thread
+    unsigned depth;
+    struct stats_block *next;
+};
+
+enum stats_format STATS_FORMAT = STATS_FORMAT_NONE;
+
+static const char *COUNTER_NAMES[STATS_NUM_COUNTERS] = {
+    "candidates",  "primality_tests", "mr_rounds", "mr_early_exits",
+    "lucas_tests", "rng_bytes",       "reseeds",
+};
+
+static const char *STAGE_NAMES[STATS_NUM_STAGES] = {
+    "rng",
+    "trial_division",
+    "modexp",
+    "output",
+};
+
+static const char *PERF_EVENT_NAMES[STATS_NUM_PERF_EVENTS] = {
+    "cycles",     "instructions", "branch_misses",
+    "l1d_misses", "llc_misses",
+};
+
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+} PERF_EVENTS[STATS_NUM_PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+          | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8
+          | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+};
+
+static int perf_enabled = 0;
+// bit i is set once any thread could open the counter i
+static unsigned perf_available = 0;
+
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_block *blocks = NULL;
+static unsigned num_blocks = 0;
+static uint64_t start_ns = 0;
+
+static __thread struct stats_block *local_block = NULL;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int set_stats_format(const char *arg)
+{
+    if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0)
+        STATS_FORMAT = STATS_FORMAT_TEXT;
+    else if (strcmp(arg, "--stats=json") == 0)
+        STATS_FORMAT = STATS_FORMAT_JSON;
+    else
+        return 0;
+
+    start_ns = monotonic_ns();
+    return 1;
+}
+
+void enable_perf_counters(void)
+{
+    perf_enabled = 1;
+    if (STATS_FORMAT == STATS_FORMAT_NONE)
+        set_stats_format("--stats");
+}
+
+static int perf_event_open(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // user space only : allowed with the default perf_event_paranoid
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // calling thread, any cpu
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * Open the counters of the calling thread, if enabled. The ones the cpu (or
+ * the container) does not provide are left out, and the timers only use the
+ * clock if none is there.
+ */
+static void open_perf_group(struct stats_perf_group *group)
+{
+    group->leader = -1;
+    group->size = 0;
+    for (size_t i = 0; i < STATS_NUM_PERF_EVENTS; ++i)
+    {
+        group->index[i] = -1;
+        if (!perf_enabled)
+            continue;
+        group->fds[i] = perf_event_open(PERF_EVENTS[i].type,
+                                        PERF_EVENTS[i].config, group->leader);
+        if (group->fds[i] == -1)
+        {
+            LOG_DEBUG("perf counter %s unavailable: %s", PERF_EVENT_NAMES[i],
+                      strerror(errno))
+            continue;
+        }
+        if (group->leader == -1)
+            group->leader = group->fds[i];
+        group->index[i] = group->size++;
+        __atomic_fetch_or(&perf_available, 1u << i, __ATOMIC_RELAXED);
+    }
+}
+
+static void close_perf_group(struct stats_perf_group *group)
+{
+    for (size_t i = 0; i < STATS_NUM_PERF_EVENTS; ++i)
+        if (group->index[i] != -1)
+            close(group->fds[i]);
+}
+
+/*
+ * Current value of the counters. Returns 0 if the group is not open (or
+ * could not be read).
+ */
+static int read_perf_group(const struct stats_perf_group *group,
+                           uint64_t *values)
+{
+    // number of events, then their values
+    uint64_t buffer[1 + STATS_NUM_PERF_EVENTS];
+    if (group->leader == -1
+        || read(group->leader, buffer, sizeof(buffer))
+            != (ssize_t)((1 + group->size) * sizeof(uint64_t)))
+        return 0;
+    for (size_t i = 0; i < STATS_NUM_PERF_EVENTS; ++i)
+        if (group->index[i] != -1)
+            values[i] = buffer[1 + group->index[i]];
+    return 1;
+}
+
+static struct stats_block *get_local_block(void)
+{
+    if (local_block != NULL)
+        return local_block;
+
+    struct stats_block *block = calloc(1, sizeof(struct stats_block));
+    if (block == NULL)
+    {
+        LOG_ERROR("failed to allocate stats block: %s", strerror(errno))
+        return NULL;
+    }
+    for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+        block->timers[i].min_ns = UINT64_MAX;
+    open_perf_group(&block->perf);
+
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    blocks = block;
+    ++num_blocks;
+    pthread_mutex_unlock(&blocks_lock);
+
+    local_block = block;
+    return block;
+}
+
+void stats_add(enum stats_counter counter, uint64_t amount)
+{
+    struct stats_block *block = get_local_block();
+    if (block != NULL)
+        block->counters[counter] += amount;
+}
+
+void stats_add_rejection(size_t prime_index)
+{
+    struct stats_block *block = get_local_block();
+    if (block == NULL)
+        return;
+    if (prime_index >= STATS_MAX_REJECTION_PRIMES)
+        prime_index = STATS_MAX_REJECTION_PRIMES - 1;
+    ++block->rejections[prime_index];
+}
+
+/*
+ * The counters are only read around the outermost region of a thread : a
+ * nested region is clocked, but its events are counted in the stage of the
+ * region around it, so that none is counted twice and a hot region inside a
+ * longer one does not pay two read() per call.
+ */
+void stats_timer_start(struct stats_scope *scope)
+{
+    struct stats_block *block = get_local_block();
+    if (block != NULL && block->depth++ == 0)
+        scope->counting = read_perf_group(&block->perf, scope->perf);
+    // last, so that reading the counters is not timed
+    scope->start_ns = monotonic_ns();
+}
+
+static unsigned histogram_bucket(uint64_t ns)
+{
+    unsigned bucket = 0;
+    while (ns > 1 && bucket < STATS_HISTOGRAM_BUCKETS - 1)
+    {
+        ns >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void timer_record(struct stats_timer *timer, uint64_t ns)
+{
+    ++timer->count;
+    timer->total_ns += ns;
+    if (ns < timer->min_ns)
+        timer->min_ns = ns;
+    if (ns > timer->max_ns)
+        timer->max_ns = ns;
+    ++timer->histogram[histogram_bucket(ns)];
+}
+
+void stats_timer_stop(enum stats_stage stage, const struct stats_scope *scope)
+{
+    uint64_t elapsed = monotonic_ns() - scope->start_ns;
+    struct stats_block *block = get_local_block();
+    if (block == NULL)
+        return;
+    if (block->depth > 0)
+        --block->depth;
+    struct stats_timer *timer = &block->timers[stage];
+    timer_record(timer, elapsed);
+
+    uint64_t perf[STATS_NUM_PERF_EVENTS] = { 0 };
+    if (!scope->counting || !read_perf_group(&block->perf, perf))
+        return;
+    for (size_t i = 0; i < STATS_NUM_PERF_EVENTS; ++i)
+        if (block->perf.index[i] != -1)
+            timer->perf[i] += perf[i] - scope->perf[i];
+}
+
+static void merge_blocks(struct stats_block *total)
+{
+    memset(total, 0, sizeof(struct stats_block));
+    for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+        total->timers[i].min_ns = UINT64_MAX;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (struct stats_block *block = blocks; block != NULL;
+         block = block->next)
+    {
+        for (size_t i = 0; i < STATS_NUM_COUNTERS; ++i)
+            total->counters[i] += block->counters[i];
+        for (size_t i = 0; i < STATS_MAX_REJECTION_PRIMES; ++i)
+            total->rejections[i] += block->rejections[i];
+        for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+        {
+            struct stats_timer *dst = &total->timers[i];
+            struct stats_timer *src = &block->timers[i];
+            dst->count += src->count;
+            dst->total_ns += src->total_ns;
+            if (src->min_ns < dst->min_ns)
+                dst->min_ns = src->min_ns;
+            if (src->max_ns > dst->max_ns)
+                dst->max_ns = src->max_ns;
+            for (size_t j = 0; j < STATS_HISTOGRAM_BUCKETS; ++j)
+                dst->histogram[j] += src->histogram[j];
+            for (size_t j = 0; j < STATS_NUM_PERF_EVENTS; ++j)
+                dst->perf[j] += src->perf[j];
+        }
+    }
+    pthread_mutex_unlock(&blocks_lock);
+
+    for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+        if (total->timers[i].count == 0)
+            total->timers[i].min_ns = 0;
+}
+
+static unsigned long rejection_prime(size_t index)
+{
+    if (index >= preliminary_num_primes())
+        return 0;
+    return preliminary_prime(index);
+}
+
+static void report_json(struct stats_block *total, uint64_t elapsed_ns)
+{
+    fprintf(stderr,
+            "{\"elapsed_ns\":%" PRIu64 ",\"threads\":%u,\"counters\":{",
+            elapsed_ns, num_blocks);
+    for (size_t i = 0; i < STATS_NUM_COUNTERS; ++i)
+        fprintf(stderr, "%s\"%s\":%" PRIu64, i ? "," : "", COUNTER_NAMES[i],
+                total->counters[i]);
+
+    fprintf(stderr, "},\"rejections\":{");
+    int first = 1;
+    for (size_t i = 0; i < STATS_MAX_REJECTION_PRIMES; ++i)
+    {
+        if (total->rejections[i] == 0)
+            continue;
+        fprintf(stderr, "%s\"%lu\":%" PRIu64, first ? "" : ",",
+                rejection_prime(i),
+                total->rejections[i]);
+        first = 0;
+    }
+
+    fprintf(stderr, "},\"stages\":{");
+    for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+    {
+        struct stats_timer *timer = &total->timers[i];
+        fprintf(stderr,
+                "%s\"%s\":{\"count\":%" PRIu64 ",\"total_ns\":%" PRIu64
+                ",\"min_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64
+                ",\"histogram_log2_ns\":[",
+                i ? "," : "", STAGE_NAMES[i], timer->count, timer->total_ns,
+                timer->min_ns, timer->max_ns);
+        for (size_t j = 0; j < STATS_HISTOGRAM_BUCKETS; ++j)
+            fprintf(stderr, "%s%" PRIu64, j ? "," : "",
+                    timer->histogram[j]);
+        fprintf(stderr, "]");
+        if (perf_available)
+        {
+            fprintf(stderr, ",\"perf\":{");
+            first = 1;
+            for (size_t j = 0; j < STATS_NUM_PERF_EVENTS; ++j)
+            {
+                if (!(perf_available & 1u << j))
+                    continue;
+                fprintf(stderr, "%s\"%s\":%" PRIu64, first ? "" : ",",
+                        PERF_EVENT_NAMES[j], timer->perf[j]);
+                first = 0;
+            }
+            fprintf(stderr, "}");
+        }
+        fprintf(stderr, "}");
+    }
+    fprintf(stderr, "}");
+    if (perf_enabled)
+        fprintf(stderr, ",\"perf_counters\":%s",
+                perf_available ? "true" : "false");
+    fprintf(stderr, "}\n");
+}
+
+// IPC, and every counter per call and per candidate
+static void report_perf_text(const struct stats_timer *timer,
+                             uint64_t candidates)
+{
+    const uint64_t *perf = timer->perf;
+    if (perf[STATS_PERF_CYCLES] != 0
+        && (perf_available & 1u << STATS_PERF_INSTRUCTIONS))
+        fprintf(stderr, "    ipc %.2f\n",
+                (double)perf[STATS_PERF_INSTRUCTIONS]
+                    / perf[STATS_PERF_CYCLES]);
+    for (size_t i = 0; i < STATS_NUM_PERF_EVENTS; ++i)
+    {
+        if (!(perf_available & 1u << i))
+            continue;
+        fprintf(stderr, "    %-13s %" PRIu64 ", %.1f per call",
+                PERF_EVENT_NAMES[i],
+                perf[i], (double)perf[i] / timer->count);
+        if (candidates != 0)
+            fprintf(stderr, ", %.1f per candidate",
+                    (double)perf[i] / candidates);
+        fprintf(stderr, "\n");
+    }
+}
+
+static void report_text(struct stats_block *total, uint64_t elapsed_ns)
+{
+    fprintf(stderr, "stats: %.3f ms elapsed, %u thread(s)\n",
+            elapsed_ns / 1e6, num_blocks);
+    for (size_t i = 0; i < STATS_NUM_COUNTERS; ++i)
+        fprintf(stderr, "  %-20s %" PRIu64 "\n", COUNTER_NAMES[i],
+                total->counters[i]);
+
+    fprintf(stderr, "  rejections by small prime:\n");
+    for (size_t i = 0; i < STATS_MAX_REJECTION_PRIMES; ++i)
+        if (total->rejections[i] != 0)
+            fprintf(stderr, "    %-8lu %" PRIu64 "\n", rejection_prime(i),
+                    total->rejections[i]);
+
+    for (size_t i = 0; i < STATS_NUM_STAGES; ++i)
+    {
+        struct stats_timer *timer = &total->timers[i];
+        fprintf(stderr,
+                "  %-15s %" PRIu64 " calls, total %.3f ms, mean %.0f ns, "
+                "min %" PRIu64 " ns, max %" PRIu64 " ns\n",
+                STAGE_NAMES[i], timer->count, timer->total_ns / 1e6,
+                timer->count ? (double)timer->total_ns / timer->count : 0.0,
+                timer->min_ns, timer->max_ns);
+        for (size_t j = 0; j < STATS_HISTOGRAM_BUCKETS; ++j)
+            if (timer->histogram[j] != 0)
+                fprintf(stderr, "    < 2^%-2zu ns %" PRIu64 "\n", j + 1,
+                        timer->histogram[j]);
+        if (perf_available && timer->count != 0)
+            report_perf_text(timer, total->counters[STATS_CANDIDATES]);
+    }
+    if (perf_enabled && !perf_available)
+        fprintf(stderr, "  perf counters unavailable, clock only\n");
+}
+
+void stats_report(void)
+{
+    if (!STATS_ENABLED)
+        return;
+
+    struct stats_block *total = malloc(sizeof(struct stats_block));
+    if (total == NULL)
+    {
+        LOG_ERROR("failed to allocate stats report: %s", strerror(errno))
+        return;
+    }
+    merge_blocks(total);
+
+    uint64_t elapsed_ns = monotonic_ns() - start_ns;
+    if (STATS_FORMAT == STATS_FORMAT_JSON)
+        report_json(total, elapsed_ns);
+    else
+        report_text(total, elapsed_ns);
+
+    free(total);
+}
+
+void cleanup_stats(void)
+{
+    pthread_mutex_lock(&blocks_lock);
+    while (blocks != NULL)
+    {
+        struct stats_block *next = blocks->next;
+        close_perf_group(&blocks->perf);
+        free(blocks);
+        blocks = next;
+    }
+    num_blocks = 0;
+    pthread_mutex_unlock(&blocks_lock);
+    local_block = NULL;
+}
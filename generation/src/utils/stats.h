@@ -0,0 +1,119 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum stats_format
+{
+    STATS_FORMAT_NONE = 0,
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+};
+
+enum stats_counter
+{
+    STATS_CANDIDATES, // prime candidates drawn
+    STATS_PRIMALITY_TESTS, // calls to primality_test()
+    STATS_MR_ROUNDS, // miller-rabin rounds run
+    STATS_MR_EARLY_EXITS, // miller-rabin tests that found a witness
+    STATS_LUCAS_TESTS, // strong lucas tests run
+    STATS_RNG_BYTES, // random bytes consumed (fortuna or system)
+    STATS_RESEEDS, // fortuna reseeds
+    STATS_NUM_COUNTERS,
+};
+
+enum stats_stage
+{
+    STATS_STAGE_RNG,
+    STATS_STAGE_TRIAL_DIVISION,
+    STATS_STAGE_MODEXP,
+    STATS_STAGE_OUTPUT,
+    STATS_NUM_STAGES,
+};
+
+// Hardware counters of a stage (--perf-counters)
+enum stats_perf_event
+{
+    STATS_PERF_CYCLES,
+    STATS_PERF_INSTRUCTIONS,
+    STATS_PERF_BRANCH_MISSES,
+    STATS_PERF_L1D_MISSES,
+    STATS_PERF_LLC_MISSES,
+    STATS_NUM_PERF_EVENTS,
+};
+
+// Start of a timed region : clock, and hardware counters if they are open
+struct stats_scope
+{
+    uint64_t start_ns;
+    int counting;
+    uint64_t perf[STATS_NUM_PERF_EVENTS];
+};
+
+// Rejections by small primes past this index are all counted in the last one
+#define STATS_MAX_REJECTION_PRIMES 1024
+
+extern enum stats_format STATS_FORMAT;
+
+#define STATS_ENABLED (STATS_FORMAT != STATS_FORMAT_NONE)
+
+/*
+ * The macros below are the only thing the hot paths should use: when stats
+ * are disabled, they boil down to a single (well predicted) branch.
+ */
+#define STATS_ADD(Counter, Amount)                                             \
+    {                                                                          \
+        if (STATS_ENABLED)                                                     \
+            stats_add((Counter), (Amount));                                    \
+    }
+
+#define STATS_REJECTION(PrimeIndex)                                            \
+    {                                                                          \
+        if (STATS_ENABLED)                                                     \
+            stats_add_rejection(PrimeIndex);                                   \
+    }
+
+#define STATS_TIMER_START(Name)                                                \
+    struct stats_scope Name = { 0 };                                           \
+    if (STATS_ENABLED)                                                         \
+        stats_timer_start(&(Name));
+
+#define STATS_TIMER_STOP(Stage, Name)                                          \
+    {                                                                          \
+        if (STATS_ENABLED)                                                     \
+            stats_timer_stop((Stage), &(Name));                                \
+    }
+
+/*
+ * Parse the argument of "--stats[=text|json]" and enable the stats.
+ * Returns 0 if the format is unknown.
+ */
+int set_stats_format(const char *arg);
+
+/*
+ * --perf-counters : also count cycles, instructions, branch and cache misses
+ * per stage (with the text stats, unless --stats selected a format). Every
+ * thread opens its own perf_event group on its first timed region, and only
+ * keeps the clock if the counters are not available. The counters are read
+ * around the outermost timed region of a thread only.
+ */
+void enable_perf_counters(void);
+
+void stats_add(enum stats_counter counter, uint64_t amount);
+
+void stats_add_rejection(size_t prime_index);
+
+void stats_timer_start(struct stats_scope *scope);
+
+void stats_timer_stop(enum stats_stage stage, const struct stats_scope *scope);
+
+/*
+ * Merge the per-thread counters and print them on stderr, in the format
+ * selected with set_stats_format().
+ */
+void stats_report(void);
+
+void cleanup_stats(void);
+
+#endif /* !STATS_H */
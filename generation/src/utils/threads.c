@@ -0,0 +1,38 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "threads.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utils/logging.h"
+
+// More threads than this is most likely a typo
+#define MAX_NUM_THREADS 1024
+
+unsigned NUM_THREADS = 0;
+
+int set_num_threads(const char *arg)
+{
+    char *endptr = NULL;
+    long value = strtol(arg, &endptr, 10);
+    if (*arg == 0 || *endptr != 0 || value < 0 || value > MAX_NUM_THREADS)
+    {
+        LOG_ERROR("Invalid number of threads: %s", arg)
+        return 0;
+    }
+
+    NUM_THREADS = value;
+    return 1;
+}
+
+unsigned num_threads(void)
+{
+    if (NUM_THREADS != 0)
+        return NUM_THREADS;
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1)
+        return 1;
+    return online > MAX_NUM_THREADS ? MAX_NUM_THREADS : online;
+}
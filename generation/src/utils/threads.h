@@ -0,0 +1,17 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+// Number of worker threads (0: one per online cpu)
+extern unsigned NUM_THREADS;
+
+/*
+ * Parse the value of "--threads N". Returns 0 if it is not a valid number.
+ */
+int set_num_threads(const char *arg);
+
+/*
+ * Number of worker threads to start (at least 1)
+ */
+unsigned num_threads(void);
+
+#endif /* !THREADS_H */
@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tuning.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logging.h"
+
+// Larger values are not a profile written by --autotune
+#define TUNING_MAX_WINDOW (1u << 24)
+#define TUNING_MAX_THREADS 1024
+
+static struct tuning_entry profile[TUNING_MAX_ENTRIES];
+static size_t profile_size = 0;
+
+const char *tuning_default_path(void)
+{
+    static char path[4096];
+
+    const char *env = getenv("MY_PRIME_PROFILE");
+    if (env != NULL && *env != 0)
+        return env;
+
+    const char *home = getenv("HOME");
+    if (home == NULL || *home == 0)
+        return NULL;
+    int size =
+        snprintf(path, sizeof(path), "%s/%s", home, TUNING_DEFAULT_FILE);
+    if (size < 0 || (size_t)size >= sizeof(path))
+        return NULL;
+    return path;
+}
+
+// Reads the 4 fields of an entry line. Returns 0 if it is malformed.
+static int parse_entry(const char *line, struct tuning_entry *entry)
+{
+    unsigned *fields[] = {&entry->bits, &entry->trial_primes,
+                          &entry->sieve_window, &entry->threads};
+    const char *p = line;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(*fields); ++i)
+    {
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p < '0' || *p > '9')
+            return 0;
+        char *endptr = NULL;
+        errno = 0;
+        unsigned long value = strtoul(p, &endptr, 10);
+        if (errno != 0 || value > 0xffffffffu)
+            return 0;
+        *fields[i] = value;
+        p = endptr;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        ++p;
+    return *p == 0 && entry->bits != 0
+        && entry->sieve_window <= TUNING_MAX_WINDOW
+        && entry->threads <= TUNING_MAX_THREADS;
+}
+
+int tuning_load(const char *path)
+{
+    profile_size = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+        {
+            LOG_DEBUG("no tuning profile at %s, using the defaults", path)
+            return 0;
+        }
+        LOG_WARN("failed to open the tuning profile %s: %s", path,
+                 strerror(errno))
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t line_number = 0;
+    int version = 0;
+    size_t size = 0;
+    while (getline(&line, &capacity, f) != -1)
+    {
+        ++line_number;
+        if (*line == '#' || *line == '\n')
+            continue;
+        if (!version)
+        {
+            if (sscanf(line, "version %d", &version) != 1
+                || version != TUNING_VERSION)
+                goto TuningLoadInvalid;
+            continue;
+        }
+
+        struct tuning_entry entry;
+        if (size == TUNING_MAX_ENTRIES || !parse_entry(line, &entry)
+            || (size > 0 && entry.bits <= profile[size - 1].bits))
+            goto TuningLoadInvalid;
+        profile[size++] = entry;
+    }
+    free(line);
+    fclose(f);
+
+    if (size == 0)
+    {
+        LOG_WARN("tuning profile %s is empty, using the defaults", path)
+        return -1;
+    }
+    profile_size = size;
+    LOG_DEBUG("loaded %zu bit lengths from the tuning profile %s", size, path)
+    return 1;
+
+TuningLoadInvalid:
+    LOG_WARN("invalid tuning profile %s (line %zu), using the defaults", path,
+             line_number)
+    free(line);
+    fclose(f);
+    return -1;
+}
+
+int tuning_save(const char *path, const struct tuning_entry *entries,
+                size_t count)
+{
+    char tmp_path[4096];
+    int size = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (size < 0 || (size_t)size >= sizeof(tmp_path))
+    {
+        LOG_ERROR("tuning profile path is too long: %s", path)
+        return 0;
+    }
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL)
+    {
+        LOG_ERROR("failed to create %s: %s", tmp_path, strerror(errno))
+        return 0;
+    }
+    fprintf(f, "# my_prime tuning profile, written by --autotune\n");
+    fprintf(f, "version %d\n", TUNING_VERSION);
+    fprintf(f, "# bits trial_primes sieve_window threads\n");
+    for (size_t i = 0; i < count; ++i)
+        fprintf(f, "%u %u %u %u\n", entries[i].bits, entries[i].trial_primes,
+                entries[i].sieve_window, entries[i].threads);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed)
+    {
+        LOG_ERROR("failed to write %s", tmp_path)
+        remove(tmp_path);
+        return 0;
+    }
+    if (rename(tmp_path, path) != 0)
+    {
+        LOG_ERROR("failed to rename %s to %s: %s", tmp_path, path,
+                  strerror(errno))
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+const struct tuning_entry *tuning_lookup(unsigned bits)
+{
+    if (profile_size == 0)
+        return NULL;
+
+    size_t i = 0;
+    while (i + 1 < profile_size && profile[i + 1].bits <= bits)
+        ++i;
+    return &profile[i];
+}
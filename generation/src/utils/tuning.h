@@ -0,0 +1,61 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stddef.h>
+
+/*
+ * Tuning profile : the parameters measured by --autotune on this host, per
+ * bit length. The profile is a text file :
+ *  - comment lines starting with '#'
+ *  - "version 1"
+ *  - one line "bits trial_primes sieve_window threads" per bit length, in
+ *    increasing order
+ * A parameter set to 0 keeps its default.
+ */
+
+#define TUNING_VERSION 1
+
+// More bit lengths than this is not a profile written by --autotune
+#define TUNING_MAX_ENTRIES 64
+
+// Profile file used when neither --profile nor MY_PRIME_PROFILE is given
+#define TUNING_DEFAULT_FILE ".my_prime_profile"
+
+struct tuning_entry
+{
+    unsigned bits;
+    // odd primes tried by the trial division
+    unsigned trial_primes;
+    // odd numbers sieved at once by --next / --prev
+    unsigned sieve_window;
+    // worker threads of --next / --prev
+    unsigned threads;
+};
+
+/*
+ * Path of the profile : MY_PRIME_PROFILE, or TUNING_DEFAULT_FILE in HOME.
+ * Returns NULL if there is neither.
+ */
+const char *tuning_default_path(void);
+
+/*
+ * Load the profile at path, replacing the current one.
+ * Returns 1 on success, 0 if the file does not exist and -1 if it is
+ * invalid (the current profile is then left empty).
+ */
+int tuning_load(const char *path);
+
+/*
+ * Write count entries to path (through a temporary file, renamed once
+ * complete). Returns 1 on success, 0 on failure.
+ */
+int tuning_save(const char *path, const struct tuning_entry *entries,
+                size_t count);
+
+/*
+ * Entry of the largest bit length <= bits (the first one if bits is below
+ * all of them). Returns NULL if no profile is loaded.
+ */
+const struct tuning_entry *tuning_lookup(unsigned bits);
+
+#endif /* !TUNING_H */
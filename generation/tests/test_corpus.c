@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "utils/corpus.h"
+
+// Entries per block of the test corpora : several blocks, the last partial
+#define TEST_BLOCK_SIZE 16
+
+#define NUM_VALUES 1000
+
+static char path[] = "/tmp/my_prime-corpus-XXXXXX";
+static uint64_t values[NUM_VALUES];
+
+// Increasing values with deltas of every varint length, up to 2^64 - 1
+static void setup(void)
+{
+    int fd = mkstemp(path);
+    cr_assert_neq(fd, -1);
+    close(fd);
+
+    uint64_t value = 1;
+    for (size_t i = 0; i + 1 < NUM_VALUES; ++i)
+    {
+        values[i] = value;
+        value += 1 + ((uint64_t)i * 2654435761u) % (1ull << (i % 48));
+    }
+    values[NUM_VALUES - 1] = UINT64_MAX;
+    cr_assert_lt(values[NUM_VALUES - 2], UINT64_MAX);
+
+    struct corpus_writer writer;
+    cr_assert(corpus_writer_open(&writer, path, TEST_BLOCK_SIZE));
+    for (size_t i = 0; i < NUM_VALUES; ++i)
+        cr_assert(corpus_writer_add(&writer, values[i]));
+    cr_assert(corpus_writer_close(&writer));
+}
+
+static void teardown(void)
+{
+    unlink(path);
+}
+
+Test(corpus, round_trip, .init = setup, .fini = teardown)
+{
+    cr_assert_eq(is_corpus_file(path), 1);
+
+    struct corpus corpus;
+    cr_assert(corpus_open(&corpus, path));
+    cr_assert(corpus_verify(&corpus));
+    cr_assert_eq(corpus.count, NUM_VALUES);
+    cr_assert_eq(corpus.num_blocks,
+                 (NUM_VALUES + TEST_BLOCK_SIZE - 1) / TEST_BLOCK_SIZE);
+
+    for (uint64_t i = 0; i < NUM_VALUES; ++i)
+        cr_assert_eq(corpus_get(&corpus, i), values[i], "entry %lu",
+                     (unsigned long)i);
+
+    uint64_t block[TEST_BLOCK_SIZE];
+    uint64_t i = 0;
+    for (uint64_t b = 0; b < corpus.num_blocks; ++b)
+    {
+        size_t count = corpus_decode_block(&corpus, b, block);
+        cr_assert_neq(count, 0);
+        for (size_t j = 0; j < count; ++j, ++i)
+            cr_assert_eq(block[j], values[i]);
+    }
+    cr_assert_eq(i, NUM_VALUES);
+    corpus_close(&corpus);
+}
+
+Test(corpus, lower_bound, .init = setup, .fini = teardown)
+{
+    struct corpus corpus;
+    cr_assert(corpus_open(&corpus, path));
+
+    cr_assert_eq(corpus_lower_bound(&corpus, 0), 0);
+    for (uint64_t i = 0; i < NUM_VALUES; ++i)
+    {
+        cr_assert_eq(corpus_lower_bound(&corpus, values[i]), i);
+        if (values[i] - 1 != (i == 0 ? 0 : values[i - 1]))
+            cr_assert_eq(corpus_lower_bound(&corpus, values[i] - 1), i);
+    }
+    corpus_close(&corpus);
+}
+
+Test(corpus, corrupt_data, .init = setup, .fini = teardown)
+{
+    // a byte in the middle of the first block
+    int fd = open(path, O_RDWR);
+    cr_assert_neq(fd, -1);
+    unsigned char byte;
+    cr_assert_eq(pread(fd, &byte, 1, CORPUS_HEADER_SIZE + 12), 1);
+    byte ^= 0x40;
+    cr_assert_eq(pwrite(fd, &byte, 1, CORPUS_HEADER_SIZE + 12), 1);
+    close(fd);
+
+    struct corpus corpus;
+    cr_assert(corpus_open(&corpus, path));
+    cr_assert_not(corpus_verify(&corpus));
+    corpus_close(&corpus);
+}
+
+Test(corpus, increasing_entries, .init = setup, .fini = teardown)
+{
+    struct corpus_writer writer;
+    cr_assert(corpus_writer_open(&writer, path, TEST_BLOCK_SIZE));
+    cr_assert(corpus_writer_add(&writer, 5));
+    cr_assert_not(corpus_writer_add(&writer, 5));
+    cr_assert_not(corpus_writer_add(&writer, 3));
+    cr_assert(corpus_writer_close(&writer));
+}
@@ -0,0 +1,106 @@
+#include <criterion/criterion.h>
+#include <inttypes.h>
+#include <openssl/crypto.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "primes/next_prime.h"
+#include "primes/preliminary.h"
+#include "primes/primality_test.h"
+#include "primes/range_sieve.h"
+
+static void setup(void)
+{
+    cr_assert_eq(setup_preliminary(), 1);
+    // no random bases : the searches are deterministic
+    primality_test_type = PRIMALITY_TEST_BPSW;
+}
+
+static void teardown(void)
+{
+    cleanup_preliminary();
+}
+
+/*
+ * Checks the prime after n (or before it, if previous), both in decimal.
+ * expected is NULL if there is none.
+ */
+static void check_next(const char *n, int previous, const char *expected)
+{
+    BIGNUM *bn = NULL;
+    cr_assert(BN_dec2bn(&bn, n));
+    BIGNUM *p = find_next_prime(bn, previous);
+    BN_free(bn);
+    if (expected == NULL)
+    {
+        cr_assert_null(p, "%s prime of %s", previous ? "previous" : "next", n);
+        return;
+    }
+
+    cr_assert_not_null(p);
+    char *found = BN_bn2dec(p);
+    BN_free(p);
+    cr_assert_str_eq(found, expected, "%s prime of %s",
+                     previous ? "previous" : "next", n);
+    OPENSSL_free(found);
+}
+
+Test(next_prime, small_numbers, .init = setup, .fini = teardown)
+{
+    check_next("0", 0, "2");
+    check_next("1", 0, "2");
+    check_next("2", 0, "3");
+    check_next("3", 0, "5");
+    check_next("89", 0, "97");
+    check_next("0", 1, NULL);
+    check_next("2", 1, NULL);
+    check_next("3", 1, "2");
+    check_next("4", 1, "3");
+    check_next("97", 1, "89");
+}
+
+Test(next_prime, word_edges, .init = setup, .fini = teardown)
+{
+    // 2^32 and 2^64
+    check_next("4294967296", 0, "4294967311");
+    check_next("4294967296", 1, "4294967291");
+    check_next("18446744073709551615", 0, "18446744073709551629");
+    check_next("18446744073709551616", 1, "18446744073709551557");
+    check_next("18446744073709551557", 0, "18446744073709551629");
+    check_next("18446744073709551629", 1, "18446744073709551557");
+}
+
+Test(next_prime, mersenne_89, .init = setup, .fini = teardown)
+{
+    // 2^89 - 1 is prime
+    check_next("618970019642690137449562110", 0, "618970019642690137449562111");
+    check_next("618970019642690137449562112", 1, "618970019642690137449562111");
+}
+
+Test(next_prime, agrees_with_sieve, .init = setup, .fini = teardown)
+{
+    // every prime of [10^12, 10^12 + 20000], one after the other
+    const uint64_t lo = 1000000000000ull;
+    const uint64_t hi = lo + 20000;
+    FILE *out = tmpfile();
+    cr_assert_not_null(out);
+    long count = sieve_range(lo, hi, out);
+    cr_assert(count > 0);
+    rewind(out);
+
+    BIGNUM *p = BN_new();
+    cr_assert_not_null(p);
+    cr_assert(BN_set_word(p, lo));
+    for (long i = 0; i < count; ++i)
+    {
+        uint64_t expected = 0;
+        cr_assert_eq(fscanf(out, "%" SCNu64, &expected), 1);
+        BIGNUM *next = find_next_prime(p, 0);
+        cr_assert_not_null(next);
+        cr_assert_eq(BN_get_word(next), expected);
+        BN_free(p);
+        p = next;
+    }
+    BN_free(p);
+    fclose(out);
+}
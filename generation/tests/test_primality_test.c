@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <criterion/criterion.h>
+#include <openssl/bn.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "primes/preliminary.h"
+#include "primes/primality_test.h"
+#include "utils/result_cache.h"
+
+static BN_CTX *ctx = NULL;
+
+static void setup(void)
+{
+    cr_assert_eq(setup_preliminary(), 1);
+    ctx = BN_CTX_new();
+    cr_assert_not_null(ctx);
+}
+
+static void teardown(void)
+{
+    BN_CTX_free(ctx);
+    cleanup_preliminary();
+}
+
+// primality_test() of a decimal number
+static int test_dec(const char *n, enum primality_test_type type)
+{
+    BIGNUM *bn = NULL;
+    cr_assert(BN_dec2bn(&bn, n));
+    primality_test_type = type;
+    int success = primality_test(bn, 40, ctx);
+    BN_free(bn);
+    return success;
+}
+
+Test(primality_test, two, .init = setup, .fini = teardown)
+{
+    BIGNUM *two = BN_new();
+    cr_assert_not_null(two);
+    cr_assert(BN_set_word(two, 2));
+    // certainly prime : neither test runs on an even number
+    cr_assert_eq(preliminary_checks(two, ctx), 2);
+    BN_free(two);
+
+    cr_assert_eq(test_dec("2", PRIMALITY_TEST_BPSW), 1);
+    cr_assert_eq(test_dec("2", PRIMALITY_TEST_MILLER_RABIN), 1);
+}
+
+Test(primality_test, small_numbers, .init = setup, .fini = teardown)
+{
+    cr_assert_eq(test_dec("0", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("1", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("3", PRIMALITY_TEST_BPSW), 1);
+    cr_assert_eq(test_dec("4", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("97", PRIMALITY_TEST_BPSW), 1);
+    cr_assert_eq(test_dec("-7", PRIMALITY_TEST_BPSW), 0);
+}
+
+Test(primality_test, bpsw, .init = setup, .fini = teardown)
+{
+    // base-2 strong pseudoprimes, and a Carmichael number
+    cr_assert_eq(test_dec("2047", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("3215031751", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("3825123056546413051", PRIMALITY_TEST_BPSW), 0);
+    cr_assert_eq(test_dec("561", PRIMALITY_TEST_BPSW), 0);
+    // 2^61 - 1, 2^89 - 1 and 2^64 - 59
+    cr_assert_eq(test_dec("2305843009213693951", PRIMALITY_TEST_BPSW), 1);
+    cr_assert_eq(test_dec("618970019642690137449562111", PRIMALITY_TEST_BPSW),
+                 1);
+    cr_assert_eq(test_dec("18446744073709551557", PRIMALITY_TEST_BPSW), 1);
+    // (2^61 - 1) * (2^89 - 1)
+    cr_assert_eq(test_dec("1427247692705959880439315947500961989719490561",
+                          PRIMALITY_TEST_BPSW),
+                 0);
+}
+
+Test(primality_test, cached_two, .init = setup, .fini = teardown)
+{
+    char path[] = "/tmp/my_prime-cache-XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_neq(fd, -1);
+    close(fd);
+    unlink(path);
+
+    BIGNUM *two = BN_new();
+    cr_assert_not_null(two);
+    cr_assert(BN_set_word(two, 2));
+    struct result_cache cache;
+    cr_assert(result_cache_open(&cache, path));
+    // the stored verdict is prime, whatever the test
+    primality_test_type = PRIMALITY_TEST_BPSW;
+    cr_assert_eq(primality_test_cached(two, &cache), 1);
+    primality_test_type = PRIMALITY_TEST_MILLER_RABIN;
+    cr_assert_eq(primality_test_cached(two, &cache), 1);
+    result_cache_close(&cache);
+    BN_free(two);
+    unlink(path);
+}
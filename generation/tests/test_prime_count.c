@@ -0,0 +1,45 @@
+#include <criterion/criterion.h>
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "primes/prime_count.h"
+#include "primes/range_sieve.h"
+
+// π(10^k), k = 0 to 13
+static const long PI_POWERS_OF_TEN[] = {
+    0,        4,         25,         168,         1229,
+    9592,     78498,     664579,     5761455,     50847534,
+    455052511, 4118054813, 37607912018, 346065536839,
+};
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof(*(array)))
+
+Test(prime_count, powers_of_ten)
+{
+    uint64_t x = 1;
+    for (size_t k = 0; k < ARRAY_SIZE(PI_POWERS_OF_TEN); ++k, x *= 10)
+        cr_assert_eq(prime_count(x), PI_POWERS_OF_TEN[k], "pi(%" PRIu64 ")",
+                     x);
+}
+
+Test(prime_count, small_x)
+{
+    cr_assert_eq(prime_count(0), 0);
+    cr_assert_eq(prime_count(1), 0);
+    cr_assert_eq(prime_count(2), 1);
+    cr_assert_eq(prime_count(3), 2);
+    cr_assert_eq(prime_count(4), 2);
+}
+
+Test(prime_count, agrees_with_sieve)
+{
+    // around the switch from the sieve to LMO (2^24), and on either side of
+    // primes
+    static const uint64_t X[] = {
+        99991,     16777215,  16777216,      16777217,      123456789,
+        999999937, 999999938, 4294967291ull, 4294967311ull,
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(X); ++i)
+        cr_assert_eq(prime_count(X[i]), sieve_range(0, X[i], NULL),
+                     "pi(%" PRIu64 ")", X[i]);
+}
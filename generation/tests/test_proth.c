@@ -0,0 +1,99 @@
+#include <criterion/criterion.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "primes/preliminary.h"
+#include "primes/primality_test.h"
+#include "primes/proth.h"
+
+// As --proth : the small and unusual candidates go through BPSW
+static void setup(void)
+{
+    cr_assert_eq(setup_preliminary(), 1);
+    primality_test_type = PRIMALITY_TEST_BPSW;
+}
+
+static void teardown(void)
+{
+    cleanup_preliminary();
+}
+
+// Checks the lines written by a search against expected
+static void check_output(FILE *out, const char *const *expected, size_t count)
+{
+    char line[128];
+    rewind(out);
+    for (size_t i = 0; i < count; ++i)
+    {
+        cr_assert_not_null(fgets(line, sizeof(line), out));
+        line[strcspn(line, "\n")] = 0;
+        cr_assert_str_eq(line, expected[i]);
+    }
+    cr_assert_null(fgets(line, sizeof(line), out));
+}
+
+// Number of primes found, the output being discarded
+static long count_primes(unsigned n, uint64_t k_min, uint64_t k_max, int sign)
+{
+    FILE *out = tmpfile();
+    cr_assert_not_null(out);
+    long count = proth_search(n, k_min, k_max, sign, out);
+    fclose(out);
+    return count;
+}
+
+Test(proth, small_k, .init = setup, .fini = teardown)
+{
+    static const char *const PROTH[] = {
+        "1*2^1+1", "2*2^1+1", "3*2^1+1", "5*2^1+1",
+        "6*2^1+1", "8*2^1+1", "9*2^1+1",
+    };
+    static const char *const RIESEL[] = {
+        "1*2^2-1",  "2*2^2-1",  "3*2^2-1",  "5*2^2-1",
+        "6*2^2-1",  "8*2^2-1",  "11*2^2-1", "12*2^2-1",
+        "15*2^2-1", "17*2^2-1", "18*2^2-1", "20*2^2-1",
+    };
+
+    FILE *out = tmpfile();
+    cr_assert_not_null(out);
+    cr_assert_eq(proth_search(1, 1, 10, 1, out), 7);
+    check_output(out, PROTH, 7);
+    fclose(out);
+
+    out = tmpfile();
+    cr_assert_not_null(out);
+    cr_assert_eq(proth_search(2, 1, 20, -1, out), 12);
+    check_output(out, RIESEL, 12);
+    fclose(out);
+}
+
+Test(proth, large_n, .init = setup, .fini = teardown)
+{
+    // 3 * 2^n + 1 is prime for n = 189 and 201, but not in between
+    cr_assert_eq(count_primes(189, 3, 3, 1), 1);
+    cr_assert_eq(count_primes(190, 3, 3, 1), 0);
+    cr_assert_eq(count_primes(201, 3, 3, 1), 1);
+    // 3 * 2^n - 1 is prime for n = 143 and 206, but not in between
+    cr_assert_eq(count_primes(143, 3, 3, -1), 1);
+    cr_assert_eq(count_primes(144, 3, 3, -1), 0);
+    cr_assert_eq(count_primes(206, 3, 3, -1), 1);
+}
+
+Test(proth, top_of_k_range, .init = setup, .fini = teardown)
+{
+    // the sieve must not step past 2^64 - 1, and the search must end there
+    FILE *out = tmpfile();
+    cr_assert_not_null(out);
+    cr_assert_eq(proth_search(3, 18446744073709551000ull, UINT64_MAX, 1, out),
+                 30);
+    rewind(out);
+    char line[128];
+    char last[128] = "";
+    while (fgets(line, sizeof(line), out) != NULL)
+        strcpy(last, line);
+    cr_assert_str_eq(last, "18446744073709551612*2^3+1\n");
+    fclose(out);
+
+    cr_assert_eq(count_primes(3, 18446744073709551000ull, UINT64_MAX, -1), 27);
+}
@@ -0,0 +1,107 @@
+#include <criterion/criterion.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "primes/range_sieve.h"
+
+// π(10^k), k = 1 to 8
+static const long PI_POWERS_OF_TEN[] = {4,      25,      168,     1229,
+                                        9592,   78498,   664579,  5761455};
+
+static const uint64_t PRIMES_BELOW_100[] = {
+    2,  3,  5,  7,  11, 13, 17, 19, 23, 29, 31, 37, 41,
+    43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97,
+};
+
+// Every prime of [2^64 - 100, 2^64 - 1]
+static const uint64_t PRIMES_BELOW_2_64[] = {
+    18446744073709551521ull,
+    18446744073709551533ull,
+    18446744073709551557ull,
+};
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof(*(array)))
+
+// Lists [lo, hi] and checks the output against expected
+static void check_listing(uint64_t lo, uint64_t hi, const uint64_t *expected,
+                          size_t count)
+{
+    FILE *out = tmpfile();
+    cr_assert_not_null(out);
+    cr_assert_eq(sieve_range(lo, hi, out), (long)count);
+
+    rewind(out);
+    uint64_t p = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        cr_assert_eq(fscanf(out, "%" SCNu64, &p), 1);
+        cr_assert_eq(p, expected[i], "prime %zu: %" PRIu64, i, p);
+    }
+    cr_assert_eq(fscanf(out, "%" SCNu64, &p), EOF);
+    fclose(out);
+}
+
+Test(range_sieve, powers_of_ten)
+{
+    uint64_t x = 1;
+    for (size_t k = 0; k < ARRAY_SIZE(PI_POWERS_OF_TEN); ++k)
+    {
+        x *= 10;
+        cr_assert_eq(sieve_range(0, x, NULL), PI_POWERS_OF_TEN[k],
+                     "pi(%" PRIu64 ")", x);
+    }
+}
+
+Test(range_sieve, small_bounds)
+{
+    cr_assert_eq(sieve_range(0, 0, NULL), 0);
+    cr_assert_eq(sieve_range(0, 1, NULL), 0);
+    cr_assert_eq(sieve_range(2, 2, NULL), 1);
+    cr_assert_eq(sieve_range(3, 5, NULL), 2);
+    cr_assert_eq(sieve_range(4, 4, NULL), 0);
+    cr_assert_eq(sieve_range(7, 7, NULL), 1);
+    cr_assert_eq(sieve_range(8, 30, NULL), 6);
+    cr_assert_eq(sieve_range(0, 10, NULL), 4);
+}
+
+Test(range_sieve, listing)
+{
+    check_listing(0, 100, PRIMES_BELOW_100, ARRAY_SIZE(PRIMES_BELOW_100));
+    check_listing(30, 60, PRIMES_BELOW_100 + 10, 7);
+}
+
+Test(range_sieve, top_of_range)
+{
+    check_listing(UINT64_MAX - 99, UINT64_MAX, PRIMES_BELOW_2_64,
+                  ARRAY_SIZE(PRIMES_BELOW_2_64));
+    cr_assert_eq(sieve_range(UINT64_MAX, UINT64_MAX, NULL), 0);
+}
+
+Test(range_sieve, interval_below_10_12)
+{
+    // π(10^12) - π(999999000000)
+    cr_assert_eq(sieve_range(999999000000, 1000000000000, NULL), 36400);
+}
+
+Test(range_sieve, narrow_ranges)
+{
+    // sqrt(10^16) = 10^8 : the range of 4 * 10^6 numbers is sieved, and its
+    // quarters (below 10^8 / RANGE_TEST_RATIO) are tested number by number
+    const uint64_t lo = 10000000000000000ull;
+    const uint64_t width = 1000000;
+    long count = 0;
+    for (uint64_t i = 0; i < 4; ++i)
+    {
+        long quarter = sieve_range(lo + i * width, lo + (i + 1) * width - 1,
+                                   NULL);
+        cr_assert_neq(quarter, -1);
+        count += quarter;
+    }
+    cr_assert_eq(sieve_range(lo, lo + 4 * width - 1, NULL), count);
+
+    // 10^18 + [0, 10^6]
+    cr_assert_eq(sieve_range(1000000000000000000ull,
+                             1000000000001000000ull, NULL),
+                 24280);
+}
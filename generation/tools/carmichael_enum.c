@@ -0,0 +1,571 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * Enumerate the Carmichael numbers n <= X, after Pinch : n is built from its
+ * prime factors p1 < p2 < ... < pk (k >= 3), and Korselt's criterion
+ * (n squarefree, p - 1 | n - 1 for every p | n) is enforced on every
+ * prefix P = p1...pj with L = lcm(pi - 1) :
+ *  - a new factor q must not divide L, and no pi may divide q - 1
+ *  - the rest m of n = P * m is = P^-1 (mod L), and m > pj : when the
+ *    smallest such m is already above X / P, the prefix has no extension
+ *  - the last factor r satisfies both r = P^-1 (mod L) and r - 1 | P - 1,
+ *    so it is found by stepping through that progression up to
+ *    min(P, X / P), without any table
+ * The threads share the pairs of leading factors (p1, p2). With --tag, the
+ * Carmichael numbers up to the largest entry of a list of base-2 Fermat
+ * pseudoprimes are enumerated, and every entry of the list is tagged.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "primes/range_sieve.h"
+#include "utils/corpus.h"
+#include "utils/logging.h"
+#include "utils/mont64.h"
+#include "utils/threads.h"
+
+// X is capped so that the last factor fits in mont64
+#define MAX_X (1ull << 62)
+// 3 * 5 * 7 * ... * 53 (the first 16 odd primes) is above MAX_X
+#define MAX_FACTORS 16
+// Second factors handed to a thread at once
+#define PAIR_BATCH 64
+
+struct prefix
+{
+    uint64_t product;
+    // lcm(p - 1) of the factors, and product^-1 modulo it
+    uint64_t lcm;
+    uint64_t inverse;
+    unsigned size;
+    uint32_t factors[MAX_FACTORS];
+    // index of the last factor in the prime table
+    size_t last;
+};
+
+struct results
+{
+    uint64_t *numbers;
+    size_t count;
+    size_t capacity;
+};
+
+struct enumeration
+{
+    uint64_t x;
+    // odd primes up to sqrt(x / 3)
+    uint32_t *primes;
+    size_t num_primes;
+    // leading factors : p1^3 < x
+    size_t num_leading;
+    // next pair (leading factor, second factor) to hand out
+    size_t next_leading;
+    size_t next_second;
+    // merged by every thread once it is done
+    struct results *results;
+    // guards the pairs and the results
+    pthread_mutex_t lock;
+    int failed;
+};
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = 0;
+    for (int bit = 31; bit >= 0; --bit)
+    {
+        uint64_t candidate = r | (1ull << bit);
+        if (candidate * candidate <= n)
+            r = candidate;
+    }
+    return r;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b != 0)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// a^-1 mod m, for gcd(a, m) = 1 and m < 2^63
+static uint64_t inverse_mod(uint64_t a, uint64_t m)
+{
+    int64_t t = 0;
+    int64_t new_t = 1;
+    int64_t r = m;
+    int64_t new_r = a % m;
+    while (new_r != 0)
+    {
+        int64_t quotient = r / new_r;
+        int64_t tmp = t - quotient * new_t;
+        t = new_t;
+        new_t = tmp;
+        tmp = r - quotient * new_r;
+        r = new_r;
+        new_r = tmp;
+    }
+    return (uint64_t)(t < 0 ? t + (int64_t)m : t);
+}
+
+/*
+ * Deterministic Miller-Rabin below 2^64 (Sinclair's bases), for an odd
+ * n < 2^63
+ */
+static int is_prime(uint64_t n)
+{
+    static const uint64_t BASES[] = { 2,      325,     9375,      28178,
+                                      450775, 9780504, 1795265022 };
+    if (n < 3)
+        return n == 2;
+    if (n % 3 == 0)
+        return n == 3;
+
+    struct mont64 m;
+    mont64_init(&m, n);
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+    uint64_t minus_one = mont64_sub(&m, 0, m.one);
+    for (size_t i = 0; i < sizeof(BASES) / sizeof(BASES[0]); ++i)
+    {
+        uint64_t a = BASES[i] % n;
+        if (a == 0)
+            continue;
+        uint64_t x = mont64_pow(&m, mont64_to(&m, a), d);
+        if (x == m.one || x == minus_one)
+            continue;
+        int witness = 1;
+        for (int j = 1; j < s && witness; ++j)
+        {
+            x = mont64_mul(&m, x, x);
+            witness = x != minus_one;
+        }
+        if (witness)
+            return 0;
+    }
+    return 1;
+}
+
+static int add_result(struct results *results, uint64_t n)
+{
+    if (results->count == results->capacity)
+    {
+        size_t capacity = results->capacity ? 2 * results->capacity : 1024;
+        uint64_t *numbers =
+            realloc(results->numbers, capacity * sizeof(uint64_t));
+        if (numbers == NULL)
+        {
+            LOG_ERROR("failed to allocate results: %s", strerror(errno))
+            return 0;
+        }
+        results->numbers = numbers;
+        results->capacity = capacity;
+    }
+    results->numbers[results->count++] = n;
+    return 1;
+}
+
+// Smallest m = inverse (mod lcm) with m > above
+static uint64_t first_above(uint64_t inverse, uint64_t lcm, uint64_t above)
+{
+    if (inverse > above)
+        return inverse;
+    return inverse + ((above - inverse) / lcm + 1) * lcm;
+}
+
+/*
+ * The last factor r : r = P^-1 (mod L), r - 1 | P - 1 (so r <= P), and
+ * P * r <= x
+ */
+static int complete_prefix(const struct enumeration *e,
+                           const struct prefix *prefix,
+                           struct results *results)
+{
+    uint64_t p = prefix->product;
+    uint64_t max = e->x / p < p ? e->x / p : p;
+    uint64_t last = prefix->factors[prefix->size - 1];
+    for (uint64_t r = first_above(prefix->inverse, prefix->lcm, last);
+         r <= max; r += prefix->lcm)
+        if ((p - 1) % (r - 1) == 0 && is_prime(r)
+            && !add_result(results, p * r))
+            return 0;
+    return 1;
+}
+
+static int search_prefix(const struct enumeration *e,
+                         const struct prefix *prefix, struct results *results);
+
+/*
+ * Extend the prefix with q = primes[i], if Korselt's criterion still allows
+ * it. Returns 0 on failure.
+ */
+static int add_factor(const struct enumeration *e, const struct prefix *prefix,
+                      size_t i, struct results *results)
+{
+    uint64_t q = e->primes[i];
+    // q does not divide L and no factor divides q - 1
+    if (prefix->lcm % q == 0)
+        return 1;
+    for (unsigned j = 0; j < prefix->size; ++j)
+        if (q % prefix->factors[j] == 1)
+            return 1;
+
+    unsigned __int128 lcm =
+        (unsigned __int128)(prefix->lcm / gcd(prefix->lcm, q - 1)) * (q - 1);
+    // L divides n - 1 < x
+    if (lcm >= e->x)
+        return 1;
+    struct prefix next = *prefix;
+    next.product = prefix->product * q;
+    next.lcm = lcm;
+    next.inverse = inverse_mod(next.product % next.lcm, next.lcm);
+    // the smallest rest of n is already too large
+    if (first_above(next.inverse, next.lcm, q) > e->x / next.product)
+        return 1;
+
+    next.factors[next.size++] = q;
+    next.last = i;
+    return search_prefix(e, &next, results);
+}
+
+static int search_prefix(const struct enumeration *e,
+                         const struct prefix *prefix, struct results *results)
+{
+    if (prefix->size >= 2 && !complete_prefix(e, prefix, results))
+        return 0;
+    if (prefix->size == MAX_FACTORS - 1)
+        return 1;
+
+    uint64_t rest = e->x / prefix->product;
+    for (size_t i = prefix->last + 1; i < e->num_primes; ++i)
+    {
+        uint64_t q = e->primes[i];
+        // another factor above q is still needed
+        if (rest / q < q + 2)
+            break;
+        if (!add_factor(e, prefix, i, results))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hand out the next PAIR_BATCH second factors of the current leading
+ * factor : the subtree of a small leading factor is too large to be a
+ * single unit of work. Returns 0 once every pair is out.
+ */
+static int next_pairs(struct enumeration *e, size_t *leading, size_t *first,
+                      size_t *end)
+{
+    pthread_mutex_lock(&e->lock);
+    for (; e->next_leading < e->num_leading; ++e->next_leading)
+    {
+        uint64_t rest = e->x / e->primes[e->next_leading];
+        if (e->next_second <= e->next_leading)
+            e->next_second = e->next_leading + 1;
+        size_t i = e->next_second;
+        for (; i < e->num_primes && i < e->next_second + PAIR_BATCH; ++i)
+            if (rest / e->primes[i] < e->primes[i] + 2)
+                break;
+        if (i > e->next_second)
+        {
+            *leading = e->next_leading;
+            *first = e->next_second;
+            *end = i;
+            e->next_second = i;
+            break;
+        }
+        e->next_second = 0;
+    }
+    int found = e->next_leading < e->num_leading;
+    pthread_mutex_unlock(&e->lock);
+    return found;
+}
+
+static void *enumeration_worker(void *arg)
+{
+    struct enumeration *e = arg;
+    struct results results = { .count = 0 };
+    size_t leading = 0;
+    size_t first = 0;
+    size_t end = 0;
+    while (!__atomic_load_n(&e->failed, __ATOMIC_RELAXED)
+           && next_pairs(e, &leading, &first, &end))
+    {
+        uint32_t p = e->primes[leading];
+        struct prefix prefix = {
+            .product = p,
+            .lcm = p - 1,
+            // p = 1 (mod p - 1)
+            .inverse = 1,
+            .size = 1,
+            .factors = { p },
+            .last = leading,
+        };
+        for (size_t i = first; i < end; ++i)
+            if (!add_factor(e, &prefix, i, &results))
+                __atomic_store_n(&e->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&e->lock);
+    for (size_t i = 0; i < results.count; ++i)
+        if (!add_result(e->results, results.numbers[i]))
+            __atomic_store_n(&e->failed, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&e->lock);
+    free(results.numbers);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Odd primes up to sqrt(x / 3) (the factors but the last one). Returns 0 on
+ * failure.
+ */
+static int setup_primes(struct enumeration *e)
+{
+    uint64_t limit = isqrt(e->x / 3);
+    size_t count = 0;
+    uint32_t *large = limit >= 7 ? sieving_primes(limit, &count) : NULL;
+    if (limit >= 7 && large == NULL)
+        return 0;
+
+    e->primes = malloc((count + 2) * sizeof(uint32_t));
+    if (e->primes == NULL)
+    {
+        LOG_ERROR("failed to allocate the primes: %s", strerror(errno))
+        free(large);
+        return 0;
+    }
+    e->num_primes = 0;
+    for (uint32_t p = 3; p <= 5 && p <= limit; p += 2)
+        e->primes[e->num_primes++] = p;
+    memcpy(e->primes + e->num_primes, large, count * sizeof(uint32_t));
+    e->num_primes += count;
+    free(large);
+
+    e->num_leading = 0;
+    while (e->num_leading < e->num_primes)
+    {
+        uint64_t p = e->primes[e->num_leading];
+        if (p * p > e->x / p)
+            break;
+        ++e->num_leading;
+    }
+    return 1;
+}
+
+static int enumerate(struct enumeration *e)
+{
+    if (!setup_primes(e))
+        return 0;
+    LOG_INFO("%zu primes, %zu leading factors", e->num_primes, e->num_leading)
+
+    unsigned num = num_threads();
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 0;
+    }
+    unsigned started = 0;
+    for (; started + 1 < num; ++started)
+        if (pthread_create(&threads[started], NULL, &enumeration_worker, e)
+            != 0)
+            break;
+    // the calling thread works too (and alone if no thread could start)
+    enumeration_worker(e);
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    qsort(e->results->numbers, e->results->count, sizeof(uint64_t),
+          &compare_u64);
+    return !e->failed;
+}
+
+/*
+ * Read a list of "index value" lines, or a binary corpus, into numbers.
+ * Returns the number of entries, or 0 on failure.
+ */
+static size_t load_list(const char *path, uint64_t **numbers)
+{
+    struct results list = { .count = 0 };
+    if (is_corpus_file(path))
+    {
+        struct corpus corpus;
+        if (!corpus_open(&corpus, path) || !corpus_verify(&corpus))
+            return 0;
+        list.numbers = malloc(corpus.count * sizeof(uint64_t) + 1);
+        if (list.numbers == NULL)
+            LOG_ERROR("failed to allocate the list: %s", strerror(errno))
+        for (uint64_t block = 0;
+             list.numbers != NULL && block < corpus.num_blocks; ++block)
+            list.count += corpus_decode_block(&corpus, block,
+                                              list.numbers + list.count);
+        corpus_close(&corpus);
+        *numbers = list.numbers;
+        return list.count;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+    unsigned long index;
+    unsigned long value;
+    int success = 1;
+    while (success && fscanf(f, "%lu %lu", &index, &value) == 2)
+        success = add_result(&list, value);
+    if (success && !feof(f))
+    {
+        LOG_ERROR("invalid line %zu of %s", list.count + 1, path)
+        success = 0;
+    }
+    fclose(f);
+    if (!success)
+    {
+        free(list.numbers);
+        return 0;
+    }
+    *numbers = list.numbers;
+    return list.count;
+}
+
+/*
+ * Print the entries of the list with a "carmichael" or "fermat" tag, and
+ * check that no Carmichael number is missing from it
+ */
+static int tag_list(const uint64_t *list, size_t count,
+                    const struct results *carmichael)
+{
+    size_t j = 0;
+    size_t tagged = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (; j < carmichael->count && carmichael->numbers[j] < list[i]; ++j)
+            LOG_WARN("Carmichael number %lu is missing from the list",
+                     (unsigned long)carmichael->numbers[j])
+        int is_carmichael =
+            j < carmichael->count && carmichael->numbers[j] == list[i];
+        j += is_carmichael;
+        printf("%zu %lu %s\n", i + 1, (unsigned long)list[i],
+               is_carmichael ? "carmichael" : "fermat");
+        tagged += is_carmichael;
+    }
+    fprintf(stderr, "%zu Carmichael number(s) among %zu pseudoprime(s)\n",
+            tagged, count);
+    return tagged == carmichael->count;
+}
+
+static void usage_msg(void)
+{
+    fprintf(stderr,
+            "usage: ./tools/carmichael_enum X [--threads N] [-v]\n"
+            "       ./tools/carmichael_enum --tag file [--threads N] [-v]\n"
+            "  print the Carmichael numbers <= X (X <= 2^62), in increasing "
+            "order\n"
+            "  --tag file: tag every entry of a list of base-2 pseudoprimes "
+            "(\"index value\"\n"
+            "     lines, or binary corpus) as \"carmichael\" or \"fermat\"\n");
+}
+
+static int parse_u64(const char *arg, uint64_t *value)
+{
+    char *endptr = NULL;
+    errno = 0;
+    *value = strtoull(arg, &endptr, 10);
+    return *arg != 0 && *endptr == 0 && errno == 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct results carmichael = { .count = 0 };
+    struct enumeration e = {
+        .x = 0,
+        .results = &carmichael,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    const char *tag_path = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        int success = 1;
+        if (strcmp(argv[i], "--tag") == 0 && i < argc - 1)
+            tag_path = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i < argc - 1)
+            success = set_num_threads(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0)
+            LOG_LEVEL = 3;
+        else if (e.x == 0 && argv[i][0] != '-')
+            success = parse_u64(argv[i], &e.x) && e.x != 0;
+        else
+            success = 0;
+        if (!success)
+        {
+            usage_msg();
+            return 2;
+        }
+    }
+    if ((e.x == 0) == (tag_path == NULL) || e.x > MAX_X)
+    {
+        usage_msg();
+        return 2;
+    }
+
+    uint64_t *list = NULL;
+    size_t count = 0;
+    if (tag_path != NULL)
+    {
+        count = load_list(tag_path, &list);
+        if (count == 0)
+            return 2;
+        qsort(list, count, sizeof(uint64_t), &compare_u64);
+        e.x = list[count - 1];
+        if (e.x > MAX_X)
+        {
+            LOG_ERROR("the list goes above 2^62")
+            return 2;
+        }
+    }
+
+    double start = monotonic_seconds();
+    if (!enumerate(&e))
+        return 2;
+    fprintf(stderr, "%zu Carmichael number(s) <= %lu, %.3f s\n",
+            carmichael.count, (unsigned long)e.x, monotonic_seconds() - start);
+
+    int success = 1;
+    if (tag_path != NULL)
+        success = tag_list(list, count, &carmichael);
+    else
+        for (size_t i = 0; i < carmichael.count; ++i)
+            printf("%lu\n", (unsigned long)carmichael.numbers[i]);
+
+    free(list);
+    free(carmichael.numbers);
+    free(e.primes);
+    return success ? 0 : 2;
+}
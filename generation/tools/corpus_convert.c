@@ -0,0 +1,202 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * Convert a list of "index value" lines (e.g. pseudo-primes-b2.txt) to the
+ * binary corpus format of src/utils/corpus.h, and check the result against
+ * the text file. Also dumps a corpus back to text.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/corpus.h"
+#include "utils/logging.h"
+
+#define VERIFY_LOOKUP_STRIDE 61
+
+/*
+ * Next "index value" line of f. Returns 1 on success, 0 at the end of the
+ * file and -1 on a malformed line.
+ */
+static int read_entry(FILE *f, uint64_t expected_index, uint64_t *value)
+{
+    unsigned long index;
+    unsigned long v;
+    int read = fscanf(f, "%lu %lu", &index, &v);
+    if (read == EOF)
+        return 0;
+    if (read != 2 || index != expected_index)
+    {
+        LOG_ERROR("malformed entry %lu", (unsigned long)expected_index)
+        return -1;
+    }
+    *value = v;
+    return 1;
+}
+
+static int convert(const char *input, const char *output, uint32_t block_size)
+{
+    FILE *f = fopen(input, "r");
+    if (f == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", input, strerror(errno))
+        return 0;
+    }
+    struct corpus_writer writer;
+    if (!corpus_writer_open(&writer, output, block_size))
+    {
+        fclose(f);
+        return 0;
+    }
+
+    uint64_t value;
+    int read;
+    int success = 1;
+    while (success && (read = read_entry(f, writer.count + 1, &value)) == 1)
+        success = corpus_writer_add(&writer, value);
+    success = success && read == 0;
+
+    fclose(f);
+    return corpus_writer_close(&writer) && success;
+}
+
+/*
+ * Round trip : stream the corpus against the text file, and look some of the
+ * entries (one every VERIFY_LOOKUP_STRIDE) up again through the index.
+ */
+static int verify(const char *input, const char *output)
+{
+    struct corpus corpus;
+    if (!corpus_open(&corpus, output))
+        return 0;
+    FILE *f = fopen(input, "r");
+    uint64_t *values = malloc(corpus.block_size * sizeof(uint64_t));
+    if (f == NULL || values == NULL)
+    {
+        LOG_ERROR("failed to verify %s: %s", output, strerror(errno))
+        goto VerifyFailed;
+    }
+    if (!corpus_verify(&corpus))
+        goto VerifyFailed;
+
+    uint64_t i = 0;
+    for (uint64_t block = 0; block < corpus.num_blocks; ++block)
+    {
+        size_t count = corpus_decode_block(&corpus, block, values);
+        for (size_t j = 0; j < count; ++j, ++i)
+        {
+            uint64_t expected;
+            if (read_entry(f, i + 1, &expected) != 1 || values[j] != expected
+                || (i % VERIFY_LOOKUP_STRIDE == 0
+                    && (corpus_get(&corpus, i) != expected
+                        || corpus_lower_bound(&corpus, expected) != i
+                        || corpus_lower_bound(&corpus, expected + 1)
+                            != i + 1)))
+            {
+                LOG_ERROR("round trip mismatch at entry %lu",
+                          (unsigned long)i + 1)
+                goto VerifyFailed;
+            }
+        }
+    }
+    uint64_t extra;
+    if (read_entry(f, i + 1, &extra) != 0)
+    {
+        LOG_ERROR("%s has more entries than %s", input, output)
+        goto VerifyFailed;
+    }
+
+    LOG_INFO("%s: %lu entries in %lu blocks, %zu bytes", output,
+             (unsigned long)corpus.count, (unsigned long)corpus.num_blocks,
+             corpus.size)
+    fclose(f);
+    free(values);
+    corpus_close(&corpus);
+    return 1;
+
+VerifyFailed:
+    if (f != NULL)
+        fclose(f);
+    free(values);
+    corpus_close(&corpus);
+    return 0;
+}
+
+static int dump(const char *path)
+{
+    struct corpus corpus;
+    if (!corpus_open(&corpus, path))
+        return 0;
+    uint64_t *values = malloc(corpus.block_size * sizeof(uint64_t));
+    int success = values != NULL && corpus_verify(&corpus);
+
+    uint64_t i = 0;
+    for (uint64_t block = 0; block < corpus.num_blocks && success; ++block)
+    {
+        size_t count = corpus_decode_block(&corpus, block, values);
+        for (size_t j = 0; j < count; ++j)
+            printf("%lu %lu\n", (unsigned long)++i, (unsigned long)values[j]);
+    }
+
+    free(values);
+    corpus_close(&corpus);
+    return success;
+}
+
+static void usage_msg(void)
+{
+    fprintf(stderr,
+            "usage: ./tools/corpus_convert [--block-size N] [-v] text corpus\n"
+            "       ./tools/corpus_convert --dump corpus\n"
+            "  convert a list of \"index value\" lines to a binary corpus, "
+            "then check it\n"
+            "  against the text. --dump prints a corpus back as text\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long block_size = CORPUS_DEFAULT_BLOCK_SIZE;
+    const char *paths[2];
+    int num_paths = 0;
+    int dump_corpus = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--block-size") == 0 && i < argc - 1)
+        {
+            block_size = strtoul(argv[++i], NULL, 10);
+            if (block_size == 0 || block_size > (1ul << 24))
+            {
+                usage_msg();
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "--dump") == 0)
+            dump_corpus = 1;
+        else if (strcmp(argv[i], "-v") == 0)
+            LOG_LEVEL = 3;
+        else if (argv[i][0] != '-' && num_paths < 2)
+            paths[num_paths++] = argv[i];
+        else
+        {
+            usage_msg();
+            return 2;
+        }
+    }
+
+    if (dump_corpus && num_paths == 1)
+        return dump(paths[0]) ? 0 : 2;
+    if (dump_corpus || num_paths != 2)
+    {
+        usage_msg();
+        return 2;
+    }
+    if (!convert(paths[0], paths[1], block_size)
+        || !verify(paths[0], paths[1]))
+    {
+        LOG_ERROR("failed to convert %s", paths[0])
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,605 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * Enumerate the Fermat pseudoprimes to base 2 (composite n such that
+ * 2^(n - 1) = 1 mod n) in [lo, hi).
+ *
+ * The range is sieved by segments with the odd primes p <= sqrt(hi). Every
+ * prime factor p of a pseudoprime n satisfies n = 1 (mod ord_p(2)), so when
+ * sieving with p, the multiples n = p * m with m != 1 (mod ord_p(2)) are
+ * flagged too, as well as the multiples of p^2 unless p is a Wieferich
+ * prime. That alone leaves about 11% of the odd numbers below 10^9, mostly
+ * n = c * q with c small and q a prime above sqrt(hi), which no sieving
+ * prime sees : the sieve also keeps the product c of the sieving primes
+ * dividing n, and q = n / c must divide 2^(c - 1) - 1. Below 10^9, only the
+ * pseudoprimes themselves are left for the Fermat test.
+ *
+ * The range is split into shards, each with its output file and its
+ * checkpoint in the shard directory : an interrupted run resumes where it
+ * stopped, and the shards can be spread across processes (--shard I/N).
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/logging.h"
+#include "utils/mont64.h"
+#include "utils/threads.h"
+
+// Odd numbers per segment (one byte each)
+#define SEGMENT_SIZE (1u << 20)
+// Odd numbers per block of the small primes (a product of 8 bytes each)
+#define SIEVE_BLOCK (1u << 16)
+#define DEFAULT_SHARD_SIZE 10000000000ull
+#define DEFAULT_SHARD_DIR "psp-shards"
+#define SHARD_PATH_SIZE 4096
+// Seconds between two checkpoints of a shard
+#define CHECKPOINT_PERIOD 10
+// hi is capped so that sqrt(hi) fits in 32 bits and n in mont64
+#define MAX_HI (1ull << 62)
+
+// Fermat tests run side by side
+#define FERMAT_LANES 4
+
+#define FLAG_COMPOSITE 1
+#define FLAG_RULED_OUT 2
+// p^2 divides n for a Wieferich prime p : n / c may not be a prime
+#define FLAG_SQUARE 4
+
+struct sieve_prime
+{
+    uint32_t p;
+    // multiplicative order of 2 modulo p
+    uint32_t order;
+    // 2^(p - 1) = 1 (mod p^2) : p^2 may divide a pseudoprime
+    unsigned char wieferich;
+};
+
+struct shard_state
+{
+    // first number not sieved yet, size of the valid output and count
+    uint64_t next;
+    long offset;
+    uint64_t found;
+    int done;
+};
+
+struct enumeration
+{
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t shard_size;
+    uint64_t num_shards;
+    // this process handles the shards i with i % shard_count == shard_index
+    uint64_t shard_index;
+    uint64_t shard_count;
+    const char *dir;
+    struct sieve_prime *primes;
+    size_t num_primes;
+    uint64_t next_shard;
+    uint64_t found;
+    int failed;
+};
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = 0;
+    for (int bit = 31; bit >= 0; --bit)
+    {
+        uint64_t candidate = r | (1ull << bit);
+        if (candidate * candidate <= n)
+            r = candidate;
+    }
+    return r;
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t pow2_mod(uint64_t e, uint64_t p)
+{
+    uint64_t result = 1;
+    uint64_t base = 2 % p;
+    for (; e != 0; e >>= 1)
+    {
+        if (e & 1)
+            result = result * base % p;
+        base = base * base % p;
+    }
+    return result;
+}
+
+/*
+ * ord_p(2) : start from p - 1 and divide it by its prime factors as long as
+ * 2^order stays 1. The (smaller) primes already found factor p - 1.
+ */
+static uint32_t order_of_2(uint32_t p, const struct sieve_prime *primes,
+                           size_t count)
+{
+    uint32_t order = p - 1;
+    uint32_t rest = p - 1;
+    for (size_t i = 0; rest != 1; ++i)
+    {
+        // once past sqrt(rest), what is left of p - 1 is prime
+        uint32_t q = i == 0 ? 2 : i <= count ? primes[i - 1].p : rest;
+        if ((uint64_t)q * q > rest)
+            q = rest;
+        if (rest % q != 0)
+            continue;
+        while (rest % q == 0)
+            rest /= q;
+        while (order % q == 0 && pow2_mod(order / q, p) == 1)
+            order /= q;
+    }
+    return order;
+}
+
+static size_t setup_primes(uint64_t limit, struct sieve_prime **primes)
+{
+    // odd numbers only : index i is 2i + 1
+    size_t size = limit / 2 + 1;
+    unsigned char *composite = calloc(size, 1);
+    *primes = malloc((size / 2 + 16) * sizeof(struct sieve_prime));
+    if (composite == NULL || *primes == NULL)
+    {
+        LOG_ERROR("failed to allocate the sieving primes: %s", strerror(errno))
+        free(composite);
+        free(*primes);
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 1; i < size; ++i)
+    {
+        if (composite[i])
+            continue;
+        uint64_t p = 2 * i + 1;
+        for (uint64_t j = p * p / 2; j < size; j += p)
+            composite[j] = 1;
+        (*primes)[count].p = p;
+        (*primes)[count].order = order_of_2(p, *primes, count);
+        struct mont64 m;
+        mont64_init(&m, p * p);
+        (*primes)[count].wieferich = mont64_pow2(&m, p - 1) == m.one;
+        ++count;
+    }
+
+    free(composite);
+    return count;
+}
+
+static void shard_paths(const struct enumeration *e, uint64_t lo, uint64_t hi,
+                        char *output, char *checkpoint, size_t size)
+{
+    snprintf(output, size, "%s/%020lu-%020lu.txt", e->dir, (unsigned long)lo,
+             (unsigned long)hi);
+    snprintf(checkpoint, size, "%s/%020lu-%020lu.ckpt", e->dir,
+             (unsigned long)lo, (unsigned long)hi);
+}
+
+static int load_checkpoint(const char *path, struct shard_state *state)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return errno == ENOENT ? 0 : -1;
+    unsigned long next;
+    unsigned long found;
+    int success = fscanf(f, "%lu %ld %lu %d", &next, &state->offset, &found,
+                         &state->done)
+        == 4;
+    fclose(f);
+    state->next = next;
+    state->found = found;
+    return success ? 1 : -1;
+}
+
+// temporary file + rename : the previous checkpoint survives a crash
+static int save_checkpoint(const char *path, const struct shard_state *state)
+{
+    char tmp[SHARD_PATH_SIZE + sizeof(".tmp")];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL)
+        return 0;
+    int success = fprintf(f, "%lu %ld %lu %d\n", (unsigned long)state->next,
+                          state->offset, (unsigned long)state->found,
+                          state->done)
+            > 0
+        && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    success = fclose(f) == 0 && success;
+    return success && rename(tmp, path) == 0;
+}
+
+/*
+ * Flag the odd multiples n = p * m >= 3p of p in [lo, hi), with flags[i] and
+ * smooth[i] about start + 2i (start odd).
+ *
+ * If p^2 divides a pseudoprime n, ord_(p^2)(2) divides n - 1, so p does not
+ * divide it : ord_(p^2)(2) = ord_p(2), which makes p a Wieferich prime. The
+ * multiples of p^2 are ruled out for all the other primes.
+ */
+static void sieve_prime(const struct sieve_prime *prime, uint64_t start,
+                        uint64_t lo, uint64_t hi, unsigned char *flags,
+                        uint64_t *smooth)
+{
+    uint64_t p = prime->p;
+    uint64_t order = prime->order;
+    unsigned char square = prime->wieferich ? FLAG_SQUARE : FLAG_RULED_OUT;
+
+    // first odd multiple n = p * m >= max(lo, 3p)
+    uint64_t m = (lo + p - 1) / p;
+    if (m < 3)
+        m = 3;
+    if (m % 2 == 0)
+        ++m;
+    uint64_t r = m % order;
+    uint64_t s = m % p;
+    for (uint64_t n = p * m; n < hi; n += 2 * p)
+    {
+        size_t i = (n - start) / 2;
+        // p | n, and n = 1 (mod ord_p(2)) iff m = 1 (mod ord_p(2))
+        flags[i] |= r == 1 ? FLAG_COMPOSITE : FLAG_COMPOSITE | FLAG_RULED_OUT;
+        // p^2 | n iff p | m
+        if (s == 0)
+            flags[i] |= square;
+        smooth[i] *= p;
+        r += 2;
+        if (r >= order)
+            r -= order;
+        s += 2;
+        if (s >= p)
+            s -= p;
+    }
+}
+
+/*
+ * Sieve the odd numbers of [start, end) : flags[i] and smooth[i] are about
+ * start + 2i (start odd), smooth[i] being the product of the sieving primes
+ * dividing it (each counted once). The primes below SIEVE_BLOCK hit every
+ * block, so they are sieved block by block with smooth staying in the cache,
+ * and the larger ones (at most one hit per block) over the whole segment.
+ */
+static void sieve_segment(const struct enumeration *e, uint64_t start,
+                          uint64_t end, unsigned char *flags, uint64_t *smooth)
+{
+    size_t size = (end - start + 1) / 2;
+    memset(flags, 0, size);
+    for (size_t i = 0; i < size; ++i)
+        smooth[i] = 1;
+
+    size_t num_small = 0;
+    while (num_small < e->num_primes
+           && e->primes[num_small].p < SIEVE_BLOCK)
+        ++num_small;
+    for (uint64_t lo = start; lo < end; lo += 2ull * SIEVE_BLOCK)
+    {
+        uint64_t hi = end - lo > 2ull * SIEVE_BLOCK ? lo + 2ull * SIEVE_BLOCK
+                                                    : end;
+        for (size_t i = 0; i < num_small && 3 * e->primes[i].p < hi; ++i)
+            sieve_prime(&e->primes[i], start, lo, hi, flags, smooth);
+    }
+    for (size_t i = num_small;
+         i < e->num_primes && 3 * (uint64_t)e->primes[i].p < end; ++i)
+        sieve_prime(&e->primes[i], start, start, end, flags, smooth);
+}
+
+/*
+ * n = c * q, with c the product of the sieving primes dividing n and q = 1
+ * or a prime above sqrt(hi) (n has no square factor p^2). If n is a
+ * pseudoprime, ord_q(2) divides n - 1 = c * (q - 1) + c - 1 and q - 1, so
+ * 2^(c - 1) = 1 (mod q). Returns 1 if that rules n out.
+ */
+static int cofactor_rules_out(uint64_t n, uint64_t c)
+{
+    uint64_t q = n / c;
+    if (q == 1)
+        return 0;
+    // q cannot divide 2^(c - 1) - 1 if it is larger
+    if (c - 1 < 64 && q >> (c - 1) != 0)
+        return 1;
+    struct mont64 m;
+    mont64_init(&m, q);
+    return mont64_pow2(&m, c - 1) != m.one;
+}
+
+static int fermat_base_2(uint64_t n)
+{
+    struct mont64 m;
+    mont64_init(&m, n);
+    return mont64_pow2(&m, n - 1) == m.one;
+}
+
+/*
+ * FERMAT_LANES tests at once : the squarings of the lanes are independent,
+ * so they overlap in the pipeline instead of waiting on each other's
+ * multiplication latency. The exponents must have the same bit length.
+ */
+static void fermat_base_2_lanes(const uint64_t *n, int *pseudoprime)
+{
+    struct mont64 m[FERMAT_LANES];
+    uint64_t x[FERMAT_LANES];
+    for (int i = 0; i < FERMAT_LANES; ++i)
+    {
+        mont64_init(&m[i], n[i]);
+        x[i] = m[i].one;
+    }
+    for (int bit = 63 - __builtin_clzll(n[0] - 1); bit >= 0; --bit)
+        for (int i = 0; i < FERMAT_LANES; ++i)
+        {
+            x[i] = mont64_mul(&m[i], x[i], x[i]);
+            if (((n[i] - 1) >> bit) & 1)
+                x[i] = mont64_add(&m[i], x[i], x[i]);
+        }
+    for (int i = 0; i < FERMAT_LANES; ++i)
+        pseudoprime[i] = x[i] == m[i].one;
+}
+
+/*
+ * Fermat test of the count candidates, in place : returns the number of
+ * pseudoprimes, moved to the front
+ */
+static size_t fermat_filter(uint64_t *candidates, size_t count)
+{
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + FERMAT_LANES <= count; i += FERMAT_LANES)
+    {
+        int pseudoprime[FERMAT_LANES];
+        // all the candidates are sorted : same length at both ends
+        if (__builtin_clzll(candidates[i] - 1)
+            == __builtin_clzll(candidates[i + FERMAT_LANES - 1] - 1))
+            fermat_base_2_lanes(candidates + i, pseudoprime);
+        else
+            for (int j = 0; j < FERMAT_LANES; ++j)
+                pseudoprime[j] = fermat_base_2(candidates[i + j]);
+        for (int j = 0; j < FERMAT_LANES; ++j)
+            if (pseudoprime[j])
+                candidates[found++] = candidates[i + j];
+    }
+    for (; i < count; ++i)
+        if (fermat_base_2(candidates[i]))
+            candidates[found++] = candidates[i];
+    return found;
+}
+
+static int enumerate_shard(struct enumeration *e, uint64_t shard,
+                           unsigned char *flags, uint64_t *candidates)
+{
+    uint64_t lo = e->lo + shard * e->shard_size;
+    uint64_t hi = e->hi - lo > e->shard_size ? lo + e->shard_size : e->hi;
+    char output_path[SHARD_PATH_SIZE];
+    char checkpoint_path[SHARD_PATH_SIZE];
+    shard_paths(e, lo, hi, output_path, checkpoint_path, sizeof(output_path));
+
+    struct shard_state state = { .next = lo, .offset = 0, .found = 0 };
+    int loaded = load_checkpoint(checkpoint_path, &state);
+    if (loaded == -1)
+    {
+        LOG_ERROR("invalid checkpoint %s", checkpoint_path)
+        return 0;
+    }
+    if (state.done)
+    {
+        LOG_INFO("shard [%lu, %lu) already done", (unsigned long)lo,
+                 (unsigned long)hi)
+        __atomic_add_fetch(&e->found, state.found, __ATOMIC_RELAXED);
+        return 1;
+    }
+    // drop whatever was written after the last checkpoint
+    if (loaded && truncate(output_path, state.offset) == -1)
+    {
+        LOG_ERROR("failed to truncate %s: %s", output_path, strerror(errno))
+        return 0;
+    }
+
+    FILE *out = fopen(output_path, loaded ? "a" : "w");
+    if (out == NULL)
+    {
+        LOG_ERROR("failed to open %s: %s", output_path, strerror(errno))
+        return 0;
+    }
+    if (loaded)
+        LOG_INFO("resuming shard [%lu, %lu) at %lu", (unsigned long)lo,
+                 (unsigned long)hi, (unsigned long)state.next)
+
+    time_t last_checkpoint = time(NULL);
+    int success = 1;
+    while (state.next < hi && success)
+    {
+        // segments start on odd numbers (the even ones are never psp(2))
+        uint64_t start = state.next | 1;
+        uint64_t end = hi - start > 2ull * SEGMENT_SIZE
+            ? start + 2ull * SEGMENT_SIZE
+            : hi;
+        if (start < end)
+        {
+            // the products of the sieving primes are read before the
+            // candidates overwrite them (count <= i)
+            sieve_segment(e, start, end, flags, candidates);
+            size_t count = 0;
+            for (uint64_t n = start; n < end; n += 2)
+            {
+                size_t i = (n - start) / 2;
+                if ((flags[i] & ~FLAG_SQUARE) != FLAG_COMPOSITE
+                    || (flags[i] == FLAG_COMPOSITE
+                        && cofactor_rules_out(n, candidates[i])))
+                    continue;
+                candidates[count++] = n;
+            }
+            count = fermat_filter(candidates, count);
+            for (size_t i = 0; i < count; ++i)
+                if (fprintf(out, "%lu\n", (unsigned long)candidates[i]) < 0)
+                    success = 0;
+            state.found += count;
+        }
+        state.next = end;
+
+        if (state.next == hi
+            || time(NULL) - last_checkpoint >= CHECKPOINT_PERIOD)
+        {
+            state.done = state.next == hi;
+            success = success && fflush(out) == 0
+                && (state.offset = ftell(out)) != -1
+                && fsync(fileno(out)) == 0
+                && save_checkpoint(checkpoint_path, &state);
+            last_checkpoint = time(NULL);
+        }
+    }
+
+    success = fclose(out) == 0 && success;
+    if (!success)
+        LOG_ERROR("failed to write shard [%lu, %lu): %s", (unsigned long)lo,
+                  (unsigned long)hi, strerror(errno))
+    else
+        __atomic_add_fetch(&e->found, state.found, __ATOMIC_RELAXED);
+    return success;
+}
+
+static void *enumeration_worker(void *arg)
+{
+    struct enumeration *e = arg;
+    unsigned char *flags = malloc(SEGMENT_SIZE + 1);
+    uint64_t *candidates = malloc((SEGMENT_SIZE + 1) * sizeof(uint64_t));
+    if (flags == NULL || candidates == NULL)
+    {
+        LOG_ERROR("failed to allocate segment: %s", strerror(errno))
+        __atomic_store_n(&e->failed, 1, __ATOMIC_RELAXED);
+        free(flags);
+        free(candidates);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        uint64_t shard = __atomic_fetch_add(&e->next_shard, e->shard_count,
+                                            __ATOMIC_RELAXED);
+        if (shard >= e->num_shards
+            || __atomic_load_n(&e->failed, __ATOMIC_RELAXED))
+            break;
+        if (!enumerate_shard(e, shard, flags, candidates))
+            __atomic_store_n(&e->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    free(flags);
+    free(candidates);
+    return NULL;
+}
+
+static void usage_msg(void)
+{
+    fprintf(stderr,
+            "usage: ./tools/psp_enum LO HI [--shard-size S] [--shard I/N] "
+            "[--dir DIR] [--threads N] [-v]\n"
+            "  enumerate the base-2 Fermat pseudoprimes in [LO, HI) (HI <= "
+            "2^62)\n"
+            "  --shard-size S: numbers per shard (default: %llu)\n"
+            "  --shard I/N: only handle the shards i = I (mod N), to spread "
+            "the work across\n"
+            "     processes\n"
+            "  --dir DIR: output and checkpoint files, one pair per shard "
+            "(default: " DEFAULT_SHARD_DIR ")\n",
+            DEFAULT_SHARD_SIZE);
+}
+
+static int parse_u64(const char *arg, uint64_t *value)
+{
+    char *endptr = NULL;
+    errno = 0;
+    *value = strtoull(arg, &endptr, 10);
+    return *arg != 0 && *endptr == 0 && errno == 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct enumeration e = {
+        .shard_size = DEFAULT_SHARD_SIZE,
+        .shard_index = 0,
+        .shard_count = 1,
+        .dir = DEFAULT_SHARD_DIR,
+    };
+    int num_bounds = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        int success = 1;
+        if (strcmp(argv[i], "--shard-size") == 0 && i < argc - 1)
+            success = parse_u64(argv[++i], &e.shard_size) && e.shard_size != 0;
+        else if (strcmp(argv[i], "--shard") == 0 && i < argc - 1)
+        {
+            unsigned long index;
+            unsigned long count;
+            success = sscanf(argv[++i], "%lu/%lu", &index, &count) == 2
+                && index < count;
+            e.shard_index = index;
+            e.shard_count = count;
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && i < argc - 1)
+            e.dir = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i < argc - 1)
+            success = set_num_threads(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0)
+            LOG_LEVEL = 3;
+        else if (num_bounds < 2 && argv[i][0] != '-')
+            success = parse_u64(argv[i], num_bounds++ ? &e.hi : &e.lo);
+        else
+            success = 0;
+        if (!success)
+        {
+            usage_msg();
+            return 2;
+        }
+    }
+    if (num_bounds != 2 || e.lo >= e.hi || e.hi > MAX_HI)
+    {
+        usage_msg();
+        return 2;
+    }
+    if (mkdir(e.dir, 0755) == -1 && errno != EEXIST)
+    {
+        LOG_ERROR("failed to create %s: %s", e.dir, strerror(errno))
+        return 2;
+    }
+
+    double start = monotonic_seconds();
+
+    e.num_primes = setup_primes(isqrt(e.hi), &e.primes);
+    if (e.num_primes == 0 && e.hi > 9)
+        return 2;
+    e.num_shards = (e.hi - e.lo - 1) / e.shard_size + 1;
+    e.next_shard = e.shard_index;
+    LOG_INFO("%lu shard(s), %zu sieving primes", (unsigned long)e.num_shards,
+             e.num_primes)
+
+    unsigned num = num_threads();
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        LOG_ERROR("failed to allocate threads: %s", strerror(errno))
+        return 2;
+    }
+    unsigned started = 0;
+    for (; started + 1 < num; ++started)
+        if (pthread_create(&threads[started], NULL, &enumeration_worker, &e)
+            != 0)
+            break;
+    enumeration_worker(&e);
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    fprintf(stderr, "%lu pseudoprime(s) in [%lu, %lu), %.3f s\n",
+            (unsigned long)e.found, (unsigned long)e.lo, (unsigned long)e.hi,
+            monotonic_seconds() - start);
+
+    free(threads);
+    free(e.primes);
+    return e.failed ? 2 : 0;
+}
@@ -0,0 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * Search for counter-examples to the PSW conjecture among the Fermat
+ * pseudoprimes to base 2 : n = +-2 (mod 5) such that n divides F(n + 1).
+ * Native replacement of exploration/tests/CounterExample.hs, which builds
+ * F(n + 1) in full (about 0.69 * n bits) before reducing it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/corpus.h"
+#include "utils/logging.h"
+#include "utils/mont64.h"
+#include "utils/threads.h"
+
+#define DEFAULT_INPUT "../exploration/tests/pseudo-primes-b2.txt"
+
+// Entries handed to a thread at once
+#define SCAN_CHUNK 1024
+
+struct scan
+{
+    // either the parsed text file or the blocks of a binary corpus
+    const uint64_t *numbers;
+    const struct corpus *corpus;
+    size_t count;
+    size_t next;
+    // counter_examples[i] is set when numbers[i] is one
+    unsigned char *counter_examples;
+    // set on an unsupported entry or an allocation failure
+    int failed;
+};
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * F(k) mod n with the doubling formulas, in Montgomery form :
+ * F(2k) = F(k) * (2F(k + 1) - F(k)) and F(2k + 1) = F(k)^2 + F(k + 1)^2
+ */
+static uint64_t fibonacci_mod(uint64_t k, const struct mont64 *m)
+{
+    // (a, b) = (F(j), F(j + 1)), j being the bits of k read so far
+    uint64_t a = 0;
+    uint64_t b = m->one;
+    for (int bit = 63 - __builtin_clzll(k | 1); bit >= 0; --bit)
+    {
+        uint64_t c = mont64_mul(m, a, mont64_sub(m, mont64_add(m, b, b), a));
+        uint64_t d = mont64_add(m, mont64_mul(m, a, a), mont64_mul(m, b, b));
+        if ((k >> bit) & 1)
+        {
+            a = d;
+            b = mont64_add(m, c, d);
+        }
+        else
+        {
+            a = c;
+            b = d;
+        }
+    }
+    return mont64_from(m, a);
+}
+
+// Montgomery arithmetic needs an odd n < 2^63
+static int is_supported(uint64_t n)
+{
+    if (n % 2 == 1 && !(n >> 63))
+        return 1;
+    LOG_ERROR("unsupported entry %lu", (unsigned long)n)
+    return 0;
+}
+
+static int is_counter_example(uint64_t n)
+{
+    // (5 / n) = -1 : n = +-2 (mod 5)
+    if (n % 5 != 2 && n % 5 != 3)
+        return 0;
+
+    struct mont64 m;
+    mont64_init(&m, n);
+    return fibonacci_mod(n + 1, &m) == 0;
+}
+
+/*
+ * The blocks, already checked by corpus_verify(), are decoded again as they
+ * are scanned : no array of the entries is built
+ */
+static void *scan_corpus_worker(void *arg)
+{
+    struct scan *scan = arg;
+    const struct corpus *corpus = scan->corpus;
+    uint64_t *values = malloc(corpus->block_size * sizeof(uint64_t));
+    if (values == NULL)
+    {
+        LOG_ERROR("failed to allocate block: %s", strerror(errno))
+        __atomic_store_n(&scan->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (;;)
+    {
+        size_t block = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+        if (block >= corpus->num_blocks
+            || __atomic_load_n(&scan->failed, __ATOMIC_RELAXED))
+            break;
+        size_t count = corpus_decode_block(corpus, block, values);
+        unsigned char *counter_examples =
+            scan->counter_examples + block * corpus->block_size;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!is_supported(values[i]))
+            {
+                __atomic_store_n(&scan->failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            counter_examples[i] = is_counter_example(values[i]);
+        }
+    }
+    free(values);
+    return NULL;
+}
+
+static void *scan_worker(void *arg)
+{
+    struct scan *scan = arg;
+    if (scan->corpus != NULL)
+        return scan_corpus_worker(scan);
+    for (;;)
+    {
+        size_t start = __atomic_fetch_add(&scan->next, SCAN_CHUNK,
+                                          __ATOMIC_RELAXED);
+        if (start >= scan->count)
+            break;
+        size_t end = start + SCAN_CHUNK;
+        if (end > scan->count)
+            end = scan->count;
+
+        for (size_t i = start; i < end; ++i)
+            scan->counter_examples[i] = is_counter_example(scan->numbers[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Parse the "index value" lines of the mapped file. Returns the number of
+ * values, or 0 on failure.
+ */
+static size_t parse_numbers(const char *data, size_t size, uint64_t **numbers)
+{
+    size_t capacity = 1;
+    for (size_t i = 0; i < size; ++i)
+        capacity += data[i] == '\n';
+    *numbers = malloc(capacity * sizeof(uint64_t));
+    if (*numbers == NULL)
+    {
+        LOG_ERROR("failed to allocate numbers: %s", strerror(errno))
+        return 0;
+    }
+
+    size_t count = 0;
+    const char *end = data + size;
+    for (const char *p = data; p < end;)
+    {
+        // skip the index
+        while (p < end && *p != ' ' && *p != '\n')
+            ++p;
+        while (p < end && *p == ' ')
+            ++p;
+
+        uint64_t value = 0;
+        int digits = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+            value = value * 10 + (*p - '0');
+        if (digits != 0)
+        {
+            if (!is_supported(value))
+            {
+                free(*numbers);
+                return 0;
+            }
+            (*numbers)[count++] = value;
+        }
+
+        while (p < end && *p != '\n')
+            ++p;
+        ++p;
+    }
+
+    return count;
+}
+
+static size_t load_numbers(const char *path, uint64_t **numbers)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        LOG_ERROR("failed to open %s: %s", path, strerror(errno))
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        LOG_ERROR("failed to stat %s (or empty file)", path)
+        close(fd);
+        return 0;
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        LOG_ERROR("failed to map %s: %s", path, strerror(errno))
+        return 0;
+    }
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    size_t count = parse_numbers(data, st.st_size, numbers);
+    munmap(data, st.st_size);
+    return count;
+}
+
+static void usage_msg(void)
+{
+    fprintf(stderr,
+            "usage: ./tools/psw_scan [--threads N] [-v] [file]\n"
+            "  file: list of \"index value\" lines (default: " DEFAULT_INPUT
+            "),\n"
+            "     or binary corpus (see tools/corpus_convert)\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = DEFAULT_INPUT;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i < argc - 1)
+        {
+            if (!set_num_threads(argv[++i]))
+                return 2;
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+            LOG_LEVEL = 3;
+        else if (argv[i][0] != '-')
+            path = argv[i];
+        else
+        {
+            usage_msg();
+            return 2;
+        }
+    }
+
+    double start = monotonic_seconds();
+    struct scan scan = { .next = 0 };
+    struct corpus corpus = { .count = 0 };
+    uint64_t *numbers = NULL;
+    if (is_corpus_file(path))
+    {
+        if (!corpus_open(&corpus, path) || !corpus_verify(&corpus))
+            return 2;
+        scan.corpus = &corpus;
+        scan.count = corpus.count;
+    }
+    else
+        scan.count = load_numbers(path, &numbers);
+    scan.numbers = numbers;
+    if (scan.count == 0)
+        return 2;
+    double loaded = monotonic_seconds();
+
+    scan.counter_examples = calloc(scan.count, 1);
+    unsigned num = num_threads();
+    pthread_t *threads = calloc(num, sizeof(pthread_t));
+    if (scan.counter_examples == NULL || threads == NULL)
+    {
+        LOG_ERROR("failed to allocate scan: %s", strerror(errno))
+        return 2;
+    }
+
+    unsigned started = 0;
+    for (; started + 1 < num; ++started)
+        if (pthread_create(&threads[started], NULL, &scan_worker, &scan) != 0)
+            break;
+    // the calling thread works too (and alone if no thread could start)
+    scan_worker(&scan);
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    double scanned = monotonic_seconds();
+    if (scan.failed)
+        return 2;
+
+    size_t found = 0;
+    for (size_t i = 0; i < scan.count; ++i)
+    {
+        if (!scan.counter_examples[i])
+            continue;
+        printf("%lu\n",
+               (unsigned long)(scan.corpus != NULL ? corpus_get(&corpus, i)
+                                                   : scan.numbers[i]));
+        ++found;
+    }
+    printf("Counter Examples to the PSW conjecture: %zu found (%zu "
+           "pseudoprimes scanned)\n",
+           found, scan.count);
+    fprintf(stderr, "load %.3f s, scan %.3f s (%u thread(s))\n",
+            loaded - start, scanned - loaded, started + 1);
+
+    free(threads);
+    free(scan.counter_examples);
+    free(numbers);
+    corpus_close(&corpus);
+    return 0;
+}